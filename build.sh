@@ -10,16 +10,24 @@ echo "Building mklfs..."
 g++ -g -Wall -std=c++1z -o bin/mklfs ./utilities/mklfs.cpp bin/flash.o
 echo "Building lfsck..."
 g++ -g -Wall -std=c++1z -o bin/lfsck ./utilities/lfsck.cpp bin/flash.o
+echo "Building lfstrace..."
+g++ -g -Wall -std=c++1z -o bin/lfstrace ./utilities/lfstrace.cpp
+echo "Building lfsbench..."
+g++ -g -Wall -std=c++1z -pthread -o bin/lfsbench ./utilities/lfsbench.cpp bin/flash.o
 echo "Building Tests..."
-g++ -g -Wall -std=c++1z -o bin/tests/log_test tests/log_test.cpp bin/flash.o
-g++ -g -Wall -std=c++1z -o bin/tests/checkpoint_test tests/checkpoint_test.cpp bin/flash.o
-g++ -g -Wall -std=c++1z -o bin/tests/file_test tests/file_test.cpp bin/flash.o
-g++ -g -Wall -std=c++1z -o bin/tests/directory_test tests/directory_test.cpp bin/flash.o
-g++ -g -Wall -std=c++1z -o bin/tests/cleaner_test tests/cleaner_test.cpp bin/flash.o
-g++ -g -Wall -std=c++1z -o bin/tests/segment_cache_test tests/segment_cache_test.cpp bin/flash.o
+g++ -g -Wall -std=c++1z -pthread -o bin/tests/log_test tests/log_test.cpp bin/flash.o
+g++ -g -Wall -std=c++1z -pthread -o bin/tests/checkpoint_test tests/checkpoint_test.cpp bin/flash.o
+g++ -g -Wall -std=c++1z -pthread -o bin/tests/file_test tests/file_test.cpp bin/flash.o
+g++ -g -Wall -std=c++1z -pthread -o bin/tests/directory_test tests/directory_test.cpp bin/flash.o
+g++ -g -Wall -std=c++1z -pthread -o bin/tests/cleaner_test tests/cleaner_test.cpp bin/flash.o
+g++ -g -Wall -std=c++1z -pthread -o bin/tests/segment_cache_test tests/segment_cache_test.cpp bin/flash.o
+g++ -g -Wall -std=c++1z -o bin/tests/crc32c_test tests/crc32c_test.cpp
+g++ -g -Wall -std=c++1z -o bin/tests/lz_test tests/lz_test.cpp
+g++ -g -Wall -std=c++1z -pthread -o bin/tests/trace_test tests/trace_test.cpp
+g++ -g -Wall -std=c++1z -pthread -o bin/tests/latency_test tests/latency_test.cpp
 
 echo "Building lfs with fuse..."
-g++ -g -Og `pkg-config fuse --cflags --libs` -Wall -std=c++1z -o bin/lfs lfs_main.cpp bin/flash.o
+g++ -g -Og `pkg-config fuse --cflags --libs` -Wall -std=c++1z -pthread -o bin/lfs lfs_main.cpp bin/flash.o
 
 rm -r bin/tests/*.dSYM
 rm -r bin/*.dSYM
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#define CRC32C_X86
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CRC32C_ARM
+#endif
+
+// CRC32C (Castagnoli). Uses the crc32 instruction when the cpu has it and a table otherwise.
+// The hardware and table versions produce the same checksums so a flash written on one
+// machine can be checked on another.
+
+#define CRC32C_POLYNOMIAL 0x82F63B78 // reflected
+
+uint32_t crc32cTable[256];
+
+bool BuildCrc32cTable()
+{
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLYNOMIAL : crc >> 1;
+        }
+
+        crc32cTable[i] = crc;
+    }
+
+    return true;
+}
+
+uint32_t Crc32cSoftware(uint32_t crc, const void * data, size_t length)
+{
+    static const bool tableBuilt = BuildCrc32cTable();
+    (void)tableBuilt;
+
+    const unsigned char * bytes = (const unsigned char *)data;
+    for (size_t i = 0; i < length; ++i)
+    {
+        crc = crc32cTable[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+#if defined(CRC32C_X86)
+__attribute__((target("sse4.2")))
+uint32_t Crc32cHardware(uint32_t crc, const void * data, size_t length)
+{
+    const unsigned char * bytes = (const unsigned char *)data;
+    uint64_t crc64 = crc;
+    while (length >= sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word));
+        crc64   = _mm_crc32_u64(crc64, word);
+        bytes  += sizeof(uint64_t);
+        length -= sizeof(uint64_t);
+    }
+
+    crc = (uint32_t)crc64;
+    while (length > 0)
+    {
+        crc = _mm_crc32_u8(crc, *bytes);
+        bytes++;
+        length--;
+    }
+
+    return crc;
+}
+
+bool Crc32cHardwareSupported()
+{
+    return __builtin_cpu_supports("sse4.2");
+}
+#elif defined(CRC32C_ARM)
+uint32_t Crc32cHardware(uint32_t crc, const void * data, size_t length)
+{
+    const unsigned char * bytes = (const unsigned char *)data;
+    while (length >= sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word));
+        crc     = __crc32cd(crc, word);
+        bytes  += sizeof(uint64_t);
+        length -= sizeof(uint64_t);
+    }
+
+    while (length > 0)
+    {
+        crc = __crc32cb(crc, *bytes);
+        bytes++;
+        length--;
+    }
+
+    return crc;
+}
+
+bool Crc32cHardwareSupported()
+{
+    return true;
+}
+#else
+uint32_t Crc32cHardware(uint32_t crc, const void * data, size_t length)
+{
+    return Crc32cSoftware(crc, data, length);
+}
+
+bool Crc32cHardwareSupported()
+{
+    return false;
+}
+#endif
+
+uint32_t Crc32c(const void * data, size_t length)
+{
+    static const bool useHardware = Crc32cHardwareSupported();
+
+    uint32_t crc = 0xFFFFFFFF;
+    crc = useHardware ? Crc32cHardware(crc, data, length) : Crc32cSoftware(crc, data, length);
+    return crc ^ 0xFFFFFFFF;
+}
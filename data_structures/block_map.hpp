@@ -0,0 +1,142 @@
+#pragma once
+
+#include <limits.h>
+#include "inode.hpp"
+
+#define NUM_DIRECT_BLOCKS    4
+#define MAX_BLOCK_MAP_HEIGHT 3
+
+// The block map of a file. Blocks 0 to 3 are the direct blocks in the inode. The inode's indirect,
+// double indirect and triple indirect blocks are the roots of trees of height 1, 2 and 3 that map the
+// next N, N^2 and N^3 blocks, where N is the number of log addresses in a block. A node of height 1
+// holds the addresses of N file blocks and a node of height h holds the addresses of N nodes of height
+// h - 1, so a block is found with at most three node reads.
+//
+// A node is written to the log under a negative file block number made from its height and the first
+// file block it maps. The cleaner uses it to find the parent that points at the node.
+//
+// An extent mapped file keeps blocks 0 to 3 in the direct blocks like any other file and maps the
+// rest with a list of extents. The indirect block points at the first block of the list, which is all
+// most files need, and the double and triple indirect trees map the blocks after it. Extent list
+// blocks are written under the negative numbers a node of height 0 would have.
+typedef struct BlockMapGeometry
+{
+	unsigned long long entries; // log addresses in a node
+
+	BlockMapGeometry(unsigned int blockSizeInBytes = 0) :
+		entries(blockSizeInBytes / sizeof(LogAddress))
+	{
+	}
+
+	// file blocks mapped by a node of the given height
+	unsigned long long Span(unsigned int height)
+	{
+		unsigned long long span = 1;
+		for (unsigned int h = 0; h < height; ++h)
+		{
+			span *= entries;
+		}
+
+		return span;
+	}
+
+	// first file block of the tree of the given height. the tree of height MAX_BLOCK_MAP_HEIGHT + 1 starts past the last mapped block
+	unsigned long long RootFirstBlock(unsigned int height)
+	{
+		unsigned long long first = NUM_DIRECT_BLOCKS;
+		for (unsigned int h = 1; h < height; ++h)
+		{
+			first += Span(h);
+		}
+
+		return first;
+	}
+
+	unsigned long long MaxBlocks()
+	{
+		return RootFirstBlock(MAX_BLOCK_MAP_HEIGHT + 1);
+	}
+
+	// height of the tree that maps block. 0 for a direct block and MAX_BLOCK_MAP_HEIGHT + 1 past the last mapped block
+	unsigned int GetHeight(unsigned long long block)
+	{
+		unsigned int height = 0;
+		while (height <= MAX_BLOCK_MAP_HEIGHT && block >= RootFirstBlock(height + 1))
+		{
+			height++;
+		}
+
+		return height;
+	}
+
+	// first file block mapped by the node of the given height on the path to block
+	unsigned long long NodeFirstBlock(unsigned long long block, unsigned int height)
+	{
+		unsigned long long root = RootFirstBlock(GetHeight(block));
+		return root + (block - root) / Span(height) * Span(height);
+	}
+
+	// entry of the node of the given height on the path to block that leads to block
+	unsigned int ChildIndex(unsigned long long block, unsigned int height)
+	{
+		return (block - NodeFirstBlock(block, height)) / Span(height - 1);
+	}
+
+	int NodeId(unsigned long long firstBlock, unsigned int height)
+	{
+		return -(int)(firstBlock * (MAX_BLOCK_MAP_HEIGHT + 1) + height);
+	}
+
+	int ExtentListBlockId(unsigned int listBlock)
+	{
+		return -(int)(((unsigned long long)listBlock + 1) * (MAX_BLOCK_MAP_HEIGHT + 1));
+	}
+
+	// block of the block map that holds the address of a block of an extent list after the first
+	unsigned long long ExtentListMapBlock(unsigned int listBlock)
+	{
+		return RootFirstBlock(2) + listBlock - 1;
+	}
+
+	// returns false if id does not name a block of an extent list
+	bool DecodeExtentListBlockId(int id, unsigned int * listBlock)
+	{
+		if (id >= 0 || (-(long long)id) % (MAX_BLOCK_MAP_HEIGHT + 1) != 0)
+		{
+			return false;
+		}
+
+		*listBlock = -(long long)id / (MAX_BLOCK_MAP_HEIGHT + 1) - 1;
+		return true;
+	}
+
+	// returns false if id does not name a node of a block map
+	bool DecodeNodeId(int id, unsigned long long * firstBlock, unsigned int * height)
+	{
+		if (id >= 0)
+		{
+			return false;
+		}
+
+		unsigned long long value = -(long long)id;
+		*firstBlock              = value / (MAX_BLOCK_MAP_HEIGHT + 1);
+		*height                  = value % (MAX_BLOCK_MAP_HEIGHT + 1);
+		return *height != 0 &&
+		       *firstBlock >= NUM_DIRECT_BLOCKS &&
+		       *firstBlock < MaxBlocks() &&
+		       GetHeight(*firstBlock) >= *height &&
+		       NodeFirstBlock(*firstBlock, *height) == *firstBlock;
+	}
+} BlockMapGeometry;
+
+// the inode's pointer to the root of the tree of the given height
+LogAddress * GetBlockMapRoot(INode * iNode, unsigned int height)
+{
+	switch (height)
+	{
+		case 1:  return &iNode->indirectBlock;
+		case 2:  return &iNode->doubleIndirectBlock;
+		case 3:  return &iNode->tripleIndirectBlock;
+		default: return NULL;
+	}
+}
@@ -2,6 +2,7 @@
 
 #include <string.h>
 #include <iostream>
+#include "../trace.hpp"
 
 #define INUM_NOT_FOUND UINT_MAX
 #define MAX_FILE_NAME_LENGTH 255
@@ -38,7 +39,7 @@ typedef struct DirectoryList
 
 	int AddFile(const char * fileName, unsigned int inum) // CHECK FOR DUPLICATE FILES???
 	{
-    	std::cout << "[DirectoryList] AddFile: " << fileName << " " << inum << std::endl;
+    	TRACE_DEBUG(DirectoryListAdd, inum);
 
 		DirectoryEntry * oldEntries = directoryEntries;
 		DirectoryEntry * newEntries = (DirectoryEntry *)malloc((size + 1) * sizeof(DirectoryEntry));
@@ -56,7 +57,7 @@ typedef struct DirectoryList
 
 	int RemoveFile(const char * fileName)
 	{
-    	std::cout << "[DirectoryList] RemoveFile: " << fileName << std::endl;
+    	TRACE_DEBUG(DirectoryListRemove);
     	if (strcmp(fileName, ".") == 0 || strcmp(fileName, "..") == 0)
     	{
     		std::cout << "[DirectoryList] Cannot remove: " << fileName << std::endl;
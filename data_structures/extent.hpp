@@ -0,0 +1,34 @@
+#pragma once
+
+#include "log_address.hpp"
+
+// a run of file blocks stored in consecutive block slots of one segment
+typedef struct Extent
+{
+	unsigned int fileBlock; // first file block of the run
+	unsigned int length;    // in blocks
+	LogAddress   address;   // of the first block
+
+	unsigned int End()
+	{
+		return fileBlock + length;
+	}
+
+	LogAddress GetAddress(unsigned int block)
+	{
+		LogAddress blockAddress = {
+			.logSegment  = address.logSegment,
+			.blockNumber = address.blockNumber + (block - fileBlock)
+		};
+
+		return blockAddress;
+	}
+
+	// true if next maps the blocks right after this run to the slots right after it
+	bool Continues(Extent& next)
+	{
+		return next.fileBlock == End() &&
+		       next.address.logSegment == address.logSegment &&
+		       next.address.blockNumber == address.blockNumber + length;
+	}
+} Extent;
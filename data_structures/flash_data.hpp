@@ -2,10 +2,18 @@
 
 #include <time.h>
 #include "inode.hpp"
+#include "write_stream.hpp"
 
 #define CHECKPOINT_SIZE_IN_SECTORS 1
 #define FLASH_FULL -9
 
+// block compression codecs, chosen at mklfs time
+#define COMPRESSION_NONE 0
+#define COMPRESSION_LZ   1
+
+// a compressed segment has this many block slots per block of space so packed blocks get a slot
+#define COMPRESSED_SLOTS_PER_BLOCK 3
+
 typedef struct SegmentUsageTableEntry
 {
 	unsigned int liveBytesInSegment;
@@ -16,9 +24,12 @@ typedef struct Checkpoint
 {
 	bool 		       isValid;
 	unsigned long long time;
+	unsigned long long sequenceNumber; // increases by one with every checkpoint written
 	unsigned int       segmentUsageTableSegment;
 	unsigned int       lastSegmentWritten;
 	INode              iFileINode;
+	unsigned int       tailSegments[NUM_WRITE_STREAMS];       // tails written in part for this checkpoint, 0 for none
+	unsigned int       tailSummaryOffsets[NUM_WRITE_STREAMS]; // where each of those tails has its latest summary copy in its data area
 } Checkpoint; 
 
 typedef struct FlashData
@@ -29,4 +40,6 @@ typedef struct FlashData
 	unsigned int wearLimit;         // Wear limit for erase blocks
 	unsigned int numBlocks;         // total number of blocks in flash
 	unsigned int checkpointSegment; // reserved checkpoint segment
+	unsigned int compression;       // codec used for blocks written to the log
+	unsigned int deduplication;     // identical file data blocks are stored once
 } FlashData;
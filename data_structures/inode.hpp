@@ -1,6 +1,7 @@
 #pragma once
 
 #include <limits.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include "log_address.hpp"
@@ -10,6 +11,7 @@
 #define IFILE_INUM 0
 #define ROOT_DIRECTORY_INUM (IFILE_INUM + 1)
 #define EMPTY_DIRECT_BLOCK_ADDRESS UINT_MAX
+#define INLINE_DATA_SIZE 124 // bytes of data kept in the inode, sized so an inode is 256 bytes
 
 typedef struct INode
 {
@@ -22,10 +24,16 @@ typedef struct INode
     gid_t          gid;             // group
     unsigned short permissions;     // 9 bits - rwx rwx rwx
     LogAddress     directBlocks[4]; // First 4 blocks of file
-    LogAddress     indirectBlock;
+    LogAddress     indirectBlock;   // Roots of the block map, see block_map.hpp
+    LogAddress     doubleIndirectBlock;
+    LogAddress     tripleIndirectBlock;
     time_t         atime;   // Time of last access. 
     time_t         mtime;   // Time of last data modification. 
     time_t         ctime;   // Time of last status change 
+    bool           extentMapped;    // blocks past the direct blocks are mapped by a list of extents
+    unsigned int   extentCount;     // entries in the extent list
+    bool           dataInline;      // the data is in inlineData and the file has no blocks
+    char           inlineData[INLINE_DATA_SIZE];
 
     bool operator !=(INode& rhs)
     {
@@ -40,7 +48,13 @@ typedef struct INode
             mtime         != rhs.mtime                  ||
             ctime         != rhs.ctime                  ||
             permissions   != rhs.permissions            ||
-            indirectBlock != rhs.indirectBlock)
+            indirectBlock != rhs.indirectBlock            ||
+            doubleIndirectBlock != rhs.doubleIndirectBlock ||
+            tripleIndirectBlock != rhs.tripleIndirectBlock ||
+            extentMapped  != rhs.extentMapped           ||
+            extentCount   != rhs.extentCount            ||
+            dataInline    != rhs.dataInline             ||
+            memcmp(inlineData, rhs.inlineData, INLINE_DATA_SIZE) != 0)
         {
             return true;
         }
@@ -76,5 +90,12 @@ typedef struct INode
 
         std::cout << "\t[iNode] indirect block: " << std::endl;
         indirectBlock.Print();
+        std::cout << "\t[iNode] double indirect block: " << std::endl;
+        doubleIndirectBlock.Print();
+        std::cout << "\t[iNode] triple indirect block: " << std::endl;
+        tripleIndirectBlock.Print();
+        std::cout << "\t[iNode] extent mapped: " << extentMapped << std::endl;
+        std::cout << "\t[iNode] extents: " << extentCount << std::endl;
+        std::cout << "\t[iNode] data inline: " << dataInline << std::endl;
     }
 } inode;
\ No newline at end of file
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <limits.h>
+#include <sstream>
+#include <string>
+#include "write_stream.hpp"
+#include "write_cause.hpp"
+#include "../layers/flash/flash.h"
+
+// counters reported through /.lfs_stats. the log and file layers each fill in their own part
+struct LogStats
+{
+	unsigned long long cacheHits;           // reads of segments in the segment cache or an open tail
+	unsigned long long cacheMisses;         // reads that had to go to flash
+	unsigned int       flashSize;           // segments
+	unsigned int       freeSegments;        // segments with no live data
+	unsigned int       erasedSegments;      // free segments already erased by the erase thread
+	unsigned long long blocksWritten[NUM_WRITE_STREAMS];
+	unsigned long long blocksDeduplicated;
+	unsigned long long blocksRewritten;     // blocks changed in place in a tail that was not yet on flash
+	unsigned long long flashReads;
+	unsigned long long flashSectorsRead;
+	unsigned long long flashWrites;
+	unsigned long long flashSectorsWritten;
+	unsigned long long flashErases;
+	unsigned long long flashEraseBlocksErased;
+	unsigned long long checkpoints;
+	unsigned long long checkpointSequenceNumber;
+	unsigned long long secondsSinceCheckpoint;
+	unsigned long long dataAtRisk;          // bytes written since the last checkpoint
+	unsigned long long bytesWrittenByCause[NUM_WRITE_CAUSES]; // flash bytes, adds up to flashSectorsWritten
+};
+
+struct FileStats
+{
+	unsigned long long bytesWritten;        // by File_Write
+	unsigned long long bytesRead;           // by File_Read
+	unsigned long long cleaningPasses;
+	unsigned long long segmentsCleaned;
+	unsigned long long emptySegmentsReleased;
+	unsigned long long blocksMoved;         // live blocks the cleaner copied to the log tail
+	unsigned long long segmentsLeveled;     // segments moved by static wear leveling
+	unsigned long long inodeCacheHits;
+	unsigned long long inodeCacheMisses;    // inodes read from the ifile
+	unsigned long long inodeWriteBacks;     // times the dirty inodes were written to the ifile
+	unsigned long long inodesWrittenBack;
+	unsigned long long extentFilesConverted; // extent mapped files changed to block maps
+};
+
+struct LfsStats
+{
+	LogStats  log;
+	FileStats file;
+};
+
+// settings that can be changed through /.lfs_control while the file system is mounted
+struct LfsTunables
+{
+	unsigned int cacheSize;                 // segments
+	unsigned int checkpointInterval;        // segments
+	unsigned int checkpointAge;             // seconds, 0 disables timed checkpoints
+	unsigned int cleaningStart;             // clean segments
+	unsigned int cleaningStop;              // clean segments
+};
+
+// /.lfs_stats and /.lfs_control hold one "name value" pair per line
+std::string FormatStats(const LfsStats& stats)
+{
+	const LogStats& log   = stats.log;
+	const FileStats& file = stats.file;
+	unsigned long long lookups     = log.cacheHits + log.cacheMisses;
+	unsigned long long flashBytes  = log.flashSectorsWritten * FLASH_SECTOR_SIZE;
+	double hitRate                 = lookups == 0 ? 0.0 : (double)log.cacheHits / lookups;
+	double writeAmplification      = file.bytesWritten == 0 ? 0.0 : (double)flashBytes / file.bytesWritten;
+
+	std::ostringstream out;
+	out << "cache_hits "                 << log.cacheHits                   << "\n"
+	    << "cache_misses "               << log.cacheMisses                 << "\n"
+	    << "cache_hit_rate "             << hitRate                         << "\n"
+	    << "segments "                   << log.flashSize                   << "\n"
+	    << "free_segments "              << log.freeSegments                << "\n"
+	    << "erased_segments "            << log.erasedSegments              << "\n"
+	    << "bytes_written "              << file.bytesWritten               << "\n"
+	    << "bytes_read "                 << file.bytesRead                  << "\n"
+	    << "flash_bytes_written "        << flashBytes                      << "\n"
+	    << "write_amplification "        << writeAmplification              << "\n";
+
+	for (int stream = 0; stream < NUM_WRITE_STREAMS; ++stream)
+	{
+		out << "blocks_written_" << GetWriteStreamString((WriteStream)stream) << " " << log.blocksWritten[stream] << "\n";
+	}
+
+	out << "blocks_deduplicated "        << log.blocksDeduplicated          << "\n"
+	    << "blocks_rewritten "           << log.blocksRewritten             << "\n"
+	    << "flash_reads "                << log.flashReads                  << "\n"
+	    << "flash_sectors_read "         << log.flashSectorsRead            << "\n"
+	    << "flash_writes "               << log.flashWrites                 << "\n"
+	    << "flash_sectors_written "      << log.flashSectorsWritten         << "\n"
+	    << "flash_erases "               << log.flashErases                 << "\n"
+	    << "flash_erase_blocks_erased "  << log.flashEraseBlocksErased      << "\n"
+	    << "cleaning_passes "            << file.cleaningPasses             << "\n"
+	    << "segments_cleaned "           << file.segmentsCleaned            << "\n"
+	    << "empty_segments_released "    << file.emptySegmentsReleased      << "\n"
+	    << "blocks_moved "               << file.blocksMoved                << "\n"
+	    << "segments_leveled "           << file.segmentsLeveled            << "\n"
+	    << "inode_cache_hits "           << file.inodeCacheHits             << "\n"
+	    << "inode_cache_misses "         << file.inodeCacheMisses           << "\n"
+	    << "inode_write_backs "          << file.inodeWriteBacks            << "\n"
+	    << "inodes_written_back "        << file.inodesWrittenBack          << "\n"
+	    << "extent_files_converted "     << file.extentFilesConverted       << "\n"
+	    << "checkpoints "                << log.checkpoints                 << "\n"
+	    << "checkpoint_sequence_number " << log.checkpointSequenceNumber    << "\n"
+	    << "checkpoint_age_seconds "     << log.secondsSinceCheckpoint      << "\n"
+	    << "data_at_risk_bytes "         << log.dataAtRisk                  << "\n";
+
+	for (int cause = 0; cause < NUM_WRITE_CAUSES; ++cause)
+	{
+		out << "flash_bytes_" << GetWriteCauseString((WriteCause)cause) << " " << log.bytesWrittenByCause[cause] << "\n";
+	}
+
+	return out.str();
+}
+
+std::string FormatTunables(const LfsTunables& tunables)
+{
+	std::ostringstream out;
+	out << "cache_size "          << tunables.cacheSize          << "\n"
+	    << "checkpoint_interval " << tunables.checkpointInterval << "\n"
+	    << "checkpoint_age "      << tunables.checkpointAge      << "\n"
+	    << "cleaning_start "      << tunables.cleaningStart      << "\n"
+	    << "cleaning_stop "       << tunables.cleaningStop       << "\n";
+	return out.str();
+}
+
+// updates the settings named in text. returns 1 without changing anything on an unknown name or bad value
+int ParseTunables(const std::string& text, LfsTunables * tunables)
+{
+	LfsTunables parsed = *tunables;
+	std::istringstream in(text);
+	std::string line;
+	while (std::getline(in, line))
+	{
+		std::istringstream fields(line);
+		std::string name;
+		long long value;
+		if (!(fields >> name))
+		{
+			continue;
+		}
+
+		std::string rest;
+		if (!(fields >> value) || value < 0 || value > UINT_MAX || (fields >> rest))
+		{
+			return 1;
+		}
+
+		if (name == "cache_size")
+		{
+			parsed.cacheSize = value;
+		}
+		else if (name == "checkpoint_interval")
+		{
+			parsed.checkpointInterval = value;
+		}
+		else if (name == "checkpoint_age")
+		{
+			parsed.checkpointAge = value;
+		}
+		else if (name == "cleaning_start")
+		{
+			parsed.cleaningStart = value;
+		}
+		else if (name == "cleaning_stop")
+		{
+			parsed.cleaningStop = value;
+		}
+		else
+		{
+			return 1;
+		}
+	}
+
+	*tunables = parsed;
+	return 0;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <algorithm>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+
+#define LOCK_TABLE_STRIPES 64
+
+// a fixed set of reader-writer locks shared by any number of objects. an object is guarded by the lock
+// its key maps to, so objects that share a lock only wait on each other and no lock has to be created
+// or destroyed as objects come and go
+class LockTable
+{
+private:
+	std::shared_mutex stripes[LOCK_TABLE_STRIPES];
+
+public:
+	std::shared_mutex& get(unsigned int key)
+	{
+		return stripes[key % LOCK_TABLE_STRIPES];
+	}
+
+	// locks several objects exclusively. the locks are taken once each in a fixed order, so threads
+	// locking overlapping sets of objects cannot deadlock
+	std::vector<std::unique_lock<std::shared_mutex>> lockAll(std::vector<unsigned int> keys)
+	{
+		std::vector<unsigned int> indexes;
+		for (unsigned int key : keys)
+		{
+			indexes.push_back(key % LOCK_TABLE_STRIPES);
+		}
+
+		std::sort(indexes.begin(), indexes.end());
+		indexes.erase(std::unique(indexes.begin(), indexes.end()), indexes.end());
+
+		std::vector<std::unique_lock<std::shared_mutex>> locks;
+		for (unsigned int index : indexes)
+		{
+			locks.emplace_back(stripes[index]);
+		}
+
+		return locks;
+	}
+};
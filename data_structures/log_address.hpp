@@ -10,6 +10,11 @@ typedef struct LogAddress
     	return logSegment != rhs.logSegment || blockNumber != rhs.blockNumber;
     }
 
+    bool operator ==(LogAddress& rhs)
+    {
+    	return !(*this != rhs);
+    }
+
     void Print()
     {
         std::cout << "\t\t[LogAddress] logSegment: " << logSegment << std::endl;
@@ -1,25 +1,37 @@
 #pragma once
 
 #include <limits.h>
+#include "../crc32c.hpp"
 
 #define NO_INUM -1
 #define SUMMARY_BLOCK -2
 
-#define INDIRECT_BLOCK -1 
+// other negative file block numbers name block map nodes, see block_map.hpp
 #define NO_BLOCK INT_MAX
 
 typedef struct SegmentSummary
 {
+	uint32_t     summaryChecksum;   // CRC32C of the serialized summary after this field. must stay first
 	unsigned int segmentNumber;
 	unsigned int startSector;
-	unsigned int numberOfBlocks;
+	unsigned int numberOfBlocks;    // block slots, including the summary slot
+	unsigned int nextSlot;          // compressed segments fill slots in order, starting at 1
+	unsigned int dataBytes;         // bytes of segment data used by compressed segments
+	unsigned int unpackedBlockSize; // bytes of every block of an uncompressed segment. 0 when blocks are packed
 	int *        blockINums;
 	int *        iNodeBlockNumbers;
+	uint32_t *   blockChecksums;    // CRC32C of each block's uncompressed data
+	uint32_t *   blockOffsets;      // byte offset of each block in the segment data. only stored when blocks are packed
+	uint32_t *   blockLengths;      // bytes the block takes in the segment data. a block size means it is stored uncompressed
 
-	SegmentSummary(unsigned int segNum, unsigned int sector, unsigned int nBlocks) :
+	SegmentSummary(unsigned int segNum, unsigned int sector, unsigned int nBlocks, unsigned int unpackedSize) :
+		summaryChecksum(0),
 		segmentNumber(segNum),
 		startSector(sector),
-		numberOfBlocks(nBlocks)
+		numberOfBlocks(nBlocks),
+		nextSlot(1),
+		dataBytes(0),
+		unpackedBlockSize(unpackedSize)
 	{
 		blockINums = (int *)malloc(numberOfBlocks * sizeof(int));
 		memset(blockINums, NO_INUM, numberOfBlocks * sizeof(int));
@@ -31,6 +43,94 @@ typedef struct SegmentSummary
 		{
 			iNodeBlockNumbers[i] = NO_BLOCK;
 		}
+
+		blockChecksums = (uint32_t *)malloc(numberOfBlocks * sizeof(uint32_t));
+		memset(blockChecksums, 0, numberOfBlocks * sizeof(uint32_t));
+
+		blockOffsets = (uint32_t *)malloc(numberOfBlocks * sizeof(uint32_t));
+		memset(blockOffsets, 0, numberOfBlocks * sizeof(uint32_t));
+
+		blockLengths = (uint32_t *)malloc(numberOfBlocks * sizeof(uint32_t));
+		memset(blockLengths, 0, numberOfBlocks * sizeof(uint32_t));
+	}
+
+	// on flash the summary holds this struct followed by the inums, file block numbers and block checksums.
+	// packed blocks are followed by their offsets and lengths, uncompressed blocks sit one after another
+	static unsigned int SizeInBytes(unsigned int nBlocks, bool packed)
+	{
+		return sizeof(SegmentSummary) + nBlocks * (2 * sizeof(int) + (packed ? 3 : 1) * sizeof(uint32_t));
+	}
+
+	static uint32_t ComputeChecksum(const char * summaryBlock, unsigned int nBlocks, bool packed)
+	{
+		return Crc32c(summaryBlock + sizeof(uint32_t), SizeInBytes(nBlocks, packed) - sizeof(uint32_t));
+	}
+
+	// copies the summary into a summary block and stamps it with its checksum
+	void Serialize(char * summaryBlock)
+	{
+		char * iNumsBuffer     = summaryBlock + sizeof(SegmentSummary);
+		char * blocksBuffer    = iNumsBuffer + numberOfBlocks * sizeof(int);
+		char * checksumsBuffer = blocksBuffer + numberOfBlocks * sizeof(int);
+		char * offsetsBuffer   = checksumsBuffer + numberOfBlocks * sizeof(uint32_t);
+		char * lengthsBuffer   = offsetsBuffer + numberOfBlocks * sizeof(uint32_t);
+
+		memcpy(summaryBlock, this, sizeof(SegmentSummary));
+		memcpy(iNumsBuffer, blockINums, numberOfBlocks * sizeof(int));
+		memcpy(blocksBuffer, iNodeBlockNumbers, numberOfBlocks * sizeof(int));
+		memcpy(checksumsBuffer, blockChecksums, numberOfBlocks * sizeof(uint32_t));
+		if (unpackedBlockSize == 0)
+		{
+			memcpy(offsetsBuffer, blockOffsets, numberOfBlocks * sizeof(uint32_t));
+			memcpy(lengthsBuffer, blockLengths, numberOfBlocks * sizeof(uint32_t));
+		}
+
+		summaryChecksum = ComputeChecksum(summaryBlock, numberOfBlocks, unpackedBlockSize == 0);
+		memcpy(summaryBlock, &summaryChecksum, sizeof(uint32_t));
+	}
+
+	// reads the summary out of a summary block. returns false if the block fails its checksum
+	bool Deserialize(const char * summaryBlock)
+	{
+		unsigned int nBlocks       = numberOfBlocks;
+		unsigned int unpackedSize  = unpackedBlockSize;
+		int * iNumsPointer         = blockINums;
+		int * blocksPointer        = iNodeBlockNumbers;
+		uint32_t * checksumPointer = blockChecksums;
+		uint32_t * offsetsPointer  = blockOffsets;
+		uint32_t * lengthsPointer  = blockLengths;
+
+		*this = *reinterpret_cast<const SegmentSummary *>(summaryBlock); // DONT READ THE POINTERS. THEY ARE ALLOCATED PER SEGMENT
+		blockINums        = iNumsPointer;
+		iNodeBlockNumbers = blocksPointer;
+		blockChecksums    = checksumPointer;
+		blockOffsets      = offsetsPointer;
+		blockLengths      = lengthsPointer;
+		unpackedBlockSize = unpackedSize;
+
+		const char * iNumsBuffer     = summaryBlock + sizeof(SegmentSummary);
+		const char * blocksBuffer    = iNumsBuffer + nBlocks * sizeof(int);
+		const char * checksumsBuffer = blocksBuffer + nBlocks * sizeof(int);
+		const char * offsetsBuffer   = checksumsBuffer + nBlocks * sizeof(uint32_t);
+		const char * lengthsBuffer   = offsetsBuffer + nBlocks * sizeof(uint32_t);
+		memcpy(blockINums, iNumsBuffer, nBlocks * sizeof(int));
+		memcpy(iNodeBlockNumbers, blocksBuffer, nBlocks * sizeof(int));
+		memcpy(blockChecksums, checksumsBuffer, nBlocks * sizeof(uint32_t));
+		if (unpackedBlockSize == 0)
+		{
+			memcpy(blockOffsets, offsetsBuffer, nBlocks * sizeof(uint32_t));
+			memcpy(blockLengths, lengthsBuffer, nBlocks * sizeof(uint32_t));
+		}
+		else
+		{
+			for (unsigned int b = 1; b < nBlocks; ++b)
+			{
+				blockOffsets[b] = (b - 1) * unpackedBlockSize;
+				blockLengths[b] = unpackedBlockSize;
+			}
+		}
+
+		return summaryChecksum == ComputeChecksum(summaryBlock, nBlocks, unpackedBlockSize == 0);
 	}
 
 	void PrintSegmentSummaryBlock()
@@ -55,8 +155,8 @@ typedef struct InMemorySegment
 	SegmentSummary summary;
 	void *         data; // maybe change to include summary
 
-	InMemorySegment(unsigned int segmentNumber, unsigned int startSector, unsigned int segmentSizeInBytes, unsigned int segmentSizeInBlocks) :
-		summary(segmentNumber, startSector, segmentSizeInBlocks)
+	InMemorySegment(unsigned int segmentNumber, unsigned int startSector, unsigned int segmentSizeInBytes, unsigned int segmentSizeInBlocks, unsigned int unpackedBlockSize) :
+		summary(segmentNumber, startSector, segmentSizeInBlocks, unpackedBlockSize)
     {
 		data = malloc(segmentSizeInBytes); memset(data, 0, segmentSizeInBytes);
     }
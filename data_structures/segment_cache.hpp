@@ -1,120 +1,201 @@
 #pragma once
 
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
 #include <vector>
 #include "segment.hpp"
 #include "segment_factory.hpp"
+#include "../trace.hpp"
 
+// cached segments are never modified, so any number of readers can copy blocks out of them at once.
+// a lookup only stamps the entry it uses, the least recently stamped entry is evicted when the cache
+// is full. adding, evicting and invalidating entries wait for the readers to finish
 class SegmentCache
 {
 private:
+	struct CacheEntry
+	{
+		InMemorySegment *     segment;
+		std::atomic<uint64_t> lastUse;
+	};
+
 	int cache_size;
-	std::vector<InMemorySegment *> queue;		
+	std::vector<CacheEntry *> queue;		
 	SegmentFactory * segmentFactory;
+	std::atomic<uint64_t> useClock;
+	std::shared_mutex cacheMutex;
 
 public:
 	SegmentCache(SegmentFactory * segFac, int size) : 			
 		cache_size(size),
-		segmentFactory(segFac)
+		segmentFactory(segFac),
+		useClock(0)
 	{
 	}
 
 	~SegmentCache()
 	{
-		for (auto seg : queue)
+		for (auto entry : queue)
 		{
-			segmentFactory->Destroy(seg);
+			segmentFactory->Destroy(entry->segment);
+			delete entry;
 		}
 	}
 
 	bool containsEntry(unsigned int segmentNumber)
 	{
-		for (auto seg : queue)
-		{
-			if (seg->summary.segmentNumber == segmentNumber)
-			{
-				return true;
-			}
-		} 
-
-		return false;
+		std::shared_lock<std::shared_mutex> lock(cacheMutex);
+		return findEntry(segmentNumber) != NULL;
 	}
 
 	InMemorySegment * getEntry(unsigned int segmentNumber)
 	{
-		std::cout << "[SegmentCache] getting segment in cache. Segment: " << segmentNumber << std::endl;
+		TRACE_DEBUG(SegmentCacheGet, segmentNumber);
+		std::shared_lock<std::shared_mutex> lock(cacheMutex);
 
-		if (!containsEntry(segmentNumber))
+		CacheEntry * entry = findEntry(segmentNumber);
+		if (entry == NULL)
 		{
 			std::cerr << "[SegmentCache] ERROR: Attempting to accesss non existing entry in segment cache" << std::endl;
 			throw;
 		}
 
-		if (queue[0]->summary.segmentNumber == segmentNumber)
-		{
-			return queue[0];
-		}
+		entry->lastUse = ++useClock;
+		return entry->segment;
+	}
 
-		for(auto it = queue.begin(); it != queue.end(); ++it)
+	// runs reader on a cached segment while it cannot be evicted. returns false if the segment is not cached
+	bool readEntry(unsigned int segmentNumber, std::function<void(InMemorySegment *)> reader)
+	{
+		TRACE_DEBUG(SegmentCacheGet, segmentNumber);
+		std::shared_lock<std::shared_mutex> lock(cacheMutex);
+
+		CacheEntry * entry = findEntry(segmentNumber);
+		if (entry == NULL)
 		{
-			auto x = *it;
-			if (x->summary.segmentNumber == segmentNumber)
-			{
-				queue.erase(it);
-    			queue.insert(queue.begin(), x);
-    			break;
-			}
+			return false;
 		}
-		
-		return queue[0];
+
+		entry->lastUse = ++useClock;
+		reader(entry->segment);
+		return true;
 	}
 
 	void putEntry(InMemorySegment * segment)
 	{
 		// cant add duplicated entries
 		unsigned int segmentNumber = segment->summary.segmentNumber;
-		std::cout << "[SegmentCache] Putting segment in cache. Segment: " << segmentNumber << std::endl;
+		TRACE_DEBUG(SegmentCachePut, segmentNumber);
+		std::unique_lock<std::shared_mutex> lock(cacheMutex);
 
-		if (containsEntry(segmentNumber))
+		if (findEntry(segmentNumber) != NULL)
 		{
 			std::cerr << "[SegmentCache] ERROR: Attempting to add duplicate entry to segment cache: " << segmentNumber << std::endl;
-			for(auto it = queue.begin(); it != queue.end(); ++it)
+			for (auto entry : queue)
 			{
-				auto x = *it;
-				x->summary.PrintSegmentSummaryBlock();
+				entry->segment->summary.PrintSegmentSummaryBlock();
 			}
 
 			throw;
 		}
 
-		if (queue.size() == cache_size)
+		addEntry(segment);
+	}
+
+	// for readers that fill the cache from flash without holding the log lock. returns false, leaving the
+	// segment to the caller, if another reader cached the segment first
+	bool putEntryIfAbsent(InMemorySegment * segment)
+	{
+		TRACE_DEBUG(SegmentCachePut, segment->summary.segmentNumber);
+		std::unique_lock<std::shared_mutex> lock(cacheMutex);
+
+		if (findEntry(segment->summary.segmentNumber) != NULL)
 		{
-			std::cout << "[SegmentCache] Segment cache full. Removing segment " << queue.back()->summary.segmentNumber << std::endl;
-			InMemorySegment * toDelete = queue.back();
-			segmentFactory->Destroy(toDelete);
-			queue.pop_back();
+			return false;
 		}
 
-		queue.insert(queue.begin(), segment);
+		addEntry(segment);
+		return true;
 	}
 
-	void invalidateEntry(unsigned int segmentNumber)
+	// evicts the least recently used segments that no longer fit
+	void resize(int size)
 	{
-		std::cout << "[SegmentCache] invalidating segment in cache. Segment: " << segmentNumber << std::endl;
-
-		if (!containsEntry(segmentNumber))
+		std::unique_lock<std::shared_mutex> lock(cacheMutex);
+		cache_size = size;
+		while (queue.size() > cache_size)
 		{
-			return;
+			evictEntry();
 		}
+	}
+
+	void invalidateEntry(unsigned int segmentNumber)
+	{
+		TRACE_DEBUG(SegmentCacheInvalidate, segmentNumber);
+		std::unique_lock<std::shared_mutex> lock(cacheMutex);
 
 		for(auto it = queue.begin(); it != queue.end(); ++it)
 		{
 			auto x = *it;
-			if (x->summary.segmentNumber == segmentNumber)
+			if (x->segment->summary.segmentNumber == segmentNumber)
 			{
-				segmentFactory->Destroy(x);
+				segmentFactory->Destroy(x->segment);
+				delete x;
 				queue.erase(it);
 				break;
 			}
 		}
 	}
-};
\ No newline at end of file
+
+private:
+	CacheEntry * findEntry(unsigned int segmentNumber)
+	{
+		for (auto entry : queue)
+		{
+			if (entry->segment->summary.segmentNumber == segmentNumber)
+			{
+				return entry;
+			}
+		}
+
+		return NULL;
+	}
+
+	void addEntry(InMemorySegment * segment)
+	{
+		if (cache_size <= 0)
+		{
+			segmentFactory->Destroy(segment);
+			return;
+		}
+
+		if (queue.size() >= cache_size)
+		{
+			evictEntry();
+		}
+
+		CacheEntry * entry = new CacheEntry();
+		entry->segment     = segment;
+		entry->lastUse     = ++useClock;
+		queue.push_back(entry);
+	}
+
+	void evictEntry()
+	{
+		auto oldest = queue.begin();
+		for (auto it = queue.begin(); it != queue.end(); ++it)
+		{
+			if ((*it)->lastUse < (*oldest)->lastUse)
+			{
+				oldest = it;
+			}
+		}
+
+		TRACE_DEBUG(SegmentCacheEvict, (*oldest)->segment->summary.segmentNumber);
+		segmentFactory->Destroy((*oldest)->segment);
+		delete *oldest;
+		queue.erase(oldest);
+	}
+};
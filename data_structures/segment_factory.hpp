@@ -3,6 +3,7 @@
 #include "flash_data.hpp"
 #include "segment.hpp"
 #include "../layers/flash/flash.h"
+#include "../trace.hpp"
 
 
 class SegmentFactory
@@ -18,12 +19,12 @@ public:
 
 	InMemorySegment * Build(unsigned int segmentNumber)
 	{
-		std::cout << "[SegmentFactory] Building Segment: " << segmentNumber << std::endl;
+		TRACE_DEBUG(SegmentBuild, segmentNumber);
 
 		unsigned int startSector         = segmentNumber * flashData.segmentSize * flashData.blockSize;
 		unsigned int segmentSizeInBytes  = getSegmentSizeInBytes();
-		unsigned int segmentSizeInBlocks = getSegmentSizeInBlocks();
-		InMemorySegment * segment        = new InMemorySegment(segmentNumber, startSector, segmentSizeInBytes, segmentSizeInBlocks);
+		unsigned int segmentSizeInSlots  = getSegmentSizeInSlots();
+		InMemorySegment * segment        = new InMemorySegment(segmentNumber, startSector, segmentSizeInBytes, segmentSizeInSlots, getUnpackedBlockSize());
 		return segment;
 	}
 
@@ -32,6 +33,9 @@ public:
 		free(segment->data);
 		free(segment->summary.blockINums);
 		free(segment->summary.iNodeBlockNumbers);
+		free(segment->summary.blockChecksums);
+		free(segment->summary.blockOffsets);
+		free(segment->summary.blockLengths);
 		delete segment;
 	}
 
@@ -49,4 +53,40 @@ public:
 	{
 		return flashData.segmentSize;
 	}
+
+	bool isCompressed()
+	{
+		return flashData.compression != COMPRESSION_NONE;
+	}
+
+	// blocks of an uncompressed segment all take a block, so their summary does not store where they are
+	unsigned int getUnpackedBlockSize()
+	{
+		return isCompressed() ? 0 : flashData.blockSize * FLASH_SECTOR_SIZE;
+	}
+
+	// compressed blocks are packed so a compressed segment has more slots than blocks
+	unsigned int getSegmentSizeInSlots()
+	{
+		return isCompressed() ? COMPRESSED_SLOTS_PER_BLOCK * flashData.segmentSize : flashData.segmentSize;
+	}
+
+	// the summary of a compressed segment can take more than one block. segment data starts after it
+	unsigned int getSummarySizeInBlocks()
+	{
+		unsigned int blockSizeInBytes   = flashData.blockSize * FLASH_SECTOR_SIZE;
+		unsigned int summarySizeInBytes = SegmentSummary::SizeInBytes(getSegmentSizeInSlots(), isCompressed());
+		return summarySizeInBytes / blockSizeInBytes + (summarySizeInBytes % blockSizeInBytes != 0);
+	}
+
+	unsigned int getDataSizeInBytes()
+	{
+		return (flashData.segmentSize - getSummarySizeInBlocks()) * flashData.blockSize * FLASH_SECTOR_SIZE;
+	}
+
+	// one bit per slot. the validity bitmaps are stored after the segment usage table
+	unsigned int getValidityBitmapSizeInBytes()
+	{
+		return (getSegmentSizeInSlots() + 7) / 8;
+	}
 };
\ No newline at end of file
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "log_address.hpp"
+
+// a file block that references a deduplicated block
+typedef struct BlockOwner
+{
+	unsigned int inum;
+	int          fileBlock;
+
+	bool operator ==(const BlockOwner& rhs) const
+	{
+		return inum == rhs.inum && fileBlock == rhs.fileBlock;
+	}
+} BlockOwner;
+
+// a block referenced by more than one file block
+typedef struct SharedBlock
+{
+	unsigned int            extraReferences; // references beyond the first
+	std::vector<BlockOwner> owners;          // file blocks that have referenced the block. may be stale, the cleaner checks each one
+} SharedBlock;
+
+uint64_t LogAddressKey(LogAddress logAddress)
+{
+	return ((uint64_t)logAddress.logSegment << 32) | logAddress.blockNumber;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+
+// Why bytes were written to flash. Every flash write is charged to one cause, so the
+// per-cause totals add up to the bytes written to flash.
+enum WriteCause
+{
+	UserData,          // file blocks written in full or for the first time
+	ReadModifyWrite,   // file blocks rewritten because part of them was overwritten
+	INodeUpdate,       // ifile blocks rewritten by UpdateIFile
+	IndirectBlock,     // indirect blocks rewritten after a block address changed
+	DirectoryData,     // directory and symlink blocks
+	CleanerRelocation, // live blocks moved by the cleaner
+	SegmentUsageTable, // the segment usage table and validity bitmaps
+	Checkpointing,     // checkpoints and the partly filled tails written before them
+	SegmentOverhead    // segment summaries and the unused end of segments
+};
+
+#define NUM_WRITE_CAUSES 9
+#define NO_WRITE_CAUSE   -1
+
+std::string GetWriteCauseString(WriteCause cause)
+{
+    switch (cause)
+    {
+        case WriteCause::UserData:
+            return "UserData";
+        case WriteCause::ReadModifyWrite:
+            return "ReadModifyWrite";
+        case WriteCause::INodeUpdate:
+            return "INodeUpdate";
+        case WriteCause::IndirectBlock:
+            return "IndirectBlock";
+        case WriteCause::DirectoryData:
+            return "DirectoryData";
+        case WriteCause::CleanerRelocation:
+            return "CleanerRelocation";
+        case WriteCause::SegmentUsageTable:
+            return "SegmentUsageTable";
+        case WriteCause::Checkpointing:
+            return "Checkpointing";
+        case WriteCause::SegmentOverhead:
+            return "SegmentOverhead";
+        default:
+            std::cerr << "[GetWriteCauseString] unknown write cause: " << cause << std::endl;
+            throw;
+    }
+}
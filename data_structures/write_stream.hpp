@@ -0,0 +1,34 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+
+// Each write stream has its own open tail segment in the log so blocks with
+// similar lifetimes end up in the same segments.
+enum WriteStream
+{
+	HotData,       // overwrites of existing file blocks
+	ColdData,      // first writes of file blocks
+	Metadata,      // ifile, directory and indirect blocks
+	CleanerOutput  // blocks relocated by the cleaner
+};
+
+#define NUM_WRITE_STREAMS 4
+
+std::string GetWriteStreamString(WriteStream stream)
+{
+    switch (stream)
+    {
+        case WriteStream::HotData:
+            return "HotData";
+        case WriteStream::ColdData:
+            return "ColdData";
+        case WriteStream::Metadata:
+            return "Metadata";
+        case WriteStream::CleanerOutput:
+            return "CleanerOutput";
+        default:
+            std::cerr << "[GetWriteStreamString] unknown write stream: " << stream << std::endl;
+            throw;
+    }
+}
@@ -8,10 +8,12 @@
 #include "layers/fuse.hpp"
 
 IFuseLayer * fuseLayer;
+char * traceFile = NULL;
 
-void LFS_Start(char * flashFile, unsigned int cacheSize, unsigned int checkpointInterval, unsigned int cleaningStart, unsigned int cleaningEnd)
+void LFS_Start(char * flashFile, unsigned int cacheSize, unsigned int checkpointInterval, unsigned int cleaningStart, unsigned int cleaningEnd, unsigned int erasePoolSize, unsigned int wearLeveling, unsigned int checkpointAge, char * trace = NULL)
 {
-    fuseLayer = new FuseLayer(flashFile, cacheSize, checkpointInterval, cleaningStart, cleaningEnd);
+    traceFile = trace;
+    fuseLayer = new FuseLayer(flashFile, cacheSize, checkpointInterval, cleaningStart, cleaningEnd, erasePoolSize, wearLeveling, checkpointAge);
 }
 
 void * lfs_init(struct fuse_conn_info *conn)
@@ -22,109 +24,137 @@ void * lfs_init(struct fuse_conn_info *conn)
 void lfs_destroy(void * private_data)
 {
     delete fuseLayer;
+    PrintLatencyReport(std::cout);
+
+    // the trace rings are written out once the layers have shut down
+    if (traceFile != NULL && TraceDump(traceFile) != 0)
+    {
+        std::cerr << "[LFS] ERROR: Unable to write trace file " << traceFile << std::endl;
+    }
 }
 
 int lfs_statfs(const char* path, struct statvfs* stbuf)
 {
+    LatencyTimer timer(LatencyOp::FuseStatfs);
     return fuseLayer->Fuse_Statfs(path, stbuf);
 }
 
 int lfs_getattr(const char *path, struct stat *st)
 {
+    LatencyTimer timer(LatencyOp::FuseGetattr);
     return fuseLayer->Fuse_Getattr(path, st);
 }
 
 int lfs_readlink(const char* path, char* buf, size_t size)
 {
+    LatencyTimer timer(LatencyOp::FuseReadlink);
     return fuseLayer->Fuse_Readlink(path, buf, size);
 }
 
 int lfs_read(const char* path, char *buf, size_t size, off_t offset, struct fuse_file_info* fi)
 {
+    LatencyTimer timer(LatencyOp::FuseRead);
     return fuseLayer->Fuse_Read(path, buf, size, offset, fi);
 }
 
 int lfs_opendir(const char* path, struct fuse_file_info* fi)
 {
+    LatencyTimer timer(LatencyOp::FuseOpendir);
     return fuseLayer->Fuse_Opendir(path, fi);
 }
 
 int lfs_readdir(const char * path, void * buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info* fi)
 {
+    LatencyTimer timer(LatencyOp::FuseReaddir);
     return fuseLayer->Fuse_Readdir(path, buf, filler, offset, fi);
 }
 
 int lfs_releasedir(const char* path, struct fuse_file_info *fi)
 {
+    LatencyTimer timer(LatencyOp::FuseReleasedir);
     return fuseLayer->Fuse_Releasedir(path, fi);
 }
 
 int lfs_mkdir(const char* path, mode_t mode)
 {
+    LatencyTimer timer(LatencyOp::FuseMkdir);
     return fuseLayer->Fuse_Mkdir(path, mode);
 }
 
 int lfs_symlink(const char* to, const char* from)
 {
+    LatencyTimer timer(LatencyOp::FuseSymlink);
     return fuseLayer->Fuse_Symlink(to, from);
 }
 
 int lfs_unlink(const char* path)
 {
+    LatencyTimer timer(LatencyOp::FuseUnlink);
     return fuseLayer->Fuse_Unlink(path);
 }
 
 int lfs_rmdir(const char* path)
 {
+    LatencyTimer timer(LatencyOp::FuseRmdir);
     return fuseLayer->Fuse_Rmdir(path);
 }
 
 int lfs_rename(const char* from, const char* to)
 {
+    LatencyTimer timer(LatencyOp::FuseRename);
     return fuseLayer->Fuse_Rename(from, to);
 }
 
 int lfs_link(const char* from, const char* to)
 {
+    LatencyTimer timer(LatencyOp::FuseLink);
     return fuseLayer->Fuse_Link(from, to);
 }
 
 int lfs_chmod(const char* path, mode_t mode)
 {
+    LatencyTimer timer(LatencyOp::FuseChmod);
     return fuseLayer->Fuse_Chmod(path, mode);
 }
 
 int lfs_chown(const char* path, uid_t uid, gid_t gid)
 {
+    LatencyTimer timer(LatencyOp::FuseChown);
     return fuseLayer->Fuse_Chown(path, uid, gid);
 }
 
 int lfs_truncate(const char* path, off_t size)
 {
+    LatencyTimer timer(LatencyOp::FuseTruncate);
     return fuseLayer->Fuse_Truncate(path, size);
 }
 
 int lfs_create(const char* path, mode_t mode, struct fuse_file_info *fi)
 {
+    LatencyTimer timer(LatencyOp::FuseCreate);
     return fuseLayer->Fuse_Create(path, mode, fi);
 }
 
 int lfs_write(const char* path, const char *buf, size_t size, off_t offset, struct fuse_file_info* fi)
 {
+    LatencyTimer timer(LatencyOp::FuseWrite);
     return fuseLayer->Fuse_Write(path, buf, size, offset, fi);
 }
 
 int lfs_release(const char* path, struct fuse_file_info *fi)
 {
+    LatencyTimer timer(LatencyOp::FuseRelease);
     return fuseLayer->Fuse_Release(path, fi);
 }
 
 int lfs_access(const char * path, int mask)
 {
+    LatencyTimer timer(LatencyOp::FuseAccess);
     return fuseLayer->Fuse_Access(path, mask);
 }
 
 int lfs_open(const char* path, struct fuse_file_info* fi)
 {
+    LatencyTimer timer(LatencyOp::FuseOpen);
     return fuseLayer->Fuse_Open(path, fi);
 }
\ No newline at end of file
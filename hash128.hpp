@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// 128 bit MurmurHash3 (x64 variant) used to find blocks with identical contents. It is fast but
+// not cryptographic, so a match is always confirmed by comparing the blocks.
+
+typedef struct Hash128
+{
+	uint64_t low;
+	uint64_t high;
+
+	bool operator ==(const Hash128& rhs) const
+	{
+		return low == rhs.low && high == rhs.high;
+	}
+} Hash128;
+
+struct Hash128Hasher
+{
+	size_t operator ()(const Hash128& hash) const
+	{
+		return (size_t)(hash.low ^ hash.high);
+	}
+};
+
+uint64_t Rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+uint64_t FinalMix64(uint64_t k)
+{
+	k ^= k >> 33;
+	k *= 0xFF51AFD7ED558CCDULL;
+	k ^= k >> 33;
+	k *= 0xC4CEB9FE1A85EC53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+Hash128 ComputeHash128(const void * data, size_t length, uint32_t seed = 0)
+{
+	const unsigned char * bytes = (const unsigned char *)data;
+	const uint64_t c1           = 0x87C37B91114253D5ULL;
+	const uint64_t c2           = 0x4CF5AD432745937FULL;
+	uint64_t h1                 = seed;
+	uint64_t h2                 = seed;
+
+	size_t nBlocks = length / 16;
+	for (size_t i = 0; i < nBlocks; ++i)
+	{
+		uint64_t k1;
+		uint64_t k2;
+		memcpy(&k1, bytes + i * 16, sizeof(k1));
+		memcpy(&k2, bytes + i * 16 + 8, sizeof(k2));
+
+		k1 *= c1; k1 = Rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+		h1 = Rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52DCE729;
+
+		k2 *= c2; k2 = Rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+		h2 = Rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495AB5;
+	}
+
+	// tail bytes are folded in little endian order
+	const unsigned char * tail = bytes + nBlocks * 16;
+	uint64_t k1 = 0;
+	uint64_t k2 = 0;
+	for (size_t i = length & 15; i > 8; --i)
+	{
+		k2 ^= (uint64_t)tail[i - 1] << ((i - 9) * 8);
+	}
+
+	for (size_t i = (length & 15) < 8 ? (length & 15) : 8; i > 0; --i)
+	{
+		k1 ^= (uint64_t)tail[i - 1] << ((i - 1) * 8);
+	}
+
+	if ((length & 15) > 8)
+	{
+		k2 *= c2; k2 = Rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+	}
+
+	if ((length & 15) > 0)
+	{
+		k1 *= c1; k1 = Rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+	}
+
+	h1 ^= length;
+	h2 ^= length;
+	h1 += h2;
+	h2 += h1;
+	h1 = FinalMix64(h1);
+	h2 = FinalMix64(h2);
+	h1 += h2;
+	h2 += h1;
+
+	Hash128 hash = { .low = h1, .high = h2 };
+	return hash;
+}
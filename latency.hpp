@@ -0,0 +1,274 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
+#include <ostream>
+
+// Latency histograms for the entry points of every layer.
+//
+// Each operation has a histogram of log linear buckets in the style of HdrHistogram: values below
+// LATENCY_SUB_BUCKETS nanoseconds get a bucket each and every power of two above that is split into
+// LATENCY_SUB_BUCKETS buckets, so a bucket is within 1/16 of the values it holds from nanoseconds up
+// to hours. Buckets and totals are relaxed atomic counters, so recording takes no locks and the
+// histograms can be read while the file system is running.
+
+#define LATENCY_SUB_BUCKET_BITS 4
+#define LATENCY_SUB_BUCKETS     (1 << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_BUCKETS         ((64 - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+// the operations that are timed and the names they are reported under
+#define LATENCY_OPS(OP) \
+	OP(FuseGetattr,               "lfs_getattr") \
+	OP(FuseReadlink,              "lfs_readlink") \
+	OP(FuseMkdir,                 "lfs_mkdir") \
+	OP(FuseUnlink,                "lfs_unlink") \
+	OP(FuseRmdir,                 "lfs_rmdir") \
+	OP(FuseSymlink,               "lfs_symlink") \
+	OP(FuseRename,                "lfs_rename") \
+	OP(FuseLink,                  "lfs_link") \
+	OP(FuseChmod,                 "lfs_chmod") \
+	OP(FuseChown,                 "lfs_chown") \
+	OP(FuseTruncate,              "lfs_truncate") \
+	OP(FuseOpen,                  "lfs_open") \
+	OP(FuseRead,                  "lfs_read") \
+	OP(FuseWrite,                 "lfs_write") \
+	OP(FuseStatfs,                "lfs_statfs") \
+	OP(FuseRelease,               "lfs_release") \
+	OP(FuseOpendir,               "lfs_opendir") \
+	OP(FuseReaddir,               "lfs_readdir") \
+	OP(FuseReleasedir,            "lfs_releasedir") \
+	OP(FuseAccess,                "lfs_access") \
+	OP(FuseCreate,                "lfs_create") \
+	OP(DirectoryStatfs,           "Directory_Statfs") \
+	OP(DirectoryMkdir,            "Directory_Mkdir") \
+	OP(DirectoryReaddir,          "Directory_Readdir") \
+	OP(DirectoryCreate,           "Directory_Create") \
+	OP(DirectoryRead,             "Directory_Read") \
+	OP(DirectoryWrite,            "Directory_Write") \
+	OP(DirectoryGetAttr,          "Directory_GetAttr") \
+	OP(DirectoryExists,           "Directory_Exists") \
+	OP(DirectoryTruncate,         "Directory_Truncate") \
+	OP(DirectorySeek,             "Directory_Seek") \
+	OP(DirectoryChmod,            "Directory_Chmod") \
+	OP(DirectoryChown,            "Directory_Chown") \
+	OP(DirectoryLink,             "Directory_Link") \
+	OP(DirectorySymlink,          "Directory_Symlink") \
+	OP(DirectoryReadlink,         "Directory_Readlink") \
+	OP(DirectoryUnlink,           "Directory_Unlink") \
+	OP(DirectoryRmdir,            "Directory_Rmdir") \
+	OP(DirectoryRename,           "Directory_Rename") \
+	OP(DirectoryCheckPermissions, "Directory_CheckPermissions") \
+	OP(DirectoryLookup,           "path lookup") \
+	OP(FileStatfs,                "File_Statfs") \
+	OP(FileCreate,                "File_Create") \
+	OP(FileWrite,                 "File_Write") \
+	OP(FileRead,                  "File_Read") \
+	OP(FileTruncate,              "File_Truncate") \
+	OP(FileSeek,                  "File_Seek") \
+	OP(FileFree,                  "File_Free") \
+	OP(FileGetAttr,               "File_GetAttr") \
+	OP(FileChmod,                 "File_Chmod") \
+	OP(FileChown,                 "File_Chown") \
+	OP(FileAddLink,               "File_AddLink") \
+	OP(FileRemoveLink,            "File_RemoveLink") \
+	OP(FileGetFileType,           "File_GetFileType") \
+	OP(CleanerCheck,              "cleaner check") \
+	OP(CleanerPass,               "cleaning pass") \
+	OP(CleanerSegment,            "segment evacuation") \
+	OP(LogRead,                   "Log_Read") \
+	OP(LogWrite,                  "Log_Write") \
+	OP(LogFree,                   "Log_Free") \
+	OP(LogReadSegment,            "segment read (cache miss)") \
+	OP(LogWriteSegment,           "segment flush") \
+	OP(LogEraseSegment,           "segment erase") \
+	OP(LogCheckpoint,             "checkpoint")
+
+#define LATENCY_OP_ENUM(name, label) name,
+#define LATENCY_OP_LABEL(name, label) label,
+
+enum class LatencyOp : uint16_t
+{
+	LATENCY_OPS(LATENCY_OP_ENUM)
+	Count
+};
+
+const char * latencyOpLabels[] = { LATENCY_OPS(LATENCY_OP_LABEL) };
+
+struct LatencyHistogram
+{
+	std::atomic<uint64_t> count;
+	std::atomic<uint64_t> totalNanos;
+	std::atomic<uint64_t> maxNanos;
+	std::atomic<uint64_t> buckets[LATENCY_BUCKETS];
+};
+
+// static storage so every counter starts at zero
+LatencyHistogram latencyHistograms[(int)LatencyOp::Count];
+
+const char * GetLatencyOpLabel(LatencyOp op)
+{
+	return latencyOpLabels[(int)op];
+}
+
+unsigned int GetLatencyBucket(uint64_t nanos)
+{
+	if (nanos < LATENCY_SUB_BUCKETS)
+	{
+		return nanos;
+	}
+
+	unsigned int magnitude = 63 - __builtin_clzll(nanos);
+	unsigned int shift     = magnitude - LATENCY_SUB_BUCKET_BITS;
+	unsigned int subBucket = (nanos >> shift) & (LATENCY_SUB_BUCKETS - 1);
+	return (shift + 1) * LATENCY_SUB_BUCKETS + subBucket;
+}
+
+// the largest value that falls in a bucket
+uint64_t GetLatencyBucketLimit(unsigned int bucket)
+{
+	if (bucket < LATENCY_SUB_BUCKETS)
+	{
+		return bucket;
+	}
+
+	unsigned int shift     = bucket / LATENCY_SUB_BUCKETS - 1;
+	unsigned int subBucket = bucket % LATENCY_SUB_BUCKETS;
+	uint64_t lowest        = (uint64_t)(LATENCY_SUB_BUCKETS + subBucket) << shift;
+	return lowest + ((uint64_t)1 << shift) - 1;
+}
+
+uint64_t LatencyNow()
+{
+	struct timespec spec;
+	clock_gettime(CLOCK_MONOTONIC, &spec);
+	return (uint64_t)spec.tv_sec * 1000000000ULL + (uint64_t)spec.tv_nsec;
+}
+
+void RecordLatency(LatencyOp op, uint64_t nanos)
+{
+	LatencyHistogram& histogram = latencyHistograms[(int)op];
+	histogram.count.fetch_add(1, std::memory_order_relaxed);
+	histogram.totalNanos.fetch_add(nanos, std::memory_order_relaxed);
+	histogram.buckets[GetLatencyBucket(nanos)].fetch_add(1, std::memory_order_relaxed);
+
+	uint64_t max = histogram.maxNanos.load(std::memory_order_relaxed);
+	while (nanos > max && !histogram.maxNanos.compare_exchange_weak(max, nanos, std::memory_order_relaxed))
+	{
+	}
+}
+
+// times the scope it is declared in
+class LatencyTimer
+{
+private:
+	LatencyOp op;
+	uint64_t start;
+
+public:
+	LatencyTimer(LatencyOp latencyOp) :
+		op(latencyOp),
+		start(LatencyNow())
+	{
+	}
+
+	~LatencyTimer()
+	{
+		RecordLatency(op, LatencyNow() - start);
+	}
+};
+
+uint64_t GetLatencyCount(LatencyOp op)
+{
+	return latencyHistograms[(int)op].count.load(std::memory_order_relaxed);
+}
+
+uint64_t GetLatencyMax(LatencyOp op)
+{
+	return latencyHistograms[(int)op].maxNanos.load(std::memory_order_relaxed);
+}
+
+uint64_t GetLatencyMean(LatencyOp op)
+{
+	uint64_t count = GetLatencyCount(op);
+	return count == 0 ? 0 : latencyHistograms[(int)op].totalNanos.load(std::memory_order_relaxed) / count;
+}
+
+// the bucket limit at or below which percentile percent of the recorded latencies fall
+uint64_t GetLatencyPercentile(LatencyOp op, double percentile)
+{
+	LatencyHistogram& histogram = latencyHistograms[(int)op];
+	uint64_t counts[LATENCY_BUCKETS];
+	uint64_t total = 0;
+	for (unsigned int bucket = 0; bucket < LATENCY_BUCKETS; ++bucket)
+	{
+		counts[bucket]  = histogram.buckets[bucket].load(std::memory_order_relaxed);
+		total          += counts[bucket];
+	}
+
+	if (total == 0)
+	{
+		return 0;
+	}
+
+	uint64_t rank = (uint64_t)(percentile / 100.0 * total + 0.5);
+	rank          = rank == 0 ? 1 : rank;
+
+	uint64_t seen = 0;
+	for (unsigned int bucket = 0; bucket < LATENCY_BUCKETS; ++bucket)
+	{
+		seen += counts[bucket];
+		if (seen >= rank)
+		{
+			return std::min(GetLatencyBucketLimit(bucket), GetLatencyMax(op));
+		}
+	}
+
+	return GetLatencyMax(op);
+}
+
+void ResetLatencyHistograms()
+{
+	for (LatencyHistogram& histogram : latencyHistograms)
+	{
+		histogram.count.store(0, std::memory_order_relaxed);
+		histogram.totalNanos.store(0, std::memory_order_relaxed);
+		histogram.maxNanos.store(0, std::memory_order_relaxed);
+		for (std::atomic<uint64_t>& bucket : histogram.buckets)
+		{
+			bucket.store(0, std::memory_order_relaxed);
+		}
+	}
+}
+
+// one line per operation that has run, in microseconds
+void PrintLatencyReport(std::ostream& out)
+{
+	out << std::left << std::setw(28) << "operation" << std::right
+	    << std::setw(10) << "count" << std::setw(12) << "mean us" << std::setw(12) << "p50 us"
+	    << std::setw(12) << "p90 us" << std::setw(12) << "p99 us" << std::setw(12) << "p99.9 us"
+	    << std::setw(12) << "max us" << std::endl;
+
+	out << std::fixed << std::setprecision(1);
+	for (int i = 0; i < (int)LatencyOp::Count; ++i)
+	{
+		LatencyOp op = (LatencyOp)i;
+		if (GetLatencyCount(op) == 0)
+		{
+			continue;
+		}
+
+		out << std::left << std::setw(28) << GetLatencyOpLabel(op) << std::right
+		    << std::setw(10) << GetLatencyCount(op)
+		    << std::setw(12) << GetLatencyMean(op) / 1000.0
+		    << std::setw(12) << GetLatencyPercentile(op, 50) / 1000.0
+		    << std::setw(12) << GetLatencyPercentile(op, 90) / 1000.0
+		    << std::setw(12) << GetLatencyPercentile(op, 99) / 1000.0
+		    << std::setw(12) << GetLatencyPercentile(op, 99.9) / 1000.0
+		    << std::setw(12) << GetLatencyMax(op) / 1000.0 << std::endl;
+	}
+
+	out.unsetf(std::ios_base::floatfield);
+}
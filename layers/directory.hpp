@@ -11,9 +11,11 @@
 #include <iostream>
 #include <cstdlib>
 #include <string>
+#include <functional>
 #include "file.hpp"
 #include "../data_structures/directory_list.hpp"
 #include "../data_structures/file_type.hpp"
+#include "../data_structures/lock_table.hpp"
 
 
 class IDirectoryLayer 
@@ -30,6 +32,7 @@ public:
 	virtual int Directory_GetAttr(const char * path, struct stat *stbuf) = 0;
 	virtual int Directory_Exists(const char * path) = 0;
 	virtual int Directory_Truncate(const char * path, unsigned int size) = 0;
+	virtual int Directory_Seek(const char * path, unsigned int offset, int whence, unsigned int * result) = 0;
 	virtual int Directory_Chmod(const char * path, mode_t mode) = 0;
 	virtual int Directory_Chown(const char * path, uid_t uid, gid_t gid) = 0;
 	virtual int Directory_Link(const char * from, const char * to) = 0;
@@ -39,6 +42,9 @@ public:
 	virtual int Directory_Rmdir(const char * path) = 0;
 	virtual int Directory_Rename(const char * from, const char * to) = 0;
 	virtual int Directory_CheckPermissions(const char * path, int flags) = 0;
+	virtual void Directory_GetStats(LfsStats * stats) = 0;
+	virtual void Directory_GetTunables(LfsTunables * tunables) = 0;
+	virtual int Directory_SetTunables(LfsTunables tunables) = 0;
 };
 
 class DirectoryLayer : public IDirectoryLayer
@@ -46,10 +52,15 @@ class DirectoryLayer : public IDirectoryLayer
 private:
 	IFileLayer * fileLayer;
 
+	// a directory list is read with two file reads and rewritten whole, so lookups hold the lock of each
+	// directory they read shared and changes to a directory hold its lock exclusively. paths are looked
+	// up before any lock is held exclusively
+	LockTable    directoryLocks;
+
 public:
-	DirectoryLayer(char * flashFile, unsigned int cacheSize, unsigned int checkpointInterval, unsigned int cleaningStart, unsigned int cleaningEnd)
+	DirectoryLayer(char * flashFile, unsigned int cacheSize, unsigned int checkpointInterval, unsigned int cleaningStart, unsigned int cleaningEnd, unsigned int erasePoolSize = 4, unsigned int wearLeveling = 0, unsigned int checkpointAge = 0)
 	{
-    	fileLayer = new FileLayer(flashFile, cacheSize, checkpointInterval, cleaningStart, cleaningEnd);
+    	fileLayer = new FileLayer(flashFile, cacheSize, checkpointInterval, cleaningStart, cleaningEnd, erasePoolSize, wearLeveling, checkpointAge);
 	}
 
 	~DirectoryLayer()
@@ -66,6 +77,7 @@ public:
 
 	int Directory_Statfs(struct statvfs* stbuf)
 	{
+		LatencyTimer timer(LatencyOp::DirectoryStatfs);
 		fileLayer->RunCleaner();
 	    stbuf->f_namemax = MAX_FILE_NAME_LENGTH; /* maximum filename length */
 		return fileLayer->File_Statfs(stbuf);
@@ -73,25 +85,18 @@ public:
 
 	int Directory_Mkdir(const char * path, mode_t mode)
 	{
-		std::cout << "[DirectoryLayer] Creating new directory: " << path << std::endl;
+		LatencyTimer timer(LatencyOp::DirectoryMkdir);
+		TRACE_INFO(DirectoryMkdir, mode);
 		fileLayer->RunCleaner();
 
     	unsigned int directoryINum;
-		if (CreateFile(path, FileType::Directory, mode, &directoryINum) != 0)
-		{
-			return 1;
-		}
-
-		const char * directoryName = GetLastPathElement(path).c_str();
-		DirectoryList * directory  = new DirectoryList(directoryName, directoryINum);
-		WriteDirectory(directory);
-    	FreeDirectory(directory);
-		return 0;
+		return CreateFile(path, FileType::Directory, mode, &directoryINum);
 	}
 
     int Directory_Readdir(const char * path, char ** files[], unsigned int * numFiles)
     {
-    	std::cout << "[DirectoryLayer] Getting Directory: " << path << std::endl;
+		LatencyTimer timer(LatencyOp::DirectoryReaddir);
+    	TRACE_INFO(DirectoryReaddir);
 		fileLayer->RunCleaner();
 
     	unsigned int directoryINum = GetINum(path);
@@ -100,7 +105,7 @@ public:
     		return -ENOENT;
     	}
 
-    	DirectoryList * directory = ReadDirectory(directoryINum);
+    	DirectoryList * directory = LookupDirectory(directoryINum);
     	if (directory == NULL)
     	{
     		return -EIO;
@@ -124,7 +129,8 @@ public:
 
 	int Directory_Create(const char * path, mode_t mode)
 	{
-		std::cout << "[DirectoryLayer] Creating new file: " << path << std::endl;
+		LatencyTimer timer(LatencyOp::DirectoryCreate);
+		TRACE_INFO(DirectoryCreate, mode);
 		fileLayer->RunCleaner();
 
  		unsigned int inumOut;
@@ -133,8 +139,8 @@ public:
 
 	int Directory_Read(const char * path, unsigned int offset, unsigned int size, char * buffer)
     {
-    	std::cout << "[DirectoryLayer] Reading Directory Path: " << path << std::endl;
-    	std::cout << "[DirectoryLayer] offset: " << offset << " size: " << size << std::endl;
+		LatencyTimer timer(LatencyOp::DirectoryRead);
+    	TRACE_INFO(DirectoryRead, offset, size);
 		fileLayer->RunCleaner();
 
     	unsigned int inum = GetINum(path);
@@ -155,8 +161,8 @@ public:
 
 	int Directory_Write(const char * path, unsigned int offset, unsigned int size, const char * buffer)
 	{
-    	std::cout << "[DirectoryLayer] Writing Directory: " << path << std::endl;
-    	std::cout << "[DirectoryLayer] offset: " << offset << " size: " << size << std::endl;
+		LatencyTimer timer(LatencyOp::DirectoryWrite);
+    	TRACE_INFO(DirectoryWrite, offset, size);
 		fileLayer->RunCleaner();
 
     	unsigned int inum = GetINum(path);
@@ -183,7 +189,8 @@ public:
 
 	int Directory_GetAttr(const char * path, struct stat * stbuf)
 	{
-    	std::cout << "[DirectoryLayer] Directory_GetAttr: " << path << std::endl;
+		LatencyTimer timer(LatencyOp::DirectoryGetAttr);
+    	TRACE_INFO(DirectoryGetAttr);
 		fileLayer->RunCleaner();
 
     	memset(stbuf, 0, sizeof(struct stat));
@@ -199,13 +206,15 @@ public:
 
 	int Directory_Exists(const char * path)
 	{
+		LatencyTimer timer(LatencyOp::DirectoryExists);
 		fileLayer->RunCleaner();
 		return GetINum(path) != INUM_NOT_FOUND ? 0 : -ENOENT;
 	}
 
 	int Directory_Truncate(const char * path, unsigned int size)
 	{
-    	std::cout << "[DirectoryLayer] Directory_Truncate path: " << path << " size: " << size << std::endl;
+		LatencyTimer timer(LatencyOp::DirectoryTruncate);
+    	TRACE_INFO(DirectoryTruncate, size);
 		fileLayer->RunCleaner();
 
 		unsigned int inum = GetINum(path);
@@ -218,9 +227,25 @@ public:
 		return fileLayer->File_Truncate(inum, size);
 	}
 
+	int Directory_Seek(const char * path, unsigned int offset, int whence, unsigned int * result)
+	{
+		LatencyTimer timer(LatencyOp::DirectorySeek);
+    	TRACE_INFO(DirectorySeek, offset, whence);
+		fileLayer->RunCleaner();
+
+		unsigned int inum = GetINum(path);
+		if (inum == INUM_NOT_FOUND)
+		{
+			return -ENOENT;
+		}
+
+		return fileLayer->File_Seek(inum, offset, whence, result);
+	}
+
 	int Directory_Chmod(const char * path, mode_t mode)
 	{
-    	std::cout << "[DirectoryLayer] Directory_Chmod path: " << path << " mode: " << mode << std::endl;
+		LatencyTimer timer(LatencyOp::DirectoryChmod);
+    	TRACE_INFO(DirectoryChmod, mode);
 		fileLayer->RunCleaner();
 
 		unsigned int inum = GetINum(path);
@@ -234,7 +259,8 @@ public:
 
 	int Directory_Chown(const char * path, uid_t uid, gid_t gid)
 	{
-    	std::cout << "[DirectoryLayer] Directory_Chown path: " << path << " uid: " << uid << " gid: " << gid << std::endl;
+		LatencyTimer timer(LatencyOp::DirectoryChown);
+    	TRACE_INFO(DirectoryChown, uid, gid);
 		fileLayer->RunCleaner();
 
 		unsigned int inum = GetINum(path);
@@ -248,8 +274,9 @@ public:
 
 	int Directory_Link(const char * from, const char * to)
 	{
+		LatencyTimer timer(LatencyOp::DirectoryLink);
 		// get inum of from
-		std::cout << "[DirectoryLayer] Hard Linking from: " << from << " to: " << to << std::endl;
+		TRACE_INFO(DirectoryLink);
 		fileLayer->RunCleaner();
 
 		unsigned int fromINum = GetINum(from);
@@ -270,22 +297,13 @@ public:
     		return -ENOENT;
     	}
 
-    	DirectoryList * toDirectory = ReadDirectory(toDirectoryINum);
-    	if (toDirectory == NULL)
-    	{
-    		return -EIO;
-    	}
-
-    	toDirectory->AddFile(toFileName, fromINum);
-
-    	if (WriteDirectory(toDirectory) != 0)
+    	int ret = AddDirectoryEntry(toDirectoryINum, toFileName, fromINum);
+    	if (ret != 0)
     	{
 			std::cerr << "[DirectoryLayer] Directory_Link ERROR: writeDirectory failed" << std::endl;
-    		return 1;
+    		return ret;
     	}
 
-    	FreeDirectory(toDirectory);
-
 		// update inode of inums hardlinks
     	fileLayer->File_AddLink(fromINum);
 		return 0;
@@ -293,8 +311,9 @@ public:
 
 	int Directory_Symlink(const char * to, const char * from)
 	{
+		LatencyTimer timer(LatencyOp::DirectorySymlink);
 		// symlink named 'from' evaluated to 'to'
-		std::cout << "[DirectoryLayer] Soft Linking to: " << to << " from: " << from << std::endl;
+		TRACE_INFO(DirectorySymlink);
 		fileLayer->RunCleaner();
     	
     	unsigned int symlinkINum;
@@ -308,7 +327,8 @@ public:
 
 	int Directory_Readlink(const char * path, char * buf, size_t size)
 	{
-		std::cout << "[DirectoryLayer] Reading link: " << path << " size: " << size << std::endl;
+		LatencyTimer timer(LatencyOp::DirectoryReadlink);
+		TRACE_INFO(DirectoryReadLink, size);
 		fileLayer->RunCleaner();
 
 		return Directory_Read(path, 0, size, buf);
@@ -316,7 +336,8 @@ public:
 
 	int Directory_Unlink(const char * path)
 	{
-		std::cout << "[DirectoryLayer] Unlinking: " << path << std::endl;
+		LatencyTimer timer(LatencyOp::DirectoryUnlink);
+		TRACE_INFO(DirectoryUnlink);
 		fileLayer->RunCleaner();
 
 		unsigned int inum = GetINum(path);
@@ -336,22 +357,18 @@ public:
     		return -ENOENT;
     	}
 
-    	DirectoryList * directory = ReadDirectory(linkDirectoryINum);
-    	if (directory == NULL || strcmp(linkName, ".") == 0 || strcmp(linkName, "..") == 0)
+    	if (strcmp(linkName, ".") == 0 || strcmp(linkName, "..") == 0)
     	{
     		return -EIO;
     	}
 
-    	directory->RemoveFile(linkName);
-
-    	if (WriteDirectory(directory) != 0)
+    	int ret = RemoveDirectoryEntry(linkDirectoryINum, linkName);
+    	if (ret != 0)
     	{
 			std::cerr << "[DirectoryLayer] Directory_Unlink ERROR: writeDirectory failed" << std::endl;
-    		return 1;
+    		return ret;
     	}
 
-    	FreeDirectory(directory);
-
     	if (fileLayer->File_GetFileType(inum) == FileType::Symlink)
     	{
     		return fileLayer->File_Free(inum);
@@ -362,7 +379,8 @@ public:
 
 	int Directory_Rmdir(const char * path)
 	{
-		std::cout << "[DirectoryLayer] Removing Directory: " << path << std::endl;
+		LatencyTimer timer(LatencyOp::DirectoryRmdir);
+		TRACE_INFO(DirectoryRemove);
 		fileLayer->RunCleaner();
 
 		unsigned int inum = GetINum(path);
@@ -372,13 +390,15 @@ public:
 			return -ENOENT;
 		}
 
-		DirectoryList * directory = ReadDirectory(inum);
+		DirectoryList * directory = LookupDirectory(inum);
 		if (directory == NULL)
 		{
 			return -EIO;
 		}
 
-		if (!directory->IsEmpty())
+		bool empty = directory->IsEmpty();
+		FreeDirectory(directory);
+		if (!empty)
 		{
 			std::cerr << "[DirectoryLayer] Directory_Rmdir Directory not empty: " << path << std::endl;
 			return -ENOTEMPTY;
@@ -390,10 +410,10 @@ public:
 
 	int Directory_Rename(const char * from, const char * to)
 	{
+		LatencyTimer timer(LatencyOp::DirectoryRename);
 		unsigned int fromINum = GetINum(from);
 		fileLayer->RunCleaner();
 
-		// remove old 'from' dir entry
 		std::string fromFileNameStr      = GetLastPathElement(from);
 		std::string fromDirectoryPathStr = GetDirectoryPath(from);
 		const char * fromFileName        = fromFileNameStr.c_str();
@@ -406,24 +426,6 @@ public:
     		return 1;
     	}
 
-    	DirectoryList * fromDirectory = ReadDirectory(fromDirectoryINum);
-    	if (fromDirectory == NULL || strcmp(fromFileName, ".") == 0 || strcmp(fromFileName, "..") == 0)
-    	{
-    		std::cerr << "[DirectoryLayer] Directory_Rename ERROR: Directory " << fromDirectoryPath << " read failed" << std::endl;
-    		return 1;
-    	}
-
-    	fromDirectory->RemoveFile(fromFileName);
-
-    	if (WriteDirectory(fromDirectory) != 0)
-    	{
-			std::cerr << "[DirectoryLayer] Directory_Unlink ERROR: writeDirectory failed" << std::endl;
-    		return 1;
-    	}
-
-    	FreeDirectory(fromDirectory);
-
-    	// add new 'to' entry
     	std::string toFileNameStr      = GetLastPathElement(to);
 		std::string toDirectoryPathStr = GetDirectoryPath(to);
 		const char * toFileName        = toFileNameStr.c_str();
@@ -436,28 +438,51 @@ public:
     		return 1;
     	}
 
-    	DirectoryList * toDirectory = ReadDirectory(toDirectoryINum);
-    	if (toDirectory == NULL|| strcmp(toFileName, ".") == 0 || strcmp(toFileName, "..") == 0)
+    	if (strcmp(fromFileName, ".") == 0 || strcmp(fromFileName, "..") == 0 || strcmp(toFileName, ".") == 0 || strcmp(toFileName, "..") == 0)
     	{
-    		std::cerr << "[DirectoryLayer] Directory_Rename ERROR: Directory " << toDirectoryPath << " read failed" << std::endl;
+    		std::cerr << "[DirectoryLayer] Directory_Rename ERROR: Cannot rename " << from << " to " << to << std::endl;
     		return 1;
     	}
 
-    	toDirectory->AddFile(toFileName, fromINum);
+    	// both directories are locked so no lookup sees the file in neither or both of them
+    	auto directoryLocksHeld = directoryLocks.lockAll({ fromDirectoryINum, toDirectoryINum });
 
-    	if (WriteDirectory(toDirectory) != 0)
+    	// remove old 'from' dir entry
+    	if (UpdateDirectory(fromDirectoryINum, [fromFileName](DirectoryList * directory) { directory->RemoveFile(fromFileName); }) != 0)
     	{
-			std::cerr << "[DirectoryLayer] Directory_Unlink ERROR: writeDirectory failed" << std::endl;
+			std::cerr << "[DirectoryLayer] Directory_Rename ERROR: Directory " << fromDirectoryPath << " update failed" << std::endl;
+    		return 1;
+    	}
+
+    	// add new 'to' entry
+    	if (UpdateDirectory(toDirectoryINum, [toFileName, fromINum](DirectoryList * directory) { directory->AddFile(toFileName, fromINum); }) != 0)
+    	{
+			std::cerr << "[DirectoryLayer] Directory_Rename ERROR: Directory " << toDirectoryPath << " update failed" << std::endl;
     		return 1;
     	}
 
-    	FreeDirectory(toDirectory);
     	return 0;
 	}
 
+	void Directory_GetStats(LfsStats * stats)
+	{
+		fileLayer->File_GetStats(stats);
+	}
+
+	void Directory_GetTunables(LfsTunables * tunables)
+	{
+		fileLayer->File_GetTunables(tunables);
+	}
+
+	int Directory_SetTunables(LfsTunables tunables)
+	{
+		return fileLayer->File_SetTunables(tunables);
+	}
+
 	int Directory_CheckPermissions(const char * path, int flags)
 	{
-		std::cout << "[DirectoryLayer] Checking permissions: " << path << std::endl;
+		LatencyTimer timer(LatencyOp::DirectoryCheckPermissions);
+		TRACE_INFO(DirectoryCheckAccess);
 		fileLayer->RunCleaner();
 
 		struct stat stbuf; memset(&stbuf, 0, sizeof(struct stat));
@@ -528,6 +553,7 @@ public:
 private:
 	unsigned int GetINum(const char * path)
 	{
+		LatencyTimer timer(LatencyOp::DirectoryLookup);
 		unsigned int pathLen   = strlen(path) + 1;
 		char * pathCopy        = (char *) malloc(pathLen);
 
@@ -542,7 +568,7 @@ private:
     		return ROOT_DIRECTORY_INUM;
     	}
 
-		DirectoryList * currDir = ReadDirectory(ROOT_DIRECTORY_INUM); 
+		DirectoryList * currDir = LookupDirectory(ROOT_DIRECTORY_INUM); 
 
 		while (currToken != NULL)
     	{
@@ -557,13 +583,13 @@ private:
 
         	if (nextToken == NULL)
         	{
-    			std::cout << "[DirectoryLayer] Found INum for path " << path << " : " << nextINum << std::endl;
+    			TRACE_DEBUG(DirectoryFindINum, nextINum);
         		FreeDirectory(currDir);
         		return nextINum;
         	}
 
         	FreeDirectory(currDir);
-        	currDir = ReadDirectory(nextINum);
+        	currDir = LookupDirectory(nextINum);
         	if (currDir == NULL)
         	{
 				std::cerr << "[DirectoryLayer] ERROR GetINum(): Unable to read directory " << currToken << std::endl;
@@ -576,9 +602,17 @@ private:
     	return INUM_NOT_FOUND;
 	}
 
+	// reads a directory list without holding its lock across the lookup that follows
+	DirectoryList * LookupDirectory(unsigned int inum)
+	{
+		std::shared_lock<std::shared_mutex> directoryLock(directoryLocks.get(inum));
+		return ReadDirectory(inum);
+	}
+
+	// the caller holds the lock of the directory
 	DirectoryList * ReadDirectory(unsigned int inum)
 	{
-    	std::cout << "[DirectoryLayer] Reading directory with INum " << inum << std::endl;
+    	TRACE_DEBUG(DirectoryReadList, inum);
     	FileType fileType = fileLayer->File_GetFileType(inum);
     	switch(fileType)
     	{
@@ -620,7 +654,7 @@ private:
 
 	int WriteDirectory(DirectoryList * directory)
 	{
-    	std::cout << "[DirectoryLayer] Writing directory " << directory->directoryNameINumPair.name << std::endl;
+    	TRACE_DEBUG(DirectoryWriteList, directory->directoryNameINumPair.inum);
 
 		unsigned int inum      = directory->directoryNameINumPair.inum;
 		unsigned int byteSize  = sizeof(DirectoryList) + directory->size * sizeof(DirectoryEntry);
@@ -646,6 +680,33 @@ private:
 		free(directory);
 	}
 
+	// reads, changes and rewrites a directory list. the caller holds the lock of the directory
+	int UpdateDirectory(unsigned int inum, std::function<void(DirectoryList *)> update)
+	{
+		DirectoryList * directory = ReadDirectory(inum);
+		if (directory == NULL)
+		{
+			return -EIO;
+		}
+
+		update(directory);
+		int ret = WriteDirectory(directory);
+		FreeDirectory(directory);
+		return ret;
+	}
+
+	int AddDirectoryEntry(unsigned int directoryINum, const char * fileName, unsigned int inum)
+	{
+		std::unique_lock<std::shared_mutex> directoryLock(directoryLocks.get(directoryINum));
+		return UpdateDirectory(directoryINum, [fileName, inum](DirectoryList * directory) { directory->AddFile(fileName, inum); });
+	}
+
+	int RemoveDirectoryEntry(unsigned int directoryINum, const char * fileName)
+	{
+		std::unique_lock<std::shared_mutex> directoryLock(directoryLocks.get(directoryINum));
+		return UpdateDirectory(directoryINum, [fileName](DirectoryList * directory) { directory->RemoveFile(fileName); });
+	}
+
 	int CreateFile(const char * path, FileType fileType, mode_t mode, unsigned int * inumOut)
 	{
 		std::string fileNameStr      = GetLastPathElement(path);
@@ -659,13 +720,6 @@ private:
     		return 1;
     	}
 
-    	unsigned int fileInum;
-    	if (fileLayer->File_Create(fileType, mode, &fileInum) != 0)
-    	{
-    		std::cerr << "[DirectoryLayer] CreateFile ERROR: File_Create failed" << std::endl;
-    		return 1;
-    	}
-
     	unsigned int directoryINum = GetINum(directoryPath);
     	if (directoryINum == INUM_NOT_FOUND)
     	{
@@ -673,22 +727,31 @@ private:
     		return 1;
     	}
 
-    	DirectoryList * directory = ReadDirectory(directoryINum);
-    	if (directory == NULL)
+    	unsigned int fileInum;
+    	if (fileLayer->File_Create(fileType, mode, &fileInum) != 0)
     	{
-    		std::cerr << "[DirectoryLayer] CreateFile ERROR: Directory " << path << " read failed" << std::endl;
+    		std::cerr << "[DirectoryLayer] CreateFile ERROR: File_Create failed" << std::endl;
     		return 1;
     	}
-    	
-    	directory->AddFile(fileName, fileInum);
 
-    	if (WriteDirectory(directory) != 0)
+    	// a new directory gets its list before lookups can find it
+    	if (fileType == FileType::Directory)
+    	{
+			DirectoryList * newDirectory = new DirectoryList(fileName, fileInum);
+			int ret                      = WriteDirectory(newDirectory);
+	    	FreeDirectory(newDirectory);
+	    	if (ret != 0)
+	    	{
+	    		return 1;
+	    	}
+    	}
+
+    	if (AddDirectoryEntry(directoryINum, fileName, fileInum) != 0)
     	{
 			std::cerr << "[DirectoryLayer] CreateFile ERROR: writeDirectory failed" << std::endl;
     		return 1;
     	}
 
-    	FreeDirectory(directory);
     	*inumOut = fileInum;
 		return 0;
 	}
@@ -5,13 +5,91 @@
 #include <cstdlib>
 #include <cstring>
 #include <tuple>
+#include <map>
+#include <set>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
 #include <unistd.h>
+#include <errno.h>
 #include <sys/statvfs.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include "../layers/log.hpp"
 #include "../data_structures/inode.hpp"
+#include "../data_structures/block_map.hpp"
+#include "../data_structures/extent.hpp"
 #include "../data_structures/log_address.hpp"
+#include "../data_structures/lock_table.hpp"
+
+#define INODE_CACHE_SIZE 1024 // inodes. dirty inodes are written back once half of the cache is dirty
+
+#define BLOCK_MAP_CACHE_SIZE 1024 // decoded block map nodes
+
+#define EXTENT_CACHE_SIZE 64 // decoded extent lists
+
+#define MIN_AVERAGE_EXTENT_LENGTH 4 // blocks. a file with more than a block of shorter extents goes back to a block map
+
+// an inode in the inode cache. dirty inodes have changed since they were last written to the ifile
+struct CachedINode
+{
+	INode inode;
+	bool  dirty;
+};
+
+// a block map node decoded, with the log address it was read from or written to. a new copy of a
+// node always goes to a new address, so an entry is current while its parent points at it
+struct CachedBlockMap
+{
+	LogAddress              address;
+	std::vector<LogAddress> blocks;
+};
+
+// a block map node loaded by one read or write. changes are made to the entries and the dirty
+// nodes are written together by WriteBlockMap
+struct BlockMapNode
+{
+	LogAddress              address;
+	std::vector<LogAddress> entries;
+	bool                    dirty;
+};
+
+// the nodes of a file's block map that an operation has loaded, by node id
+typedef std::map<int, BlockMapNode> BlockMapNodes;
+
+// what an operation has loaded of a file's map. the extents of an extent mapped file are loaded the
+// first time a block is looked up and the ones from firstChangedExtent on are written by WriteBlockMap
+struct FileMap
+{
+	BlockMapNodes       nodes;
+	std::vector<Extent> extents;
+	bool                extentsLoaded;
+	unsigned int        firstChangedExtent;
+
+	FileMap() :
+		extentsLoaded(false),
+		firstChangedExtent(UINT_MAX)
+	{
+	}
+};
+
+// a file's extent list decoded, with the address of its last block. the list is written from the
+// first changed extent to its end, so the last block moves with every change
+struct CachedExtents
+{
+	LogAddress          lastBlock;
+	std::vector<Extent> extents;
+};
+
+// a file whose blocks the cleaner is moving. its map changes are written once the segment is evacuated
+struct CleanedFile
+{
+	INode   inode;
+	FileMap map;
+};
 
 class IFileLayer
 {
@@ -23,6 +101,7 @@ public:
 	virtual int File_Write(unsigned int inum, unsigned int offset, unsigned int length, const void * buffer) = 0;
 	virtual int File_Read(unsigned int inum, unsigned int offset, unsigned int length, void * buffer) = 0;
 	virtual int File_Truncate(unsigned int inum, unsigned int size) = 0;
+	virtual int File_Seek(unsigned int inum, unsigned int offset, int whence, unsigned int * result) = 0;
 	virtual int File_Free(unsigned int inum) = 0;
 	virtual int File_GetAttr(unsigned int inum, struct stat * stbuf) = 0;
 	virtual int File_Chmod(unsigned int inum, mode_t mode) = 0;
@@ -31,32 +110,101 @@ public:
 	virtual int File_RemoveLink(unsigned int inum) = 0;
 	virtual FileType File_GetFileType(unsigned int inum) = 0;
 	virtual int RunCleaner() = 0;
+	virtual void File_GetStats(LfsStats * stats) = 0;
+	virtual void File_GetTunables(LfsTunables * tunables) = 0;
+	virtual int File_SetTunables(LfsTunables tunables) = 0;
 };
 
 class FileLayer : public IFileLayer
 {
 private:
 	ILog *       log;
-	unsigned int iFileSizeInINodes;
+	std::atomic<unsigned int> iFileSizeInINodes;
 	unsigned int blockSizeInBytes;
 	unsigned int numLogAddrInBlock;
+	unsigned int numExtentsInBlock;
 	unsigned int maxFileBlocks;
+	BlockMapGeometry blockMap;
 	unsigned int flashSize;
 	unsigned int cleaningStartThreshold;
 	unsigned int cleaningEndThreshold;
+	unsigned int wearLevelingThreshold; // erase count spread that triggers static wear leveling. 0 disables it
 	unsigned int firstSegment;
+	FileStats    stats;         // counters for /.lfs_stats. the cleaner's are guarded by cleanerMutex
+	std::atomic<unsigned long long> bytesWritten;
+	std::atomic<unsigned long long> bytesRead;
+
+	// file operations hold cleanerMutex shared and the lock of their inode, shared to read and exclusive
+	// to change it, so operations on different files run in parallel. the cleaner moves blocks of every
+	// file and holds cleanerMutex exclusively. inodes are stored in the ifile, which has a lock of its own
+	std::shared_mutex cleanerMutex;
+	LockTable         inodeLocks;
+	std::shared_mutex iFileMutex;
+	std::mutex        allocationMutex;
+
+	// the inode map: the ifile's block map nodes, decoded on first use and kept for as long as the file
+	// system is mounted, so looking up an inode does not compete with file data for the block map cache.
+	// lookups hold iFileMutex shared and iNodeMapMutex. write back changes the nodes in place holding
+	// iFileMutex exclusively and writes each changed node once
+	BlockMapNodes     iNodeMap;
+	std::mutex        iNodeMapMutex;
+
+	// the inums of the ifile whose inodes are not in use, found by reading the ifile on mount and kept
+	// up to date on create and free, so a create takes the lowest one without reading any inode.
+	// guarded by allocationMutex
+	std::set<unsigned int> freeINums;
+
+	// write-back inode cache. changed inodes stay in memory and are written to the ifile together, a
+	// block at a time, after a segment is flushed and before every checkpoint. reading the ifile on a
+	// miss holds iFileMutex shared and writing back holds it exclusively, so a miss never caches an
+	// inode that is being written back
+	std::unordered_map<unsigned int, CachedINode> inodeCache;
+	std::mutex         inodeCacheMutex;
+	unsigned int       dirtyINodes;
+	unsigned long long segmentsFlushedAtWriteBack;
+	std::atomic<unsigned long long> inodeCacheHits;
+	std::atomic<unsigned long long> inodeCacheMisses;
+	std::atomic<unsigned long long> inodeWriteBacks;
+	std::atomic<unsigned long long> inodesWrittenBack;
+
+	// decoded block map nodes by inum and node id, so a read or write looks up its blocks without
+	// reading the nodes again and a write changes them in memory and writes each once
+	std::unordered_map<unsigned long long, CachedBlockMap> blockMapCache;
+	std::mutex        blockMapCacheMutex;
+
+	// decoded extent lists by inum
+	std::unordered_map<unsigned int, CachedExtents> extentCache;
+	std::mutex        extentCacheMutex;
+	std::atomic<unsigned long long> extentFilesConverted;
 
 public:
-	FileLayer(char * flashFile, unsigned int cacheSize, unsigned int checkpointInterval, unsigned int cleaningStart, unsigned int cleaningEnd) :
+	FileLayer(char * flashFile, unsigned int cacheSize, unsigned int checkpointInterval, unsigned int cleaningStart, unsigned int cleaningEnd, unsigned int erasePoolSize = 4, unsigned int wearLeveling = 0, unsigned int checkpointAge = 0) :
 		iFileSizeInINodes(INITIAL_IFILE_SIZE),
 		cleaningStartThreshold(cleaningStart),
-		cleaningEndThreshold(cleaningEnd)
+		cleaningEndThreshold(cleaningEnd),
+		wearLevelingThreshold(wearLeveling),
+		bytesWritten(0),
+		bytesRead(0),
+		dirtyINodes(0),
+		segmentsFlushedAtWriteBack(0),
+		inodeCacheHits(0),
+		inodeCacheMisses(0),
+		inodeWriteBacks(0),
+		inodesWrittenBack(0),
+		extentFilesConverted(0)
 	{
-    	log = new Log(flashFile, cacheSize, checkpointInterval);
+		memset(&stats, 0, sizeof(FileStats));
+    	log = new Log(flashFile, cacheSize, checkpointInterval, erasePoolSize, checkpointAge);
 	}
 
 	~FileLayer()
 	{
+		log->SetCheckpointHandler(nullptr);
+		{
+			std::unique_lock<std::shared_mutex> iFileLock(iFileMutex);
+			WriteBackINodes();
+		}
+
 		delete log;
 	}
 
@@ -69,21 +217,50 @@ public:
     	flashSize         = log->GetFlashSize();
     	firstSegment      = log->GetFirstSegment();
     	numLogAddrInBlock = blockSizeInBytes / sizeof(LogAddress);
-    	maxFileBlocks     = 4 + numLogAddrInBlock;
+    	numExtentsInBlock = blockSizeInBytes / sizeof(Extent);
+    	blockMap          = BlockMapGeometry(blockSizeInBytes);
+    	maxFileBlocks     = std::min(blockMap.MaxBlocks(), ((unsigned long long)UINT_MAX + 1) / blockSizeInBytes);
+    	if (LoadFreeINums() != 0)
+    	{
+    		return 1;
+    	}
+
+    	log->SetCheckpointHandler([this]()
+    	{
+    		std::shared_lock<std::shared_mutex> cleanerLock(cleanerMutex);
+    		return Checkpoint();
+    	});
+
+    	if (log->IsDeduplicating())
+    	{
+    		return RestoreBlockReferences();
+    	}
+
 		return 0;
 	}
 
 	int File_Statfs(struct statvfs* stbuf)
 	{
-	    stbuf->f_files  = iFileSizeInINodes; /* # inodes */
-	    stbuf->f_ffree  = INITIAL_IFILE_SIZE; /* # free inodes */
-	    stbuf->f_favail = INITIAL_IFILE_SIZE; /* # free inodes for unprivileged users */
-		return log->Log_Statfs(stbuf);
+		LatencyTimer timer(LatencyOp::FileStatfs);
+		if (log->Log_Statfs(stbuf) != 0)
+		{
+			return 1;
+		}
+
+		// the ifile grows into free blocks, so the inodes that fit in them are free as well
+		std::lock_guard<std::mutex> allocationLock(allocationMutex);
+		unsigned long long growth     = std::min((unsigned long long)stbuf->f_bfree * (blockSizeInBytes / sizeof(INode)), (unsigned long long)GetMaxINodes() - iFileSizeInINodes);
+		unsigned long long freeINodes = freeINums.size() + growth;
+	    stbuf->f_files  = iFileSizeInINodes - freeINums.size() + freeINodes; /* # inodes */
+	    stbuf->f_ffree  = freeINodes; /* # free inodes */
+	    stbuf->f_favail = freeINodes; /* # free inodes for unprivileged users */
+		return 0;
 	}
 
 	int File_Create(FileType fileType, mode_t mode, unsigned int * inumOut) 
 	{
-    	std::cout << "[FileLayer] Creating file" << std::endl;
+		LatencyTimer timer(LatencyOp::FileCreate);
+		std::shared_lock<std::shared_mutex> cleanerLock(cleanerMutex);
 
 		if (InitNewINode(fileType, mode, inumOut) != 0)
 		{
@@ -91,27 +268,251 @@ public:
 			return 1;
 		}
 
-		return 0;
+		return WriteBackIfDue();
 	}
 
 	int File_Write(unsigned int inum, unsigned int offset, unsigned int length, const void * buffer)
 	{
-    	std::cout << "[FileLayer] Writing inum " << inum << " at offset " << offset << " for length " << length << std::endl;
+		std::shared_lock<std::shared_mutex> cleanerLock(cleanerMutex);
+		std::unique_lock<std::shared_mutex> inodeLock(inodeLocks.get(inum));
+		int ret = WriteFile(inum, offset, length, buffer);
+		inodeLock.unlock();
+		return ret + WriteBackIfDue();
+	}
+
+	int File_Read(unsigned int inum, unsigned int offset, unsigned int length, void * buffer)
+	{
+		std::shared_lock<std::shared_mutex> cleanerLock(cleanerMutex);
+		std::shared_lock<std::shared_mutex> inodeLock(inodeLocks.get(inum));
+		return ReadFile(inum, offset, length, buffer);
+	}
+
+	int File_Truncate(unsigned int inum, unsigned int size)
+	{
+		std::shared_lock<std::shared_mutex> cleanerLock(cleanerMutex);
+		std::unique_lock<std::shared_mutex> inodeLock(inodeLocks.get(inum));
+		int ret = TruncateFile(inum, size);
+		inodeLock.unlock();
+		return ret + WriteBackIfDue();
+	}
+
+	// finds the next data or hole at or after offset, like lseek with SEEK_DATA or SEEK_HOLE
+	int File_Seek(unsigned int inum, unsigned int offset, int whence, unsigned int * result)
+	{
+		std::shared_lock<std::shared_mutex> cleanerLock(cleanerMutex);
+		std::shared_lock<std::shared_mutex> inodeLock(inodeLocks.get(inum));
+		return SeekFile(inum, offset, whence, result);
+	}
+
+	int File_Free(unsigned int inum)
+	{
+		std::shared_lock<std::shared_mutex> cleanerLock(cleanerMutex);
+		std::unique_lock<std::shared_mutex> inodeLock(inodeLocks.get(inum));
+		int ret = FreeFile(inum);
+		inodeLock.unlock();
+		return ret + WriteBackIfDue();
+	}
+
+	int File_GetAttr(unsigned int inum, struct stat * stbuf)
+	{
+		LatencyTimer timer(LatencyOp::FileGetAttr);
+		std::shared_lock<std::shared_mutex> cleanerLock(cleanerMutex);
+		std::shared_lock<std::shared_mutex> inodeLock(inodeLocks.get(inum));
+		INode inode = GetINode(inum);
+
+		unsigned int blocks = inode.dataInline ? 0 : inode.fileSize / blockSizeInBytes;
+	    if (!inode.dataInline && inode.fileSize % blockSizeInBytes != 0)
+	    {
+	    	blocks++;
+	    }
+
+		stbuf->st_mode    = GetFileTypeMode(inode.fileType) | inode.permissions;
+	    stbuf->st_nlink   = inode.nlinks;   // number of hardlinks. add to inode
+	    stbuf->st_size    = inode.fileSize; // change for symlinks
+	    stbuf->st_ino     = inum;
+	    stbuf->st_uid     = inode.uid;
+	    stbuf->st_gid     = inode.gid;
+	    stbuf->st_blksize = blockSizeInBytes;
+	    stbuf->st_blocks  = blocks;
+	    stbuf->st_atime   = inode.atime; // time of last access
+	    stbuf->st_mtime   = inode.mtime; // time of last modification
+	    stbuf->st_ctime   = inode.ctime; // time of last status change
+
+		return 0;
+	}
+
+	int File_Chmod(unsigned int inum, mode_t mode)
+	{
+		LatencyTimer timer(LatencyOp::FileChmod);
+		std::shared_lock<std::shared_mutex> cleanerLock(cleanerMutex);
+		std::unique_lock<std::shared_mutex> inodeLock(inodeLocks.get(inum));
+		INode inode       = GetINode(inum);
+		inode.permissions = mode;
+		inode.ctime       = time(0);		
+		int ret           = UpdateIFile(inode);
+		inodeLock.unlock();
+		return ret + WriteBackIfDue();
+	}
+
+	int File_Chown(unsigned int inum, uid_t uid, gid_t gid)
+	{
+		LatencyTimer timer(LatencyOp::FileChown);
+		std::shared_lock<std::shared_mutex> cleanerLock(cleanerMutex);
+		std::unique_lock<std::shared_mutex> inodeLock(inodeLocks.get(inum));
+		INode inode = GetINode(inum);
+		inode.uid   = uid;
+		inode.gid   = gid;
+		inode.ctime = time(0);		
+		int ret     = UpdateIFile(inode);
+		inodeLock.unlock();
+		return ret + WriteBackIfDue();
+	}
+
+	int File_AddLink(unsigned int inum)
+	{
+		LatencyTimer timer(LatencyOp::FileAddLink);
+		std::shared_lock<std::shared_mutex> cleanerLock(cleanerMutex);
+		std::unique_lock<std::shared_mutex> inodeLock(inodeLocks.get(inum));
+		INode noteToUpdate = GetINode(inum);
+		noteToUpdate.nlinks++;
+		int ret = UpdateIFile(noteToUpdate);
+		inodeLock.unlock();
+		return ret + WriteBackIfDue();
+	}
+
+	int File_RemoveLink(unsigned int inum)
+	{
+		LatencyTimer timer(LatencyOp::FileRemoveLink);
+		std::shared_lock<std::shared_mutex> cleanerLock(cleanerMutex);
+		std::unique_lock<std::shared_mutex> inodeLock(inodeLocks.get(inum));
+		INode noteToUpdate = GetINode(inum);
+		noteToUpdate.nlinks--;
+		int ret = UpdateIFile(noteToUpdate);
+		if (noteToUpdate.nlinks == 0)
+		{
+			ret = FreeFile(inum);
+		}
+
+		inodeLock.unlock();
+		return ret + WriteBackIfDue();
+	}
+
+	FileType File_GetFileType(unsigned int inum)
+	{
+		LatencyTimer timer(LatencyOp::FileGetFileType);
+		std::shared_lock<std::shared_mutex> cleanerLock(cleanerMutex);
+		std::shared_lock<std::shared_mutex> inodeLock(inodeLocks.get(inum));
+		return GetINode(inum).fileType;
+	}
+
+	void File_GetStats(LfsStats * lfsStats)
+	{
+		std::shared_lock<std::shared_mutex> cleanerLock(cleanerMutex);
+		lfsStats->file              = stats;
+		lfsStats->file.bytesWritten = bytesWritten;
+		lfsStats->file.bytesRead    = bytesRead;
+		lfsStats->file.inodeCacheHits       = inodeCacheHits;
+		lfsStats->file.inodeCacheMisses     = inodeCacheMisses;
+		lfsStats->file.inodeWriteBacks      = inodeWriteBacks;
+		lfsStats->file.inodesWrittenBack    = inodesWrittenBack;
+		lfsStats->file.extentFilesConverted = extentFilesConverted;
+		log->GetStats(&lfsStats->log);
+	}
+
+	void File_GetTunables(LfsTunables * tunables)
+	{
+		log->GetTunables(tunables);
+		tunables->cleaningStart = cleaningStartThreshold;
+		tunables->cleaningStop  = cleaningEndThreshold;
+	}
+
+	// cleaning stops once it has made cleaningStop clean segments, so it cannot be below the start threshold
+	int File_SetTunables(LfsTunables tunables)
+	{
+		std::unique_lock<std::shared_mutex> cleanerLock(cleanerMutex);
+		if (tunables.cleaningStop < tunables.cleaningStart || tunables.cleaningStop > flashSize)
+		{
+			std::cerr << "[FileLayer] ERROR: Invalid cleaning thresholds. start: " << tunables.cleaningStart << " stop: " << tunables.cleaningStop << std::endl;
+			return 1;
+		}
+
+		if (log->SetTunables(tunables) != 0)
+		{
+			return 1;
+		}
+
+		cleaningStartThreshold = tunables.cleaningStart;
+		cleaningEndThreshold   = tunables.cleaningStop;
+		return 0;
+	}
+
+	void PrintIFile()
+	{
+		std::cout << "[FileLayer] Printing IFile INode " << std::endl;
+		GetINode(IFILE_INUM).Print();
+
+		for (int inum = 1; inum < iFileSizeInINodes; inum++)
+		{
+			PrintIFileEntry(inum);
+		}
+	}
+
+	void PrintIFileEntry(unsigned int inum)
+	{
+		std::cout << "[FileLayer] Printing IFile Entry for inum " << inum << std::endl;
+		GetINode(inum).Print();
+	}
+
+	// the check runs alongside file operations. cleaning waits for the operations in progress and holds
+	// new ones back until it is done, then counts again as another thread may have cleaned meanwhile
+	int RunCleaner()
+	{
+		LatencyTimer timer(LatencyOp::CleanerCheck);
+		TRACE_DEBUG(CleanerCheck);
+
+		{
+			std::shared_lock<std::shared_mutex> cleanerLock(cleanerMutex);
+			SegmentUsageTableEntry * segmentUsageTable = log->ReadSegmentUsageTable();
+			bool cleaningNeeded = CountCleanSegments(segmentUsageTable) <= cleaningStartThreshold || FindColdSegment(segmentUsageTable, NULL, NULL) != flashSize;
+			free(segmentUsageTable);
+			if (!cleaningNeeded)
+			{
+				return 0;
+			}
+		}
+
+		std::unique_lock<std::shared_mutex> cleanerLock(cleanerMutex);
+		SegmentUsageTableEntry * segmentUsageTable = log->ReadSegmentUsageTable();
+		unsigned int cleanSegments                 = CountCleanSegments(segmentUsageTable);
+		int ret;
+		if (cleanSegments > cleaningStartThreshold)
+		{
+			ret = LevelWear(segmentUsageTable);
+			free(segmentUsageTable);
+		}
+		else
+		{
+			ret = CleanLog(cleanSegments, segmentUsageTable);
+		}
+
+		// the moved blocks are only reachable through the cached inodes until they are written back
+		return ret + WriteBackIfDue();
+	}
+
+private:
+	int WriteFile(unsigned int inum, unsigned int offset, unsigned int length, const void * buffer)
+	{
+		LatencyTimer timer(LatencyOp::FileWrite);
+    	TRACE_INFO(FileWrite, inum, offset, length);
+    	bytesWritten += length;
     	if (length == 0)
     	{
     		return 0;
     	}
 
+    	// a write past the end of the file leaves a hole. only the blocks it touches are written
     	INode inode = GetINode(inum);
 
-		if (offset > inode.fileSize)
-		{
-	        std::cerr << "[FileLayer] ERROR: Attempting to write beyond end of file. inum: " << inum << std::endl;
-	        std::cerr << "[FileLayer] \tfile size: " << inode.fileSize << std::endl;
-	        std::cerr << "[FileLayer] \toffset: " << length << std::endl;
-	        return 1;
-		}
-
 		unsigned int startBlock          = offset / blockSizeInBytes;
 		unsigned int writeLengthInBlocks = 1;
 		unsigned int startBlockOffset    = offset % blockSizeInBytes;
@@ -122,22 +523,44 @@ public:
 		}
 
 		unsigned int endBlock            = startBlock + writeLengthInBlocks - 1;
+		if (offset + length < offset || endBlock >= maxFileBlocks)
+		{
+	        std::cerr << "[FileLayer] ERROR: Attempting to write beyond maximum file size. inum: " << inum << std::endl;
+	        std::cerr << "[FileLayer] \tmaximum file blocks: " << maxFileBlocks << std::endl;
+			return 1;
+		}
 
-    	std::cout << "[FileLayer] Writing block " << startBlock << " to block " << endBlock << " of inum " << inum << std::endl;
+    	// a small file is written into its inode. one that outgrows it moves its data to block 0 first
+    	if (inode.dataInline && offset + length <= INLINE_DATA_SIZE)
+    	{
+    		memcpy(inode.inlineData + offset, buffer, length);
+    		log->AddDataAtRisk(length);
+    		time_t now     = time(0);
+    		inode.fileSize = std::max(inode.fileSize, offset + length);
+    		inode.atime    = now;
+    		inode.mtime    = now;
+    		return UpdateIFile(inode);
+    	}
+
+    	if (inode.dataInline && SpillInlineData(&inode) != 0)
+    	{
+    		return 1;
+    	}
 
+    	TRACE_DEBUG(FileWriteBlocks, inum, startBlock, endBlock);
+
+		FileMap fileMap;
     	void * blockBuffer                = malloc(blockSizeInBytes);
 		unsigned int writeLengthRemaining = length;
 		unsigned int bufferOffset         = 0;
-    	for (int blockToWrite = startBlock; blockToWrite <= endBlock; ++blockToWrite)
+    	for (unsigned int blockToWrite = startBlock; blockToWrite <= endBlock; ++blockToWrite)
     	{
-    		std::cout << "[FileLayer] Writing block " << blockToWrite << std::endl;
-    		if (blockToWrite >= maxFileBlocks)
-    		{
-    			std::cout << "[FileLayer] Attempting to write beyond maximum file blocks" << std::endl;
-    			break;
-    		}
-
-			LogAddress blockAddress = GetBlockAddress(inode, blockToWrite);
+			LogAddress blockAddress;
+			if (GetBlockAddress(inode, fileMap, blockToWrite, &blockAddress) != 0)
+			{
+	        	free(blockBuffer);
+	        	return 1;
+			}
 
     		if ((blockAddress.logSegment != EMPTY_DIRECT_BLOCK_ADDRESS && blockAddress.blockNumber == EMPTY_DIRECT_BLOCK_ADDRESS) || 
     			(blockAddress.logSegment == EMPTY_DIRECT_BLOCK_ADDRESS && blockAddress.blockNumber != EMPTY_DIRECT_BLOCK_ADDRESS))
@@ -148,20 +571,6 @@ public:
 	        	return 1;
     		}
 
-			memset(blockBuffer, 0, blockSizeInBytes);
-			if (blockAddress.logSegment != EMPTY_DIRECT_BLOCK_ADDRESS)
-			{
-				if (log->Log_Read(blockAddress, blockBuffer) != 0)
-				{
-					std::cerr << "[FileLayer] ERROR: Log write failed in File_Write. inum: " << inum << std::endl;
-	        		std::cerr << "[FileLayer] \tblock: " << blockToWrite << std::endl;
-	        		free(blockBuffer);
-	        		return 1;
-				}
-
-				log->Log_Free(blockAddress);
-			}
-
     		unsigned int blockOffset;
     		unsigned int writeLength;
 			if (writeLengthInBlocks == 1)
@@ -185,19 +594,66 @@ public:
 				writeLength   = blockSizeInBytes;
 			}
 
-			memcpy((char *) blockBuffer + blockOffset, (char *) buffer + bufferOffset, writeLength);
-			if (log->Log_Write(inum, blockToWrite, blockBuffer, &blockAddress) != 0)
+			// only a block that is partly overwritten needs its old contents
+			memset(blockBuffer, 0, blockSizeInBytes);
+			bool overwrite     = blockAddress.logSegment != EMPTY_DIRECT_BLOCK_ADDRESS;
+			bool partial       = overwrite && writeLength < blockSizeInBytes;
+			WriteStream stream = GetWriteStream(inode, overwrite);
+			if (partial && log->Log_Read(blockAddress, blockBuffer) != 0)
 			{
-				std::cerr << "[FileLayer] ERROR: Log_Write failed in File_Write. inum: " << inum << std::endl;
-	        	std::cerr << "[FileLayer] \tdirectBlock: " << blockToWrite << std::endl;
-	        	free(blockBuffer);
-	        	return 1;
+				std::cerr << "[FileLayer] ERROR: Log write failed in File_Write. inum: " << inum << std::endl;
+        		std::cerr << "[FileLayer] \tblock: " << blockToWrite << std::endl;
+        		free(blockBuffer);
+        		return 1;
 			}
 
-			UpdateINodeBlock(&inode, blockToWrite, blockAddress);
+			memcpy((char *) blockBuffer + blockOffset, (char *) buffer + bufferOffset, writeLength);
+
+			// a block still waiting in a tail is changed in place and keeps its address
+			if (!overwrite || log->Log_Rewrite(blockAddress, blockBuffer) != 0)
+			{
+				if (overwrite)
+				{
+					log->Log_Free(blockAddress);
+				}
+
+				if (log->Log_Write(inum, blockToWrite, blockBuffer, &blockAddress, stream, GetWriteCause(inode, partial)) != 0)
+				{
+					std::cerr << "[FileLayer] ERROR: Log_Write failed in File_Write. inum: " << inum << std::endl;
+		        	std::cerr << "[FileLayer] \tdirectBlock: " << blockToWrite << std::endl;
+		        	free(blockBuffer);
+		        	return 1;
+				}
+
+				if (SetBlockAddress(&inode, fileMap, blockToWrite, blockAddress) != 0)
+				{
+		        	free(blockBuffer);
+		        	return 1;
+				}
+			}
 
 			writeLengthRemaining -= writeLength;
 			bufferOffset += writeLength;
+
+			// a checkpoint that fell due with this block is taken now, while the tail the block filled is
+			// still empty, rather than after the rest of the write has gone into the next one
+			if (inum != IFILE_INUM && log->IsCheckpointDue())
+			{
+				inode.fileSize = std::max(inode.fileSize, offset + bufferOffset);
+				if (WriteBlockMap(&inode, fileMap) != 0 || UpdateIFile(inode) != 0 || Checkpoint() != 0)
+				{
+					free(blockBuffer);
+					return 1;
+				}
+			}
+    	}
+
+    	free(blockBuffer);
+
+    	// each changed block map node is written once for the whole write
+    	if (WriteBlockMap(&inode, fileMap) != 0)
+    	{
+    		return 1;
     	}
 
     	if (offset + length > inode.fileSize) // think about this for truncating?????
@@ -219,9 +675,11 @@ public:
 		return 0;
 	}
 
-	int File_Read(unsigned int inum, unsigned int offset, unsigned int length, void * buffer)
+	int ReadFile(unsigned int inum, unsigned int offset, unsigned int length, void * buffer)
 	{
-    	std::cout << "[FileLayer] Reading inum " << inum << " at offset " << offset << " for length " << length << std::endl;
+		LatencyTimer timer(LatencyOp::FileRead);
+    	TRACE_INFO(FileRead, inum, offset, length);
+    	bytesRead += length;
     	if (length == 0)
     	{
     		return 0;
@@ -234,11 +692,24 @@ public:
     		return 1;
 		}
 
+		// nothing can be read at or past the end of the file. a hole before it reads as zeros
+		if (offset >= inode.fileSize)
+		{
+			return 1;
+		}
+
 		if (length > inode.fileSize - offset)
 		{
 			length = inode.fileSize - offset;
 		}
     	
+    	// a small file is read from its inode without touching the log
+    	if (inode.dataInline)
+    	{
+    		memcpy(buffer, inode.inlineData + offset, length);
+    		return 0;
+    	}
+
     	memset(buffer, 0, length);
 
 		unsigned int startBlock         = offset / blockSizeInBytes;
@@ -252,20 +723,21 @@ public:
 
 		unsigned int endBlock           = startBlock + readLengthInBlocks - 1;
 
-    	std::cout << "[FileLayer] Reading block " << startBlock << " to block " << endBlock << " of inum " << inum << std::endl;
+    	TRACE_DEBUG(FileReadBlocks, inum, startBlock, endBlock);
 
+		FileMap fileMap;
 		void * blockBuffer               = malloc(blockSizeInBytes);
 		unsigned int readLengthRemaining = length;
 		unsigned int bufferOffset        = 0;
-		for (int blockToRead = startBlock; blockToRead <= endBlock; ++blockToRead)
+		for (unsigned int blockToRead = startBlock; blockToRead <= endBlock; ++blockToRead)
 		{
-			if (blockToRead >= maxFileBlocks)
-    		{
-    			std::cout << "[FileLayer] Attempting to read beyond maximum file blocks" << std::endl;
-    			break;
-    		}
+			LogAddress addr;
+			if (GetBlockAddress(inode, fileMap, blockToRead, &addr) != 0)
+			{
+	        	free(blockBuffer);
+	        	return 1;
+			}
 
-			LogAddress addr = GetBlockAddress(inode, blockToRead);
 			if ((addr.logSegment != EMPTY_DIRECT_BLOCK_ADDRESS && addr.blockNumber == EMPTY_DIRECT_BLOCK_ADDRESS) || 
     			(addr.logSegment == EMPTY_DIRECT_BLOCK_ADDRESS && addr.blockNumber != EMPTY_DIRECT_BLOCK_ADDRESS))
     		{
@@ -275,16 +747,9 @@ public:
 	        	return 1;
     		}
 
-			if (addr.logSegment == EMPTY_DIRECT_BLOCK_ADDRESS)
-			{
-				std::cerr << "[FileLayer] ERROR: Attempting to read empty direct block. inum: " << inum << std::endl;
-	        	std::cerr << "[FileLayer] \tblock: " << blockToRead << std::endl;
-	        	free(blockBuffer);
-	        	return 1;
-			}
-
+			// a block that was never written is a hole and reads back as zeros
 			memset(blockBuffer, 0, blockSizeInBytes);
-			if (log->Log_Read(addr, blockBuffer) != 0)
+			if (addr.logSegment != EMPTY_DIRECT_BLOCK_ADDRESS && log->Log_Read(addr, blockBuffer) != 0)
 			{
 				std::cerr << "[FileLayer] ERROR: Log read failed in File_Read. inum: " << inum << std::endl;
 	        	std::cerr << "[FileLayer] \tblock: " << blockToRead << std::endl;
@@ -325,189 +790,210 @@ public:
 		return 0;
 	}
 
-	int File_Truncate(unsigned int inum, unsigned int size)
+	// the end of the file counts as a hole, so SEEK_HOLE always finds one and SEEK_DATA fails with
+	// -ENXIO in the hole at the end of a file. holes are skipped a run or a missing node at a time
+	int SeekFile(unsigned int inum, unsigned int offset, int whence, unsigned int * result)
 	{
-    	std::cout << "[FileLayer] Truncating file at inum: " << inum << " size: " << size << std::endl;
+		LatencyTimer timer(LatencyOp::FileSeek);
+		TRACE_INFO(FileSeek, inum, offset, whence);
+		if (whence != SEEK_DATA && whence != SEEK_HOLE)
+		{
+			return -EINVAL;
+		}
 
 		INode inode = GetINode(inum);
+		if (offset >= inode.fileSize)
+		{
+			return -ENXIO;
+		}
 
-		unsigned int oldFileSize = inode.fileSize;
-		void * buffer = malloc(oldFileSize);
+		if (inode.dataInline)
+		{
+			*result = whence == SEEK_DATA ? offset : inode.fileSize;
+			return 0;
+		}
 
-		if (File_Read(inum, 0, oldFileSize, buffer) != 0)
-    	{
-			std::cerr << "[FileLayer] ERROR: File_Truncate: File_Read failed" << std::endl;
-    		return 1;
-    	}
+		FileMap fileMap;
+		unsigned int fileBlocks = inode.fileSize / blockSizeInBytes + (inode.fileSize % blockSizeInBytes > 0);
+		unsigned int block      = offset / blockSizeInBytes;
+		while (block < fileBlocks)
+		{
+			bool allocated;
+			unsigned int run;
+			if (GetBlockRun(inode, fileMap, block, &allocated, &run) != 0)
+			{
+				return -EIO;
+			}
 
-        inode.fileSize = 0;
-    	for (int b = 0; b < 4; ++b)
-        {
-        	log->Log_Free(inode.directBlocks[b]);
-            inode.directBlocks[b].logSegment  = EMPTY_DIRECT_BLOCK_ADDRESS; 
-            inode.directBlocks[b].blockNumber = EMPTY_DIRECT_BLOCK_ADDRESS;
-        }
+			if (allocated == (whence == SEEK_DATA))
+			{
+				*result = std::max(offset, block * blockSizeInBytes);
+				return 0;
+			}
 
-    	log->Log_Free(inode.indirectBlock);
-        inode.indirectBlock.logSegment  = EMPTY_DIRECT_BLOCK_ADDRESS; 
-        inode.indirectBlock.blockNumber = EMPTY_DIRECT_BLOCK_ADDRESS;
-        
-        UpdateIFile(inode);
+			block += run;
+		}
 
-    	void * newBuffer = malloc(size); memset(newBuffer, 0, size);
-    	unsigned int copyLength = oldFileSize;
-    	if (size <= oldFileSize)
-    	{
-    		copyLength = size;
-    	}
-    	
-    	memcpy(newBuffer, buffer, copyLength);
-    	if (File_Write(inum, 0, size, newBuffer) != 0)
-    	{
-			std::cerr << "[FileLayer] ERROR: File_Truncate: File_Write failed" << std::endl;
-    		return 1;
-    	}
+		if (whence == SEEK_DATA)
+		{
+			return -ENXIO;
+		}
 
-    	free(buffer);
-    	free(newBuffer);
+		*result = inode.fileSize;
 		return 0;
 	}
 
-	int File_Free(unsigned int inum)
+	// a truncate changes only the map past the new end. the blocks after it are freed, the rest of
+	// the last block is zeroed so a later extension reads zeros, and a larger size leaves a hole
+	int TruncateFile(unsigned int inum, unsigned int size)
 	{
-    	std::cout << "[FileLayer] File_Free Freeing inum " << inum << std::endl;
-    	if (inum == IFILE_INUM)
-    	{
-			std::cerr << "[FileLayer] ERROR: File_Free attempting to free iFile" << std::endl;
-    		throw;
-    	}
-
-		INode toFree = GetINode(inum); // maybe change this from throwing error? DONT MEMSET, INUM BECOMES 0
-		toFree.inUse = false;
-		for (int b = 0; b < 4; ++b)
-        {
-        	log->Log_Free(toFree.directBlocks[b]);
-            toFree.directBlocks[b].logSegment  = EMPTY_DIRECT_BLOCK_ADDRESS; 
-            toFree.directBlocks[b].blockNumber = EMPTY_DIRECT_BLOCK_ADDRESS;
-        }
-
-    	log->Log_Free(toFree.indirectBlock);
-        toFree.indirectBlock.logSegment  = EMPTY_DIRECT_BLOCK_ADDRESS; 
-        toFree.indirectBlock.blockNumber = EMPTY_DIRECT_BLOCK_ADDRESS;
-
-		UpdateIFile(toFree);
-		return 0;
-	}
+		LatencyTimer timer(LatencyOp::FileTruncate);
+    	TRACE_INFO(FileTruncate, inum, size);
 
-	int File_GetAttr(unsigned int inum, struct stat * stbuf)
-	{
+		// inline data past the new end is zeroed so a later extension reads zeros
 		INode inode = GetINode(inum);
+		if (inode.dataInline && size > INLINE_DATA_SIZE && SpillInlineData(&inode) != 0)
+		{
+			return 1;
+		}
 
-		unsigned int blocks = inode.fileSize / blockSizeInBytes;
-	    if (inode.fileSize % blockSizeInBytes != 0)
-	    {
-	    	blocks++;
-	    }
+		if (inode.dataInline)
+		{
+			if (size < inode.fileSize)
+			{
+				memset(inode.inlineData + size, 0, inode.fileSize - size);
+			}
+		}
+		else if (size < inode.fileSize)
+		{
+			unsigned int fileBlocks = size / blockSizeInBytes + (size % blockSizeInBytes > 0);
+			FileMap fileMap;
+			int ret = size == 0 ? FreeFileBlocks(&inode) : FreeBlocksFrom(&inode, fileMap, fileBlocks);
+			if (ret != 0)
+			{
+				std::cerr << "[FileLayer] ERROR: File_Truncate: unable to free file blocks. inum: " << inum << std::endl;
+				return 1;
+			}
 
-		stbuf->st_mode    = GetFileTypeMode(inode.fileType) | inode.permissions;
-	    stbuf->st_nlink   = inode.nlinks;   // number of hardlinks. add to inode
-	    stbuf->st_size    = inode.fileSize; // change for symlinks
-	    stbuf->st_ino     = inum;
-	    stbuf->st_uid     = inode.uid;
-	    stbuf->st_gid     = inode.gid;
-	    stbuf->st_blksize = blockSizeInBytes;
-	    stbuf->st_blocks  = blocks;
-	    stbuf->st_atime   = inode.atime; // time of last access
-	    stbuf->st_mtime   = inode.mtime; // time of last modification
-	    stbuf->st_ctime   = inode.ctime; // time of last status change
+			if (size % blockSizeInBytes != 0 && ZeroBlockTail(&inode, fileMap, fileBlocks - 1, size % blockSizeInBytes) != 0)
+			{
+				return 1;
+			}
 
-		return 0;
-	}
+			if (WriteBlockMap(&inode, fileMap) != 0)
+			{
+				return 1;
+			}
+		}
 
-	int File_Chmod(unsigned int inum, mode_t mode)
-	{
-		INode inode       = GetINode(inum);
-		inode.permissions = mode;
-		inode.ctime       = time(0);		
+		time_t now     = time(0);
+		inode.fileSize = size;
+		inode.mtime    = now;
+		inode.ctime    = now;
 		return UpdateIFile(inode);
 	}
 
-	int File_Chown(unsigned int inum, uid_t uid, gid_t gid)
+	// zeros a block from offset to its end. a block that is still in a tail is changed in place
+	int ZeroBlockTail(INode * iNode, FileMap& map, unsigned int blockNum, unsigned int offset)
 	{
-		INode inode = GetINode(inum);
-		inode.uid   = uid;
-		inode.gid   = gid;
-		inode.ctime = time(0);		
-		return UpdateIFile(inode);
-	}
+		LogAddress address;
+		if (GetBlockAddress(*iNode, map, blockNum, &address) != 0)
+		{
+			return 1;
+		}
 
-	int File_AddLink(unsigned int inum)
-	{
-		INode noteToUpdate = GetINode(inum);
-		noteToUpdate.nlinks++;
-		return UpdateIFile(noteToUpdate);
-	}
+		if (address.logSegment == EMPTY_DIRECT_BLOCK_ADDRESS)
+		{
+			return 0;
+		}
 
-	int File_RemoveLink(unsigned int inum)
-	{
-		INode noteToUpdate = GetINode(inum);
-		noteToUpdate.nlinks--;
-		int ret = UpdateIFile(noteToUpdate);
-		if (noteToUpdate.nlinks == 0)
+		void * blockBuffer = malloc(blockSizeInBytes);
+		if (log->Log_Read(address, blockBuffer) != 0)
 		{
-			return File_Free(inum);
+			std::cerr << "[FileLayer] ERROR: Log read failed in File_Truncate. inum: " << iNode->inum << " block: " << blockNum << std::endl;
+			free(blockBuffer);
+			return 1;
+		}
+
+		memset((char *)blockBuffer + offset, 0, blockSizeInBytes - offset);
+		int ret = 0;
+		if (log->Log_Rewrite(address, blockBuffer) != 0)
+		{
+			log->Log_Free(address);
+			if (log->Log_Write(iNode->inum, blockNum, blockBuffer, &address, GetWriteStream(*iNode, true), GetWriteCause(*iNode, true)) != 0)
+			{
+				std::cerr << "[FileLayer] ERROR: Log_Write failed in File_Truncate. inum: " << iNode->inum << " block: " << blockNum << std::endl;
+				ret = 1;
+			}
+			else if (iNode->extentMapped && blockNum >= NUM_DIRECT_BLOCKS)
+			{
+				// the block ends the last extent, so splitting it off keeps the file extent mapped
+				ret = MoveExtentBlock(*iNode, map, blockNum, address);
+			}
+			else
+			{
+				ret = SetBlockMapAddress(iNode, map.nodes, blockNum, address);
+			}
 		}
 
+		free(blockBuffer);
 		return ret;
 	}
 
-	FileType File_GetFileType(unsigned int inum)
+	// moves the data of a file kept in its inode to block 0, so the file can grow past the inode
+	int SpillInlineData(INode * iNode)
 	{
-		return GetINode(inum).fileType;
-	}
+		iNode->dataInline = false;
+		if (iNode->fileSize == 0)
+		{
+			return 0;
+		}
 
-	void PrintIFile()
-	{
-		std::cout << "[FileLayer] Printing IFile INode " << std::endl;
-		GetINode(IFILE_INUM).Print();
+		void * blockBuffer = malloc(blockSizeInBytes);
+		memset(blockBuffer, 0, blockSizeInBytes);
+		memcpy(blockBuffer, iNode->inlineData, iNode->fileSize);
+		memset(iNode->inlineData, 0, INLINE_DATA_SIZE);
 
-		for (int inum = 1; inum < iFileSizeInINodes; inum++)
+		int ret = log->Log_Write(iNode->inum, 0, blockBuffer, &iNode->directBlocks[0], GetWriteStream(*iNode, false), GetWriteCause(*iNode, false));
+		if (ret != 0)
 		{
-			PrintIFileEntry(inum);
+			std::cerr << "[FileLayer] ERROR: Log_Write failed moving inline data to a block. inum: " << iNode->inum << std::endl;
 		}
-	}
 
-	void PrintIFileEntry(unsigned int inum)
-	{
-		std::cout << "[FileLayer] Printing IFile Entry for inum " << inum << std::endl;
-		GetINode(inum).Print();
+		free(blockBuffer);
+		return ret;
 	}
 
-	int RunCleaner()
+	int FreeFile(unsigned int inum)
 	{
-		std::cout << "[Cleaner] Checking number of free segments..." << std::endl;
-
-		unsigned int cleanSegments = 0;
-		SegmentUsageTableEntry * segmentUsageTable = log->ReadSegmentUsageTable();
+		LatencyTimer timer(LatencyOp::FileFree);
+    	TRACE_INFO(FileFree, inum);
+    	if (inum == IFILE_INUM)
+    	{
+			std::cerr << "[FileLayer] ERROR: File_Free attempting to free iFile" << std::endl;
+    		throw;
+    	}
 
-		for (unsigned int segment = firstSegment; segment < flashSize; ++segment)
+		INode toFree = GetINode(inum); // maybe change this from throwing error? DONT MEMSET, INUM BECOMES 0
+		toFree.inUse = false;
+		if (FreeFileBlocks(&toFree) != 0)
 		{
-			if (segmentUsageTable[segment].liveBytesInSegment == 0)
-			{
-				cleanSegments++;
-			}
+			std::cerr << "[FileLayer] ERROR: File_Free unable to free file blocks. inum: " << inum << std::endl;
+			return 1;
 		}
 
-		if (cleanSegments > cleaningStartThreshold)
+		// the inum is only reused once its inode is stored as not in use
+		if (UpdateIFile(toFree) != 0)
 		{
-			free(segmentUsageTable);
-			return 0;
+			std::cerr << "[FileLayer] ERROR: File_Free unable to update the ifile. inum: " << inum << std::endl;
+			return 1;
 		}
 
-		return CleanLog(cleanSegments, segmentUsageTable);
+		std::lock_guard<std::mutex> allocationLock(allocationMutex);
+		freeINums.insert(inum);
+		return 0;
 	}
 
-private:
 	INode GetINode(unsigned int inum)
 	{
 		if (inum > iFileSizeInINodes)
@@ -521,43 +1007,63 @@ private:
 			return log->GetIFileINode();
 		}
 
+		{
+			std::lock_guard<std::mutex> cacheLock(inodeCacheMutex);
+			auto cached = inodeCache.find(inum);
+			if (cached != inodeCache.end())
+			{
+				inodeCacheHits++;
+				return cached->second.inode;
+			}
+		}
+
+		inodeCacheMisses++;
+		std::shared_lock<std::shared_mutex> iFileLock(iFileMutex);
 		INode toReturn;
 		memset(&toReturn, 0, sizeof(INode));
 		unsigned int iNodeOffset = (inum - 1) * sizeof(INode);
-		if (File_Read(IFILE_INUM, iNodeOffset, sizeof(INode), (void *) &toReturn) != 0)
+		if (ReadIFile(iNodeOffset, sizeof(INode), (void *) &toReturn) != 0)
 		{
 			std::cerr << "[FileLayer] ERROR: GetINode failed. inum: " << inum << std::endl;
 			throw;
 		}
 
+		// the inode may have been changed in the cache while the ifile was read. that copy is newer
+		std::lock_guard<std::mutex> cacheLock(inodeCacheMutex);
+		toReturn = inodeCache.emplace(inum, CachedINode{ toReturn, false }).first->second.inode;
+		EvictCleanINodes();
 		return toReturn;
 	}
 
 	int InitNewINode(FileType fileType, mode_t mode, unsigned int * out)
 	{
+		// the inum stays free until its inode is written, so creators pick one at a time
+		std::lock_guard<std::mutex> allocationLock(allocationMutex);
     	unsigned int inum = GetUnusedINum();
-    	std::cout << "[FileLayer] Creating file with inum " << inum << " and file type " << GetFileTypeString(fileType) << std::endl;
-
-		if (inum <= iFileSizeInINodes && GetINode(inum).inUse == true)
-		{
-			std::cerr << "[FileLayer] ERROR: inum already in use. inum: " << inum << std::endl;
-			return 1;
-		}
+    	TRACE_INFO(FileCreate, inum, (int)fileType);
+    	if (inum > GetMaxINodes())
+    	{
+    		std::cerr << "[FileLayer] ERROR: no free inodes. inodes: " << iFileSizeInINodes << std::endl;
+    		return 1;
+    	}
 
     	time_t now = time(0);
 
 		INode newINode = {
-			.inUse       = true,
-			.inum        = inum,
-			.fileType    = fileType,
-			.fileSize    = 0,
-			.nlinks      = 1,
-			.uid         = getuid(),
-			.gid         = getgid(),
-			.permissions = mode,
-			.atime       = now,
-			.mtime       = now,
-			.ctime       = now,
+			.inUse        = true,
+			.inum         = inum,
+			.fileType     = fileType,
+			.fileSize     = 0,
+			.nlinks       = 1,
+			.uid          = getuid(),
+			.gid          = getgid(),
+			.permissions  = mode,
+			.atime        = now,
+			.mtime        = now,
+			.ctime        = now,
+			.extentMapped = fileType == FileType::File,
+			.extentCount  = 0,
+			.dataInline   = CanInline(fileType),
 		};
 
 		for (int b = 0; b < 4; ++b)
@@ -568,158 +1074,1396 @@ private:
 			};
 		}
 
-		newINode.indirectBlock = {
-			.logSegment  = EMPTY_DIRECT_BLOCK_ADDRESS,
-			.blockNumber = EMPTY_DIRECT_BLOCK_ADDRESS
-		};
+		for (unsigned int height = 1; height <= MAX_BLOCK_MAP_HEIGHT; ++height)
+		{
+			*GetBlockMapRoot(&newINode, height) = {
+				.logSegment  = EMPTY_DIRECT_BLOCK_ADDRESS,
+				.blockNumber = EMPTY_DIRECT_BLOCK_ADDRESS
+			};
+		}
+
+
+		if (inum == iFileSizeInINodes + 1)
+		{
+			iFileSizeInINodes++;
+		}
+
+		freeINums.erase(inum);
+		*out = inum;
+		return UpdateIFile(newINode);
+	}
+
+	// reference counts of deduplicated blocks are not stored on flash. on mount count the file blocks pointing at each block,
+	// walking only the written runs of each file
+	int RestoreBlockReferences()
+	{
+		std::cout << "[FileLayer] Restoring block references" << std::endl;
+
+		std::map<std::pair<unsigned int, unsigned int>, std::vector<BlockOwner>> owners;
+		for (unsigned int inum = IFILE_INUM + 1; inum <= iFileSizeInINodes; ++inum)
+		{
+			INode inode = GetINode(inum);
+			if (!inode.inUse || GetWriteStream(inode, false) == WriteStream::Metadata)
+			{
+				continue;
+			}
+
+			FileMap fileMap;
+			unsigned int fileBlocks = std::min(inode.fileSize / blockSizeInBytes + (inode.fileSize % blockSizeInBytes > 0), maxFileBlocks);
+			for (unsigned int block = 0; block < fileBlocks;)
+			{
+				bool allocated;
+				unsigned int run;
+				if (GetBlockRun(inode, fileMap, block, &allocated, &run) != 0)
+				{
+					return 1;
+				}
+
+				unsigned int end = run < fileBlocks - block ? block + run : fileBlocks;
+				for (; allocated && block < end; ++block)
+				{
+					LogAddress address;
+					if (GetBlockAddress(inode, fileMap, block, &address) != 0)
+					{
+						return 1;
+					}
+
+					owners[std::make_pair(address.logSegment, address.blockNumber)].push_back({ .inum = inum, .fileBlock = (int)block });
+				}
+
+				block = end;
+			}
+		}
+
+		// a block with one owner needs no entry unless that owner deduplicated it and the file block
+		// its summary names has been overwritten since. owners are in address order, so each summary
+		// is read once
+		InMemorySegment * segment = NULL;
+		for (auto it = owners.begin(); it != owners.end(); ++it)
+		{
+			LogAddress address = { .logSegment = it->first.first, .blockNumber = it->first.second };
+			if (it->second.size() == 1)
+			{
+				if (segment == NULL || segment->summary.segmentNumber != address.logSegment)
+				{
+					if (segment != NULL)
+					{
+						log->FreeSegment(segment);
+					}
+
+					segment = log->ReadSegmentSummary(address.logSegment);
+				}
+
+				BlockOwner owner = it->second[0];
+				if (segment == NULL || address.blockNumber >= segment->summary.numberOfBlocks ||
+					(segment->summary.blockINums[address.blockNumber] == (int)owner.inum && segment->summary.iNodeBlockNumbers[address.blockNumber] == owner.fileBlock))
+				{
+					continue;
+				}
+			}
+
+			log->RestoreBlockReferences(address, it->second);
+		}
+
+		if (segment != NULL)
+		{
+			log->FreeSegment(segment);
+		}
+
+		return 0;
+	}
+
+	int UpdateIFile(INode toUpdate)
+	{
+		unsigned int inum = toUpdate.inum;
+		if (inum == IFILE_INUM)
+		{
+    		log->UpdateIFileINode(toUpdate);
+			return 0;
+		}
+
+		std::lock_guard<std::mutex> cacheLock(inodeCacheMutex);
+		CachedINode& cached = inodeCache.emplace(inum, CachedINode{ toUpdate, false }).first->second;
+		if (!cached.dirty)
+		{
+			dirtyINodes++;
+		}
+
+		cached.inode = toUpdate;
+		cached.dirty = true;
+		EvictCleanINodes();
+		return 0;
+	}
+
+	// drops clean inodes once the cache is over its size, down to three quarters of it so the scan is
+	// not repeated on every miss. dirty inodes stay until they are written back. inodeCacheMutex is held
+	void EvictCleanINodes()
+	{
+		if (inodeCache.size() <= INODE_CACHE_SIZE)
+		{
+			return;
+		}
+
+		for (auto it = inodeCache.begin(); it != inodeCache.end() && inodeCache.size() > INODE_CACHE_SIZE * 3 / 4;)
+		{
+			it = it->second.dirty ? std::next(it) : inodeCache.erase(it);
+		}
+	}
+
+	// called at the end of operations that change inodes, with cleanerMutex held
+	int WriteBackIfDue()
+	{
+		if (log->IsCheckpointDue())
+		{
+			return Checkpoint();
+		}
+
+		bool due;
+		{
+			std::lock_guard<std::mutex> cacheLock(inodeCacheMutex);
+			due = dirtyINodes >= INODE_CACHE_SIZE / 2 || (dirtyINodes > 0 && log->GetSegmentsFlushed() != segmentsFlushedAtWriteBack);
+		}
 
+		if (due)
+		{
+			std::unique_lock<std::shared_mutex> iFileLock(iFileMutex);
+			if (WriteBackINodes() != 0)
+			{
+				return 1;
+			}
+		}
+
+		// writing back can fill a segment too
+		return log->IsCheckpointDue() ? Checkpoint() : 0;
+	}
+
+	// writes the dirty inodes back and checkpoints while no other write back can start, so the
+	// checkpoint holds every inode change made before it. cleanerMutex is held
+	int Checkpoint()
+	{
+		std::unique_lock<std::shared_mutex> iFileLock(iFileMutex);
+		if (WriteBackINodes() != 0)
+		{
+			return 1;
+		}
+
+		return log->CheckpointNow();
+	}
+
+	// writes every dirty inode to the ifile. inodes in the same ifile block go out in one write, in inum
+	// order so the ifile grows one block after another. iFileMutex is held exclusively
+	int WriteBackINodes()
+	{
+		std::map<unsigned int, INode> dirty;
+		{
+			std::lock_guard<std::mutex> cacheLock(inodeCacheMutex);
+			segmentsFlushedAtWriteBack = log->GetSegmentsFlushed();
+			for (auto it = inodeCache.begin(); it != inodeCache.end(); ++it)
+			{
+				if (it->second.dirty)
+				{
+					dirty[it->first]  = it->second.inode;
+					it->second.dirty  = false;
+				}
+			}
+
+			dirtyINodes = 0;
+		}
+
+		if (dirty.empty())
+		{
+			return 0;
+		}
+
+		TRACE_DEBUG(FileWriteBackINodes, dirty.size());
+		inodeWriteBacks++;
+		inodesWrittenBack += dirty.size();
+		INode iFileINode = log->GetIFileINode();
+		int ret          = 0;
+		for (auto it = dirty.begin(); it != dirty.end();)
+		{
+			unsigned int block = (it->first - 1) * sizeof(INode) / blockSizeInBytes;
+			auto next          = it;
+			unsigned int last  = it->first;
+			while (next != dirty.end() && (next->first - 1) * sizeof(INode) / blockSizeInBytes == block)
+			{
+				last = next->first;
+				++next;
+			}
+
+			// the clean inodes between the dirty ones are read back from the ifile
+			unsigned int first  = it->first;
+			unsigned int offset = (first - 1) * sizeof(INode);
+			unsigned int length = (last - first + 1) * sizeof(INode);
+			INode * inodes      = (INode *)malloc(length);
+			if (ReadIFile(offset, length, inodes) != 0)
+			{
+				std::cerr << "[FileLayer] ERROR: unable to read the ifile to write back inodes. inum: " << first << std::endl;
+				free(inodes);
+				MarkDirty(it, dirty.end());
+				ret = 1;
+				break;
+			}
+
+			for (auto dirtyINode = it; dirtyINode != next; ++dirtyINode)
+			{
+				inodes[dirtyINode->first - first] = dirtyINode->second;
+			}
+
+			if (WriteIFile(&iFileINode, offset, length, inodes) != 0)
+			{
+				std::cerr << "[FileLayer] ERROR: unable to write back inodes. inum: " << first << std::endl;
+				free(inodes);
+				MarkDirty(it, dirty.end());
+				ret = 1;
+				break;
+			}
+
+			free(inodes);
+			it = next;
+		}
+
+		// the blocks written so far are reachable once the map nodes above them are written
+		if (WriteBlockMapNodes(&iFileINode, iNodeMap) != 0)
+		{
+			std::cerr << "[FileLayer] ERROR: unable to write the inode map" << std::endl;
+			ret = 1;
+		}
+
+		log->UpdateIFileINode(iFileINode);
+		return ret;
+	}
+
+	// reads a range of the ifile through the inode map. the part past the end of the ifile reads as zeros
+	int ReadIFile(unsigned int offset, unsigned int length, void * buffer)
+	{
+		INode iFileINode = log->GetIFileINode();
+		memset(buffer, 0, length);
+		length = offset < iFileINode.fileSize ? std::min(length, iFileINode.fileSize - offset) : 0;
+
+		void * blockBuffer = malloc(blockSizeInBytes);
+		int ret            = 0;
+		for (unsigned int done = 0; done < length && ret == 0;)
+		{
+			unsigned int block       = (offset + done) / blockSizeInBytes;
+			unsigned int blockOffset = (offset + done) % blockSizeInBytes;
+			unsigned int copyLength  = std::min(blockSizeInBytes - blockOffset, length - done);
+			LogAddress address;
+			ret = GetINodeMapAddress(iFileINode, block, &address);
+			memset(blockBuffer, 0, blockSizeInBytes);
+			if (ret == 0 && address.logSegment != EMPTY_DIRECT_BLOCK_ADDRESS && log->Log_Read(address, blockBuffer) != 0)
+			{
+				std::cerr << "[FileLayer] ERROR: Log read failed reading the ifile. block: " << block << std::endl;
+				ret = 1;
+			}
+
+			memcpy((char *)buffer + done, (char *)blockBuffer + blockOffset, copyLength);
+			done += copyLength;
+		}
+
+		free(blockBuffer);
+		return ret;
+	}
+
+	// writes a range of the ifile and grows it to cover the range. the inode map nodes that change are
+	// left dirty in iNodeMap. iFileMutex is held exclusively
+	int WriteIFile(INode * iFileINode, unsigned int offset, unsigned int length, const void * buffer)
+	{
+		void * blockBuffer = malloc(blockSizeInBytes);
+		int ret            = 0;
+		for (unsigned int done = 0; done < length && ret == 0;)
+		{
+			unsigned int block       = (offset + done) / blockSizeInBytes;
+			unsigned int blockOffset = (offset + done) % blockSizeInBytes;
+			unsigned int writeLength = std::min(blockSizeInBytes - blockOffset, length - done);
+			LogAddress address;
+			if (GetINodeMapAddress(*iFileINode, block, &address) != 0)
+			{
+				ret = 1;
+				break;
+			}
+
+			bool overwrite = address.logSegment != EMPTY_DIRECT_BLOCK_ADDRESS;
+			bool partial   = overwrite && writeLength < blockSizeInBytes;
+			memset(blockBuffer, 0, blockSizeInBytes);
+			if (partial && log->Log_Read(address, blockBuffer) != 0)
+			{
+				std::cerr << "[FileLayer] ERROR: Log read failed writing the ifile. block: " << block << std::endl;
+				ret = 1;
+				break;
+			}
+
+			memcpy((char *)blockBuffer + blockOffset, (char *)buffer + done, writeLength);
+			if (!overwrite || log->Log_Rewrite(address, blockBuffer) != 0)
+			{
+				if (overwrite)
+				{
+					log->Log_Free(address);
+				}
+
+				if (log->Log_Write(IFILE_INUM, block, blockBuffer, &address, GetWriteStream(*iFileINode, overwrite), GetWriteCause(*iFileINode, partial)) != 0)
+				{
+					std::cerr << "[FileLayer] ERROR: Log_Write failed writing the ifile. block: " << block << std::endl;
+					ret = 1;
+					break;
+				}
+
+				ret = SetBlockMapAddress(iFileINode, iNodeMap, block, address);
+			}
+
+			done += writeLength;
+			iFileINode->fileSize = std::max(iFileINode->fileSize, offset + done);
+		}
+
+		free(blockBuffer);
+		return ret;
+	}
+
+	// the address of an ifile block. the cleaner moves ifile blocks and nodes with a map of its own, and
+	// as a moved node takes its ancestors with it, the kept nodes are dropped when a root has moved
+	int GetINodeMapAddress(INode& iFileINode, unsigned int block, LogAddress * address)
+	{
+		std::lock_guard<std::mutex> mapLock(iNodeMapMutex);
+		for (unsigned int height = 1; height <= MAX_BLOCK_MAP_HEIGHT; ++height)
+		{
+			auto root = iNodeMap.find(blockMap.NodeId(blockMap.RootFirstBlock(height), height));
+			if (root != iNodeMap.end() && !(root->second.address == *GetBlockMapRoot(&iFileINode, height)))
+			{
+				iNodeMap.clear();
+				break;
+			}
+		}
+
+		if (block >= maxFileBlocks)
+		{
+			std::cerr << "[FileLayer] ERROR: the ifile is full. block: " << block << std::endl;
+			return 1;
+		}
+
+		return GetBlockMapAddress(iFileINode, iNodeMap, block, address);
+	}
+
+	// inodes that could not be written back are kept dirty so the next write back tries again
+	void MarkDirty(std::map<unsigned int, INode>::iterator from, std::map<unsigned int, INode>::iterator to)
+	{
+		std::lock_guard<std::mutex> cacheLock(inodeCacheMutex);
+		for (auto it = from; it != to; ++it)
+		{
+			CachedINode& cached = inodeCache.emplace(it->first, CachedINode{ it->second, false }).first->second;
+			if (!cached.dirty)
+			{
+				dirtyINodes++;
+				cached.dirty = true;
+			}
+		}
+	}
+
+	// the ifile is mapped like any other file, so it can hold as many inodes as the largest file
+	unsigned int GetMaxINodes()
+	{
+		return std::min((unsigned long long)maxFileBlocks * blockSizeInBytes, (unsigned long long)UINT_MAX) / sizeof(INode);
+	}
+
+	// the lowest free inum, or the one past the end of the ifile. allocationMutex is held
+	unsigned int GetUnusedINum()
+	{
+		return freeINums.empty() ? iFileSizeInINodes + 1 : *freeINums.begin();
+	}
+
+	// reads the ifile a block at a time on mount and collects the inums that are not in use
+	int LoadFreeINums()
+	{
+		unsigned int iNodesInBlock = blockSizeInBytes / sizeof(INode);
+		INode * iNodes             = (INode *)malloc(iNodesInBlock * sizeof(INode));
+		freeINums.clear();
+		for (unsigned int first = IFILE_INUM + 1; first <= iFileSizeInINodes; first += iNodesInBlock)
+		{
+			unsigned int count = std::min(iNodesInBlock, iFileSizeInINodes - first + 1);
+			if (ReadIFile((first - 1) * sizeof(INode), count * sizeof(INode), iNodes) != 0)
+			{
+				std::cerr << "[FileLayer] ERROR: unable to read the ifile to find free inodes. inum: " << first << std::endl;
+				free(iNodes);
+				return 1;
+			}
+
+			for (unsigned int i = 0; i < count; ++i)
+			{
+				if (!iNodes[i].inUse)
+				{
+					freeINums.insert(first + i);
+				}
+			}
+		}
+
+		free(iNodes);
+		return 0;
+	}
+
+	// the address of a file block, from the file's extents or its block map
+	int GetBlockAddress(INode& iNode, FileMap& map, unsigned int blockNum, LogAddress * address)
+	{
+		if (!iNode.extentMapped || blockNum < NUM_DIRECT_BLOCKS)
+		{
+			return GetBlockMapAddress(iNode, map.nodes, blockNum, address);
+		}
+
+		if (LoadExtents(iNode, map) != 0)
+		{
+			return 1;
+		}
+
+		unsigned int extent = FindExtent(map.extents, blockNum);
+		if (extent == map.extents.size())
+		{
+			address->logSegment  = EMPTY_DIRECT_BLOCK_ADDRESS;
+			address->blockNumber = EMPTY_DIRECT_BLOCK_ADDRESS;
+			return 0;
+		}
+
+		*address = map.extents[extent].GetAddress(blockNum);
+		return 0;
+	}
+
+	// the number of blocks from blockNum on that are all written or all holes, at least 1. an extent
+	// or the gap before the next one is a run, and so is the part of a missing block map node
+	// from blockNum to its end
+	int GetBlockRun(INode& iNode, FileMap& map, unsigned int blockNum, bool * allocated, unsigned int * run)
+	{
+		*run = 1;
+		if (blockNum < NUM_DIRECT_BLOCKS)
+		{
+			*allocated = iNode.directBlocks[blockNum].logSegment != EMPTY_DIRECT_BLOCK_ADDRESS;
+			return 0;
+		}
+
+		if (iNode.extentMapped)
+		{
+			if (LoadExtents(iNode, map) != 0)
+			{
+				return 1;
+			}
+
+			std::vector<Extent>& extents = map.extents;
+			auto next = std::upper_bound(extents.begin(), extents.end(), blockNum, [](unsigned int b, const Extent& extent)
+			{
+				return b < extent.fileBlock;
+			});
+
+			*allocated = next != extents.begin() && blockNum < (next - 1)->End();
+			if (*allocated)
+			{
+				*run = (next - 1)->End() - blockNum;
+			}
+			else if (next != extents.end())
+			{
+				*run = next->fileBlock - blockNum;
+			}
+			else
+			{
+				*run = maxFileBlocks - blockNum;
+			}
+
+			return 0;
+		}
+
+		if (blockNum >= maxFileBlocks)
+		{
+			*allocated = false;
+			return 0;
+		}
+
+		for (unsigned int height = blockMap.GetHeight(blockNum); height >= 1; --height)
+		{
+			BlockMapNode * node = NULL;
+			if (GetBlockMapNode(iNode, map.nodes, blockNum, height, false, &node) != 0)
+			{
+				return 1;
+			}
+
+			if (node == NULL)
+			{
+				*allocated = false;
+				*run       = blockMap.NodeFirstBlock(blockNum, height) + blockMap.Span(height) - blockNum;
+				return 0;
+			}
+
+			if (height == 1)
+			{
+				*allocated = node->entries[blockMap.ChildIndex(blockNum, 1)].logSegment != EMPTY_DIRECT_BLOCK_ADDRESS;
+			}
+		}
+
+		return 0;
+	}
+
+	// changes the address of a file block. changed extents and block map nodes are written by the
+	// caller with WriteBlockMap
+	int SetBlockAddress(INode * iNode, FileMap& map, unsigned int blockNum, LogAddress logAddress)
+	{
+		if (!iNode->extentMapped || blockNum < NUM_DIRECT_BLOCKS)
+		{
+			return SetBlockMapAddress(iNode, map.nodes, blockNum, logAddress);
+		}
+
+		if (LoadExtents(*iNode, map) != 0)
+		{
+			return 1;
+		}
+
+		// a block that is already mapped is split out of its run, and the blocks rewritten after it join
+		// it again. a block in a hole goes between the extents around it
+		std::vector<Extent>& extents = map.extents;
+		if (FindExtent(extents, blockNum) != extents.size())
+		{
+			if (MoveExtentBlock(*iNode, map, blockNum, logAddress) != 0)
+			{
+				return 1;
+			}
+		}
+		else
+		{
+			Extent added = {
+				.fileBlock = blockNum,
+				.length    = 1,
+				.address   = logAddress
+			};
+
+			auto next = std::upper_bound(extents.begin(), extents.end(), blockNum, [](unsigned int b, const Extent& extent)
+			{
+				return b < extent.fileBlock;
+			});
+
+			unsigned int index = next - extents.begin();
+			extents.insert(next, added);
+			unsigned int first = index > 0 ? index - 1 : 0;
+			JoinExtents(extents, first, std::min(index + 1, (unsigned int)extents.size() - 1));
+			map.firstChangedExtent = std::min(map.firstChangedExtent, first);
+		}
+
+		if (extents.size() > numExtentsInBlock && extents.back().End() - NUM_DIRECT_BLOCKS < extents.size() * MIN_AVERAGE_EXTENT_LENGTH)
+		{
+			return ConvertToBlockMap(iNode, map);
+		}
+
+		return 0;
+	}
+
+	// the address of a block mapped by the block map. the nodes on the way to it are looked up in nodes
+	// and the ones an operation has not used yet are loaded into it
+	int GetBlockMapAddress(INode& iNode, BlockMapNodes& nodes, unsigned int blockNum, LogAddress * address)
+	{
+		if (blockNum < NUM_DIRECT_BLOCKS)
+		{
+			*address = iNode.directBlocks[blockNum];
+			return 0;
+		}
+
+		if (blockNum >= maxFileBlocks)
+		{
+			std::cerr << "[FileLayer] ERROR: GetBlockMapAddress Beyond max number of blocks" << std::endl;
+			throw;
+		}
+
+		BlockMapNode * node = NULL;
+		if (GetBlockMapNode(iNode, nodes, blockNum, 1, false, &node) != 0)
+		{
+			return 1;
+		}
+
+		if (node == NULL)
+		{
+			address->logSegment  = EMPTY_DIRECT_BLOCK_ADDRESS;
+			address->blockNumber = EMPTY_DIRECT_BLOCK_ADDRESS;
+			return 0;
+		}
+
+		*address = node->entries[blockMap.ChildIndex(blockNum, 1)];
+		return 0;
+	}
+
+	// changes a block address in the inode or in its block map node, creating the nodes the block is
+	// the first to need
+	int SetBlockMapAddress(INode * iNode, BlockMapNodes& nodes, unsigned int blockNum, LogAddress logAddress)
+	{
+		if (blockNum < NUM_DIRECT_BLOCKS)
+		{
+			iNode->directBlocks[blockNum] = logAddress;
+			return 0;
+		}
+
+		BlockMapNode * node = NULL;
+		if (GetBlockMapNode(*iNode, nodes, blockNum, 1, true, &node) != 0)
+		{
+			return 1;
+		}
+
+		node->entries[blockMap.ChildIndex(blockNum, 1)] = logAddress;
+		node->dirty                                     = true;
+		return 0;
+	}
+
+	int GetExtentListBlockAddress(INode& iNode, BlockMapNodes& nodes, unsigned int listBlock, LogAddress * address)
+	{
+		if (listBlock == 0)
+		{
+			*address = iNode.indirectBlock;
+			return 0;
+		}
+
+		return GetBlockMapAddress(iNode, nodes, blockMap.ExtentListMapBlock(listBlock), address);
+	}
+
+	int SetExtentListBlockAddress(INode * iNode, BlockMapNodes& nodes, unsigned int listBlock, LogAddress logAddress)
+	{
+		if (listBlock == 0)
+		{
+			iNode->indirectBlock = logAddress;
+			return 0;
+		}
+
+		return SetBlockMapAddress(iNode, nodes, blockMap.ExtentListMapBlock(listBlock), logAddress);
+	}
+
+	// loads the extents of an extent mapped file, from the extent cache when it holds the list the
+	// inode's block map points at
+	int LoadExtents(INode& iNode, FileMap& map)
+	{
+		if (map.extentsLoaded)
+		{
+			return 0;
+		}
+
+		LogAddress lastBlock = {
+			.logSegment  = EMPTY_DIRECT_BLOCK_ADDRESS,
+			.blockNumber = EMPTY_DIRECT_BLOCK_ADDRESS
+		};
+
+		unsigned int listBlocks = GetExtentListBlocks(iNode.extentCount);
+		if (listBlocks > 0 && GetExtentListBlockAddress(iNode, map.nodes, listBlocks - 1, &lastBlock) != 0)
+		{
+			return 1;
+		}
+
+		{
+			std::lock_guard<std::mutex> cacheLock(extentCacheMutex);
+			auto cached = extentCache.find(iNode.inum);
+			if (cached != extentCache.end() && cached->second.lastBlock == lastBlock && cached->second.extents.size() == iNode.extentCount)
+			{
+				map.extents       = cached->second.extents;
+				map.extentsLoaded = true;
+				return 0;
+			}
+		}
+
+		map.extents.clear();
+		void * blockBuffer = malloc(blockSizeInBytes);
+		int ret            = 0;
+		for (unsigned int listBlock = 0; listBlock < listBlocks && ret == 0; ++listBlock)
+		{
+			LogAddress address;
+			ret = GetExtentListBlockAddress(iNode, map.nodes, listBlock, &address);
+			if (ret == 0 && (address.logSegment == EMPTY_DIRECT_BLOCK_ADDRESS || log->Log_Read(address, blockBuffer) != 0))
+			{
+				std::cerr << "[FileLayer] ERROR: unable to read extent list. inum: " << iNode.inum << " list block: " << listBlock << std::endl;
+				ret = 1;
+			}
+
+			if (ret == 0)
+			{
+				Extent * extents   = (Extent *)blockBuffer;
+				unsigned int count = std::min(numExtentsInBlock, iNode.extentCount - listBlock * numExtentsInBlock);
+				map.extents.insert(map.extents.end(), extents, extents + count);
+			}
+		}
+
+		free(blockBuffer);
+		if (ret == 0)
+		{
+			map.extentsLoaded = true;
+			CacheExtents(iNode.inum, lastBlock, map.extents);
+		}
+
+		return ret;
+	}
+
+	unsigned int GetExtentListBlocks(unsigned int extentCount)
+	{
+		return extentCount / numExtentsInBlock + (extentCount % numExtentsInBlock > 0);
+	}
+
+	// the extent holding block, or extents.size() when no extent does
+	unsigned int FindExtent(std::vector<Extent>& extents, unsigned int block)
+	{
+		auto next = std::upper_bound(extents.begin(), extents.end(), block, [](unsigned int b, const Extent& extent)
+		{
+			return b < extent.fileBlock;
+		});
+
+		if (next == extents.begin() || block >= (next - 1)->End())
+		{
+			return extents.size();
+		}
+
+		return next - 1 - extents.begin();
+	}
+
+	void CacheExtents(unsigned int inum, LogAddress lastBlock, std::vector<Extent>& extents)
+	{
+		std::lock_guard<std::mutex> cacheLock(extentCacheMutex);
+		if (extentCache.size() >= EXTENT_CACHE_SIZE && extentCache.find(inum) == extentCache.end())
+		{
+			extentCache.erase(extentCache.begin());
+		}
+
+		CachedExtents& cached = extentCache[inum];
+		cached.lastBlock      = lastBlock;
+		cached.extents        = extents;
+	}
+
+	// points one block of an extent at its moved copy. the extent is split around the block and the
+	// pieces are joined with their neighbours again, so a run the cleaner moves in order ends up as
+	// one extent
+	int MoveExtentBlock(INode& iNode, FileMap& map, unsigned int blockNum, LogAddress logAddress)
+	{
+		if (LoadExtents(iNode, map) != 0)
+		{
+			return 1;
+		}
+
+		std::vector<Extent>& extents = map.extents;
+		unsigned int index           = FindExtent(extents, blockNum);
+		if (index == extents.size())
+		{
+			std::cerr << "[FileLayer] ERROR: MoveExtentBlock block is not in an extent. inum: " << iNode.inum << " block: " << blockNum << std::endl;
+			return 1;
+		}
+
+		Extent old = extents[index];
+		std::vector<Extent> pieces;
+		if (blockNum > old.fileBlock)
+		{
+			pieces.push_back({ .fileBlock = old.fileBlock, .length = blockNum - old.fileBlock, .address = old.address });
+		}
+
+		pieces.push_back({ .fileBlock = blockNum, .length = 1, .address = logAddress });
+		if (blockNum + 1 < old.End())
+		{
+			pieces.push_back({ .fileBlock = blockNum + 1, .length = old.End() - blockNum - 1, .address = old.GetAddress(blockNum + 1) });
+		}
+
+		extents.erase(extents.begin() + index);
+		extents.insert(extents.begin() + index, pieces.begin(), pieces.end());
+
+		unsigned int first = index > 0 ? index - 1 : 0;
+		JoinExtents(extents, first, std::min(index + (unsigned int)pieces.size(), (unsigned int)extents.size() - 1));
+
+		map.firstChangedExtent = std::min(map.firstChangedExtent, first);
+		return 0;
+	}
+
+	// merges the extents from first to last that continue the one before them
+	void JoinExtents(std::vector<Extent>& extents, unsigned int first, unsigned int last)
+	{
+		for (unsigned int extent = last; extent > first; --extent)
+		{
+			if (extents[extent - 1].Continues(extents[extent]))
+			{
+				extents[extent - 1].length += extents[extent].length;
+				extents.erase(extents.begin() + extent);
+			}
+		}
+	}
+
+	// moves an extent mapped file to a block map. the extent list is freed and every block of the
+	// extents is mapped one by one
+	int ConvertToBlockMap(INode * iNode, FileMap& map)
+	{
+		if (LoadExtents(*iNode, map) != 0 || FreeBlockMapTrees(iNode) != 0)
+		{
+			return 1;
+		}
+
+		TRACE_INFO(FileToBlockMap, iNode->inum, map.extents.size());
+
+		std::vector<Extent> extents = map.extents;
+		iNode->extentMapped         = false;
+		iNode->extentCount          = 0;
+		map.nodes.clear();
+		map.extents.clear();
+		map.extentsLoaded           = false;
+		map.firstChangedExtent      = UINT_MAX;
+		UncacheExtents(iNode->inum);
+		extentFilesConverted++;
+
+		for (Extent& extent : extents)
+		{
+			for (unsigned int block = extent.fileBlock; block < extent.End(); ++block)
+			{
+				if (SetBlockMapAddress(iNode, map.nodes, block, extent.GetAddress(block)) != 0)
+				{
+					return 1;
+				}
+			}
+		}
+
+		return 0;
+	}
+
+	void UncacheExtents(unsigned int inum)
+	{
+		std::lock_guard<std::mutex> cacheLock(extentCacheMutex);
+		extentCache.erase(inum);
+	}
+
+	// finds the node of the given height on the path from the root to blockNum, loading the nodes above
+	// it as needed. a missing node is created empty when create is set and is NULL otherwise
+	int GetBlockMapNode(INode& iNode, BlockMapNodes& nodes, unsigned int blockNum, unsigned int height, bool create, BlockMapNode ** out)
+	{
+		unsigned int rootHeight = blockMap.GetHeight(blockNum);
+		BlockMapNode * parent   = NULL;
+		for (unsigned int h = rootHeight; h >= height; --h)
+		{
+			int id    = blockMap.NodeId(blockMap.NodeFirstBlock(blockNum, h), h);
+			auto node = nodes.find(id);
+			if (node == nodes.end())
+			{
+				LogAddress address = parent == NULL ? *GetBlockMapRoot(&iNode, rootHeight) : parent->entries[blockMap.ChildIndex(blockNum, h + 1)];
+				BlockMapNode loaded;
+				loaded.address = address;
+				loaded.dirty   = false;
+				if (address.logSegment == EMPTY_DIRECT_BLOCK_ADDRESS)
+				{
+					if (!create)
+					{
+						*out = NULL;
+						return 0;
+					}
+
+					LogAddress empty = {
+						.logSegment  = EMPTY_DIRECT_BLOCK_ADDRESS,
+						.blockNumber = EMPTY_DIRECT_BLOCK_ADDRESS
+					};
+
+					loaded.entries.assign(numLogAddrInBlock, empty);
+				}
+				else if (ReadBlockMapNode(iNode.inum, id, address, loaded.entries) != 0)
+				{
+					return 1;
+				}
+
+				node = nodes.emplace(id, loaded).first;
+			}
+
+			parent = &node->second;
+		}
+
+		*out = parent;
+		return 0;
+	}
+
+	// decodes a block map node, from the block map cache when it holds the copy at address
+	int ReadBlockMapNode(unsigned int inum, int id, LogAddress address, std::vector<LogAddress>& entries)
+	{
+		{
+			std::lock_guard<std::mutex> cacheLock(blockMapCacheMutex);
+			auto cached = blockMapCache.find(GetBlockMapCacheKey(inum, id));
+			if (cached != blockMapCache.end() && cached->second.address == address)
+			{
+				entries = cached->second.blocks;
+				return 0;
+			}
+		}
+
+		LogAddress * read = ReadIndirectBlocks(address);
+		if (read == NULL)
+		{
+			return 1;
+		}
+
+		entries.assign(read, read + numLogAddrInBlock);
+		free(read);
+		CacheIndirectBlocks(inum, id, address, entries);
+		return 0;
+	}
+
+	unsigned long long GetBlockMapCacheKey(unsigned int inum, int id)
+	{
+		return ((unsigned long long)inum << 32) | (uint32_t)id;
+	}
+
+	void CacheIndirectBlocks(unsigned int inum, int id, LogAddress address, std::vector<LogAddress>& entries)
+	{
+		unsigned long long key = GetBlockMapCacheKey(inum, id);
+		std::lock_guard<std::mutex> cacheLock(blockMapCacheMutex);
+		if (blockMapCache.size() >= BLOCK_MAP_CACHE_SIZE && blockMapCache.find(key) == blockMapCache.end())
+		{
+			blockMapCache.erase(blockMapCache.begin());
+		}
+
+		CachedBlockMap& cached = blockMapCache[key];
+		cached.address         = address;
+		cached.blocks          = entries;
+	}
+
+	// drops the cached nodes of a file
+	void UncacheIndirectBlocks(unsigned int inum)
+	{
+		std::lock_guard<std::mutex> cacheLock(blockMapCacheMutex);
+		for (auto it = blockMapCache.begin(); it != blockMapCache.end();)
+		{
+			it = it->first >> 32 == inum ? blockMapCache.erase(it) : std::next(it);
+		}
+	}
+
+	LogAddress * ReadIndirectBlocks(LogAddress addr)
+	{
+		if (addr.logSegment == EMPTY_DIRECT_BLOCK_ADDRESS || addr.blockNumber == EMPTY_DIRECT_BLOCK_ADDRESS)
+		{
+			std::cerr << "[FileLayer] ERROR: ReadIndirectBlocks attempting to read empty log address" << std::endl;
+			throw;
+		}
+
+		void * indirectBlocksBuffer = malloc(blockSizeInBytes);
+		memset(indirectBlocksBuffer, 0, blockSizeInBytes);
+
+		if (log->Log_Read(addr, indirectBlocksBuffer) != 0)
+		{
+			std::cerr << "[FileLayer] ERROR: Log read failed in ReadIndirectBlocks" << std::endl;
+        	addr.Print();
+        	free(indirectBlocksBuffer);
+        	return NULL;
+		}
+
+		LogAddress * indirectBlocks = (LogAddress *)malloc(numLogAddrInBlock * sizeof(LogAddress));
+		memcpy(indirectBlocks, indirectBlocksBuffer, numLogAddrInBlock * sizeof(LogAddress));
+		free(indirectBlocksBuffer);
+		return indirectBlocks;
+	}
+
+	// regular files and symlinks keep their data in the inode until it outgrows INLINE_DATA_SIZE
+	bool CanInline(FileType fileType)
+	{
+		return fileType == FileType::File || fileType == FileType::Symlink;
+	}
+
+	// gives every block of a file back to the log, including its extent list and the nodes of its block map
+	int FreeFileBlocks(INode * iNode)
+	{
+		if (iNode->extentMapped)
+		{
+			FileMap map;
+			if (LoadExtents(*iNode, map) != 0)
+			{
+				return 1;
+			}
+
+			for (Extent& extent : map.extents)
+			{
+				for (unsigned int block = extent.fileBlock; block < extent.End(); ++block)
+				{
+					log->Log_Free(extent.GetAddress(block));
+				}
+			}
+		}
+
+		int ret = FreeBlockMap(iNode);
+		UncacheExtents(iNode->inum);
+		iNode->extentMapped = iNode->fileType == FileType::File;
+		iNode->extentCount  = 0;
+		iNode->dataInline   = CanInline(iNode->fileType);
+		return ret;
+	}
+
+	// frees the blocks from firstBlock to the end of the file. the extents are cut at firstBlock and
+	// the block map nodes that only map blocks past it are freed whole, so the work is proportional to
+	// what is freed. the changes are written by the caller with WriteBlockMap
+	int FreeBlocksFrom(INode * iNode, FileMap& map, unsigned int firstBlock)
+	{
+		for (unsigned int b = firstBlock; b < NUM_DIRECT_BLOCKS; ++b)
+		{
+			if (iNode->directBlocks[b].logSegment != EMPTY_DIRECT_BLOCK_ADDRESS)
+			{
+				log->Log_Free(iNode->directBlocks[b]);
+			}
+
+			iNode->directBlocks[b].logSegment  = EMPTY_DIRECT_BLOCK_ADDRESS;
+			iNode->directBlocks[b].blockNumber = EMPTY_DIRECT_BLOCK_ADDRESS;
+		}
+
+		if (iNode->extentMapped)
+		{
+			return FreeExtentsFrom(*iNode, map, std::max(firstBlock, (unsigned int)NUM_DIRECT_BLOCKS));
+		}
+
+		int ret = 0;
+		for (unsigned int height = 1; height <= MAX_BLOCK_MAP_HEIGHT && ret == 0; ++height)
+		{
+			LogAddress * root = GetBlockMapRoot(iNode, height);
+			if (blockMap.RootFirstBlock(height) >= firstBlock)
+			{
+				ret              += FreeBlockMapNode(iNode->inum, blockMap.RootFirstBlock(height), height, *root);
+				root->logSegment  = EMPTY_DIRECT_BLOCK_ADDRESS;
+				root->blockNumber = EMPTY_DIRECT_BLOCK_ADDRESS;
+				map.nodes.erase(blockMap.NodeId(blockMap.RootFirstBlock(height), height));
+			}
+			else if (blockMap.RootFirstBlock(height + 1) > firstBlock)
+			{
+				ret = FreeBlockMapEntriesFrom(*iNode, map.nodes, firstBlock);
+			}
+		}
+
+		return ret;
+	}
+
+	// empties the entries past firstBlock in the nodes on the path to it, from the root down
+	int FreeBlockMapEntriesFrom(INode& iNode, BlockMapNodes& nodes, unsigned int firstBlock)
+	{
+		for (unsigned int height = blockMap.GetHeight(firstBlock); height >= 1; --height)
+		{
+			BlockMapNode * node = NULL;
+			if (GetBlockMapNode(iNode, nodes, firstBlock, height, false, &node) != 0)
+			{
+				return 1;
+			}
+
+			if (node == NULL)
+			{
+				return 0;
+			}
+
+			unsigned long long nodeFirstBlock = blockMap.NodeFirstBlock(firstBlock, height);
+			int ret                           = 0;
+			for (unsigned int entry = blockMap.ChildIndex(firstBlock, height); entry < node->entries.size(); ++entry)
+			{
+				// the child that holds firstBlock keeps the blocks before it and is handled one level down
+				unsigned long long childFirstBlock = nodeFirstBlock + entry * blockMap.Span(height - 1);
+				LogAddress& child                  = node->entries[entry];
+				if (childFirstBlock < firstBlock || child.logSegment == EMPTY_DIRECT_BLOCK_ADDRESS)
+				{
+					continue;
+				}
+
+				if (height > 1)
+				{
+					ret += FreeBlockMapNode(iNode.inum, childFirstBlock, height - 1, child);
+					nodes.erase(blockMap.NodeId(childFirstBlock, height - 1));
+				}
+				else
+				{
+					log->Log_Free(child);
+				}
+
+				child.logSegment  = EMPTY_DIRECT_BLOCK_ADDRESS;
+				child.blockNumber = EMPTY_DIRECT_BLOCK_ADDRESS;
+				node->dirty       = true;
+			}
+
+			if (ret != 0)
+			{
+				return ret;
+			}
+		}
+
+		return 0;
+	}
+
+	// frees the blocks of the extents from firstBlock on and cuts the extent that holds it
+	int FreeExtentsFrom(INode& iNode, FileMap& map, unsigned int firstBlock)
+	{
+		if (LoadExtents(iNode, map) != 0)
+		{
+			return 1;
+		}
 
-		if (inum == iFileSizeInINodes + 1)
+		std::vector<Extent>& extents = map.extents;
+		unsigned int kept            = extents.size();
+		unsigned int firstChanged    = UINT_MAX;
+		while (kept > 0 && extents[kept - 1].End() > firstBlock)
 		{
-			iFileSizeInINodes++;
+			Extent& extent = extents[kept - 1];
+			for (unsigned int block = std::max(extent.fileBlock, firstBlock); block < extent.End(); ++block)
+			{
+				log->Log_Free(extent.GetAddress(block));
+			}
+
+			if (extent.fileBlock < firstBlock)
+			{
+				extent.length = firstBlock - extent.fileBlock;
+				firstChanged  = kept - 1;
+				break;
+			}
+
+			kept--;
+			firstChanged = kept;
 		}
 
-		*out = inum;
-		return UpdateIFile(newINode);
+		extents.resize(kept);
+		map.firstChangedExtent = std::min(map.firstChangedExtent, firstChanged);
+		return 0;
 	}
 
-	int UpdateIFile(INode toUpdate)
+	// frees the direct blocks and the trees of the block map
+	int FreeBlockMap(INode * iNode)
 	{
-		unsigned int inum = toUpdate.inum;
-		if (inum == IFILE_INUM)
-		{
-    		log->UpdateIFileINode(toUpdate);
-			return 0;
-		}
+		for (int b = 0; b < NUM_DIRECT_BLOCKS; ++b)
+        {
+        	if (iNode->directBlocks[b].logSegment != EMPTY_DIRECT_BLOCK_ADDRESS)
+        	{
+        		log->Log_Free(iNode->directBlocks[b]);
+        	}
 
-		unsigned int iNodeOffset = (inum - 1) * sizeof(INode);
-		return File_Write(IFILE_INUM, iNodeOffset, sizeof(INode), (const void *) &toUpdate);
+            iNode->directBlocks[b].logSegment  = EMPTY_DIRECT_BLOCK_ADDRESS; 
+            iNode->directBlocks[b].blockNumber = EMPTY_DIRECT_BLOCK_ADDRESS;
+        }
+
+        return FreeBlockMapTrees(iNode);
 	}
 
-	unsigned int GetUnusedINum()
+	// frees the trees of the block map and with them the extent list of an extent mapped file
+	int FreeBlockMapTrees(INode * iNode)
 	{
-		for (unsigned int inum = IFILE_INUM + 1; inum <= iFileSizeInINodes; inum++)
-		{
-			if (GetINode(inum).inUse == false)
-			{
-				return inum;
-			}
-		}
+        int ret = 0;
+        unsigned int height = 1;
+        if (iNode->extentMapped)
+        {
+        	// the indirect block is the first block of the extent list rather than a node
+        	if (iNode->indirectBlock.logSegment != EMPTY_DIRECT_BLOCK_ADDRESS)
+        	{
+        		log->Log_Free(iNode->indirectBlock);
+        	}
+
+        	iNode->indirectBlock.logSegment  = EMPTY_DIRECT_BLOCK_ADDRESS;
+        	iNode->indirectBlock.blockNumber = EMPTY_DIRECT_BLOCK_ADDRESS;
+        	height++;
+        }
+
+        for (; height <= MAX_BLOCK_MAP_HEIGHT; ++height)
+        {
+        	LogAddress * root = GetBlockMapRoot(iNode, height);
+        	ret              += FreeBlockMapNode(iNode->inum, blockMap.RootFirstBlock(height), height, *root);
+        	root->logSegment  = EMPTY_DIRECT_BLOCK_ADDRESS;
+        	root->blockNumber = EMPTY_DIRECT_BLOCK_ADDRESS;
+        }
 
-		return iFileSizeInINodes + 1;
+        UncacheIndirectBlocks(iNode->inum);
+        return ret;
 	}
 
-	LogAddress GetBlockAddress(INode iNode, unsigned int blockNum)
+	// frees a block map node and everything under it
+	int FreeBlockMapNode(unsigned int inum, unsigned long long firstBlock, unsigned int height, LogAddress address)
 	{
-		if (blockNum < 4)
+		if (address.logSegment == EMPTY_DIRECT_BLOCK_ADDRESS)
 		{
-			return iNode.directBlocks[blockNum];
+			return 0;
 		}
 
-		if (blockNum > numLogAddrInBlock + 4)
+		std::vector<LogAddress> entries;
+		if (ReadBlockMapNode(inum, blockMap.NodeId(firstBlock, height), address, entries) != 0)
 		{
-			std::cerr << "[FileLayer] ERROR: GetBlockAddress Beyond max number of blocks" << std::endl;
-			throw;
+			return 1;
 		}
 
-		if (iNode.indirectBlock.logSegment == EMPTY_DIRECT_BLOCK_ADDRESS)
+		int ret = 0;
+		for (unsigned int entry = 0; entry < entries.size(); ++entry)
 		{
-			LogAddress ret = {
-				.logSegment  = EMPTY_DIRECT_BLOCK_ADDRESS,
-				.blockNumber = EMPTY_DIRECT_BLOCK_ADDRESS
-			};
-
-			return ret;
+			if (height > 1)
+			{
+				ret += FreeBlockMapNode(inum, firstBlock + entry * blockMap.Span(height - 1), height - 1, entries[entry]);
+			}
+			else if (entries[entry].logSegment != EMPTY_DIRECT_BLOCK_ADDRESS)
+			{
+				log->Log_Free(entries[entry]);
+			}
 		}
 
-		LogAddress * indirectBlocks      = ReadIndirectBlocks(iNode.indirectBlock);
-		LogAddress ret                   = indirectBlocks[blockNum - 4];
-		free(indirectBlocks);
+		log->Log_Free(address);
 		return ret;
 	}
 
-	LogAddress * ReadIndirectBlocks(LogAddress addr)
+	// ifile, directory and symlink blocks go to the metadata stream. file data that
+	// is being overwritten is likely to be overwritten again so it goes to the hot stream
+	WriteStream GetWriteStream(INode& inode, bool overwrite)
 	{
-		if (addr.logSegment == EMPTY_DIRECT_BLOCK_ADDRESS || addr.blockNumber == EMPTY_DIRECT_BLOCK_ADDRESS)
+		if (inode.inum == IFILE_INUM || inode.fileType == FileType::Directory || inode.fileType == FileType::Symlink)
 		{
-			std::cerr << "[FileLayer] ERROR: ReadIndirectBlocks attempting to read empty log address" << std::endl;
-			throw;
+			return WriteStream::Metadata;
 		}
 
-		void * indirectBlocksBuffer = malloc(blockSizeInBytes);
-		memset(indirectBlocksBuffer, 0, blockSizeInBytes);
+		return overwrite ? WriteStream::HotData : WriteStream::ColdData;
+	}
 
-		if (log->Log_Read(addr, indirectBlocksBuffer) != 0)
+	// a file block that already held data and is only partly overwritten is a read-modify-write
+	WriteCause GetWriteCause(INode& inode, bool partialOverwrite)
+	{
+		if (inode.inum == IFILE_INUM)
 		{
-			std::cerr << "[FileLayer] ERROR: Log read failed in ReadIndirectBlocks" << std::endl;
-        	addr.Print();
-        	free(indirectBlocksBuffer);
-        	return NULL;
+			return WriteCause::INodeUpdate;
 		}
 
-		LogAddress * indirectBlocks = (LogAddress *)malloc(numLogAddrInBlock * sizeof(LogAddress));
-		memcpy(indirectBlocks, indirectBlocksBuffer, numLogAddrInBlock * sizeof(LogAddress));
-		free(indirectBlocksBuffer);
-		return indirectBlocks;
+		if (inode.fileType == FileType::Directory || inode.fileType == FileType::Symlink)
+		{
+			return WriteCause::DirectoryData;
+		}
+
+		return partialOverwrite ? WriteCause::ReadModifyWrite : WriteCause::UserData;
+	}
+
+	// writes the changed extents of a file and then the changed nodes of its block map
+	int WriteBlockMap(INode * iNode, FileMap& map)
+	{
+		return WriteExtents(iNode, map) != 0 ? 1 : WriteBlockMapNodes(iNode, map.nodes);
 	}
 
-	int UpdateINodeBlock(INode * iNode, unsigned int blockNum, LogAddress logAddress)
+	// writes the extent list from the block holding the first changed extent to its end and frees the
+	// list blocks it no longer needs
+	int WriteExtents(INode * iNode, FileMap& map)
 	{
-		if (blockNum < 4)
+		if (!iNode->extentMapped || map.firstChangedExtent == UINT_MAX)
 		{
-			iNode->directBlocks[blockNum] = logAddress;
 			return 0;
 		}
 
-		LogAddress * indirectBlocks;
-		if (iNode->indirectBlock.logSegment == EMPTY_DIRECT_BLOCK_ADDRESS)
+		unsigned int oldListBlocks = GetExtentListBlocks(iNode->extentCount);
+		unsigned int newListBlocks = GetExtentListBlocks(map.extents.size());
+		void * blockBuffer         = malloc(blockSizeInBytes);
+		int ret                    = 0;
+		for (unsigned int listBlock = map.firstChangedExtent / numExtentsInBlock; listBlock < std::max(oldListBlocks, newListBlocks) && ret == 0; ++listBlock)
 		{
-			indirectBlocks = (LogAddress *)malloc(numLogAddrInBlock * sizeof(LogAddress));
-			for (int i = 0; i < numLogAddrInBlock; ++i)
+			LogAddress address;
+			if (GetExtentListBlockAddress(*iNode, map.nodes, listBlock, &address) != 0)
+			{
+				ret = 1;
+				break;
+			}
+
+			// the new copy replaces the old one
+			if (address.logSegment != EMPTY_DIRECT_BLOCK_ADDRESS)
+			{
+				log->Log_Free(address);
+			}
+
+			address.logSegment  = EMPTY_DIRECT_BLOCK_ADDRESS;
+			address.blockNumber = EMPTY_DIRECT_BLOCK_ADDRESS;
+			if (listBlock < newListBlocks)
 			{
-				indirectBlocks[i] = {
-					.logSegment  = EMPTY_DIRECT_BLOCK_ADDRESS,
-					.blockNumber = EMPTY_DIRECT_BLOCK_ADDRESS
-				};
+				unsigned int first = listBlock * numExtentsInBlock;
+				unsigned int count = std::min(numExtentsInBlock, (unsigned int)map.extents.size() - first);
+				memset(blockBuffer, 0, blockSizeInBytes);
+				memcpy(blockBuffer, map.extents.data() + first, count * sizeof(Extent));
+				if (log->Log_Write(iNode->inum, blockMap.ExtentListBlockId(listBlock), blockBuffer, &address, WriteStream::Metadata, WriteCause::IndirectBlock) != 0)
+				{
+					std::cerr << "[FileLayer] ERROR: Log_Write failed in WriteExtents. inum: " << iNode->inum << std::endl;
+					ret = 1;
+					break;
+				}
 			}
+
+			ret = SetExtentListBlockAddress(iNode, map.nodes, listBlock, address);
 		}
-		else
+
+		free(blockBuffer);
+		if (ret != 0)
 		{
-			indirectBlocks = ReadIndirectBlocks(iNode->indirectBlock);
+			return ret;
 		}
 
-		indirectBlocks[blockNum - 4] = logAddress;
-		int ret = WriteIndirectBlocks(iNode, indirectBlocks);
-		free(indirectBlocks);
-		return ret;
+		LogAddress lastBlock = {
+			.logSegment  = EMPTY_DIRECT_BLOCK_ADDRESS,
+			.blockNumber = EMPTY_DIRECT_BLOCK_ADDRESS
+		};
+
+		if (newListBlocks > 0 && GetExtentListBlockAddress(*iNode, map.nodes, newListBlocks - 1, &lastBlock) != 0)
+		{
+			return 1;
+		}
+
+		iNode->extentCount     = map.extents.size();
+		map.firstChangedExtent = UINT_MAX;
+		CacheExtents(iNode->inum, lastBlock, map.extents);
+		return 0;
 	}
 
-	int WriteIndirectBlocks(INode * iNode, LogAddress * indirectBlocks)
+	// writes the changed nodes of a block map, lowest first so every parent is written once with the
+	// new addresses of its children. the roots go into the inode
+	int WriteBlockMapNodes(INode * iNode, BlockMapNodes& nodes)
 	{
 		void * blockBuffer = malloc(blockSizeInBytes);
-		memset(blockBuffer, 0, blockSizeInBytes);
+		int ret            = 0;
+		for (unsigned int height = 1; height <= MAX_BLOCK_MAP_HEIGHT && ret == 0; ++height)
+		{
+			for (auto it = nodes.begin(); it != nodes.end() && ret == 0; ++it)
+			{
+				unsigned long long firstBlock;
+				unsigned int nodeHeight;
+				BlockMapNode& node = it->second;
+				if (!node.dirty || !blockMap.DecodeNodeId(it->first, &firstBlock, &nodeHeight) || nodeHeight != height)
+				{
+					continue;
+				}
 
-		memcpy(blockBuffer, indirectBlocks, numLogAddrInBlock * sizeof(LogAddress));
+				memset(blockBuffer, 0, blockSizeInBytes);
+				memcpy(blockBuffer, node.entries.data(), numLogAddrInBlock * sizeof(LogAddress));
 
-		int ret = 0;
-		if (log->Log_Write(iNode->inum, iNode->indirectBlock.blockNumber, blockBuffer, &iNode->indirectBlock) != 0)
-		{
-			std::cerr << "[FileLayer] ERROR: Log_Write failed in WriteIndirectBlocks. inum: " << iNode->inum << std::endl;
-        	ret = 1;
+				// the new copy replaces the old one
+				if (node.address.logSegment != EMPTY_DIRECT_BLOCK_ADDRESS)
+				{
+					log->Log_Free(node.address);
+				}
+
+				if (log->Log_Write(iNode->inum, it->first, blockBuffer, &node.address, WriteStream::Metadata, WriteCause::IndirectBlock) != 0)
+				{
+					std::cerr << "[FileLayer] ERROR: Log_Write failed in WriteBlockMap. inum: " << iNode->inum << std::endl;
+		        	ret = 1;
+		        	break;
+				}
+
+				node.dirty = false;
+				CacheIndirectBlocks(iNode->inum, it->first, node.address, node.entries);
+				ret = SetBlockMapNodeAddress(iNode, nodes, firstBlock, height, node.address);
+			}
 		}
 
         free(blockBuffer);
 		return ret;
 	}
 
+	// points the parent of a node, or the inode for a root, at a new copy of the node
+	int SetBlockMapNodeAddress(INode * iNode, BlockMapNodes& nodes, unsigned long long firstBlock, unsigned int height, LogAddress address)
+	{
+		if (blockMap.GetHeight(firstBlock) == height)
+		{
+			*GetBlockMapRoot(iNode, height) = address;
+			return 0;
+		}
+
+		BlockMapNode * parent = NULL;
+		if (GetBlockMapNode(*iNode, nodes, firstBlock, height + 1, false, &parent) != 0 || parent == NULL)
+		{
+			std::cerr << "[FileLayer] ERROR: block map node has no parent. inum: " << iNode->inum << std::endl;
+			return 1;
+		}
+
+		parent->entries[blockMap.ChildIndex(firstBlock, height + 1)] = address;
+		parent->dirty                                                = true;
+		return 0;
+	}
+
 	int CleanLog(unsigned int cleanSegments, SegmentUsageTableEntry * segmentUsageTable)
 	{
-		std::cout << "[Cleaner] Cleaning log. Clean segments: " << cleanSegments << ". Start threshold: " << cleaningStartThreshold << std::endl;
-		log->PrintSegmentUsageTable(segmentUsageTable);
+		LatencyTimer timer(LatencyOp::CleanerPass);
+		TRACE_INFO(CleanerStart, cleanSegments, cleaningStartThreshold);
+		stats.cleaningPasses++;
 
 		std::vector<std::tuple<double, unsigned int>> policies;
 		for (unsigned int segment = firstSegment; segment < flashSize; ++segment)
 		{
+			// open tails are still being filled by their write streams. empty segments are already
+			// clean and are erased by the log before reuse
+			if (log->IsTailSegment(segment) || segmentUsageTable[segment].liveBytesInSegment == 0)
+			{
+				continue;
+			}
+
 			double costBenefit = ComputePolicy(segmentUsageTable[segment]);
 			if (costBenefit == 0.0)
 			{
@@ -730,15 +2474,7 @@ private:
 		}
 
 		std::sort(policies.begin(), policies.end());
-		std::cout << "[Cleaner] Policies:" << std::endl;
-
-		for (auto it = policies.begin(); it != policies.end(); ++it)
-		{
-			auto policy = *it;
-			double p = std::get<0>(policy);
-			unsigned int seg = std::get<1>(policy);
-			std::cout << "[Cleaner] Policy: " << p << " segment: " << seg << std::endl;
-		}
+		TRACE_INFO(CleanerCandidates, policies.size());
 
 		while (!policies.empty())
 		{
@@ -749,31 +2485,129 @@ private:
 
 			std::tuple<double, unsigned int> segmentPolicy = policies.back();
 			unsigned int segmentNumber                     = std::get<1>(segmentPolicy);
-			InMemorySegment * segment                      = log->ReadSegment(segmentNumber);
 
-			int ret = CleanSegment(segment);
+			int ret = EvacuateSegment(segmentNumber);
 			if (ret != 0)
 			{
 				return ret;
 			}
 
-			log->EraseSegment(segment->summary.segmentNumber);
-			log->InvalidateSegment(segment->summary.segmentNumber);
-			log->FreeSegment(segment);
 			policies.pop_back();
 			cleanSegments++;
 		}
 
 		free(segmentUsageTable);
-		std::cout << "[Cleaner] Cleaner Done" << std::endl;
+		TRACE_INFO(CleanerDone);
+		return 0;
+	}
 
-		segmentUsageTable = log->ReadSegmentUsageTable();
-		log->PrintSegmentUsageTable(segmentUsageTable);
-		free(segmentUsageTable);
+	// moves the live blocks of a segment to the log tail and gives the segment back to the log
+	int EvacuateSegment(unsigned int segmentNumber)
+	{
+		LatencyTimer timer(LatencyOp::CleanerSegment);
+		// nothing to move, so the segment is not read
+		if (log->CountLiveBlocks(segmentNumber) == 0)
+		{
+			TRACE_INFO(CleanerEmptySegment, segmentNumber);
+			log->ReleaseSegment(segmentNumber);
+			log->InvalidateSegment(segmentNumber);
+			stats.emptySegmentsReleased++;
+			return 0;
+		}
+
+		InMemorySegment * segment = log->ReadLiveBlocks(segmentNumber);
+		if (segment == NULL)
+		{
+			return 1;
+		}
+
+		int ret = CleanSegment(segment);
+		if (ret != 0)
+		{
+			return ret;
+		}
 
+		log->ReleaseSegment(segmentNumber);
+		log->InvalidateSegment(segmentNumber);
+		log->FreeSegment(segment);
+		stats.segmentsCleaned++;
 		return 0;
 	}
 
+	// static wear leveling. segments full of cold data are never cleaned so they stop taking erases while
+	// the rest of the flash wears out. when the spread in wear passes the threshold, move the data off the
+	// least worn segment so the log can reuse it
+	int LevelWear(SegmentUsageTableEntry * segmentUsageTable)
+	{
+		unsigned int minWear;
+		unsigned int maxWear;
+		unsigned int coldSegment = FindColdSegment(segmentUsageTable, &minWear, &maxWear);
+		if (coldSegment == flashSize)
+		{
+			return 0;
+		}
+
+		TRACE_INFO(CleanerLevelWear, coldSegment, minWear, maxWear);
+		stats.segmentsLeveled++;
+		return EvacuateSegment(coldSegment);
+	}
+
+	// the least worn segment holding data once the spread in wear passes the threshold, flashSize otherwise
+	unsigned int FindColdSegment(SegmentUsageTableEntry * segmentUsageTable, unsigned int * minWearOut, unsigned int * maxWearOut)
+	{
+		if (wearLevelingThreshold == 0)
+		{
+			return flashSize;
+		}
+
+		unsigned int maxWear     = 0;
+		unsigned int minWear     = UINT_MAX;
+		unsigned int coldSegment = flashSize;
+		for (unsigned int segment = firstSegment; segment < flashSize; ++segment)
+		{
+			unsigned int wear = log->GetSegmentWear(segment);
+			maxWear = std::max(maxWear, wear);
+
+			if (segmentUsageTable[segment].liveBytesInSegment == 0 || log->IsTailSegment(segment))
+			{
+				continue;
+			}
+
+			if (wear < minWear)
+			{
+				minWear     = wear;
+				coldSegment = segment;
+			}
+		}
+
+		if (coldSegment == flashSize || maxWear - minWear <= wearLevelingThreshold)
+		{
+			return flashSize;
+		}
+
+		if (minWearOut != NULL)
+		{
+			*minWearOut = minWear;
+			*maxWearOut = maxWear;
+		}
+
+		return coldSegment;
+	}
+
+	unsigned int CountCleanSegments(SegmentUsageTableEntry * segmentUsageTable)
+	{
+		unsigned int cleanSegments = 0;
+		for (unsigned int segment = firstSegment; segment < flashSize; ++segment)
+		{
+			if (segmentUsageTable[segment].liveBytesInSegment == 0 && !log->IsTailSegment(segment))
+			{
+				cleanSegments++;
+			}
+		}
+
+		return cleanSegments;
+	}
+
 	double ComputePolicy(SegmentUsageTableEntry entry)
 	{
 		double u = entry.liveBytesInSegment / blockSizeInBytes;
@@ -781,15 +2615,110 @@ private:
 		return ( (1 - u) * age ) / (1 + u);
 	}
 
+	LogAddress GetOwnedBlockAddress(INode& inode, FileMap& map, int fileBlockNumber)
+	{
+		LogAddress address = {
+			.logSegment  = EMPTY_DIRECT_BLOCK_ADDRESS,
+			.blockNumber = EMPTY_DIRECT_BLOCK_ADDRESS
+		};
+
+		unsigned long long firstBlock;
+		unsigned int height;
+		unsigned int listBlock;
+		int ret = 0;
+		if (fileBlockNumber >= 0)
+		{
+			ret = GetBlockAddress(inode, map, fileBlockNumber, &address);
+		}
+		else if (blockMap.DecodeExtentListBlockId(fileBlockNumber, &listBlock))
+		{
+			// a list block of a file that has changed to a block map is no longer used
+			if (inode.extentMapped)
+			{
+				ret = GetExtentListBlockAddress(inode, map.nodes, listBlock, &address);
+			}
+		}
+		else if (blockMap.DecodeNodeId(fileBlockNumber, &firstBlock, &height))
+		{
+			BlockMapNode * node = NULL;
+			ret                 = GetBlockMapNode(inode, map.nodes, firstBlock, height, false, &node);
+			address             = node == NULL ? address : node->address;
+		}
+		else
+		{
+			std::cerr << "[Cleaner] ERROR CleanSegment encountered invalid file block in segment summary. fileBlockNumber: " << fileBlockNumber << std::endl;
+			throw;
+		}
+
+		if (ret != 0)
+		{
+			std::cerr << "[Cleaner] ERROR CleanSegment unable to read block map. inum: " << inode.inum << std::endl;
+			throw;
+		}
+
+		return address;
+	}
+
+	// points a file at the moved copy of one of its blocks. a moved block of an extent is split off and
+	// joined with the blocks moved after it, and a moved block map node is pointed at by its parent.
+	// the changes are written by the caller with WriteBlockMap
+	int UpdateOwnedBlockAddress(INode * inode, FileMap& map, int fileBlockNumber, LogAddress logAddress)
+	{
+		unsigned long long firstBlock;
+		unsigned int height;
+		unsigned int listBlock;
+		if (blockMap.DecodeNodeId(fileBlockNumber, &firstBlock, &height))
+		{
+			{
+				std::lock_guard<std::mutex> cacheLock(blockMapCacheMutex);
+				blockMapCache.erase(GetBlockMapCacheKey(inode->inum, fileBlockNumber));
+			}
+
+			// a copy that was already loaded is freed from its new address when it is written again
+			auto node = map.nodes.find(fileBlockNumber);
+			if (node != map.nodes.end())
+			{
+				node->second.address = logAddress;
+			}
+
+			return SetBlockMapNodeAddress(inode, map.nodes, firstBlock, height, logAddress);
+		}
+		else if (blockMap.DecodeExtentListBlockId(fileBlockNumber, &listBlock))
+		{
+			return SetExtentListBlockAddress(inode, map.nodes, listBlock, logAddress);
+		}
+		else if (inode->extentMapped && fileBlockNumber >= NUM_DIRECT_BLOCKS)
+		{
+			return MoveExtentBlock(*inode, map, fileBlockNumber, logAddress);
+		}
+
+		return SetBlockMapAddress(inode, map.nodes, fileBlockNumber, logAddress);
+	}
+
+	CleanedFile& GetCleanedFile(std::map<unsigned int, CleanedFile>& files, unsigned int inum)
+	{
+		auto file = files.find(inum);
+		if (file == files.end())
+		{
+			file = files.emplace(inum, CleanedFile()).first;
+			file->second.inode = GetINode(inum);
+		}
+
+		return file->second;
+	}
+
 	int CleanSegment(InMemorySegment * segment)
 	{
-		std::cout << "[Cleaner] Cleaning segment: " << segment->summary.segmentNumber << std::endl;
-		log->PrintTailSummary();
+		TRACE_INFO(CleanerSegment, segment->summary.segmentNumber);
 
 		int ret = 0;
 		SegmentSummary * summary = &segment->summary;
 		//std::vector<std::tuple<INode, unsigned int, LogAddress>> updates;
 
+		// the files with blocks in the segment, so the block maps and extent lists they share are
+		// changed in memory and written once when the segment is done
+		std::map<unsigned int, CleanedFile> files;
+
 		for (unsigned int block = 1; block < summary->numberOfBlocks; ++block)
 		{
 			int inum            = summary->blockINums[block];
@@ -805,24 +2734,36 @@ private:
 				.blockNumber = block,
 			};
 
-			INode inode = GetINode(inum);
-
-			LogAddress currentBlockAddress;
-			if (fileBlockNumber >= 0)
+			// dead blocks are skipped without reading their inodes
+			if (!log->IsBlockLive(logAddress))
 			{
-				currentBlockAddress = GetBlockAddress(inode, fileBlockNumber);
+				continue;
 			}
-			else if (fileBlockNumber == INDIRECT_BLOCK)
+
+			// a shared block is moved once and every file block still pointing at it follows it
+			std::vector<BlockOwner> owners = { { .inum = (unsigned int)inum, .fileBlock = fileBlockNumber } };
+			for (BlockOwner owner : log->GetBlockOwners(logAddress))
 			{
-				currentBlockAddress = inode.indirectBlock;
+				if (std::find(owners.begin(), owners.end(), owner) == owners.end())
+				{
+					owners.push_back(owner);
+				}
 			}
-			else
+
+			std::vector<BlockOwner> liveOwners;
+			for (BlockOwner owner : owners)
 			{
-				std::cerr << "[Cleaner] ERROR CleanSegment encountered invalid file block in segment summary. fileBlockNumber: " << fileBlockNumber << std::endl;
-				throw;
+				CleanedFile& file              = GetCleanedFile(files, owner.inum);
+				LogAddress currentBlockAddress = GetOwnedBlockAddress(file.inode, file.map, owner.fileBlock);
+				if (currentBlockAddress != logAddress)
+				{
+					continue;
+				}
+
+				liveOwners.push_back(owner);
 			}
 
-			if (currentBlockAddress != logAddress)
+			if (liveOwners.empty())
 			{
 				continue;
 			}
@@ -830,8 +2771,13 @@ private:
 			void * blockBuffer = malloc(blockSizeInBytes);
 			memset(blockBuffer, 0, blockSizeInBytes);
 
-			unsigned int offset = (block - 1) * blockSizeInBytes;
-			memcpy(blockBuffer, (char *)segment->data + offset, blockSizeInBytes);
+			// relocating a corrupted block would give it a fresh checksum and hide the damage
+			if (log->ReadSegmentBlock(segment, block, blockBuffer) != 0)
+			{
+				std::cerr << "[Cleaner] ERROR CleanSegment found a corrupt block. segment: " << summary->segmentNumber << " block: " << block << std::endl;
+				free(blockBuffer);
+				return 1;
+			}
 
 			LogAddress newAddress = 
 			{
@@ -839,9 +2785,16 @@ private:
 				.blockNumber = EMPTY_DIRECT_BLOCK_ADDRESS
 			};
 
-			ret += log->Log_Write(inum, fileBlockNumber, blockBuffer, &newAddress);
-			ret += UpdateINodeBlock(&inode, fileBlockNumber, newAddress);
-	 		ret += UpdateIFile(inode);
+			ret += log->Log_Write(liveOwners[0].inum, liveOwners[0].fileBlock, blockBuffer, &newAddress, WriteStream::CleanerOutput, WriteCause::CleanerRelocation);
+			stats.blocksMoved++;
+			free(blockBuffer);
+			for (BlockOwner owner : liveOwners)
+			{
+				CleanedFile& file = GetCleanedFile(files, owner.inum);
+				ret += UpdateOwnedBlockAddress(&file.inode, file.map, owner.fileBlock, newAddress);
+			}
+
+			ret += log->MoveBlockReferences(logAddress, newAddress, liveOwners);
 	 		//updates.push_back(std::make_tuple(inode, fileBlockNumber, newAddress));
 
 	 		if (ret != 0)
@@ -863,6 +2816,16 @@ private:
 		}
 		*/
 
+		for (auto& file : files)
+		{
+			ret += WriteBlockMap(&file.second.inode, file.second.map);
+			ret += UpdateIFile(file.second.inode);
+			if (ret != 0)
+			{
+				return ret;
+			}
+		}
+
 		return ret;
 	}
 };
@@ -114,7 +114,6 @@ Flash_GetWear(
     FlashInfo	*flash = (FlashInfo *) flashHandle;
     u_int       buffer;
     off_t       offset;
-    off_t       result;
     int         rc;
     int         amount;
 
@@ -125,12 +124,7 @@ Flash_GetWear(
     }
 
     offset = flash->hdr.wearOffset + (block * sizeof(u_int));
-    result = lseek(flash->fd, offset, SEEK_SET);
-    if (result != offset) {
-        rc = 1;
-        goto done;
-    }
-    amount = read(flash->fd, &buffer, sizeof(buffer));
+    amount = pread(flash->fd, &buffer, sizeof(buffer), offset);
     if (amount != sizeof(buffer)) {
         rc = 1;
         if (errno == 0) {
@@ -153,17 +147,11 @@ FlashSetWear(
 
 {
     off_t       offset;
-    off_t       result;
     int         rc;
     int         amount;
 
     offset = flash->hdr.wearOffset + (block * sizeof(u_int));
-    result = lseek(flash->fd, offset, SEEK_SET);
-    if (result != offset) {
-        rc = 1;
-        goto done;
-    }
-    amount = write(flash->fd, &wear, sizeof(wear));
+    amount = pwrite(flash->fd, &wear, sizeof(wear), offset);
     if (amount != sizeof(wear)) {
         rc = 1;
         if (errno == 0) {
@@ -185,17 +173,11 @@ FlashGetState(
 {
     u_char      buffer;
     off_t       offset;
-    off_t       result;
     int         rc;
     int         amount;
 
     offset = flash->hdr.stateOffset + (sector * sizeof(u_char));
-    result = lseek(flash->fd, offset, SEEK_SET);
-    if (result != offset) {
-        rc = 1;
-        goto done;
-    }
-    amount = read(flash->fd, &buffer, sizeof(buffer));
+    amount = pread(flash->fd, &buffer, sizeof(buffer), offset);
     if (amount != sizeof(buffer)) {
         rc = 1;
         if (errno == 0) {
@@ -217,17 +199,11 @@ FlashSetState(
 
 {
     off_t       offset;
-    off_t       result;
     int         rc;
     int         amount;
 
     offset = flash->hdr.stateOffset + (sector * sizeof(u_char));
-    result = lseek(flash->fd, offset, SEEK_SET);
-    if (result != offset) {
-        rc = 1;
-        goto done;
-    }
-    amount = write(flash->fd, &state, sizeof(state));
+    amount = pwrite(flash->fd, &state, sizeof(state), offset);
     if (amount != sizeof(state)) {
         rc = 1;
         if (errno == 0) {
@@ -292,7 +268,6 @@ FlashIO(
     void	*buffer)
 {
     off_t	seekOffset;
-    off_t	resultOffset;
     int		rc;
     ssize_t	amount;
 
@@ -306,18 +281,14 @@ FlashIO(
         errno = EINVAL;
         goto done;
     }
+    /* positional I/O so reads from several threads do not share a file offset */
     seekOffset = flash->hdr.blockOffset + (offset * FLASH_SECTOR_SIZE);
-    resultOffset = lseek(flash->fd, seekOffset, SEEK_SET);
-    if (resultOffset != seekOffset) {
-	rc = 1;
-	goto done;
-    }
     switch (type) {
 	case FLASH_READ: 
-	    amount = read(flash->fd, buffer, count * FLASH_SECTOR_SIZE);
+	    amount = pread(flash->fd, buffer, count * FLASH_SECTOR_SIZE, seekOffset);
 	    break;
 	case FLASH_WRITE: 
-	    amount = write(flash->fd, buffer, count * FLASH_SECTOR_SIZE);
+	    amount = pwrite(flash->fd, buffer, count * FLASH_SECTOR_SIZE, seekOffset);
 	    break;
 	default:
 	    fprintf(stderr, "Internal error in FlashIO\n");
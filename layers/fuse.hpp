@@ -8,9 +8,16 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <time.h>
+#include <unistd.h>
 #include <sys/statvfs.h>
+#include <sstream>
+#include <string>
 #include "directory.hpp"
 
+// served by the fuse layer itself and never stored in the log. neither is listed by readdir
+#define STATS_FILE   "/.lfs_stats"
+#define CONTROL_FILE "/.lfs_control"
+
 class IFuseLayer
 {
 public:
@@ -45,10 +52,81 @@ class FuseLayer : public IFuseLayer
 private:
 	IDirectoryLayer * directoryLayer;
 
+	bool isStatsFile(const char * path)
+	{
+		return strcmp(path, STATS_FILE) == 0;
+	}
+
+	bool isControlFile(const char * path)
+	{
+		return strcmp(path, CONTROL_FILE) == 0;
+	}
+
+	bool isPseudoFile(const char * path)
+	{
+		return isStatsFile(path) || isControlFile(path);
+	}
+
+	std::string getPseudoFileText(const char * path)
+	{
+		if (isControlFile(path))
+		{
+			LfsTunables tunables;
+			directoryLayer->Directory_GetTunables(&tunables);
+			return FormatTunables(tunables);
+		}
+
+		LfsStats stats;
+		directoryLayer->Directory_GetStats(&stats);
+		std::ostringstream out;
+		out << FormatStats(stats) << "\n";
+		PrintLatencyReport(out);
+		return out.str();
+	}
+
+	int getPseudoFileAttr(const char * path, struct stat * st)
+	{
+		memset(st, 0, sizeof(struct stat));
+		st->st_mode  = S_IFREG | (isControlFile(path) ? 0644 : 0444);
+		st->st_nlink = 1;
+		st->st_uid   = getuid();
+		st->st_gid   = getgid();
+		st->st_size  = getPseudoFileText(path).size();
+		st->st_atime = st->st_mtime = st->st_ctime = time(NULL);
+		return 0;
+	}
+
+	int readPseudoFile(const char * path, char * buf, size_t size, off_t offset)
+	{
+		std::string text = getPseudoFileText(path);
+		if (offset >= (off_t)text.size())
+		{
+			return 0;
+		}
+
+		size_t length = std::min(size, text.size() - offset);
+		memcpy(buf, text.data() + offset, length);
+		return length;
+	}
+
+	// each write holds whole "name value" lines. settings it does not name keep their values
+	int writeControlFile(const char * buf, size_t size)
+	{
+		LfsTunables tunables;
+		directoryLayer->Directory_GetTunables(&tunables);
+		if (ParseTunables(std::string(buf, size), &tunables) != 0)
+		{
+			std::cerr << "[FuseLayer] invalid settings written to " << CONTROL_FILE << std::endl;
+			return -EINVAL;
+		}
+
+		return directoryLayer->Directory_SetTunables(tunables) != 0 ? -EINVAL : size;
+	}
+
 public:
-	FuseLayer(char * flashFile, unsigned int cacheSize, unsigned int checkpointInterval, unsigned int cleaningStart, unsigned int cleaningEnd)
+	FuseLayer(char * flashFile, unsigned int cacheSize, unsigned int checkpointInterval, unsigned int cleaningStart, unsigned int cleaningEnd, unsigned int erasePoolSize, unsigned int wearLeveling, unsigned int checkpointAge)
 	{
-		directoryLayer = new DirectoryLayer(flashFile, cacheSize, checkpointInterval, cleaningStart, cleaningEnd);
+		directoryLayer = new DirectoryLayer(flashFile, cacheSize, checkpointInterval, cleaningStart, cleaningEnd, erasePoolSize, wearLeveling, checkpointAge);
 	}
 	
 	~FuseLayer()
@@ -75,11 +153,21 @@ public:
 
 	int Fuse_Getattr(const char *path, struct stat *st)
 	{
+		if (isPseudoFile(path))
+		{
+			return getPseudoFileAttr(path, st);
+		}
+
 	    return directoryLayer->Directory_GetAttr(path, st);
 	}
 
 	int Fuse_Link(const char * from, const char * to)
 	{
+		if (isPseudoFile(from) || isPseudoFile(to))
+		{
+			return isPseudoFile(to) ? -EEXIST : -EPERM;
+		}
+
 	    return directoryLayer->Directory_Link(from, to);
 	}
 
@@ -90,21 +178,41 @@ public:
 
 	int Fuse_Symlink(const char * to, const char * from)
 	{
+		if (isPseudoFile(from))
+		{
+			return -EEXIST;
+		}
+
 	    return directoryLayer->Directory_Symlink(to, from);
 	}
 
 	int Fuse_Unlink(const char * path)
 	{
+		if (isPseudoFile(path))
+		{
+			return -EPERM;
+		}
+
 	    return directoryLayer->Directory_Unlink(path);
 	}
 
 	int Fuse_Read(const char * path, char *buf, size_t size, off_t offset, struct fuse_file_info * fi)
 	{
+		if (isPseudoFile(path))
+		{
+			return readPseudoFile(path, buf, size, offset);
+		}
+
 	    return directoryLayer->Directory_Read(path, offset, size, buf) != 0 ? 0 : size;
 	}
 
 	int Fuse_Access(const char * path, int mask)
 	{
+		if (isPseudoFile(path))
+		{
+			return (mask & X_OK) || (isStatsFile(path) && (mask & W_OK)) ? -EACCES : 0;
+		}
+
 		int ret = directoryLayer->Directory_Exists(path);
 		if (ret != 0)
 		{
@@ -143,31 +251,61 @@ public:
 
 	int Fuse_Mkdir(const char * path, mode_t mode)
 	{
+		if (isPseudoFile(path))
+		{
+			return -EEXIST;
+		}
+
 	    return directoryLayer->Directory_Mkdir(path, mode) == 0 ? 0 : -1;
 	}
 
 	int Fuse_Chmod(const char * path, mode_t mode)
 	{
+		if (isPseudoFile(path))
+		{
+			return -EPERM;
+		}
+
 		return directoryLayer->Directory_Chmod(path, mode);
 	}
 
 	int Fuse_Chown(const char * path, uid_t uid, gid_t gid)
 	{
+		if (isPseudoFile(path))
+		{
+			return -EPERM;
+		}
+
 		return directoryLayer->Directory_Chown(path, uid, gid);
 	}
 
 	int Fuse_Truncate(const char * path, off_t size)
 	{
+		if (isPseudoFile(path))
+		{
+			return isControlFile(path) ? 0 : -EACCES; // so the shell can open the control file with O_TRUNC
+		}
+
 	    return directoryLayer->Directory_Truncate(path, size) != 0 ? -1 : 0;
 	}
 
 	int Fuse_Create(const char * path, mode_t mode, struct fuse_file_info *)
 	{
+		if (isPseudoFile(path))
+		{
+			return -EEXIST;
+		}
+
 	    return directoryLayer->Directory_Create(path, mode) != 0 ? -1 : 0;
 	}
 
 	int Fuse_Write(const char * path, const char *buf, size_t size, off_t offset, struct fuse_file_info * fi)
 	{
+		if (isPseudoFile(path))
+		{
+			return isControlFile(path) ? writeControlFile(buf, size) : -EACCES;
+		}
+
 	    return directoryLayer->Directory_Write(path, offset, size, buf) != 0 ? 0 : size;
 	}
 
@@ -178,6 +316,17 @@ public:
 
 	int Fuse_Open(const char * path, struct fuse_file_info * fi)
 	{
+		if (isPseudoFile(path))
+		{
+			if (isStatsFile(path) && (fi->flags & O_ACCMODE) != O_RDONLY)
+			{
+				return -EACCES;
+			}
+
+			fi->direct_io = 1; // the text changes between getattr and read, so read past the reported size
+			return 0;
+		}
+
 	    return directoryLayer->Directory_Exists(path) != 0;
 	}
 
@@ -198,6 +347,11 @@ public:
 
 	int Fuse_Rename(const char * from, const char * to)
 	{
+		if (isPseudoFile(from) || isPseudoFile(to))
+		{
+			return -EPERM;
+		}
+
 	    return directoryLayer->Directory_Rename(from, to);
 	}
 };
\ No newline at end of file
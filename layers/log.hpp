@@ -6,6 +6,16 @@
 #include <errno.h>
 #include <iostream>
 #include <vector>
+#include <algorithm>
+#include <deque>
+#include <queue>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <chrono>
 #include <sys/statvfs.h>
 #include "flash/flash.h"
 #include "../data_structures/flash_data.hpp"
@@ -14,7 +24,17 @@
 #include "../data_structures/segment_cache.hpp"
 #include "../data_structures/log_address.hpp"
 #include "../data_structures/inode.hpp"
+#include "../data_structures/write_stream.hpp"
+#include "../data_structures/write_cause.hpp"
+#include "../data_structures/shared_block.hpp"
+#include "../data_structures/lfs_stats.hpp"
 #include "../utils.hpp"
+#include "../lz.hpp"
+#include "../hash128.hpp"
+#include "../trace.hpp"
+#include "../latency.hpp"
+
+#define CHECKPOINT_MAX_BACKOFF 16 // most the segment interval between checkpoints grows under a burst of writes
 
 class ILog
 {
@@ -23,8 +43,9 @@ public:
 	virtual int Init() = 0;
 	virtual int Log_Statfs(struct statvfs * stbuf) = 0;
 	virtual int Log_Read(LogAddress logAddress, void *buffer) = 0;
-	virtual int Log_Write(unsigned int inum, unsigned int fileBlock, void * buffer, LogAddress * logAddress) = 0;
+	virtual int Log_Write(unsigned int inum, unsigned int fileBlock, void * buffer, LogAddress * logAddress, WriteStream stream = WriteStream::HotData, WriteCause cause = WriteCause::UserData) = 0;
 	virtual int Log_Free(LogAddress logAddress) = 0;
+	virtual int Log_Rewrite(LogAddress logAddress, void * buffer) = 0;
 	virtual void UpdateIFileINode(INode newIFileINode) = 0;
 	virtual INode GetIFileINode() = 0;
 	virtual unsigned int GetFileBlockSizeInBytes() = 0;
@@ -33,14 +54,35 @@ public:
 	virtual SegmentUsageTableEntry * ReadSegmentUsageTable() = 0;
 	virtual int WriteSegmentUsageTable(SegmentUsageTableEntry * table) = 0;
 	virtual InMemorySegment * ReadSegment(unsigned int segmentNumber) = 0;
+	virtual InMemorySegment * ReadLiveBlocks(unsigned int segmentNumber) = 0;
+	virtual InMemorySegment * ReadSegmentSummary(unsigned int segmentNumber) = 0;
+	virtual int ReadSegmentBlock(InMemorySegment * segment, unsigned int blockNumber, void * buffer) = 0;
 	virtual void FreeSegment(InMemorySegment * segment) = 0;
-	virtual int EraseSegment(unsigned int segment) = 0;
+	virtual int ReleaseSegment(unsigned int segment) = 0;
 	virtual int InvalidateSegment(unsigned int segment) = 0;
+	virtual bool IsTailSegment(unsigned int segment) = 0;
+	virtual unsigned int GetSegmentWear(unsigned int segment) = 0;
+	virtual bool IsDeduplicating() = 0;
+	virtual std::vector<BlockOwner> GetBlockOwners(LogAddress logAddress) = 0;
+	virtual int MoveBlockReferences(LogAddress from, LogAddress to, std::vector<BlockOwner> owners) = 0;
+	virtual int RestoreBlockReferences(LogAddress logAddress, std::vector<BlockOwner> owners) = 0;
+	virtual unsigned long long GetDataAtRisk() = 0;
+	virtual void AddDataAtRisk(unsigned int bytes) = 0;
+	virtual bool IsBlockLive(LogAddress logAddress) = 0;
+	virtual unsigned int CountLiveBlocks(unsigned int segment) = 0;
+	virtual void GetStats(LogStats * stats) = 0;
+	virtual void GetTunables(LfsTunables * tunables) = 0;
+	virtual int SetTunables(LfsTunables tunables) = 0;
 	virtual void PrintTailSummary() = 0;
 	virtual void PrintSegmentUsageTable(SegmentUsageTableEntry * table) = 0;
-
+	virtual int CheckpointNow() = 0;
+	virtual void SetCheckpointHandler(std::function<int()> handler) = 0;
+	virtual bool IsCheckpointDue() = 0;
+	virtual unsigned long long GetSegmentsFlushed() = 0;
 };
 
+typedef std::pair<unsigned int, unsigned int> SegmentWearEntry; // (wear, segment)
+
 class Log : public ILog
 {
 private:	
@@ -51,28 +93,128 @@ private:
 	Flash                    flash;
 	FlashData                flashData;
 	SegmentUsageTableEntry * segmentUsageTable;
+	std::vector<uint8_t>     validityBitmaps;  // a bit per slot of each segment, set while the slot holds a live block
 	SegmentFactory         * segmentFactory;
-	InMemorySegment        * tailSegment;
+	InMemorySegment        * tailSegments[NUM_WRITE_STREAMS]; // one open tail segment per write stream
 	SegmentCache           * segmentCache;
 	Checkpoint               checkpoint;
 	unsigned int 	         checkpointSector;
+	unsigned int             lastSegmentWritten;
 	INode 			         iFileINode;
-	bool                     recoveredWithPartialSegment; // if we recover from a partial segment we need to erase it before writing it back when its full
+	bool                     tailDirty[NUM_WRITE_STREAMS];   // the tail has blocks that are not on flash
+	unsigned int             tailFlushedBytes[NUM_WRITE_STREAMS]; // bytes of the tail's data area already written for checkpoints
+
+	// checkpoint scheduler. with a maximum age, a timer checkpoints once the log has been idle for a
+	// while and no written data waits longer than the maximum age for a checkpoint. 0 checkpoints every
+	// checkpointInterval segments only
+	std::atomic<unsigned int> maxCheckpointAge;         // seconds. read by the checkpoint thread without the log lock
+	unsigned int             checkpointBackoff;         // multiplies checkpointInterval while writes come in bursts
+	unsigned long long       dataAtRisk;                // bytes written since the last checkpoint
+	std::chrono::steady_clock::time_point dirtySince;   // first write since the last checkpoint
+	std::chrono::steady_clock::time_point lastWrite;
+	std::chrono::steady_clock::time_point lastCheckpoint;
+	std::thread              checkpointThread;
+	std::mutex               checkpointTimerMutex;
+	std::condition_variable  checkpointTimerCondition;
+	bool                     stopCheckpointing;
+
+	// a layer that caches what it writes to the log sets a handler to write it back before a checkpoint.
+	// checkpoints that fall due during a write are then left to the handler's layer, which can take its
+	// own locks, and the timer calls the handler instead of checkpointing itself
+	std::function<int()>     checkpointHandler;
+	std::mutex               checkpointHandlerMutex;    // held while the handler runs so it can be cleared safely
+	std::atomic<bool>        checkpointDue;
+	std::atomic<unsigned long long> segmentsFlushed;    // full tail segments written to flash
+	std::recursive_mutex     logMutex;                  // appends and everything they change: the tails, usage table, dedup index and checkpoints
+
+	// erase-ahead pool. clean segments are erased by a background thread so a new tail never waits on an erase
+	unsigned int             erasePoolSize;
+	std::deque<unsigned int> erasedSegments;  // erased clean segments, new tails are taken from the front
+	std::deque<unsigned int> segmentsToErase; // clean segments waiting on the erase thread
+	std::vector<bool>        segmentErased;   // segment is known to be erased on flash
+	std::vector<bool>        segmentInPool;   // segment is in erasedSegments or segmentsToErase
+	std::thread              eraseThread;
+	std::mutex               poolMutex;
+	std::condition_variable  poolCondition;
+	bool                     stopErasing;
+	std::shared_mutex        flashMutex;      // the flash is shared with the erase thread. reads may run together
+
+	// free segments ordered by erase count, lowest segment number first on ties. entries are not removed
+	// when a segment is reused, they are skipped when popped if the segment is no longer free
+	std::priority_queue<SegmentWearEntry, std::vector<SegmentWearEntry>, std::greater<SegmentWearEntry>> freeSegmentsByWear;
+	std::vector<unsigned int> segmentWear;    // erase count of each segment, guarded by flashMutex
+
+	// dedup index of file data blocks written since mount. a hash match is confirmed by comparing the blocks
+	std::unordered_map<Hash128, LogAddress, Hash128Hasher> dedupIndex;
+	std::unordered_map<uint64_t, Hash128>                  blockHashes;  // indexed blocks by address, to drop them when they die
+	std::unordered_map<uint64_t, SharedBlock>              sharedBlocks; // blocks with more than one reference by address
+
+	// counters for /.lfs_stats. the cache and flash counters are updated outside the log lock by readers and the erase thread
+	std::atomic<unsigned long long> cacheHits;
+	std::atomic<unsigned long long> cacheMisses;
+	unsigned long long              blocksWritten[NUM_WRITE_STREAMS];
+	unsigned long long              blocksDeduplicated;
+	unsigned long long              blocksRewritten;
+	unsigned long long              checkpointsTaken;
+	unsigned long long              bytesWrittenByCause[NUM_WRITE_CAUSES];
+	std::vector<int8_t>             tailSlotCauses[NUM_WRITE_STREAMS]; // cause of each block added to a tail since it was last written
+	std::atomic<unsigned long long> flashReads;
+	std::atomic<unsigned long long> flashSectorsRead;
+	std::atomic<unsigned long long> flashWrites;
+	std::atomic<unsigned long long> flashSectorsWritten;
+	std::atomic<unsigned long long> flashErases;
+	std::atomic<unsigned long long> flashEraseBlocksErased;
 
 public:
-	Log(char * f, unsigned int cacheSize, unsigned int ckptInterval) :
+	Log(char * f, unsigned int cacheSize, unsigned int ckptInterval, unsigned int poolSize = 4, unsigned int ckptAge = 0) :
 		flashFile(f),
 		segmentCacheSize(cacheSize),
 		checkpointInterval(ckptInterval),
 		writesSinceLastCheckpoint(0),
-		recoveredWithPartialSegment(false)
+		maxCheckpointAge(ckptAge),
+		checkpointBackoff(1),
+		dataAtRisk(0),
+		stopCheckpointing(false),
+		checkpointDue(false),
+		segmentsFlushed(0),
+		erasePoolSize(poolSize),
+		stopErasing(false),
+		cacheHits(0),
+		cacheMisses(0),
+		blocksDeduplicated(0),
+		blocksRewritten(0),
+		checkpointsTaken(0),
+		flashReads(0),
+		flashSectorsRead(0),
+		flashWrites(0),
+		flashSectorsWritten(0),
+		flashErases(0),
+		flashEraseBlocksErased(0)
 	{
+		for (int stream = 0; stream < NUM_WRITE_STREAMS; ++stream)
+		{
+			tailDirty[stream]        = false;
+			tailFlushedBytes[stream] = 0;
+			blocksWritten[stream]    = 0;
+		}
+
+		memset(bytesWrittenByCause, 0, sizeof(bytesWrittenByCause));
 	}
 
 	~Log()
 	{
+		StopCheckpointThread();
 		CheckpointNow();
-		segmentFactory->Destroy(tailSegment);
+		closePartlyWrittenTails();
+		StopEraseThread();
+		for (int stream = 0; stream < NUM_WRITE_STREAMS; ++stream)
+		{
+			if (tailSegments[stream] != NULL)
+			{
+				segmentFactory->Destroy(tailSegments[stream]);
+			}
+		}
+
 		delete segmentCache;
 		delete segmentFactory;
 		free(segmentUsageTable);
@@ -103,7 +245,7 @@ public:
 	    unsigned int flashDataBufferSize = flashDataSizeInSectors * FLASH_SECTOR_SIZE;
 	    void * flashDataBuffer           = malloc(flashDataBufferSize);
 	    memset(flashDataBuffer, 0, flashDataBufferSize);
-		if(Flash_Read(flash, 0, flashDataSizeInSectors, flashDataBuffer) != 0)
+		if(flashRead(0, flashDataSizeInSectors, flashDataBuffer) != 0)
 		{
 	        std::cerr << "[LogLayer] ERROR: Unable to read flash on LogInit" << std::endl;
 	        std::cerr << "[LogLayer] errno: " << errno << std::endl;
@@ -117,7 +259,11 @@ public:
 
 		// copy checkpoint region
 		memset(&checkpoint, 0, sizeof(Checkpoint));
-	    RecoverCheckpoint(); 
+	    if (RecoverCheckpoint() != 0)
+	    {
+	    	return 1;
+	    }
+
 	    iFileINode = checkpoint.iFileINode;
 
 		// init data structs
@@ -125,37 +271,75 @@ public:
 		segmentFactory = new SegmentFactory(flashData);
 		segmentCache   = new SegmentCache(segmentFactory, segmentCacheSize); 
 
-		unsigned int lastSegmentWritten = checkpoint.lastSegmentWritten;
-		tailSegment                     = segmentFactory->Build(lastSegmentWritten);
-		
-		if(readSegment(tailSegment) != 0)
+		for (int stream = 0; stream < NUM_WRITE_STREAMS; ++stream)
+		{
+			tailSegments[stream] = NULL;
+		}
+
+		lastSegmentWritten             = checkpoint.lastSegmentWritten;
+		char * segmentUsageTableBuffer = readSegmentUsageTableSegment();
+		if (segmentUsageTableBuffer == NULL)
 		{
-			std::cerr << "[LogLayer] ERROR: Unable to read lastSegmentWritten from flash on log init" << std::endl;
-		    std::cerr << "[LogLayer] segment number: " << lastSegmentWritten << std::endl;
-        	std::cerr << "[LogLayer] errno: " << strerror(errno) << std::endl;
-        	return 1;
-		};
+			return 1;
+		}
 
-		// read segment usage table
-		segmentUsageTable = ReadSegmentUsageTable();
-		unsigned int tailSegmentNumber = GetCleanSegment();
+		unsigned int segmentUsageTableSize = flashData.flashSize * sizeof(SegmentUsageTableEntry);
+		segmentUsageTable                  = (SegmentUsageTableEntry *)malloc(segmentUsageTableSize);
+		memcpy(segmentUsageTable, segmentUsageTableBuffer, segmentUsageTableSize);
+		validityBitmaps.assign(segmentUsageTableBuffer + segmentUsageTableSize, segmentUsageTableBuffer + segmentUsageTableSize + getValidityBitmapsSizeInBytes());
+		free(segmentUsageTableBuffer);
+
+		// a clean segment that was never written since its last erase has no age.
+		// clean segments that still hold dead blocks are erased before they are reused
+		segmentErased.assign(flashData.flashSize, false);
+		segmentInPool.assign(flashData.flashSize, false);
+		for (unsigned int segment = GetFirstSegment(); segment < flashData.flashSize; ++segment)
+		{
+			segmentErased[segment] = segmentUsageTable[segment].liveBytesInSegment == 0 && segmentUsageTable[segment].ageOfYoungestBlock == 0;
+		}
 
-		if (tailSegment->summary.blockINums[flashData.segmentSize - 1] != NO_INUM)
+		if (ReadSegmentWear() != 0)
 		{
-			segmentFactory->Destroy(tailSegment);
-		    tailSegment = segmentFactory->Build(tailSegmentNumber);
+			return 1;
 		}
-		else
+
+		for (unsigned int segment = GetFirstSegment(); segment < flashData.flashSize; ++segment)
+		{
+			if (segmentUsageTable[segment].liveBytesInSegment == 0)
+			{
+				freeSegmentsByWear.push(SegmentWearEntry(segmentWear[segment], segment));
+			}
+		}
+
+		if (closeRecoveredTails() != 0)
 		{
-			recoveredWithPartialSegment = true;
+			return 1;
 		}
 
+		eraseThread = std::thread(&Log::EraseSegments, this);
+
+		// the default stream starts in a clean segment and the other streams open a tail on their first write
+		InMemorySegment * tailSegment = getTailSegment(WriteStream::HotData);
 		std::cout << "[LogLayer] tail segment segment number: " << tailSegment->summary.segmentNumber << std::endl;
+
+		// start erasing ahead of the first tail roll
+		{
+			std::lock_guard<std::mutex> lock(poolMutex);
+			FillErasePool(erasePoolSize);
+		}
+
+		lastCheckpoint = std::chrono::steady_clock::now();
+		if (maxCheckpointAge > 0)
+		{
+			checkpointThread = std::thread(&Log::CheckpointOnTimer, this);
+		}
+
 		return 0;
 	}
 
 	int Log_Statfs(struct statvfs* stbuf)
 	{
+		std::lock_guard<std::recursive_mutex> logLock(logMutex);
 		stbuf->f_bsize   = flashData.blockSize * FLASH_SECTOR_SIZE;                         /* file system block size */
 	    stbuf->f_frsize  = flashData.segmentSize * flashData.blockSize * FLASH_SECTOR_SIZE; /* fragment size */
 	    stbuf->f_blocks  = flashData.flashSize;                                             /* size of fs in f_frsize units */
@@ -165,7 +349,7 @@ public:
 		{
 			unsigned int liveBytes = segmentUsageTable[segment].liveBytesInSegment;
 			unsigned int liveBlocks = liveBytes / (flashData.blockSize * FLASH_SECTOR_SIZE);
-			unsigned int freeBlockInSegment = flashData.segmentSize - liveBlocks;
+			unsigned int freeBlockInSegment = liveBlocks < flashData.segmentSize ? flashData.segmentSize - liveBlocks : 0; // compressed segments can hold more
 			freeBlocks += freeBlockInSegment;
 		}
 
@@ -174,9 +358,13 @@ public:
 	    return 0;
 	}
 
+	// reads of cached segments only take the segment cache's shared lock, so they run alongside each
+	// other and alongside appends. the log lock is taken to read an open tail, and a segment missing
+	// from the cache is read from flash without it
 	int Log_Read(LogAddress logAddress, void * buffer)
 	{
-		std::cout << "[LogLayer] Reading log address segment number: " << logAddress.logSegment << " block Number: " << logAddress.blockNumber << std::endl;
+		LatencyTimer timer(LatencyOp::LogRead);
+		TRACE_DEBUG(LogRead, logAddress.logSegment, logAddress.blockNumber);
 
 		// check valid params
 		if (!ValidLogAddress(logAddress))
@@ -187,54 +375,152 @@ public:
 			return 1;
 		}
 
-		// get segment
-		unsigned int segmentNumber      = logAddress.logSegment;
-		InMemorySegment * segmentToRead = getSegment(segmentNumber);
-		if (segmentToRead == NULL)
+		unsigned int segmentNumber = logAddress.logSegment;
+		unsigned int blockNumber   = logAddress.blockNumber;
+		int ret                    = 1;
+		if (segmentCache->readEntry(segmentNumber, [&](InMemorySegment * segment) { ret = readLiveBlock(segment, blockNumber, buffer); }))
+		{
+			cacheHits++;
+			return ret;
+		}
+
+		{
+			std::lock_guard<std::recursive_mutex> logLock(logMutex);
+			InMemorySegment * tailSegment = getOpenTailSegment(segmentNumber);
+			if (tailSegment != NULL)
+			{
+				cacheHits++;
+				return readLiveBlock(tailSegment, blockNumber, buffer);
+			}
+		}
+
+		cacheMisses++;
+		InMemorySegment * segmentToRead = segmentFactory->Build(segmentNumber);
+		if (readSegment(segmentToRead) != 0)
 		{
-	        std::cerr << "[LogLayer] ERROR: Cant read segment: " << segmentNumber << std::endl;
+			std::cerr << "[LogLayer] ERROR: Unable to read segment from flash" << std::endl;
+	        std::cerr << "[LogLayer] segment number: " << segmentNumber << std::endl;
+       		std::cerr << "[LogLayer] errno: " << errno << std::endl;
+			segmentFactory->Destroy(segmentToRead);
 			return 1;
 		}
-		
-		// check if we are reading dead blocks (just report for now)
-		unsigned int blockNumber = logAddress.blockNumber;
-		if (segmentToRead->summary.blockINums[blockNumber] == NO_INUM)
+
+		ret = readLiveBlock(segmentToRead, blockNumber, buffer);
+
+		// the segment may have died or become a tail while it was read. only segments with live data are cached
+		std::lock_guard<std::recursive_mutex> logLock(logMutex);
+		if (segmentUsageTable[segmentNumber].liveBytesInSegment == 0 || getOpenTailSegment(segmentNumber) != NULL || !segmentCache->putEntryIfAbsent(segmentToRead))
 		{
-		    std::cerr << "[LogLayer] ERROR: Attempting to reading dead block " << std::endl;
-		    std::cerr << "[LogLayer] Segment Number: " << segmentNumber << std::endl;
+			segmentFactory->Destroy(segmentToRead);
+		}
+
+		return ret;
+	}
+
+	// copies a block out of a segment, decompressing it if needed, and checks it against its checksum
+	int ReadSegmentBlock(InMemorySegment * segment, unsigned int blockNumber, void * buffer)
+	{
+		SegmentSummary& summary = segment->summary;
+		unsigned int blockSize  = GetFileBlockSizeInBytes();
+		unsigned int offset     = summary.blockOffsets[blockNumber];
+		unsigned int length     = summary.blockLengths[blockNumber];
+		char * extent           = (char *)segment->data + offset;
+
+		if (length > blockSize || offset + length > segmentFactory->getDataSizeInBytes())
+		{
+		    std::cerr << "[LogLayer] ERROR: Block extent out of range" << std::endl;
+		    std::cerr << "[LogLayer] Segment Number: " << summary.segmentNumber << std::endl;
 		    std::cerr << "[LogLayer] Block Number: " << blockNumber << std::endl;
-		    throw;
-		    //return 1;
+			return 1;
+		}
+
+		if (length == blockSize)
+		{
+			memcpy(buffer, extent, blockSize);
+		}
+		else if (LzDecompress(extent, length, buffer, blockSize) != blockSize)
+		{
+		    std::cerr << "[LogLayer] ERROR: Unable to decompress block" << std::endl;
+		    std::cerr << "[LogLayer] Segment Number: " << summary.segmentNumber << std::endl;
+		    std::cerr << "[LogLayer] Block Number: " << blockNumber << std::endl;
+			return 1;
+		}
+
+		if (Crc32c(buffer, blockSize) != summary.blockChecksums[blockNumber])
+		{
+		    std::cerr << "[LogLayer] ERROR: Block checksum mismatch" << std::endl;
+		    std::cerr << "[LogLayer] Segment Number: " << summary.segmentNumber << std::endl;
+		    std::cerr << "[LogLayer] Block Number: " << blockNumber << std::endl;
+			return 1;
 		}
 
-		char * dataToRead              = (char *)segmentToRead->data;
-		unsigned int segmentDataOffset = (blockNumber - 1) * flashData.blockSize * FLASH_SECTOR_SIZE; // -1 because we are reading from segment data which starts at block 1
-		memcpy(buffer, dataToRead + segmentDataOffset, flashData.blockSize * FLASH_SECTOR_SIZE);
 		return 0;
 	}
 
-	int Log_Write(unsigned int inum, unsigned int fileBlock, void * buffer, LogAddress * logAddress)
+	int Log_Write(unsigned int inum, unsigned int fileBlock, void * buffer, LogAddress * logAddress, WriteStream stream = WriteStream::HotData, WriteCause cause = WriteCause::UserData)
 	{
-		std::cout << "[LogLayer] Writing inum: " << inum << " block Number: " << fileBlock << std::endl;
-
-		SegmentSummary& tailSegmentSummary = tailSegment->summary;
+		LatencyTimer timer(LatencyOp::LogWrite);
+		std::lock_guard<std::recursive_mutex> logLock(logMutex);
 
-		if (tailSegmentSummary.segmentNumber >= flashData.flashSize)
+		InMemorySegment * tailSegment = getTailSegment(stream);
+		if (tailSegment->summary.segmentNumber >= flashData.flashSize)
 		{
        		std::cerr << "[LogLayer] ERROR: FLASH IS FULL CANNOT WRITE" << std::endl;
 			return 1;
 		}
 
-		unsigned int emptyBlock = 0;
-		for (int b = 1; b < segmentFactory->getSegmentSizeInBlocks(); ++b)
+		// identical file data is stored once and referenced by every file block that holds it
+		unsigned int blockSize = GetFileBlockSizeInBytes();
+		bool dedupBlock        = IsDeduplicating() && (stream == WriteStream::HotData || stream == WriteStream::ColdData);
+		Hash128 hash;
+		if (dedupBlock)
+		{
+			hash       = ComputeHash128(buffer, blockSize);
+			auto entry = dedupIndex.find(hash);
+			if (entry != dedupIndex.end() && isSameBlock(entry->second, buffer))
+			{
+				TRACE_DEBUG(LogDedup, inum, fileBlock, entry->second.logSegment, entry->second.blockNumber);
+				*logAddress = entry->second;
+				addBlockReference(*logAddress, inum, fileBlock);
+				blocksDeduplicated++;
+				return 0;
+			}
+		}
+
+		// compress before picking a slot so we know how much of the tail the block takes
+		void * blockData       = buffer;
+		unsigned int length    = blockSize;
+		void * compressed      = NULL;
+		if (segmentFactory->isCompressed())
+		{
+			compressed                    = malloc(blockSize);
+			unsigned int compressedLength = LzCompress(buffer, blockSize, compressed, blockSize - 1);
+			if (compressedLength != 0)
+			{
+				blockData = compressed;
+				length    = compressedLength;
+			}
+		}
+
+		if (!hasRoomInTail(tailSegment, length))
 		{
-			if (tailSegmentSummary.blockINums[b] == NO_INUM)
+			// what is left of a compressed tail is too small for this block
+			tailSegment = NULL;
+			if (flushTailSegment(stream) == 0)
+			{
+				tailSegment = getTailSegment(stream);
+			}
+
+			if (tailSegment == NULL || tailSegment->summary.segmentNumber >= flashData.flashSize)
 			{
-				emptyBlock = b;
-				break;
+	       		std::cerr << "[LogLayer] ERROR: Unable to open a new tail segment" << std::endl;
+	       		free(compressed);
+				return 1;
 			}
 		}
 
+		SegmentSummary& tailSegmentSummary = tailSegment->summary;
+		unsigned int emptyBlock            = getEmptySlot(stream);
 		if (emptyBlock == 0)
 		{
         	std::cerr << "[LogLayer] ERROR: No empty block in tail segment" << std::endl;
@@ -246,72 +532,128 @@ public:
 		tailSegmentSummary.blockINums[emptyBlock]        = inum;
 		tailSegmentSummary.iNodeBlockNumbers[emptyBlock] = fileBlock;
 		
-		// copy bytes to tail segment
-		char * tailBuffer               = (char *)tailSegment->data;
-		unsigned int tailBufferTailByte = (emptyBlock - 1) * flashData.blockSize * FLASH_SECTOR_SIZE; // USE RIGHT BLOCK. subtract 1
-		memcpy(tailBuffer + tailBufferTailByte, buffer, flashData.blockSize * FLASH_SECTOR_SIZE);
+		// copy bytes to tail segment. uncompressed blocks keep a fixed place, compressed ones are packed
+		unsigned int tailBufferTailByte = segmentFactory->isCompressed() ? tailSegmentSummary.dataBytes : (emptyBlock - 1) * blockSize;
+		memcpy((char *)tailSegment->data + tailBufferTailByte, blockData, length);
+		tailSegmentSummary.blockOffsets[emptyBlock]   = tailBufferTailByte;
+		tailSegmentSummary.blockLengths[emptyBlock]   = length;
+		tailSegmentSummary.blockChecksums[emptyBlock] = Crc32c(buffer, blockSize);
+		tailSegmentSummary.nextSlot                   = emptyBlock + 1;
+		tailSegmentSummary.dataBytes                  = tailBufferTailByte + length;
+		tailDirty[stream]                             = true;
+		setTailSlotCause(stream, emptyBlock, cause);
+		setBlockLive(*logAddress, true);
+		free(compressed);
+
+		lastWrite = std::chrono::steady_clock::now();
+		if (dataAtRisk == 0)
+		{
+			dirtySince = lastWrite;
+		}
+
+		dataAtRisk += blockSize;
+
+		if (dedupBlock)
+		{
+			// a hash collision with different data replaces the older block in the index
+			dedupIndex[hash]                         = *logAddress;
+			blockHashes[LogAddressKey(*logAddress)] = hash;
+		}
 
 		// update segment usage table
 		//segmentUsageTable[tailSegmentSummary.segmentNumber].ageOfYoungestBlock = time(0);
 		//segmentUsageTable[tailSegmentSummary.segmentNumber].liveBytesInSegment += flashData.blockSize * FLASH_SECTOR_SIZE;
 
-		if (emptyBlock == segmentFactory->getSegmentSizeInBlocks() - 1)
+		if (isSegmentFull(tailSegment) && flushTailSegment(stream) != 0)
 		{
-			if (recoveredWithPartialSegment)
-			{	
-				if(eraseSegment(tailSegment->summary.segmentNumber) != 0) // what if we erase and crash before write? use flag
-				{
-					std::cerr << "[LogLayer] ERROR: Unable to erase segment" << std::endl;
-				    std::cerr << "[LogLayer] segment number: " << tailSegment->summary.segmentNumber << std::endl;
-		        	std::cerr << "[LogLayer] errno: " << strerror(errno) << std::endl;
-		        	return 1;
-				}
+			return 1;
+		}
 
-				recoveredWithPartialSegment = false;
-			}
+		if (isCheckpointOverdue() && requestCheckpoint() != 0)
+		{
+			return 1;
+		}
 
-			if(writeSegment(tailSegment) != 0)
+		TRACE_DEBUG(LogWrite, inum, fileBlock, (int)stream, logAddress->logSegment, logAddress->blockNumber);
+		blocksWritten[stream]++;
+		return 0;
+	}
+
+	int Log_Free(LogAddress logAddress)
+	{
+		LatencyTimer timer(LatencyOp::LogFree);
+		std::lock_guard<std::recursive_mutex> logLock(logMutex);
+		// a shared block stays live until its last reference is freed
+		auto shared = sharedBlocks.find(LogAddressKey(logAddress));
+		if (shared != sharedBlocks.end() && shared->second.extraReferences > 0)
+		{
+			shared->second.extraReferences--;
+			if (getOpenTailSegment(logAddress.logSegment) == NULL)
 			{
-       			std::cerr << "[LogLayer] ERROR: error writing segment to flash" << std::endl;
-        		std::cerr << "[LogLayer] errno: " << strerror(errno) << std::endl;		
-        		return 1;
+				segmentUsageTable[logAddress.logSegment].liveBytesInSegment -= flashData.blockSize * FLASH_SECTOR_SIZE;
 			}
 
-			// add filled tail segment to segment cache
-       		std::cout << "[LogLayer] adding tail segment " << tailSegmentSummary.segmentNumber << " to cache" << std::endl;
-			segmentCache->putEntry(tailSegment);
+			return 0;
+		}
 
-			// make new tail segment
-			unsigned int tailSegmentNumber = GetCleanSegment();
-			tailSegment = segmentFactory->Build(tailSegmentNumber);
-			//segmentUsageTable[tailSegmentNumber].liveBytesInSegment = 0;
-			//segmentUsageTable[tailSegmentNumber].ageOfYoungestBlock = 0;
-			//WriteSegmentUsageTable(segmentUsageTable);
+		forgetBlock(logAddress);
+		if (ValidLogAddress(logAddress))
+		{
+			setBlockLive(logAddress, false);
+		}
 
-			if (writesSinceLastCheckpoint >= checkpointInterval)
+		InMemorySegment * tailSegment = getOpenTailSegment(logAddress.logSegment);
+		if (tailSegment != NULL)
+		{
+			// live bytes of a tail are counted when it is written to flash
+			tailSegment->summary.blockINums[logAddress.blockNumber]        = NO_INUM;
+			tailSegment->summary.iNodeBlockNumbers[logAddress.blockNumber] = NO_BLOCK;
+		}
+		else if (logAddress.logSegment != EMPTY_DIRECT_BLOCK_ADDRESS)
+		{
+			segmentUsageTable[logAddress.logSegment].liveBytesInSegment -= flashData.blockSize * FLASH_SECTOR_SIZE;
+			if (segmentUsageTable[logAddress.logSegment].liveBytesInSegment == 0)
 			{
-				CheckpointNow();
+				// the segment can become a tail again, its old contents must not be read from the cache
+				segmentCache->invalidateEntry(logAddress.logSegment);
+				std::lock_guard<std::mutex> lock(poolMutex);
+				PushFreeSegment(logAddress.logSegment);
 			}
 		}
 
-		std::cout << "[LogLayer] New segment: " << logAddress->logSegment << std::endl;
-		std::cout << "[LogLayer] New block: " << logAddress->blockNumber << std::endl;
 		return 0;
 	}
 
-	int Log_Free(LogAddress logAddress)
+	// replaces a block in an open tail where it is. a block added since the tail was last written is
+	// not on flash yet, so no checkpoint can refer to it and it needs no new slot. returns 1 without
+	// changing anything for any other block, which the caller writes again with Log_Write
+	int Log_Rewrite(LogAddress logAddress, void * buffer)
 	{
-		if (logAddress.logSegment == getTailSegmentNumber())
+		std::lock_guard<std::recursive_mutex> logLock(logMutex);
+		InMemorySegment * tailSegment = getOpenTailSegment(logAddress.logSegment);
+		if (tailSegment == NULL || !ValidLogAddress(logAddress) || segmentFactory->isCompressed() || IsDeduplicating())
 		{
-			tailSegment->summary.blockINums[logAddress.blockNumber]        = NO_INUM;
-			tailSegment->summary.iNodeBlockNumbers[logAddress.blockNumber] = NO_BLOCK;
+			return 1;
 		}
 
-		if (logAddress.logSegment != EMPTY_DIRECT_BLOCK_ADDRESS)
+		int stream = 0;
+		while (tailSegments[stream] != tailSegment)
 		{
-			segmentUsageTable[logAddress.logSegment].liveBytesInSegment -= flashData.blockSize * FLASH_SECTOR_SIZE;
+			stream++;
 		}
 
+		unsigned int slot = logAddress.blockNumber;
+		if (slot >= tailSlotCauses[stream].size() || tailSlotCauses[stream][slot] == NO_WRITE_CAUSE || tailSegment->summary.blockINums[slot] == NO_INUM)
+		{
+			return 1;
+		}
+
+		unsigned int blockSize = GetFileBlockSizeInBytes();
+		memcpy((char *)tailSegment->data + tailSegment->summary.blockOffsets[slot], buffer, blockSize);
+		tailSegment->summary.blockChecksums[slot] = Crc32c(buffer, blockSize);
+		lastWrite                                 = std::chrono::steady_clock::now();
+		blocksRewritten++;
+		TRACE_DEBUG(LogRewrite, logAddress.logSegment, logAddress.blockNumber);
 		return 0;
 	}
 
@@ -333,30 +675,248 @@ public:
 	// only want to update the ifile inode in the checkpoint when a segment is written. rethink this
 	void UpdateIFileINode(INode newIFileINode)
 	{
+		std::lock_guard<std::recursive_mutex> logLock(logMutex);
 		iFileINode = newIFileINode;
 	}
 
 	INode GetIFileINode()
 	{
+		std::lock_guard<std::recursive_mutex> logLock(logMutex);
 		return iFileINode;
 	}
 
 	unsigned int getTailSegmentNumber()
 	{
-		return tailSegment->summary.segmentNumber;
+		return getTailSegment(WriteStream::HotData)->summary.segmentNumber;
+	}
+
+	unsigned long long getCheckpointSequenceNumber()
+	{
+		return checkpoint.sequenceNumber;
+	}
+
+	unsigned int getTailSegmentNumber(WriteStream stream)
+	{
+		return getTailSegment(stream)->summary.segmentNumber;
+	}
+
+	bool IsTailSegment(unsigned int segment)
+	{
+		std::lock_guard<std::recursive_mutex> logLock(logMutex);
+		return getOpenTailSegment(segment) != NULL;
+	}
+
+	unsigned int GetSegmentWear(unsigned int segment)
+	{
+		std::lock_guard<std::shared_mutex> flashLock(flashMutex);
+		return segmentWear[segment];
+	}
+
+	bool IsDeduplicating()
+	{
+		return flashData.deduplication != 0;
+	}
+
+	// file blocks that have referenced a block besides its summary owner. some may have moved on since
+	std::vector<BlockOwner> GetBlockOwners(LogAddress logAddress)
+	{
+		std::lock_guard<std::recursive_mutex> logLock(logMutex);
+		auto shared = sharedBlocks.find(LogAddressKey(logAddress));
+		if (shared == sharedBlocks.end())
+		{
+			return std::vector<BlockOwner>();
+		}
+
+		return shared->second.owners;
+	}
+
+	// called by the cleaner after it writes a block to its new address and points its owners at it
+	int MoveBlockReferences(LogAddress from, LogAddress to, std::vector<BlockOwner> owners)
+	{
+		std::lock_guard<std::recursive_mutex> logLock(logMutex);
+		auto hash = blockHashes.find(LogAddressKey(from));
+		if (hash != blockHashes.end())
+		{
+			Hash128 blockHash = hash->second;
+			forgetBlock(from);
+			dedupIndex[blockHash]           = to;
+			blockHashes[LogAddressKey(to)] = blockHash;
+		}
+		else
+		{
+			forgetBlock(from);
+		}
+
+		if (owners.size() > 1)
+		{
+			RestoreBlockReferences(to, owners);
+			if (getOpenTailSegment(to.logSegment) == NULL)
+			{
+				segmentUsageTable[to.logSegment].liveBytesInSegment += (owners.size() - 1) * flashData.blockSize * FLASH_SECTOR_SIZE;
+			}
+		}
+
+		return 0;
+	}
+
+	// sets the references of a block from the file blocks that point at it. used to rebuild them on mount.
+	// a single owner is kept for a block whose summary names a file block that has moved on, so the
+	// cleaner still finds the file that refers to it
+	int RestoreBlockReferences(LogAddress logAddress, std::vector<BlockOwner> owners)
+	{
+		std::lock_guard<std::recursive_mutex> logLock(logMutex);
+		if (owners.empty())
+		{
+			sharedBlocks.erase(LogAddressKey(logAddress));
+			return 0;
+		}
+
+		SharedBlock& shared    = sharedBlocks[LogAddressKey(logAddress)];
+		shared.extraReferences = owners.size() - 1;
+		shared.owners          = owners;
+		return 0;
+	}
+
+	// bytes written since the last checkpoint. they are lost if the log is not shut down cleanly
+	unsigned long long GetDataAtRisk()
+	{
+		std::lock_guard<std::recursive_mutex> logLock(logMutex);
+		return dataAtRisk;
+	}
+
+	// data that reaches flash with the next checkpoint without going through the log, such as the data
+	// of small files kept in their inodes. it starts the checkpoint timer like a block write
+	void AddDataAtRisk(unsigned int bytes)
+	{
+		std::lock_guard<std::recursive_mutex> logLock(logMutex);
+		lastWrite = std::chrono::steady_clock::now();
+		if (dataAtRisk == 0)
+		{
+			dirtySince = lastWrite;
+		}
+
+		dataAtRisk += bytes;
+	}
+
+	void GetStats(LogStats * stats)
+	{
+		std::lock_guard<std::recursive_mutex> logLock(logMutex);
+		memset(stats, 0, sizeof(LogStats));
+		stats->cacheHits   = cacheHits;
+		stats->cacheMisses = cacheMisses;
+		stats->flashSize   = flashData.flashSize;
+		for (unsigned int segment = flashData.checkpointSegment + 1; segment < flashData.flashSize; ++segment)
+		{
+			if (segmentUsageTable[segment].liveBytesInSegment == 0 && getOpenTailSegment(segment) == NULL)
+			{
+				stats->freeSegments++;
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(poolMutex);
+			stats->erasedSegments = erasedSegments.size();
+		}
+
+		for (int stream = 0; stream < NUM_WRITE_STREAMS; ++stream)
+		{
+			stats->blocksWritten[stream] = blocksWritten[stream];
+		}
+
+		for (int cause = 0; cause < NUM_WRITE_CAUSES; ++cause)
+		{
+			stats->bytesWrittenByCause[cause] = bytesWrittenByCause[cause];
+		}
+
+		stats->blocksDeduplicated       = blocksDeduplicated;
+		stats->blocksRewritten          = blocksRewritten;
+		stats->flashReads               = flashReads;
+		stats->flashSectorsRead         = flashSectorsRead;
+		stats->flashWrites              = flashWrites;
+		stats->flashSectorsWritten      = flashSectorsWritten;
+		stats->flashErases              = flashErases;
+		stats->flashEraseBlocksErased   = flashEraseBlocksErased;
+		stats->checkpoints              = checkpointsTaken;
+		stats->checkpointSequenceNumber = checkpoint.sequenceNumber;
+		stats->secondsSinceCheckpoint   = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - lastCheckpoint).count();
+		stats->dataAtRisk               = dataAtRisk;
+	}
+
+	// the cleaning thresholds belong to the file layer and are left alone
+	void GetTunables(LfsTunables * tunables)
+	{
+		std::lock_guard<std::recursive_mutex> logLock(logMutex);
+		tunables->cacheSize          = segmentCacheSize;
+		tunables->checkpointInterval = checkpointInterval;
+		tunables->checkpointAge      = maxCheckpointAge;
+	}
+
+	int SetTunables(LfsTunables tunables)
+	{
+		if (tunables.cacheSize == 0 || tunables.checkpointInterval == 0)
+		{
+			std::cerr << "[LogLayer] ERROR: The segment cache size and checkpoint interval must be at least 1" << std::endl;
+			return 1;
+		}
+
+		// the checkpoint thread takes the log lock, so it is stopped before the lock is held
+		if (tunables.checkpointAge == 0)
+		{
+			StopCheckpointThread();
+		}
+
+		std::lock_guard<std::recursive_mutex> logLock(logMutex);
+		segmentCacheSize   = tunables.cacheSize;
+		checkpointInterval = tunables.checkpointInterval;
+		maxCheckpointAge   = tunables.checkpointAge;
+		segmentCache->resize(segmentCacheSize);
+
+		if (maxCheckpointAge > 0 && !checkpointThread.joinable())
+		{
+			stopCheckpointing = false;
+			checkpointThread  = std::thread(&Log::CheckpointOnTimer, this);
+		}
+
+		return 0;
+	}
+
+	// the cleaner skips dead blocks and empty segments with these instead of reading inodes
+	bool IsBlockLive(LogAddress logAddress)
+	{
+		std::lock_guard<std::recursive_mutex> logLock(logMutex);
+		if (!ValidLogAddress(logAddress))
+		{
+			return false;
+		}
+
+		unsigned int bit = logAddress.logSegment * segmentFactory->getValidityBitmapSizeInBytes() * 8 + logAddress.blockNumber;
+		return (validityBitmaps[bit / 8] >> (bit % 8)) & 1;
+	}
+
+	unsigned int CountLiveBlocks(unsigned int segment)
+	{
+		std::lock_guard<std::recursive_mutex> logLock(logMutex);
+		unsigned int bitmapSize = segmentFactory->getValidityBitmapSizeInBytes();
+		unsigned int liveBlocks = 0;
+		for (unsigned int byte = segment * bitmapSize; byte < (segment + 1) * bitmapSize; ++byte)
+		{
+			liveBlocks += __builtin_popcount(validityBitmaps[byte]);
+		}
+
+		return liveBlocks;
 	}
 
 	void PrintTailSummary()
 	{
 		std::cout << "[LogLayer] Printing tail summary block" << std::endl;
-		tailSegment->summary.PrintSegmentSummaryBlock();
+		getTailSegment(WriteStream::HotData)->summary.PrintSegmentSummaryBlock();
 	}
 
 	void PrintTail()
 	{
 		std::cout << "[LogLayer] Printing log tail data" << std::endl;
 
-		char * tailData = (char * )tailSegment->data;
+		char * tailData = (char * )getTailSegment(WriteStream::HotData)->data;
 		for (int i = 0; i < segmentFactory->getSegmentSizeInBytes(); ++i)
 		{
 			std::cout << tailData[i];
@@ -367,22 +927,14 @@ public:
 
 	SegmentUsageTableEntry * ReadSegmentUsageTable()
 	{
-		unsigned int size = flashData.flashSize * sizeof(SegmentUsageTableEntry);
-		SegmentUsageTableEntry * table = (SegmentUsageTableEntry *)malloc(size);
-		memset(table, 0, size);
-
-	    unsigned int bufferSize  = segmentFactory->getSegmentSizeInBytes();
-	    void * buffer            = malloc(bufferSize);
-	    unsigned int segmentSize = segmentFactory->getSegmentSizeInSectors();
-	    memset(buffer, 0, bufferSize);
-
-		if(Flash_Read(flash, checkpoint.segmentUsageTableSegment * segmentSize, segmentSize, buffer) != 0)
+		char * buffer = readSegmentUsageTableSegment();
+		if (buffer == NULL)
 		{
-	        std::cerr << "[LogLayer] ERROR: Unable to read flash on ReadSegmentUsageTable" << std::endl;
-	        std::cerr << "[LogLayer] errno: " << errno << std::endl;
-	        return NULL;
+			return NULL;
 		}
 
+		unsigned int size = flashData.flashSize * sizeof(SegmentUsageTableEntry);
+		SegmentUsageTableEntry * table = (SegmentUsageTableEntry *)malloc(size);
 		memcpy(table, buffer, size);
 		free(buffer);
 		return table;
@@ -397,15 +949,20 @@ public:
 	    void * buffer = malloc(bufferSize);
 	    memset(buffer, 0, bufferSize);
 	    memcpy(buffer, table, size);
+	    memcpy((char *)buffer + size, validityBitmaps.data(), getValidityBitmapsSizeInBytes());
 	    unsigned int segmentSize = segmentFactory->getSegmentSizeInSectors();
 
-	    if (Flash_Write(flash, checkpoint.segmentUsageTableSegment * segmentSize, segmentFactory->getSegmentSizeInSectors(), buffer) != 0)
+	    std::lock_guard<std::shared_mutex> flashLock(flashMutex);
+	    if (flashWrite(checkpoint.segmentUsageTableSegment * segmentSize, segmentFactory->getSegmentSizeInSectors(), buffer) != 0)
 	    {
 	        std::cerr << "Unable to write segment usage table on WriteSegmentUsageTable()" << std::endl;
 	        std::cerr << "errno: " << errno << std::endl;
+	        free(buffer);
 	        return 1;
 	    }
 
+	    bytesWrittenByCause[WriteCause::SegmentUsageTable] += segmentFactory->getSegmentSizeInSectors() * FLASH_SECTOR_SIZE;
+	    free(buffer);
 		return 0;
 	}
 
@@ -423,6 +980,7 @@ public:
 
 	InMemorySegment * ReadSegment(unsigned int segmentNumber)
 	{
+		std::lock_guard<std::recursive_mutex> logLock(logMutex);
 		InMemorySegment * segmentToRead = segmentFactory->Build(segmentNumber);
 		if (readSegment(segmentToRead) != 0)
 		{
@@ -436,20 +994,62 @@ public:
 		return segmentToRead;
 	}
 
-	void FreeSegment(InMemorySegment * segment)
+	// reads the summary and only the sectors holding live blocks. used by the cleaner, whose victims
+	// are mostly dead, so cleaning reads scale with live data rather than segment size
+	InMemorySegment * ReadLiveBlocks(unsigned int segmentNumber)
 	{
-		segmentFactory->Destroy(segment);
-	}
+		std::lock_guard<std::recursive_mutex> logLock(logMutex);
+		InMemorySegment * segmentToRead = segmentFactory->Build(segmentNumber);
+		if (readLiveBlocks(segmentToRead) != 0)
+		{
+			std::cerr << "[LogLayer] ERROR: Unable to read live blocks from flash" << std::endl;
+	        std::cerr << "[LogLayer] segment number: " << segmentNumber << std::endl;
+    		std::cerr << "[LogLayer] errno: " << errno << std::endl;
+			segmentFactory->Destroy(segmentToRead);
+			return NULL;
+		}
 
-	int EraseSegment(unsigned int segment)
+		return segmentToRead;
+	}
+
+	// reads the summary of a segment without its data
+	InMemorySegment * ReadSegmentSummary(unsigned int segmentNumber)
 	{
-		if (eraseSegment(segment) != 0)
+		std::lock_guard<std::recursive_mutex> logLock(logMutex);
+		InMemorySegment * segmentToRead = segmentFactory->Build(segmentNumber);
+		if (readSegmentSummary(segmentToRead) != 0)
 		{
-			return 1;
+			std::cerr << "[LogLayer] ERROR: Unable to read segment summary from flash" << std::endl;
+	        std::cerr << "[LogLayer] segment number: " << segmentNumber << std::endl;
+			segmentFactory->Destroy(segmentToRead);
+			return NULL;
 		}
 
+		return segmentToRead;
+	}
+
+	void FreeSegment(InMemorySegment * segment)
+	{
+		segmentFactory->Destroy(segment);
+	}
+
+	// called by the cleaner once a segment has no live blocks left. the segment keeps its age
+	// until it is rewritten so a crash before the background erase still finds it dirty on mount
+	int ReleaseSegment(unsigned int segment)
+	{
+		std::lock_guard<std::recursive_mutex> logLock(logMutex);
 		segmentUsageTable[segment].liveBytesInSegment = 0;
-		segmentUsageTable[segment].ageOfYoungestBlock = 0;
+		clearValidityBitmap(segment);
+		for (unsigned int block = 1; block < segmentFactory->getSegmentSizeInSlots(); ++block)
+		{
+			LogAddress logAddress = { .logSegment = segment, .blockNumber = block };
+			forgetBlock(logAddress);
+		}
+
+		std::lock_guard<std::mutex> lock(poolMutex);
+		segmentErased[segment] = false;
+		PushFreeSegment(segment);
+		FillErasePool(erasePoolSize);
 		return WriteSegmentUsageTable(segmentUsageTable);
 	}
 
@@ -460,39 +1060,466 @@ public:
 	}
 
 private:
-	InMemorySegment * getSegment(unsigned int segmentNumber)
+	int readLiveBlock(InMemorySegment * segment, unsigned int blockNumber, void * buffer)
+	{
+		// check if we are reading dead blocks (just report for now)
+		if (segment->summary.blockINums[blockNumber] == NO_INUM)
+		{
+		    std::cerr << "[LogLayer] ERROR: Attempting to reading dead block " << std::endl;
+		    std::cerr << "[LogLayer] Segment Number: " << segment->summary.segmentNumber << std::endl;
+		    std::cerr << "[LogLayer] Block Number: " << blockNumber << std::endl;
+		    throw;
+		    //return 1;
+		}
+
+		return ReadSegmentBlock(segment, blockNumber, buffer);
+	}
+
+	// references to blocks in open tails are counted when the tail is written
+	void addBlockReference(LogAddress logAddress, unsigned int inum, int fileBlock)
+	{
+		SharedBlock& shared = sharedBlocks[LogAddressKey(logAddress)];
+		shared.extraReferences++;
+		shared.owners.push_back({ .inum = inum, .fileBlock = fileBlock });
+		if (getOpenTailSegment(logAddress.logSegment) == NULL)
+		{
+			segmentUsageTable[logAddress.logSegment].liveBytesInSegment += flashData.blockSize * FLASH_SECTOR_SIZE;
+		}
+	}
+
+	unsigned int getReferenceCount(LogAddress logAddress)
+	{
+		auto shared = sharedBlocks.find(LogAddressKey(logAddress));
+		return shared == sharedBlocks.end() ? 1 : 1 + shared->second.extraReferences;
+	}
+
+	// drops a dead or moved block from the dedup index and reference counts
+	void forgetBlock(LogAddress logAddress)
+	{
+		uint64_t key = LogAddressKey(logAddress);
+		sharedBlocks.erase(key);
+
+		auto hash = blockHashes.find(key);
+		if (hash == blockHashes.end())
+		{
+			return;
+		}
+
+		auto entry = dedupIndex.find(hash->second);
+		if (entry != dedupIndex.end() && LogAddressKey(entry->second) == key)
+		{
+			dedupIndex.erase(entry);
+		}
+
+		blockHashes.erase(hash);
+	}
+
+	bool isSameBlock(LogAddress logAddress, void * buffer)
+	{
+		void * blockBuffer = malloc(GetFileBlockSizeInBytes());
+		bool same          = Log_Read(logAddress, blockBuffer) == 0 && memcmp(blockBuffer, buffer, GetFileBlockSizeInBytes()) == 0;
+		free(blockBuffer);
+		return same;
+	}
+
+	// writes a stream's tail to flash and opens the next one
+	int flushTailSegment(WriteStream stream)
+	{
+		if (closeTailSegment(stream, false) != 0)
+		{
+    		return 1;
+		}
+
+		// make new tail segment
+		unsigned int tailSegmentNumber = GetCleanSegment();
+		tailSegments[stream]     = segmentFactory->Build(tailSegmentNumber);
+		tailFlushedBytes[stream] = 0;
+		segmentsFlushed++;
+		//segmentUsageTable[tailSegmentNumber].liveBytesInSegment = 0;
+		//segmentUsageTable[tailSegmentNumber].ageOfYoungestBlock = 0;
+		//WriteSegmentUsageTable(segmentUsageTable);
+
+		if (writesSinceLastCheckpoint >= checkpointInterval * checkpointBackoff || isCheckpointOverdue())
+		{
+			requestCheckpoint();
+		}
+
+		return 0;
+	}
+
+	// writes what a stream's tail gained since its last write to flash for a checkpoint. only the new
+	// blocks and a copy of the summary after them are programmed, so the tail stays open and fills
+	// the erased rest of its segment. the summary block itself is written once, when the tail is closed
+	int writePartialTailSegment(WriteStream stream, bool& usageTableStale)
+	{
+		if (tailSegments[stream] == NULL || !tailDirty[stream])
+		{
+			return 0;
+		}
+
+		TRACE_INFO(LogWritePartialTail, (int)stream);
+		InMemorySegment * tailSegment = tailSegments[stream];
+		unsigned int summarySize      = segmentFactory->getSummarySizeInBlocks() * GetFileBlockSizeInBytes();
+		unsigned int copyOffset       = getTailDataEnd(stream);
+		if (!hasBlocks(tailSegment) || copyOffset + summarySize >= segmentFactory->getDataSizeInBytes())
+		{
+			// nothing in the tail is used or there is no room to copy the summary, so it is closed early
+			if (closeTailSegment(stream, true) != 0)
+			{
+				return 1;
+			}
+
+			tailSegments[stream] = NULL;
+			return 0;
+		}
+
+		char * summaryCopy = (char *)tailSegment->data + copyOffset;
+		memset(summaryCopy, 0, summarySize);
+		tailSegment->summary.Serialize(summaryCopy);
+		if (writeSegmentData(tailSegment, tailFlushedBytes[stream], copyOffset + summarySize) != 0)
+		{
+   			std::cerr << "[LogLayer] ERROR: error writing partial segment to flash" << std::endl;
+    		std::cerr << "[LogLayer] errno: " << strerror(errno) << std::endl;
+    		return 1;
+		}
+
+		chargeTailWrite(stream, true, copyOffset + summarySize - tailFlushedBytes[stream]);
+		usageTableStale                = true;
+		tailFlushedBytes[stream]       = copyOffset + summarySize;
+		tailSegment->summary.dataBytes = tailFlushedBytes[stream];
+		tailDirty[stream]              = false;
+		return 0;
+	}
+
+	// writes a stream's tail to flash and hands it to the segment cache. the segment is not written again
+	int closeTailSegment(WriteStream stream, bool partial)
+	{
+		InMemorySegment * tailSegment = tailSegments[stream];
+		unsigned int dataSize         = segmentFactory->getDataSizeInBytes();
+		unsigned int summarySize      = segmentFactory->getSummarySizeInBlocks() * GetFileBlockSizeInBytes();
+		if(writeSegment(tailSegment, tailFlushedBytes[stream], dataSize) != 0)
+		{
+   			std::cerr << "[LogLayer] ERROR: error writing segment to flash" << std::endl;
+    		std::cerr << "[LogLayer] errno: " << strerror(errno) << std::endl;		
+    		return 1;
+		}
+
+		chargeTailWrite(stream, partial, summarySize + dataSize - tailFlushedBytes[stream]);
+		tailDirty[stream]        = false;
+		tailFlushedBytes[stream] = 0;
+
+		// a tail whose blocks were all freed is already a free segment and must not be read from the cache
+		if (segmentUsageTable[tailSegment->summary.segmentNumber].liveBytesInSegment == 0)
+		{
+			segmentFactory->Destroy(tailSegment);
+			return 0;
+		}
+
+		// add written tail segment to segment cache
+   		TRACE_DEBUG(LogCacheTail, tailSegment->summary.segmentNumber);
+		segmentCache->putEntry(tailSegment);
+		return 0;
+	}
+
+	// a tail written in part for checkpoints gets its summary block when the log stops, so the flash
+	// reads like any other without recovering the tail on the next mount
+	void closePartlyWrittenTails()
+	{
+		std::lock_guard<std::recursive_mutex> logLock(logMutex);
+		unsigned int summarySize = segmentFactory->getSummarySizeInBlocks() * GetFileBlockSizeInBytes();
+		for (int stream = 0; stream < NUM_WRITE_STREAMS; ++stream)
+		{
+			unsigned int flushedBytes = tailFlushedBytes[stream];
+			if (tailSegments[stream] == NULL || flushedBytes == 0)
+			{
+				continue;
+			}
+
+			if (writeSegment(tailSegments[stream], flushedBytes, flushedBytes) != 0)
+			{
+				std::cerr << "[LogLayer] ERROR: Unable to write the summary of tail segment " << tailSegments[stream]->summary.segmentNumber << std::endl;
+				continue;
+			}
+
+			chargeTailWrite((WriteStream)stream, false, summarySize);
+			tailFlushedBytes[stream] = 0;
+		}
+	}
+
+	// a tail written in part for the last checkpoint that was not closed before the log stopped has
+	// only copies of its summary on flash. the latest copy, which the checkpoint points at, becomes its
+	// summary block. a tail that filled after the checkpoint has its summary block already and the
+	// flash refuses to program it again
+	int closeRecoveredTails()
+	{
+		unsigned int summarySize = segmentFactory->getSummarySizeInBlocks() * GetFileBlockSizeInBytes();
+		char * summaryBuffer     = (char *)malloc(summarySize);
+		for (int stream = 0; stream < NUM_WRITE_STREAMS; ++stream)
+		{
+			unsigned int segment = checkpoint.tailSegments[stream];
+			if (segment == 0)
+			{
+				continue;
+			}
+
+			InMemorySegment * tailSegment = segmentFactory->Build(segment);
+			unsigned int summarySector    = tailSegment->summary.startSector;
+			unsigned int copySector       = summarySector + (summarySize + checkpoint.tailSummaryOffsets[stream]) / FLASH_SECTOR_SIZE;
+			memset(summaryBuffer, 0, summarySize);
+			std::lock_guard<std::shared_mutex> flashLock(flashMutex);
+			if (flashRead(copySector, summarySize / FLASH_SECTOR_SIZE, summaryBuffer) != 0 || !tailSegment->summary.Deserialize(summaryBuffer))
+			{
+				std::cerr << "[LogLayer] ERROR: Unable to read the summary of partly written segment " << segment << std::endl;
+				segmentFactory->Destroy(tailSegment);
+				free(summaryBuffer);
+				return 1;
+			}
+
+			segmentFactory->Destroy(tailSegment);
+			if (flashWrite(summarySector, summarySize / FLASH_SECTOR_SIZE, summaryBuffer) == 0)
+			{
+				TRACE_INFO(LogCloseRecoveredTail, segment, stream);
+				bytesWrittenByCause[WriteCause::Checkpointing] += summarySize;
+			}
+			else if (errno != EIO)
+			{
+				std::cerr << "[LogLayer] ERROR: Unable to write the summary of partly written segment " << segment << std::endl;
+	    		std::cerr << "[LogLayer] errno: " << errno << std::endl;
+				free(summaryBuffer);
+				return 1;
+			}
+		}
+
+		free(summaryBuffer);
+		return 0;
+	}
+
+	void setTailSlotCause(WriteStream stream, unsigned int slot, int cause)
+	{
+		std::vector<int8_t>& slotCauses = tailSlotCauses[stream];
+		slotCauses.resize(std::max((size_t)tailSegments[stream]->summary.numberOfBlocks, slotCauses.size()), NO_WRITE_CAUSE);
+		slotCauses[slot] = cause;
+	}
+
+	// blocks added to the tail since it was last written are charged to their causes. a block that was
+	// overwritten while the tail was in memory never reaches flash and is not charged. the rest of what
+	// a checkpoint writes is charged to the checkpoint, the rest of a full segment is overhead
+	void chargeTailWrite(WriteStream stream, bool partial, unsigned long long bytesWritten)
 	{
-		InMemorySegment * segmentToRead = NULL;
+		SegmentSummary& summary         = tailSegments[stream]->summary;
+		unsigned long long blockBytes   = 0;
+		setTailSlotCause(stream, 0, NO_WRITE_CAUSE);
+		for (unsigned int slot = 1; slot < summary.numberOfBlocks; ++slot)
+		{
+			int cause = tailSlotCauses[stream][slot];
+			tailSlotCauses[stream][slot] = NO_WRITE_CAUSE;
+			if (summary.blockINums[slot] == NO_INUM || cause == NO_WRITE_CAUSE)
+			{
+				continue;
+			}
+
+			blockBytes                 += summary.blockLengths[slot];
+			bytesWrittenByCause[cause] += summary.blockLengths[slot];
+		}
+
+		unsigned long long overheadBytes = bytesWritten - blockBytes;
+		bytesWrittenByCause[WriteCause::Checkpointing]   += partial ? overheadBytes : 0;
+		bytesWrittenByCause[WriteCause::SegmentOverhead] += partial ? 0 : overheadBytes;
+	}
+
+	// end of the used part of a tail's data area, rounded up to a sector. blocks already on flash
+	// are never moved, so this is at least what was written for the last checkpoint
+	unsigned int getTailDataEnd(WriteStream stream)
+	{
+		SegmentSummary& summary = tailSegments[stream]->summary;
+		unsigned int dataEnd    = std::max(tailFlushedBytes[stream], segmentFactory->isCompressed() ? summary.dataBytes : 0);
+		for (unsigned int slot = 1; !segmentFactory->isCompressed() && slot < summary.numberOfBlocks; ++slot)
+		{
+			if (summary.blockINums[slot] != NO_INUM)
+			{
+				dataEnd = std::max(dataEnd, summary.blockOffsets[slot] + summary.blockLengths[slot]);
+			}
+		}
+
+		return (dataEnd + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE * FLASH_SECTOR_SIZE;
+	}
+
+	bool hasBlocks(InMemorySegment * segment)
+	{
+		for (unsigned int slot = 1; slot < segment->summary.numberOfBlocks; ++slot)
+		{
+			if (segment->summary.blockINums[slot] != NO_INUM)
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// uncompressed tails are written when their last slot is used so they always have room
+	bool hasRoomInTail(InMemorySegment * tailSegment, unsigned int length)
+	{
+		if (!segmentFactory->isCompressed())
+		{
+			return true;
+		}
+
+		SegmentSummary& summary = tailSegment->summary;
+		return summary.nextSlot < summary.numberOfBlocks && summary.dataBytes + length <= segmentFactory->getDataSizeInBytes();
+	}
 
-		if (segmentCache->containsEntry(segmentNumber))
+	bool isSegmentFull(InMemorySegment * segment)
+	{
+		SegmentSummary& summary = segment->summary;
+		if (!segmentFactory->isCompressed())
 		{
-			segmentToRead = segmentCache->getEntry(segmentNumber);
+			return summary.blockINums[summary.numberOfBlocks - 1] != NO_INUM;
 		}
-		else if (tailSegment->summary.segmentNumber == segmentNumber)
+
+		return summary.nextSlot == summary.numberOfBlocks || summary.dataBytes == segmentFactory->getDataSizeInBytes();
+	}
+
+	Checkpoint getCheckpointInSlot(char * checkpointSegmentBuffer, unsigned int slot)
+	{
+		Checkpoint curr;
+		memcpy(&curr, checkpointSegmentBuffer + (slot * CHECKPOINT_SIZE_IN_SECTORS * FLASH_SECTOR_SIZE), sizeof(Checkpoint));
+		return curr;
+	}
+
+	void setBlockLive(LogAddress logAddress, bool live)
+	{
+		unsigned int bit = logAddress.logSegment * segmentFactory->getValidityBitmapSizeInBytes() * 8 + logAddress.blockNumber;
+		if (live)
 		{
-			segmentToRead = tailSegment;
+			validityBitmaps[bit / 8] |= (1 << (bit % 8));
 		}
 		else
 		{
-			segmentToRead = segmentFactory->Build(segmentNumber);
-			if (readSegment(segmentToRead) != 0)
+			validityBitmaps[bit / 8] &= ~(1 << (bit % 8));
+		}
+	}
+
+	void clearValidityBitmap(unsigned int segment)
+	{
+		unsigned int bitmapSize = segmentFactory->getValidityBitmapSizeInBytes();
+		memset(validityBitmaps.data() + segment * bitmapSize, 0, bitmapSize);
+	}
+
+	unsigned int getValidityBitmapsSizeInBytes()
+	{
+		return flashData.flashSize * segmentFactory->getValidityBitmapSizeInBytes();
+	}
+
+	// the segment usage table segment holds the table followed by the validity bitmaps
+	char * readSegmentUsageTableSegment()
+	{
+	    unsigned int bufferSize  = segmentFactory->getSegmentSizeInBytes();
+	    char * buffer            = (char *)malloc(bufferSize);
+	    unsigned int segmentSize = segmentFactory->getSegmentSizeInSectors();
+	    memset(buffer, 0, bufferSize);
+
+		std::shared_lock<std::shared_mutex> flashLock(flashMutex);
+		if(flashRead(checkpoint.segmentUsageTableSegment * segmentSize, segmentSize, buffer) != 0)
+		{
+	        std::cerr << "[LogLayer] ERROR: Unable to read flash on ReadSegmentUsageTable" << std::endl;
+	        std::cerr << "[LogLayer] errno: " << errno << std::endl;
+	        free(buffer);
+	        return NULL;
+		}
+
+		return buffer;
+	}
+
+	// compressed tails fill slots in order since a freed block's bytes stay in the segment.
+	// uncompressed tails reuse the first free slot that is not on flash yet
+	unsigned int getEmptySlot(WriteStream stream)
+	{
+		SegmentSummary& summary = tailSegments[stream]->summary;
+		if (segmentFactory->isCompressed())
+		{
+			return summary.nextSlot < summary.numberOfBlocks ? summary.nextSlot : 0;
+		}
+
+		for (unsigned int b = tailFlushedBytes[stream] / GetFileBlockSizeInBytes() + 1; b < summary.numberOfBlocks; ++b)
+		{
+			if (summary.blockINums[b] == NO_INUM)
 			{
-				std::cerr << "[LogLayer] ERROR: Unable to read segment from flash" << std::endl;
-		        std::cerr << "[LogLayer] segment number: " << segmentNumber << std::endl;
-        		std::cerr << "[LogLayer] errno: " << errno << std::endl;
-				segmentFactory->Destroy(segmentToRead);
-				return NULL;
+				return b;
 			}
+		}
+
+		return 0;
+	}
 
-			segmentCache->putEntry(segmentToRead);
+	// returns the open tail of the stream, opening a new one if the stream has none yet
+	// or if its last attempt found the flash full
+	InMemorySegment * getTailSegment(WriteStream stream)
+	{
+		InMemorySegment * tailSegment = tailSegments[stream];
+		if (tailSegment != NULL && tailSegment->summary.segmentNumber < flashData.flashSize)
+		{
+			return tailSegment;
 		}
 
-		return segmentToRead;
+		if (tailSegment != NULL)
+		{
+			segmentFactory->Destroy(tailSegment);
+			tailSegments[stream] = NULL;
+		}
+
+		unsigned int tailSegmentNumber = GetCleanSegment();
+		tailSegments[stream]           = segmentFactory->Build(tailSegmentNumber);
+		tailFlushedBytes[stream]       = 0;
+		TRACE_INFO(LogOpenTail, tailSegmentNumber, (int)stream);
+		return tailSegments[stream];
+	}
+
+	// flash access goes through these so it is counted. callers hold flashMutex where it is needed
+	int flashRead(unsigned int sector, unsigned int count, void * buffer)
+	{
+		flashReads++;
+		flashSectorsRead += count;
+		return Flash_Read(flash, sector, count, buffer);
+	}
+
+	// a write the flash refuses programs nothing and is not counted
+	int flashWrite(unsigned int sector, unsigned int count, void * buffer)
+	{
+		int ret = Flash_Write(flash, sector, count, buffer);
+		if (ret == 0)
+		{
+			flashWrites++;
+			flashSectorsWritten += count;
+		}
+
+		return ret;
+	}
+
+	int flashErase(unsigned int eraseBlock, unsigned int count)
+	{
+		flashErases++;
+		flashEraseBlocksErased += count;
+		return Flash_Erase(flash, eraseBlock, count);
+	}
+
+	InMemorySegment * getOpenTailSegment(unsigned int segmentNumber)
+	{
+		for (int stream = 0; stream < NUM_WRITE_STREAMS; ++stream)
+		{
+			if (tailSegments[stream] != NULL && tailSegments[stream]->summary.segmentNumber == segmentNumber)
+			{
+				return tailSegments[stream];
+			}
+		}
+
+		return NULL;
 	}
 
 	int readSegment(InMemorySegment * segmentToRead)
 	{
-		std::cout << "[LogLayer] Reading log segment " << segmentToRead->summary.segmentNumber << " from flash" << std::endl;
+		LatencyTimer timer(LatencyOp::LogReadSegment);
+		TRACE_INFO(LogReadSegment, segmentToRead->summary.segmentNumber);
 
 		// read segment into temp buffer
 		unsigned int segmentSizeInBytes = segmentFactory->getSegmentSizeInBytes();
@@ -500,125 +1527,292 @@ private:
 		memset(segmentBuffer, 0, segmentSizeInBytes);
 		unsigned int sector  = segmentToRead->summary.startSector;
 		unsigned int count   = segmentFactory->getSegmentSizeInSectors();
-		if (Flash_Read(flash, sector, count, segmentBuffer) == 1)
+		std::shared_lock<std::shared_mutex> flashLock(flashMutex);
+		if (flashRead(sector, count, segmentBuffer) == 1)
 		{
 			free(segmentBuffer);
 			return 1;
 		}
 
-		// copy summary fields
-		int * newINumPointer   = segmentToRead->summary.blockINums;
-		int * newBlocksPointer = segmentToRead->summary.iNodeBlockNumbers;
-		segmentToRead->summary = *reinterpret_cast<SegmentSummary *>(segmentBuffer); // DONT READ THE INUMS POINTER. ITS REALLOCATED
-		segmentToRead->summary.blockINums = newINumPointer;
-		segmentToRead->summary.iNodeBlockNumbers = newBlocksPointer;
+		flashLock.unlock();
 
-		// copy blockINums
-		char * blockINumsBuffer = (char *)segmentBuffer + sizeof(SegmentSummary);
-		memcpy(segmentToRead->summary.blockINums, blockINumsBuffer, segmentToRead->summary.numberOfBlocks * sizeof(int));
-
-		// copy inode blocks nums
-		char * iNodeBlocksBuffer = (char *)segmentBuffer + sizeof(SegmentSummary) + segmentToRead->summary.numberOfBlocks * sizeof(int);
-		memcpy(segmentToRead->summary.iNodeBlockNumbers, iNodeBlocksBuffer, segmentToRead->summary.numberOfBlocks * sizeof(int));
+		// copy summary fields. a bad checksum means a torn segment write or a corrupted summary
+		if (!segmentToRead->summary.Deserialize((char *)segmentBuffer))
+		{
+			std::cerr << "[LogLayer] ERROR: Segment summary checksum mismatch" << std::endl;
+		    std::cerr << "[LogLayer] segment number: " << segmentToRead->summary.segmentNumber << std::endl;
+			free(segmentBuffer);
+			return 1;
+		}
 
 		// copy data
-		unsigned int blockSize = flashData.blockSize * FLASH_SECTOR_SIZE;
-		char * dataBuffer      = (char *)segmentBuffer + blockSize;
-		memcpy(segmentToRead->data, dataBuffer, segmentSizeInBytes - flashData.blockSize * FLASH_SECTOR_SIZE);
+		unsigned int summarySize = segmentFactory->getSummarySizeInBlocks() * flashData.blockSize * FLASH_SECTOR_SIZE;
+		char * dataBuffer        = (char *)segmentBuffer + summarySize;
+		memcpy(segmentToRead->data, dataBuffer, segmentFactory->getDataSizeInBytes());
 
 		free(segmentBuffer);
 		return 0;
 	}
 
-	int writeSegment(InMemorySegment * segmentToWrite)
+	int readSegmentSummary(InMemorySegment * segmentToRead)
+	{
+		unsigned int segmentNumber = segmentToRead->summary.segmentNumber;
+		unsigned int summarySize   = segmentFactory->getSummarySizeInBlocks() * flashData.blockSize * FLASH_SECTOR_SIZE;
+		unsigned int summarySector = segmentToRead->summary.startSector;
+		char * summaryBuffer       = (char *)malloc(summarySize);
+		memset(summaryBuffer, 0, summarySize);
+		std::shared_lock<std::shared_mutex> flashLock(flashMutex);
+		if (flashRead(summarySector, summarySize / FLASH_SECTOR_SIZE, summaryBuffer) == 1)
+		{
+			free(summaryBuffer);
+			return 1;
+		}
+
+		flashLock.unlock();
+
+		bool summaryValid = segmentToRead->summary.Deserialize(summaryBuffer);
+		free(summaryBuffer);
+		if (!summaryValid)
+		{
+			std::cerr << "[LogLayer] ERROR: Segment summary checksum mismatch" << std::endl;
+		    std::cerr << "[LogLayer] segment number: " << segmentNumber << std::endl;
+			return 1;
+		}
+
+		return 0;
+	}
+
+	int readLiveBlocks(InMemorySegment * segmentToRead)
+	{
+		LatencyTimer timer(LatencyOp::LogReadSegment);
+		if (readSegmentSummary(segmentToRead) != 0)
+		{
+			return 1;
+		}
+
+		// sector runs of the data area holding live blocks. extents are in slot order so runs that
+		// touch or overlap, including compressed blocks sharing a sector, are merged into one read
+		SegmentSummary& summary      = segmentToRead->summary;
+		unsigned int segmentNumber   = summary.segmentNumber;
+		unsigned int dataSector      = summary.startSector + segmentFactory->getSummarySizeInBlocks() * flashData.blockSize;
+		unsigned int dataSizeInBytes = segmentFactory->getDataSizeInBytes();
+		std::vector<std::pair<unsigned int, unsigned int>> runs;
+		for (unsigned int block = 1; block < summary.numberOfBlocks; ++block)
+		{
+			LogAddress logAddress = { .logSegment = segmentNumber, .blockNumber = block };
+			if (summary.blockINums[block] == NO_INUM || !IsBlockLive(logAddress))
+			{
+				continue;
+			}
+
+			unsigned int offset = summary.blockOffsets[block];
+			unsigned int length = summary.blockLengths[block];
+			if (length == 0 || offset + length > dataSizeInBytes)
+			{
+				// left for ReadSegmentBlock to report
+				continue;
+			}
+
+			unsigned int first = offset / FLASH_SECTOR_SIZE;
+			unsigned int end   = (offset + length + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE;
+			if (!runs.empty() && first <= runs.back().second)
+			{
+				runs.back().second = std::max(runs.back().second, end);
+				continue;
+			}
+
+			runs.push_back(std::make_pair(first, end));
+		}
+
+		unsigned int sectorsRead = 0;
+		std::shared_lock<std::shared_mutex> flashLock(flashMutex);
+		for (auto run : runs)
+		{
+			char * runBuffer = (char *)segmentToRead->data + run.first * FLASH_SECTOR_SIZE;
+			if (flashRead(dataSector + run.first, run.second - run.first, runBuffer) == 1)
+			{
+				return 1;
+			}
+
+			sectorsRead += run.second - run.first;
+		}
+
+		flashLock.unlock();
+		TRACE_INFO(LogReadLiveBlocks, segmentNumber, runs.size(), sectorsRead);
+		return 0;
+	}
+
+	// writes the summary and the data area from dataStart to dataEnd. a tail written in part for
+	// checkpoints already has the start of its data area on flash
+	int writeSegment(InMemorySegment * segmentToWrite, unsigned int dataStart, unsigned int dataEnd)
 	{
-		std::cout << "[LogLayer] Writing log segment " << segmentToWrite->summary.segmentNumber << " to flash" << std::endl;
+		LatencyTimer timer(LatencyOp::LogWriteSegment);
+		TRACE_INFO(LogWriteSegment, segmentToWrite->summary.segmentNumber);
 
 		// create buffer with summary block and data
-		unsigned int segmentSizeInBytes = segmentFactory->getSegmentSizeInBytes();
-		void * bufferToWrite            = malloc(segmentSizeInBytes);
-		memset(bufferToWrite, 0, segmentSizeInBytes);
-
-		// copy segment summary block into buffer
-		unsigned int blockSize     = flashData.blockSize * FLASH_SECTOR_SIZE;
-		char * segmentSummaryBlock = (char *)malloc(blockSize);
-		memset(segmentSummaryBlock, 0, blockSize);
-		memcpy(segmentSummaryBlock, &segmentToWrite->summary, sizeof(SegmentSummary));
-		memcpy(segmentSummaryBlock + sizeof(SegmentSummary), segmentToWrite->summary.blockINums, flashData.segmentSize * sizeof(int));
-		memcpy(segmentSummaryBlock + sizeof(SegmentSummary) + flashData.segmentSize * sizeof(int), segmentToWrite->summary.iNodeBlockNumbers, flashData.segmentSize * sizeof(int));
-		memcpy(bufferToWrite, segmentSummaryBlock, blockSize);
-
-		// copy data into buffer
-		memcpy(((char *)bufferToWrite) + blockSize, segmentToWrite->data, segmentSizeInBytes - blockSize);
-
-		// write to flash
+		unsigned int summarySize = segmentFactory->getSummarySizeInBlocks() * flashData.blockSize * FLASH_SECTOR_SIZE;
+		unsigned int bufferSize  = summarySize + dataEnd - dataStart;
+		char * bufferToWrite     = (char *)malloc(bufferSize);
+		memset(bufferToWrite, 0, bufferSize);
+
+		// copy segment summary blocks and data into buffer
+		segmentToWrite->summary.Serialize(bufferToWrite);
+		memcpy(bufferToWrite + summarySize, (char *)segmentToWrite->data + dataStart, dataEnd - dataStart);
+
+		// write to flash. the summary is written apart from data that does not follow it
 		unsigned int sector = segmentToWrite->summary.startSector;
-		unsigned int count  = segmentFactory->getSegmentSizeInSectors();
-		int ret             = Flash_Write(flash, sector, count, bufferToWrite);
-		free(segmentSummaryBlock);
+		std::unique_lock<std::shared_mutex> flashLock(flashMutex);
+		int ret = flashWrite(sector, (dataStart == 0 ? bufferSize : summarySize) / FLASH_SECTOR_SIZE, bufferToWrite);
+		if (ret == 0 && dataStart != 0 && dataEnd > dataStart)
+		{
+			ret = flashWrite(sector + (summarySize + dataStart) / FLASH_SECTOR_SIZE, (dataEnd - dataStart) / FLASH_SECTOR_SIZE, bufferToWrite + summarySize);
+		}
+
+		flashLock.unlock();
 		free(bufferToWrite);
 
+		// a tail written in part for checkpoints adds less than a segment since the last one
+		writesSinceLastCheckpoint += dataStart == 0;
+		updateSegmentUsage(segmentToWrite);
+		WriteSegmentUsageTable(segmentUsageTable);
+		return ret;
+	}
+
+	// writes part of an open tail's data area without its summary. the caller writes the usage table
+	int writeSegmentData(InMemorySegment * segmentToWrite, unsigned int dataStart, unsigned int dataEnd)
+	{
+		LatencyTimer timer(LatencyOp::LogWriteSegment);
+		TRACE_INFO(LogWriteSegment, segmentToWrite->summary.segmentNumber);
+		unsigned int summarySize = segmentFactory->getSummarySizeInBlocks() * flashData.blockSize * FLASH_SECTOR_SIZE;
+		unsigned int sector      = segmentToWrite->summary.startSector + (summarySize + dataStart) / FLASH_SECTOR_SIZE;
+		std::unique_lock<std::shared_mutex> flashLock(flashMutex);
+		int ret = flashWrite(sector, (dataEnd - dataStart) / FLASH_SECTOR_SIZE, (char *)segmentToWrite->data + dataStart);
+		flashLock.unlock();
+		updateSegmentUsage(segmentToWrite);
+		return ret;
+	}
+
+	void updateSegmentUsage(InMemorySegment * segmentToWrite)
+	{
 		// update checkpoint ifile inodes with ifile inodes on disk
 		// only want to update the ifileinode in the checkpoint when the segment is written
 		checkpoint.iFileINode = iFileINode;
 
-		writesSinceLastCheckpoint++;
+		lastSegmentWritten = segmentToWrite->summary.segmentNumber;
 		
 		segmentUsageTable[segmentToWrite->summary.segmentNumber].liveBytesInSegment = 0;
-		for (int s = 1; s < flashData.segmentSize; s++)
+		for (int s = 1; s < segmentToWrite->summary.numberOfBlocks; s++)
 		{
 			if (segmentToWrite->summary.blockINums[s] != NO_INUM)
 			{
-				segmentUsageTable[segmentToWrite->summary.segmentNumber].liveBytesInSegment += GetFileBlockSizeInBytes();
+				LogAddress logAddress = { .logSegment = segmentToWrite->summary.segmentNumber, .blockNumber = (unsigned int)s };
+				segmentUsageTable[segmentToWrite->summary.segmentNumber].liveBytesInSegment += GetFileBlockSizeInBytes() * getReferenceCount(logAddress);
 			}
 		}
 
 		segmentUsageTable[segmentToWrite->summary.segmentNumber].ageOfYoungestBlock = time(0);
-
-		WriteSegmentUsageTable(segmentUsageTable);
-		return ret;
+		if (segmentUsageTable[segmentToWrite->summary.segmentNumber].liveBytesInSegment == 0)
+		{
+			// every block was freed before the tail filled
+			std::lock_guard<std::mutex> lock(poolMutex);
+			PushFreeSegment(segmentToWrite->summary.segmentNumber);
+		}
 	}
 
 	int eraseSegment(unsigned int segmentToErase)
 	{
-		std::cout << "[LogLayer] Erasing log segment " << segmentToErase << " from flash" << std::endl;
+		LatencyTimer timer(LatencyOp::LogEraseSegment);
+		TRACE_INFO(LogEraseSegment, segmentToErase);
 		unsigned int eraseBlocksPerSegment = flashData.segmentSize * flashData.blockSize / FLASH_SECTORS_PER_BLOCK;
 		unsigned int eraseBlock = segmentToErase * eraseBlocksPerSegment;
-		if (Flash_Erase(flash, eraseBlock, eraseBlocksPerSegment) != 0)
+		std::lock_guard<std::shared_mutex> flashLock(flashMutex);
+		if (flashErase(eraseBlock, eraseBlocksPerSegment) != 0)
 		{
 			std::cerr << "[LogLayer] ERROR: Unable to erase segment from flash" << std::endl;
 	        std::cerr << "[LogLayer] segment number: " << segmentToErase << std::endl;
     		std::cerr << "[LogLayer] errno: " << errno << std::endl;
     		return 1;
 		}
-		
+
+		segmentWear[segmentToErase]++;
+		return 0;
+	}
+
+	// a segment's erase blocks are always erased together. use the most worn one in case they differ
+	int ReadSegmentWear()
+	{
+		unsigned int eraseBlocksPerSegment = flashData.segmentSize * flashData.blockSize / FLASH_SECTORS_PER_BLOCK;
+		std::lock_guard<std::shared_mutex> flashLock(flashMutex);
+		segmentWear.assign(flashData.flashSize, 0);
+		for (unsigned int segment = 0; segment < flashData.flashSize; ++segment)
+		{
+			for (unsigned int block = segment * eraseBlocksPerSegment; block < (segment + 1) * eraseBlocksPerSegment; ++block)
+			{
+				unsigned int wear;
+				if (Flash_GetWear(flash, block, &wear) != 0)
+				{
+					std::cerr << "[LogLayer] ERROR: Unable to read wear of erase block " << block << std::endl;
+		    		std::cerr << "[LogLayer] errno: " << errno << std::endl;
+		    		return 1;
+				}
+
+				segmentWear[segment] = std::max(segmentWear[segment], wear);
+			}
+		}
+
 		return 0;
 	}
 
 	int CheckpointNow()
 	{
-		std::cout << "[LogLayer] Checkpointing" << std::endl;
+		LatencyTimer timer(LatencyOp::LogCheckpoint);
+		std::lock_guard<std::recursive_mutex> logLock(logMutex);
+		TRACE_INFO(LogCheckpoint, dataAtRisk);
 		assert(checkpoint.isValid);
+
+		// the ifile inode can point at blocks in any stream's tail, so partly filled tails go to flash first.
+		// the usage table is written once for all of them
+		bool usageTableStale = false;
+		for (int stream = NUM_WRITE_STREAMS - 1; stream >= 0; --stream)
+		{
+			if (writePartialTailSegment((WriteStream)stream, usageTableStale) != 0)
+			{
+				return 1;
+			}
+		}
+
+		if (usageTableStale)
+		{
+			WriteSegmentUsageTable(segmentUsageTable);
+		}
+
+		checkpoint.iFileINode         = iFileINode;
 		checkpoint.time               = NanosSinceEpoch();
-		checkpoint.lastSegmentWritten = 
-			recoveredWithPartialSegment ? tailSegment->summary.segmentNumber : tailSegment->summary.segmentNumber - 1;
+		checkpoint.sequenceNumber++;
+		checkpoint.lastSegmentWritten = lastSegmentWritten;
 
-		// what if we recover from a full segment?
-		// havent written back out the partial segment yet. want to use it in recovery. 
-		// latest ifile inode already written to checkpoint struct when segment is written
+		// a tail with blocks on flash has no summary block yet. recovery uses its latest summary copy
+		unsigned int summarySize = segmentFactory->getSummarySizeInBlocks() * GetFileBlockSizeInBytes();
+		for (int stream = 0; stream < NUM_WRITE_STREAMS; ++stream)
+		{
+			bool partlyWritten                    = tailSegments[stream] != NULL && tailFlushedBytes[stream] > 0;
+			checkpoint.tailSegments[stream]       = partlyWritten ? tailSegments[stream]->summary.segmentNumber : 0;
+			checkpoint.tailSummaryOffsets[stream] = partlyWritten ? tailFlushedBytes[stream] - summarySize : 0;
+		}
 
 		// find where to write new checkpoint
 		checkpointSector = (checkpointSector + CHECKPOINT_SIZE_IN_SECTORS) % (flashData.segmentSize * flashData.blockSize);
 		checkpointSector += flashData.checkpointSegment * flashData.segmentSize * flashData.blockSize;
-		std::cout << "[LogLayer] Writing checkpoint to sector: " << checkpointSector << std::endl;
+		TRACE_INFO(LogWriteCheckpoint, checkpointSector, checkpoint.sequenceNumber);
 
 		// erase old checkpoint if neccessary 
+		std::lock_guard<std::shared_mutex> flashLock(flashMutex);
 		if (checkpointSector % FLASH_SECTORS_PER_BLOCK == 0)
 		{
-			unsigned int eraseBlocksPerSegment = flashData.segmentSize * flashData.blockSize / FLASH_SECTORS_PER_BLOCK;
-			unsigned int eraseBlock = (flashData.checkpointSegment * eraseBlocksPerSegment) + (checkpointSector / FLASH_SECTORS_PER_BLOCK);
-			std::cout << "[LogLayer] Erasing old checkpoints at erase block: " << eraseBlock << std::endl;
-		 	Flash_Erase(flash, eraseBlock, 1);
+			// checkpointSector is already relative to the start of the flash
+			unsigned int eraseBlock = checkpointSector / FLASH_SECTORS_PER_BLOCK;
+			TRACE_INFO(LogEraseCheckpoints, eraseBlock);
+		 	flashErase(eraseBlock, 1);
 		}
 
 		// write checkpoint to flash
@@ -627,54 +1821,179 @@ private:
 		memset(checkpointBuffer, 0, checkpointBufferSize);
 		memcpy(checkpointBuffer, &checkpoint, sizeof(Checkpoint));
 
-		if (Flash_Write(flash, checkpointSector, CHECKPOINT_SIZE_IN_SECTORS, checkpointBuffer) != 0)
+		if (flashWrite(checkpointSector, CHECKPOINT_SIZE_IN_SECTORS, checkpointBuffer) != 0)
 	    {
 	        std::cerr << "[LogLayer] unable to write checkpoint to flash" << std::endl;
 	        std::cerr << "[LogLayer] checkpointSector: " << checkpointSector << std::endl;
 	        std::cerr << "errno: " << errno << std::endl;
+	        free(checkpointBuffer);
 	        return 1;
 	    }
 
+	    bytesWrittenByCause[WriteCause::Checkpointing] += checkpointBufferSize;
 	    free(checkpointBuffer);
 
+		// checkpoints closer together than the idle period come from a burst of writes. spacing them out
+		// bounds what they cost and the maximum age still bounds the data at risk
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (maxCheckpointAge > 0)
+		{
+			if (now - lastCheckpoint < getCheckpointIdlePeriod())
+			{
+				checkpointBackoff = checkpointBackoff * 2 < CHECKPOINT_MAX_BACKOFF ? checkpointBackoff * 2 : CHECKPOINT_MAX_BACKOFF;
+			}
+			else
+			{
+				checkpointBackoff = 1;
+			}
+		}
+
+		lastCheckpoint            = now;
+		checkpointsTaken++;
 		writesSinceLastCheckpoint = 0;
+		dataAtRisk                = 0;
+		checkpointDue             = false;
 		return 0;
 	}
 
+	void SetCheckpointHandler(std::function<int()> handler)
+	{
+		std::lock_guard<std::mutex> handlerLock(checkpointHandlerMutex);
+		std::lock_guard<std::recursive_mutex> logLock(logMutex);
+		checkpointHandler = handler;
+	}
+
+	bool IsCheckpointDue()
+	{
+		return checkpointDue;
+	}
+
+	unsigned long long GetSegmentsFlushed()
+	{
+		return segmentsFlushed;
+	}
+
+	// called with the log lock held. the handler takes locks that come before it, so it is only flagged
+	int requestCheckpoint()
+	{
+		if (checkpointHandler)
+		{
+			checkpointDue = true;
+			return 0;
+		}
+
+		return CheckpointNow();
+	}
+
+	std::chrono::seconds getCheckpointIdlePeriod()
+	{
+		return std::chrono::seconds(maxCheckpointAge / 4 > 0 ? maxCheckpointAge / 4 : 1);
+	}
+
+	bool isCheckpointOverdue()
+	{
+		return maxCheckpointAge > 0 && dataAtRisk > 0 && std::chrono::steady_clock::now() - dirtySince >= std::chrono::seconds(maxCheckpointAge);
+	}
+
+	// checkpoint thread. checkpoints once written data has sat for the idle period with no more writes,
+	// or has waited the maximum age
+	void CheckpointOnTimer()
+	{
+		std::unique_lock<std::mutex> lock(checkpointTimerMutex);
+		while (!checkpointTimerCondition.wait_for(lock, getCheckpointIdlePeriod(), [this] { return stopCheckpointing; }))
+		{
+			lock.unlock();
+			{
+				std::lock_guard<std::mutex> handlerLock(checkpointHandlerMutex);
+				std::unique_lock<std::recursive_mutex> logLock(logMutex);
+				bool idle = std::chrono::steady_clock::now() - lastWrite >= getCheckpointIdlePeriod();
+				if (dataAtRisk > 0 && (idle || isCheckpointOverdue()))
+				{
+					if (checkpointHandler)
+					{
+						logLock.unlock();
+						checkpointHandler();
+					}
+					else
+					{
+						CheckpointNow();
+					}
+				}
+			}
+			lock.lock();
+		}
+	}
+
+	void StopCheckpointThread()
+	{
+		if (!checkpointThread.joinable())
+		{
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(checkpointTimerMutex);
+			stopCheckpointing = true;
+		}
+
+		checkpointTimerCondition.notify_all();
+		checkpointThread.join();
+	}
+
+	// checkpoints are written around the reserved segment in sequence number order. an erase only
+	// resets a sector's state, so the slots after the newest checkpoint hold older ones from the last
+	// pass. the slots from the first one up to the newest all have a sequence number at least as high
+	// as the first slot's, so the newest can be found with a binary search over one read of the segment
 	int RecoverCheckpoint()
 	{
 		std::cout << "[LogLayer] recovering from checkpoint region" << std::endl;
-		unsigned int checkpointBufferSize = CHECKPOINT_SIZE_IN_SECTORS * FLASH_SECTOR_SIZE;
-	    void * checkpointBuffer           = malloc(checkpointBufferSize);
+	    unsigned int checkpointSegmentSizeInSectors = flashData.segmentSize * flashData.blockSize;
+	    unsigned int checkpointSegmentStartSector   = flashData.checkpointSegment * checkpointSegmentSizeInSectors;
+	    unsigned int checkpointBufferSize           = checkpointSegmentSizeInSectors * FLASH_SECTOR_SIZE;
+	    char * checkpointBuffer                     = (char *)malloc(checkpointBufferSize);
+	    memset(checkpointBuffer, 0, checkpointBufferSize);
 
-	    Checkpoint curr;
-	    unsigned int checkpointSegmentStartSector = flashData.checkpointSegment * flashData.segmentSize * flashData.blockSize;
-	    unsigned int checkpointSegmentEndSector = checkpointSegmentStartSector + (flashData.segmentSize * flashData.blockSize);
+		if (flashRead(checkpointSegmentStartSector, checkpointSegmentSizeInSectors, checkpointBuffer) != 0)
+	    {
+	        std::cerr << "[LogLayer] Unable to recover checkpoint on initFlash" << std::endl;
+	        std::cerr << "[LogLayer] errno: " << errno << std::endl;
+	        free(checkpointBuffer);
+	        return 1;
+	    }
 
-	    for (unsigned int currSector = checkpointSegmentStartSector; currSector < checkpointSegmentEndSector; currSector += CHECKPOINT_SIZE_IN_SECTORS)
+	    unsigned int numberOfSlots = checkpointSegmentSizeInSectors / CHECKPOINT_SIZE_IN_SECTORS;
+	    Checkpoint first           = getCheckpointInSlot(checkpointBuffer, 0);
+	    if (!first.isValid)
 	    {
-	    	memset(&curr, 0, sizeof(Checkpoint));
-	    	memset(checkpointBuffer, 0, checkpointBufferSize);
-
-	    	if (Flash_Read(flash, currSector, CHECKPOINT_SIZE_IN_SECTORS, checkpointBuffer) != 0)
-		    {
-		        std::cerr << "[LogLayer] Unable to recover checkpoint on initFlash" << std::endl;
-		        std::cerr << "[LogLayer] errno: " << errno << std::endl;
-		        return 1;
-		    }
-
-	   		memcpy(&curr, checkpointBuffer, sizeof(Checkpoint));
-	   		if (curr.isValid && checkpoint.time < curr.time)
-	   		{
-	   			checkpoint = curr;
-	   			checkpointSector = currSector;
-	   		}
+	    	std::cerr << "[LogLayer] ERROR: No checkpoint in the first checkpoint slot" << std::endl;
+	    	free(checkpointBuffer);
+	    	return 1;
 	    }
 
+	    // slot low is always at or before the newest checkpoint, slot high is always after it
+	    unsigned int low  = 0;
+	    unsigned int high = numberOfSlots;
+	    while (high - low > 1)
+	    {
+	    	unsigned int middle = low + (high - low) / 2;
+	    	Checkpoint curr     = getCheckpointInSlot(checkpointBuffer, middle);
+	    	if (curr.isValid && curr.sequenceNumber >= first.sequenceNumber)
+	    	{
+	    		low = middle;
+	    	}
+	    	else
+	    	{
+	    		high = middle;
+	    	}
+	    }
+
+	    checkpoint       = getCheckpointInSlot(checkpointBuffer, low);
+	    checkpointSector = checkpointSegmentStartSector + (low * CHECKPOINT_SIZE_IN_SECTORS);
 	    free(checkpointBuffer);
 
 		std::cout << "[LogLayer] recovered checkpoint at sector: " << checkpointSector << std::endl;
 		std::cout << "[LogLayer] \t time: " << checkpoint.time << std::endl;
+		std::cout << "[LogLayer] \t sequenceNumber: " << checkpoint.sequenceNumber << std::endl;
 		std::cout << "[LogLayer] \t lastSegmentWritten: " << checkpoint.lastSegmentWritten << std::endl;
 		std::cout << "[LogLayer] \t segmentUsageTableSegment: " << checkpoint.segmentUsageTableSegment << std::endl;
 		checkpoint.iFileINode.Print();
@@ -683,22 +2002,130 @@ private:
 
 	unsigned int GetCleanSegment()
 	{
-		for (int segment = flashData.checkpointSegment + 1; segment < flashData.flashSize; ++segment)
+		std::unique_lock<std::mutex> lock(poolMutex);
+
+		// top up first so a pool size of 0 still erases the segment it hands out
+		FillErasePool(erasePoolSize + 1);
+		while (erasedSegments.empty() && !segmentsToErase.empty())
 		{
-			if (segmentUsageTable[segment].liveBytesInSegment == 0)
+			TRACE_INFO(LogWaitForCleanSegment);
+			poolCondition.wait(lock);
+		}
+
+		if (erasedSegments.empty())
+		{
+			return FLASH_FULL;
+		}
+
+		unsigned int segment = erasedSegments.front();
+		erasedSegments.pop_front();
+		segmentInPool[segment] = false;
+		segmentErased[segment] = false;
+
+		// bits left by blocks that were in memory when the log last went down
+		clearValidityBitmap(segment);
+		return segment;
+	}
+
+	// caller holds poolMutex
+	void PushFreeSegment(unsigned int segment)
+	{
+		freeSegmentsByWear.push(SegmentWearEntry(GetSegmentWear(segment), segment));
+	}
+
+	// queues the least worn clean segments until the pool holds poolSize segments. caller holds poolMutex
+	void FillErasePool(unsigned int poolSize)
+	{
+		while (erasedSegments.size() + segmentsToErase.size() < poolSize && !freeSegmentsByWear.empty())
+		{
+			unsigned int wear    = freeSegmentsByWear.top().first;
+			unsigned int segment = freeSegmentsByWear.top().second;
+			freeSegmentsByWear.pop();
+
+			// skip stale entries for segments that have been reused or erased since they were pushed
+			if (segmentUsageTable[segment].liveBytesInSegment != 0 || segmentInPool[segment] || getOpenTailSegment(segment) != NULL || wear != GetSegmentWear(segment))
+			{
+				continue;
+			}
+
+			if (wear >= flashData.wearLimit)
+			{
+				TRACE_INFO(LogWearLimit, segment);
+				continue;
+			}
+
+			segmentInPool[segment] = true;
+			if (segmentErased[segment])
+			{
+				erasedSegments.push_back(segment);
+			}
+			else
+			{
+				segmentsToErase.push_back(segment);
+			}
+		}
+
+		if (!segmentsToErase.empty())
+		{
+			poolCondition.notify_all();
+		}
+	}
+
+	// erase thread. a segment stays at the front of segmentsToErase while it is being erased
+	void EraseSegments()
+	{
+		std::unique_lock<std::mutex> lock(poolMutex);
+		while (true)
+		{
+			poolCondition.wait(lock, [this] { return stopErasing || !segmentsToErase.empty(); });
+			if (stopErasing)
+			{
+				return;
+			}
+
+			unsigned int segment = segmentsToErase.front();
+			lock.unlock();
+			int ret = eraseSegment(segment);
+			lock.lock();
+
+			segmentsToErase.pop_front();
+			if (ret != 0)
+			{
+				// leave it out of the pool, the next fill will try it again
+				segmentInPool[segment] = false;
+				PushFreeSegment(segment);
+			}
+			else
 			{
-				return segment;
+				segmentErased[segment] = true;
+				erasedSegments.push_back(segment);
 			}
+
+			poolCondition.notify_all();
+		}
+	}
+
+	void StopEraseThread()
+	{
+		if (!eraseThread.joinable())
+		{
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(poolMutex);
+			stopErasing = true;
 		}
 
-		return FLASH_FULL;
+		poolCondition.notify_all();
+		eraseThread.join();
 	}
 
 	bool ValidLogAddress(LogAddress& logAddress)
 	{
 		unsigned int segmentNumber = logAddress.logSegment;
 		unsigned int blockNumber   = logAddress.blockNumber;
-		return segmentNumber < flashData.flashSize && blockNumber < flashData.segmentSize;
+		return segmentNumber < flashData.flashSize && blockNumber < segmentFactory->getSegmentSizeInSlots();
 	}
 
 	void PrintInitData()
@@ -710,5 +2137,7 @@ private:
 	    std::cout << "\tflash size: "                << flashData.flashSize                       << std::endl;
 	    std::cout << "\twear limit: "                << flashData.wearLimit                       << std::endl;	
 	    std::cout << "\tnum blocks: "                << flashData.numBlocks                       << std::endl;
+	    std::cout << "\tcompression: "               << flashData.compression                     << std::endl;
+	    std::cout << "\tdeduplication: "             << flashData.deduplication                   << std::endl;
 	}
 };
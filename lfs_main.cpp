@@ -42,16 +42,28 @@ int optionCheck(char * str)
     std::string interval = "--interval=";
     std::string start = "--start=";
     std::string stop = "--stop=";
+    std::string pool = "--pool=";
+    std::string wear = "--wear=";
+    std::string age = "--age=";
+    std::string trace = "--trace=";
 
     if (s.compare("-f") == 0 ||
         s.compare("-s") == 0 ||
         s.compare("-i") == 0 ||
         s.compare("-c") == 0 ||
         s.compare("-C") == 0 ||
+        s.compare("-p") == 0 ||
+        s.compare("-w") == 0 ||
+        s.compare("-a") == 0 ||
+        s.compare("-t") == 0 ||
         isPrefix(cache, s)   ||
         isPrefix(interval, s)||
         isPrefix(start, s)   ||
-        isPrefix(stop, s))
+        isPrefix(stop, s)    ||
+        isPrefix(pool, s)    ||
+        isPrefix(wear, s)    ||
+        isPrefix(age, s)     ||
+        isPrefix(trace, s))
     {
        return 0;
     } 
@@ -59,7 +71,7 @@ int optionCheck(char * str)
     return 1;
 }
 
-int parseArgs(int argc, char **argv, unsigned int *cache_size, unsigned int *checkpoint_interval, unsigned int *cleaning_start, unsigned int *cleaning_end)
+int parseArgs(int argc, char **argv, unsigned int *cache_size, unsigned int *checkpoint_interval, unsigned int *cleaning_start, unsigned int *cleaning_end, unsigned int *erase_pool_size, unsigned int *wear_leveling, unsigned int *checkpoint_age, char **trace_file)
 {
     if (argc < 3)
     {
@@ -73,7 +85,7 @@ int parseArgs(int argc, char **argv, unsigned int *cache_size, unsigned int *che
         {
             if (optionCheck(argv[i]) != 0)
             {
-                std::cerr << "Invalid option: " << argv[i] << "\nValid options: -f, -s, -i, -c, -C, --cache=num, --interval=num, --start=num, --stop=num" << std::endl;
+                std::cerr << "Invalid option: " << argv[i] << "\nValid options: -f, -s, -i, -c, -C, -p, -w, -a, -t, --cache=num, --interval=num, --start=num, --stop=num, --pool=num, --wear=num, --age=num, --trace=file" << std::endl;
                 return 1;
             }
 
@@ -82,6 +94,19 @@ int parseArgs(int argc, char **argv, unsigned int *cache_size, unsigned int *che
             std::string delimiter = "=";
             std::string token = option.substr(option.find(delimiter) + 1, option.size());
 
+            // the trace file is the only option that does not take a number
+            if (isPrefix("--trace=", option))
+            {
+                *trace_file = argv[i] + strlen("--trace=");
+                continue;
+            }
+            else if (option.compare("-t") == 0)
+            {
+                *trace_file = argv[i + 1];
+                i++;
+                continue;
+            }
+
             if (isPrefix("--", option))
             {
                 if (!isNumber(token))
@@ -110,6 +135,21 @@ int parseArgs(int argc, char **argv, unsigned int *cache_size, unsigned int *che
                     *cleaning_end = stoi(token);
                     continue;
                 }
+                else if (isPrefix("--pool=", option))
+                {
+                    *erase_pool_size = stoi(token);
+                    continue;
+                }
+                else if (isPrefix("--wear=", option))
+                {
+                    *wear_leveling = stoi(token);
+                    continue;
+                }
+                else if (isPrefix("--age=", option))
+                {
+                    *checkpoint_age = stoi(token);
+                    continue;
+                }
             }
 
             if(option.compare("-f") == 0)
@@ -139,6 +179,18 @@ int parseArgs(int argc, char **argv, unsigned int *cache_size, unsigned int *che
             {
                 *cleaning_end = stoi(arg);
             }
+            else if(option.compare("-p") == 0)
+            {
+                *erase_pool_size = stoi(arg);
+            }
+            else if(option.compare("-w") == 0)
+            {
+                *wear_leveling = stoi(arg);
+            }
+            else if(option.compare("-a") == 0)
+            {
+                *checkpoint_age = stoi(arg);
+            }
 
             i++;
         }
@@ -166,11 +218,15 @@ int main(int argc, char *argv[])
 	unsigned int checkpointInterval = 4;
 	unsigned int cleaningStart = 4;
 	unsigned int cleaningEnd = 8;
+	unsigned int erasePoolSize = 4;
+	unsigned int wearLeveling = 0;
+	unsigned int checkpointAge = 30;
+	char * traceFile = NULL;
 
 	char * flashFile;
 	char * mountPoint;
 
-	if (parseArgs(argc, argv, &cacheSize, &checkpointInterval, &cleaningStart, &cleaningEnd) != 0)
+	if (parseArgs(argc, argv, &cacheSize, &checkpointInterval, &cleaningStart, &cleaningEnd, &erasePoolSize, &wearLeveling, &checkpointAge, &traceFile) != 0)
     {
         return 1;
     }
@@ -178,7 +234,7 @@ int main(int argc, char *argv[])
     flashFile = argv[argc - 2];
     mountPoint = argv[argc - 1];
 
-    LFS_Start(flashFile, cacheSize, checkpointInterval, cleaningStart, cleaningEnd);
+    LFS_Start(flashFile, cacheSize, checkpointInterval, cleaningStart, cleaningEnd, erasePoolSize, wearLeveling, checkpointAge, traceFile);
 
     std::cout << "\t[LFS] flash file: " << flashFile << std::endl;
     std::cout << "\t[LFS] mount point: " << mountPoint << std::endl;
@@ -189,32 +245,26 @@ int main(int argc, char *argv[])
     int nargc;
 
     char fOp[3] = "-f";
-    char sOp[3] = "-s";
     char dOp[3] = "-d";
 
-
-#define NARGS 3
-
+    // fuse runs multithreaded, the layers lock what they share
     if (runInForeground(argc, argv))
     {
-        nargc    = 5;
+        nargc    = 4;
         nargv    = (char **) malloc(nargc * sizeof(char*));
         nargv[0] = argv[0];
         nargv[1] = fOp;
-        nargv[2] = sOp;
-        nargv[3] = dOp;
-        nargv[4] = mountPoint;
+        nargv[2] = dOp;
+        nargv[3] = mountPoint;
     }
     else
     {
-        nargc    = 4;
+        nargc    = 3;
         nargv    = (char **) malloc(nargc * sizeof(char*));
         nargv[0] = argv[0];
-        nargv[1] = sOp;
-        nargv[2] = dOp;
-        nargv[3] = mountPoint;
+        nargv[1] = dOp;
+        nargv[2] = mountPoint;
     }
 
-    
     return fuse_main(nargc, nargv, &lfs_oper, NULL);
 }
\ No newline at end of file
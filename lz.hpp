@@ -0,0 +1,231 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+// Small LZ77 codec in the style of LZ4 used to compress file blocks in the log.
+//
+// The compressed stream is a list of sequences. Each sequence is a token byte whose high nibble is
+// the number of literals and low nibble is the match length minus LZ_MIN_MATCH, extra length bytes
+// when a nibble is 15, the literals, then a 2 byte little endian match offset. The last sequence has
+// only literals and ends the stream.
+
+#define LZ_MIN_MATCH  4
+#define LZ_HASH_BITS  12
+#define LZ_MAX_OFFSET 65535
+
+uint32_t LzRead32(const unsigned char * p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+uint32_t LzHash(uint32_t sequence)
+{
+    return (sequence * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+// writes a nibble overflow as a run of 255s and a final byte. returns false if it does not fit
+bool LzWriteLength(unsigned char * output, unsigned int capacity, unsigned int * op, unsigned int length)
+{
+    while (length >= 255)
+    {
+        if (*op >= capacity)
+        {
+            return false;
+        }
+
+        output[(*op)++] = 255;
+        length -= 255;
+    }
+
+    if (*op >= capacity)
+    {
+        return false;
+    }
+
+    output[(*op)++] = (unsigned char)length;
+    return true;
+}
+
+bool LzWriteSequence(unsigned char * output, unsigned int capacity, unsigned int * op, const unsigned char * literals,
+                     unsigned int literalLength, unsigned int offset, unsigned int matchLength, bool last)
+{
+    unsigned int literalNibble = literalLength >= 15 ? 15 : literalLength;
+    unsigned int matchNibble   = 0;
+    if (!last)
+    {
+        matchNibble = matchLength - LZ_MIN_MATCH >= 15 ? 15 : matchLength - LZ_MIN_MATCH;
+    }
+
+    if (*op >= capacity)
+    {
+        return false;
+    }
+
+    output[(*op)++] = (unsigned char)((literalNibble << 4) | matchNibble);
+    if (literalNibble == 15 && !LzWriteLength(output, capacity, op, literalLength - 15))
+    {
+        return false;
+    }
+
+    if (*op + literalLength > capacity)
+    {
+        return false;
+    }
+
+    memcpy(output + *op, literals, literalLength);
+    *op += literalLength;
+
+    if (last)
+    {
+        return true;
+    }
+
+    if (*op + 2 > capacity)
+    {
+        return false;
+    }
+
+    output[(*op)++] = (unsigned char)(offset & 0xFF);
+    output[(*op)++] = (unsigned char)(offset >> 8);
+
+    if (matchNibble == 15 && !LzWriteLength(output, capacity, op, matchLength - LZ_MIN_MATCH - 15))
+    {
+        return false;
+    }
+
+    return true;
+}
+
+// returns the compressed size, or 0 if it does not fit in outputCapacity
+unsigned int LzCompress(const void * inputBuffer, unsigned int inputSize, void * outputBuffer, unsigned int outputCapacity)
+{
+    const unsigned char * input = (const unsigned char *)inputBuffer;
+    unsigned char * output      = (unsigned char *)outputBuffer;
+
+    int table[1 << LZ_HASH_BITS];
+    memset(table, -1, sizeof(table));
+
+    unsigned int ip     = 0;
+    unsigned int op     = 0;
+    unsigned int anchor = 0;
+    while (inputSize >= LZ_MIN_MATCH && ip <= inputSize - LZ_MIN_MATCH)
+    {
+        uint32_t sequence = LzRead32(input + ip);
+        uint32_t hash     = LzHash(sequence);
+        int reference     = table[hash];
+        table[hash]       = ip;
+
+        if (reference < 0 || ip - reference > LZ_MAX_OFFSET || LzRead32(input + reference) != sequence)
+        {
+            ip++;
+            continue;
+        }
+
+        unsigned int matchLength = LZ_MIN_MATCH;
+        while (ip + matchLength < inputSize && input[reference + matchLength] == input[ip + matchLength])
+        {
+            matchLength++;
+        }
+
+        if (!LzWriteSequence(output, outputCapacity, &op, input + anchor, ip - anchor, ip - reference, matchLength, false))
+        {
+            return 0;
+        }
+
+        ip     += matchLength;
+        anchor  = ip;
+    }
+
+    if (!LzWriteSequence(output, outputCapacity, &op, input + anchor, inputSize - anchor, 0, 0, true))
+    {
+        return 0;
+    }
+
+    return op;
+}
+
+bool LzReadLength(const unsigned char * input, unsigned int inputSize, unsigned int * ip, unsigned int * length)
+{
+    unsigned char byte;
+    do
+    {
+        if (*ip >= inputSize)
+        {
+            return false;
+        }
+
+        byte     = input[(*ip)++];
+        *length += byte;
+    } while (byte == 255);
+
+    return true;
+}
+
+// returns the decompressed size, or 0 if the input is malformed or does not fit in outputCapacity
+unsigned int LzDecompress(const void * inputBuffer, unsigned int inputSize, void * outputBuffer, unsigned int outputCapacity)
+{
+    const unsigned char * input = (const unsigned char *)inputBuffer;
+    unsigned char * output      = (unsigned char *)outputBuffer;
+
+    unsigned int ip = 0;
+    unsigned int op = 0;
+    while (ip < inputSize)
+    {
+        unsigned char token        = input[ip++];
+        unsigned int literalLength = token >> 4;
+        if (literalLength == 15 && !LzReadLength(input, inputSize, &ip, &literalLength))
+        {
+            return 0;
+        }
+
+        if (ip + literalLength > inputSize || op + literalLength > outputCapacity)
+        {
+            return 0;
+        }
+
+        memcpy(output + op, input + ip, literalLength);
+        ip += literalLength;
+        op += literalLength;
+
+        if (ip == inputSize)
+        {
+            break;
+        }
+
+        if (ip + 2 > inputSize)
+        {
+            return 0;
+        }
+
+        unsigned int offset = input[ip] | (input[ip + 1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op)
+        {
+            return 0;
+        }
+
+        unsigned int matchLength = token & 0x0F;
+        if (matchLength == 15 && !LzReadLength(input, inputSize, &ip, &matchLength))
+        {
+            return 0;
+        }
+
+        matchLength += LZ_MIN_MATCH;
+        if (op + matchLength > outputCapacity)
+        {
+            return 0;
+        }
+
+        // byte at a time so overlapping matches repeat
+        for (unsigned int i = 0; i < matchLength; ++i)
+        {
+            output[op] = output[op - offset];
+            op++;
+        }
+    }
+
+    return op;
+}
@@ -23,7 +23,7 @@ void Teardown()
 void TestSegmentFill(Log * log)
 {
     std::cout << "\nTestSegmentFill\n" << std::endl;
-	unsigned int blocksToFill = 32 - 4;
+	unsigned int blocksToFill = 32 - 1;
 	unsigned int inum = 2;
 	void * buffer = malloc(512 * 2);
 	for (int block = 0; block < blocksToFill; ++block)
@@ -34,13 +34,13 @@ void TestSegmentFill(Log * log)
 		memset(buffer, 0, 512 * 2);
 		memcpy(buffer, s, sizeof(s)); 
 		assert(0 == log->Log_Write(inum, block, buffer, &addr));
-		assert(3 == addr.logSegment);
-		assert(block + 4 == addr.blockNumber);
+		assert(4 == addr.logSegment);
+		assert(block + 1 == addr.blockNumber);
     	std::cout << "wrote block: " << block + 6 << std::endl;
 	}
 
 	log->PrintTail();
-	assert(4 == log->getTailSegmentNumber());
+	assert(5 == log->getTailSegmentNumber());
 	free(buffer);
 }
 
@@ -56,7 +56,7 @@ void TestMoreWritesAfterSegmentFill(Log * log)
 	memcpy(buffer, s, sizeof(s)); 
 	assert(0 == log->Log_Write(inum, block, buffer, &addr));
 	log->PrintTail();
-	assert(4 == addr.logSegment);
+	assert(5 == addr.logSegment);
 	assert(1 == addr.blockNumber);
 	free(buffer);
 }
@@ -66,10 +66,11 @@ void TestInitialize2ndLog(Log * log)
     std::cout << "\nTestInitialize2ndLog\n" << std::endl;
     delete log;
 
+	// the partly filled tail was closed by the checkpoint on shutdown
     Log log2(flashFile, segmentCacheSize, checkpointInterval);
     log2.Init();
 	log2.PrintTail();
-	assert(4 == log2.getTailSegmentNumber());
+	assert(6 == log2.getTailSegmentNumber());
 }
 
 void TestWriteOneCheckpointAndRecover()
@@ -78,7 +79,7 @@ void TestWriteOneCheckpointAndRecover()
 
 	Log * log2 = new Log(flashFile, segmentCacheSize, checkpointInterval);
     log2->Init();
-	assert(4 == log2->getTailSegmentNumber());
+	assert(6 == log2->getTailSegmentNumber());
 
 	unsigned int blocksToFill = 4*32;
 	unsigned int inum = 3;
@@ -92,13 +93,13 @@ void TestWriteOneCheckpointAndRecover()
 		assert(0 == log2->Log_Write(inum, block, buffer, &addr));
 	}
 
-	assert(8 == log2->getTailSegmentNumber());
+	assert(10 == log2->getTailSegmentNumber());
 
 	delete log2;
 
 	Log log3(flashFile, segmentCacheSize, checkpointInterval);
     log3.Init();
-	assert(8 == log3.getTailSegmentNumber());
+	assert(11 == log3.getTailSegmentNumber());
 }
 
 void TestWriteMultipleCheckpointsAndRecover()
@@ -107,7 +108,7 @@ void TestWriteMultipleCheckpointsAndRecover()
 
     Log * log2 = new Log(flashFile, segmentCacheSize, checkpointInterval);
     log2->Init();
-	assert(8 == log2->getTailSegmentNumber());
+	assert(11 == log2->getTailSegmentNumber());
 
 	unsigned int blocksToFill = 12*32;
 	unsigned int inum = 3;
@@ -121,13 +122,38 @@ void TestWriteMultipleCheckpointsAndRecover()
 		assert(0 == log2->Log_Write(inum, block, buffer, &addr));
 	}
 
-	assert(20 == log2->getTailSegmentNumber());
+	assert(23 == log2->getTailSegmentNumber());
 
 	delete log2;
 
 	Log log3(flashFile, segmentCacheSize, checkpointInterval);
     log3.Init();
-	assert(20 == log3.getTailSegmentNumber());
+	assert(24 == log3.getTailSegmentNumber());
+}
+
+void TestRecoverAfterCheckpointWraparound()
+{
+    std::cout << "\nTestRecoverAfterCheckpointWraparound\n" << std::endl;
+
+    Log * log2 = new Log(flashFile, segmentCacheSize, checkpointInterval);
+    log2->Init();
+	unsigned long long sequenceNumber = log2->getCheckpointSequenceNumber();
+	delete log2;
+
+	// a log checkpoints when it is deleted. write more checkpoints than there are slots in the checkpoint segment
+	unsigned int checkpoints = 32 * 2 + 10;
+	for (int i = 1; i < checkpoints; ++i)
+	{
+		log2 = new Log(flashFile, segmentCacheSize, checkpointInterval);
+		log2->Init();
+		assert(sequenceNumber + i == log2->getCheckpointSequenceNumber());
+		delete log2;
+	}
+
+	Log log3(flashFile, segmentCacheSize, checkpointInterval);
+    log3.Init();
+	assert(sequenceNumber + checkpoints == log3.getCheckpointSequenceNumber());
+	assert(24 == log3.getTailSegmentNumber());
 }
 
 void RunTests()
@@ -142,6 +168,7 @@ void RunTests()
     TestInitialize2ndLog(log);
     TestWriteOneCheckpointAndRecover();
     TestWriteMultipleCheckpointsAndRecover();
+    TestRecoverAfterCheckpointWraparound();
     Teardown();
 }
 
@@ -140,6 +140,125 @@ void TestCleanerMoreFiles()
 	fileLayer->PrintIFile();
 }
 
+// the cleaner moves the nodes of a double indirect block map along with the blocks they map
+void TestCleanerMovesBlockMapNodes()
+{
+	std::cout << "\nTestCleanerMovesBlockMapNodes\n" << std::endl;
+	Mklfs(flashFile);
+	FileLayer * mapLayer = new FileLayer(flashFile, segmentCacheSize, checkpointInterval, 90, 95);
+	mapLayer->Init();
+
+	unsigned int bigFile;
+	unsigned int filler;
+	assert(mapLayer->File_Create(FileType::File, 0744, &bigFile) == 0);
+	assert(mapLayer->File_Create(FileType::File, 0744, &filler) == 0);
+
+	// interleave the two files so every segment is left half dead when the filler is freed
+	unsigned int chunk  = 16 * BLOCK_SIZE;
+	unsigned int chunks = 40;
+	char * buffer       = (char *)malloc(chunk);
+
+	// writing every other block leaves more than a block of short extents, which moves the big file to a block map
+	memset(buffer, 'a', chunk);
+	for (unsigned int extent = 0; extent <= BLOCK_SIZE / sizeof(Extent); ++extent)
+	{
+		assert(mapLayer->File_Write(bigFile, (NUM_DIRECT_BLOCKS + 2 * extent) * BLOCK_SIZE, BLOCK_SIZE, buffer) == 0);
+	}
+
+	LfsStats converted;
+	mapLayer->File_GetStats(&converted);
+	assert(converted.file.extentFilesConverted == 1);
+
+	for (unsigned int i = 0; i < chunks; ++i)
+	{
+		memset(buffer, 'a' + i % 26, chunk);
+		assert(mapLayer->File_Write(bigFile, i * chunk, chunk, buffer) == 0);
+		memset(buffer, 'f', chunk);
+		assert(mapLayer->File_Write(filler, i * chunk, chunk, buffer) == 0);
+	}
+
+	assert(mapLayer->File_Free(filler) == 0);
+	assert(mapLayer->RunCleaner() == 0);
+
+	LfsStats stats;
+	mapLayer->File_GetStats(&stats);
+	assert(stats.file.segmentsCleaned > 0);
+	assert(stats.file.blocksMoved > 0);
+
+	for (int remount = 0; remount < 2; ++remount)
+	{
+		for (unsigned int i = 0; i < chunks; ++i)
+		{
+			assert(mapLayer->File_Read(bigFile, i * chunk, chunk, buffer) == 0);
+			for (unsigned int b = 0; b < chunk; ++b)
+			{
+				assert(buffer[b] == 'a' + i % 26);
+			}
+		}
+
+		delete mapLayer;
+		mapLayer = new FileLayer(flashFile, segmentCacheSize, checkpointInterval, 90, 95);
+		mapLayer->Init();
+	}
+
+	free(buffer);
+	delete mapLayer;
+	DeleteTestFlash(flashFile);
+}
+
+void TestCleanerMovesExtents()
+{
+	std::cout << "\nTestCleanerMovesExtents\n" << std::endl;
+	Mklfs(flashFile);
+	FileLayer * mapLayer = new FileLayer(flashFile, segmentCacheSize, checkpointInterval, 90, 95);
+	mapLayer->Init();
+
+	unsigned int bigFile;
+	unsigned int filler;
+	assert(mapLayer->File_Create(FileType::File, 0744, &bigFile) == 0);
+	assert(mapLayer->File_Create(FileType::File, 0744, &filler) == 0);
+
+	// every chunk of the big file is an extent of its own. the cleaner moves them block by block
+	unsigned int chunk  = 16 * BLOCK_SIZE;
+	unsigned int chunks = 40;
+	char * buffer       = (char *)malloc(chunk);
+	for (unsigned int i = 0; i < chunks; ++i)
+	{
+		memset(buffer, 'a' + i % 26, chunk);
+		assert(mapLayer->File_Write(bigFile, i * chunk, chunk, buffer) == 0);
+		memset(buffer, 'f', chunk);
+		assert(mapLayer->File_Write(filler, i * chunk, chunk, buffer) == 0);
+	}
+
+	assert(mapLayer->File_Free(filler) == 0);
+	assert(mapLayer->RunCleaner() == 0);
+
+	LfsStats stats;
+	mapLayer->File_GetStats(&stats);
+	assert(stats.file.blocksMoved > 0);
+	assert(stats.file.extentFilesConverted == 0);
+
+	for (int remount = 0; remount < 2; ++remount)
+	{
+		for (unsigned int i = 0; i < chunks; ++i)
+		{
+			assert(mapLayer->File_Read(bigFile, i * chunk, chunk, buffer) == 0);
+			for (unsigned int b = 0; b < chunk; ++b)
+			{
+				assert(buffer[b] == 'a' + i % 26);
+			}
+		}
+
+		delete mapLayer;
+		mapLayer = new FileLayer(flashFile, segmentCacheSize, checkpointInterval, 90, 95);
+		mapLayer->Init();
+	}
+
+	free(buffer);
+	delete mapLayer;
+	DeleteTestFlash(flashFile);
+}
+
 void RunTests()
 {
 	Setup();
@@ -150,6 +269,9 @@ void RunTests()
 	Setup();
 	TestCleanerMoreFiles();
 	Teardown();
+
+	TestCleanerMovesBlockMapNodes();
+	TestCleanerMovesExtents();
 }
 
 int main(int argc, char **argv)
@@ -0,0 +1,114 @@
+#include <assert.h>
+#include <string>
+#include <iostream>
+#include <cstring>
+#include "../crc32c.hpp"
+#include "../data_structures/segment.hpp"
+
+void TestKnownValue()
+{
+	std::cout << "\nTestKnownValue\n" << std::endl;
+	const char s[] = "123456789";
+	assert(Crc32c(s, strlen(s)) == 0xE3069283);
+	assert(Crc32c(s, 0) == 0);
+}
+
+void TestHardwareMatchesSoftware()
+{
+	std::cout << "\nTestHardwareMatchesSoftware\n" << std::endl;
+	unsigned char buffer[1024 + 7];
+	for (unsigned int i = 0; i < sizeof(buffer); ++i)
+	{
+		buffer[i] = (unsigned char)(i * 31 + 7);
+	}
+
+	// odd lengths and offsets exercise the byte at a time tail
+	for (unsigned int offset = 0; offset < 8; ++offset)
+	{
+		for (unsigned int length = 0; length + offset <= sizeof(buffer); length += 97)
+		{
+			uint32_t hardware = Crc32cHardware(0xFFFFFFFF, buffer + offset, length);
+			uint32_t software = Crc32cSoftware(0xFFFFFFFF, buffer + offset, length);
+			assert(hardware == software);
+		}
+	}
+}
+
+void TestDetectsBitFlip()
+{
+	std::cout << "\nTestDetectsBitFlip\n" << std::endl;
+	char buffer[1024];
+	memset(buffer, 'a', sizeof(buffer));
+	uint32_t checksum = Crc32c(buffer, sizeof(buffer));
+	buffer[512] ^= 0x10;
+	assert(Crc32c(buffer, sizeof(buffer)) != checksum);
+}
+
+void TestSegmentSummaryChecksum()
+{
+	std::cout << "\nTestSegmentSummaryChecksum\n" << std::endl;
+	unsigned int blocks = 32;
+	char summaryBlock[1024];
+	memset(summaryBlock, 0, sizeof(summaryBlock));
+
+	SegmentSummary summary(5, 5 * 64, blocks, sizeof(summaryBlock));
+	summary.blockINums[1]        = 7;
+	summary.iNodeBlockNumbers[1] = 3;
+	summary.blockChecksums[1]    = 0xDEADBEEF;
+	summary.Serialize(summaryBlock);
+
+	SegmentSummary readBack(0, 0, blocks, sizeof(summaryBlock));
+	assert(readBack.Deserialize(summaryBlock));
+	assert(readBack.segmentNumber == 5);
+	assert(readBack.blockINums[1] == 7);
+	assert(readBack.iNodeBlockNumbers[1] == 3);
+	assert(readBack.blockChecksums[1] == 0xDEADBEEF);
+	assert(readBack.blockOffsets[2] == sizeof(summaryBlock));
+	assert(readBack.blockLengths[2] == sizeof(summaryBlock));
+
+	// a torn write or bit flip anywhere in the summary is caught
+	summaryBlock[SegmentSummary::SizeInBytes(blocks, false) - 1] ^= 0x01;
+	assert(!readBack.Deserialize(summaryBlock));
+}
+
+void TestPackedSegmentSummary()
+{
+	std::cout << "\nTestPackedSegmentSummary\n" << std::endl;
+	unsigned int blocks = 32;
+	char summaryBlock[1024];
+	memset(summaryBlock, 0, sizeof(summaryBlock));
+
+	// only packed blocks store their offsets and lengths, so 64 uncompressed blocks still fit in one block
+	assert(SegmentSummary::SizeInBytes(64, false) <= sizeof(summaryBlock));
+	assert(SegmentSummary::SizeInBytes(64, true) > sizeof(summaryBlock));
+
+	SegmentSummary summary(5, 5 * 64, blocks, 0);
+	summary.blockINums[1]   = 7;
+	summary.blockOffsets[1] = 100;
+	summary.blockLengths[1] = 200;
+	summary.Serialize(summaryBlock);
+
+	SegmentSummary readBack(0, 0, blocks, 0);
+	assert(readBack.Deserialize(summaryBlock));
+	assert(readBack.blockINums[1] == 7);
+	assert(readBack.blockOffsets[1] == 100);
+	assert(readBack.blockLengths[1] == 200);
+
+	summaryBlock[SegmentSummary::SizeInBytes(blocks, true) - 1] ^= 0x01;
+	assert(!readBack.Deserialize(summaryBlock));
+}
+
+void RunTests()
+{
+	TestKnownValue();
+	TestHardwareMatchesSoftware();
+	TestDetectsBitFlip();
+	TestSegmentSummaryChecksum();
+	TestPackedSegmentSummary();
+}
+
+int main(int argc, char **argv)
+{
+	RunTests();
+	return 0;
+}
@@ -1,6 +1,8 @@
 #include <iostream>
 #include <string.h>
 #include <assert.h>
+#include <thread>
+#include <vector>
 #include "test_utils.hpp"
 #include "../layers/directory.hpp"
 #include "../layers/file.hpp"
@@ -18,6 +20,13 @@ void Setup()
     directoryLayer->Init();
 }
 
+void Setup(const char * mklfsOptions)
+{
+    Mklfs(flashFile, mklfsOptions);
+    directoryLayer = new DirectoryLayer(flashFile, segmentCacheSize, checkpointInterval, 4, 8);
+    directoryLayer->Init();
+}
+
 void Teardown()
 {
     delete directoryLayer;
@@ -174,6 +183,30 @@ void TestDirectoryTruncate()
     free(buffer);
 }
 
+void TestDirectorySeek()
+{
+    std::cout << "\nTestDirectorySeek\n" << std::endl;
+
+    // a write past the end leaves a hole between the two writes
+    const char * path = "/sparse.txt";
+    unsigned int hole = 10 * 1024;
+    unsigned int result;
+    char buffer[]     = "data";
+    assert(directoryLayer->Directory_Create(path, 0644) == 0);
+    assert(directoryLayer->Directory_Write(path, 0, sizeof(buffer), buffer) == 0);
+    assert(directoryLayer->Directory_Write(path, hole, sizeof(buffer), buffer) == 0);
+
+    assert(directoryLayer->Directory_Seek(path, 0, SEEK_HOLE, &result) == 0 && result == 1024);
+    assert(directoryLayer->Directory_Seek(path, 1024, SEEK_DATA, &result) == 0 && result == hole);
+    assert(directoryLayer->Directory_Seek(path, hole + sizeof(buffer), SEEK_DATA, &result) == -ENXIO);
+    assert(directoryLayer->Directory_Seek("/file5.txt", 0, SEEK_DATA, &result) == -ENOENT);
+
+    char zeros[sizeof(buffer)] = { 0 };
+    assert(directoryLayer->Directory_Read(path, hole / 2, sizeof(buffer), buffer) == 0);
+    assert(memcmp(buffer, zeros, sizeof(buffer)) == 0);
+    assert(directoryLayer->Directory_Unlink(path) == 0);
+}
+
 void TestDirectoryChmod()
 {
     std::cout << "\nTestDirectoryChmod\n" << std::endl;
@@ -857,6 +890,186 @@ void TestCleaner()
     }
 }
 
+void TestLatencyHistograms()
+{
+    std::cout << "\nTestLatencyHistograms\n" << std::endl;
+    ResetLatencyHistograms();
+
+    // a stat is broken down into the cleaner check, the path lookup and the file layer
+    struct stat stbuf;
+    assert(directoryLayer->Directory_GetAttr("/", &stbuf) == 0);
+    assert(GetLatencyCount(LatencyOp::DirectoryGetAttr) == 1);
+    assert(GetLatencyCount(LatencyOp::CleanerCheck) == 1);
+    assert(GetLatencyCount(LatencyOp::DirectoryLookup) == 1);
+    assert(GetLatencyCount(LatencyOp::FileGetAttr) == 1);
+    assert(GetLatencyMax(LatencyOp::DirectoryGetAttr) >= GetLatencyMax(LatencyOp::DirectoryLookup));
+
+    // too large to be kept in the inode, so the write goes to the log
+    const char * file = "/latency";
+    char buffer[INLINE_DATA_SIZE + 100];
+    memset(buffer, 'l', sizeof(buffer));
+    assert(directoryLayer->Directory_Create(file, 0777) == 0);
+    assert(directoryLayer->Directory_Write(file, 0, sizeof(buffer), buffer) == 0);
+    assert(GetLatencyCount(LatencyOp::FileWrite) >= 1);
+    assert(GetLatencyCount(LatencyOp::LogWrite) >= 1);
+
+    PrintLatencyReport(std::cout);
+}
+
+void TestStats()
+{
+    std::cout << "\nTestStats\n" << std::endl;
+    LfsStats before;
+    directoryLayer->Directory_GetStats(&before);
+
+    const char * file = "/stats";
+    char buffer[3000];
+    memset(buffer, 's', sizeof(buffer));
+    assert(directoryLayer->Directory_Create(file, 0777) == 0);
+    assert(directoryLayer->Directory_Write(file, 0, sizeof(buffer), buffer) == 0);
+    assert(directoryLayer->Directory_Read(file, 0, sizeof(buffer), buffer) == 0);
+
+    LfsStats after;
+    directoryLayer->Directory_GetStats(&after);
+    assert(after.file.bytesWritten >= before.file.bytesWritten + sizeof(buffer)); // plus the directory list
+    assert(after.file.bytesRead >= before.file.bytesRead + sizeof(buffer));
+    assert(after.log.blocksWritten[ColdData] > before.log.blocksWritten[ColdData]);
+    assert(after.log.flashSize == 100);
+    assert(after.log.freeSegments > 0 && after.log.freeSegments < after.log.flashSize);
+
+    std::string text = FormatStats(after);
+    assert(text.find("write_amplification ") != std::string::npos);
+    assert(text.find("free_segments " + std::to_string(after.log.freeSegments) + "\n") != std::string::npos);
+    std::cout << text << std::endl;
+}
+
+void TestTunables()
+{
+    std::cout << "\nTestTunables\n" << std::endl;
+    LfsTunables tunables;
+    directoryLayer->Directory_GetTunables(&tunables);
+    assert(tunables.cacheSize == segmentCacheSize);
+    assert(tunables.checkpointInterval == checkpointInterval);
+    assert(tunables.cleaningStart == 4 && tunables.cleaningStop == 8);
+
+    // settings not named keep their values
+    assert(ParseTunables("cache_size 5\ncleaning_stop 12\n", &tunables) == 0);
+    assert(tunables.cacheSize == 5 && tunables.cleaningStop == 12 && tunables.cleaningStart == 4);
+    assert(ParseTunables("cache_size 6\nwrong 1\n", &tunables) != 0);
+    assert(ParseTunables("cache_size -1\n", &tunables) != 0);
+    assert(ParseTunables("cache_size many\n", &tunables) != 0);
+    assert(tunables.cacheSize == 5);
+
+    assert(directoryLayer->Directory_SetTunables(tunables) == 0);
+    LfsTunables applied;
+    directoryLayer->Directory_GetTunables(&applied);
+    assert(FormatTunables(applied) == FormatTunables(tunables));
+
+    // the cleaner must stop at or after the point it starts
+    LfsTunables invalid = applied;
+    invalid.cleaningStop = invalid.cleaningStart - 1;
+    assert(directoryLayer->Directory_SetTunables(invalid) != 0);
+    invalid = applied;
+    invalid.cacheSize = 0;
+    assert(directoryLayer->Directory_SetTunables(invalid) != 0);
+    directoryLayer->Directory_GetTunables(&applied);
+    assert(FormatTunables(applied) == FormatTunables(tunables));
+
+    // a smaller cache still serves reads
+    applied.cacheSize = 1;
+    assert(directoryLayer->Directory_SetTunables(applied) == 0);
+    char buffer[3000];
+    assert(directoryLayer->Directory_Read("/stats", 0, sizeof(buffer), buffer) == 0);
+    assert(buffer[0] == 's' && buffer[sizeof(buffer) - 1] == 's');
+}
+
+// threads create files in the same directory and rewrite them while others read. the cleaning
+// thresholds are raised so the cleaner keeps moving their blocks in the middle of it
+void TestConcurrentFiles()
+{
+    std::cout << "\nTestConcurrentFiles\n" << std::endl;
+
+    LfsTunables tunables;
+    directoryLayer->Directory_GetTunables(&tunables);
+    tunables.cleaningStart = 16;
+    tunables.cleaningStop  = 18;
+    assert(directoryLayer->Directory_SetTunables(tunables) == 0);
+
+    unsigned int numThreads = 4;
+    unsigned int rounds     = 12;
+    unsigned int size       = 60000;
+    std::vector<std::thread> threads;
+    for (unsigned int t = 0; t < numThreads; ++t)
+    {
+        threads.push_back(std::thread([t, rounds, size]()
+        {
+            std::string filename = std::string("/concurrent") + std::to_string(t);
+            assert(directoryLayer->Directory_Create(filename.c_str(), 0744) == 0);
+
+            char * buffer     = (char *) malloc(size);
+            char * readBuffer = (char *) malloc(size);
+            for (unsigned int round = 0; round < rounds; ++round)
+            {
+                // every word is unique so no block is deduplicated
+                unsigned int * words = (unsigned int *)buffer;
+                for (unsigned int i = 0; i < size / sizeof(unsigned int); ++i)
+                {
+                    words[i] = (t * rounds + round) * size + i;
+                }
+
+                assert(directoryLayer->Directory_Write(filename.c_str(), 0, size, buffer) == 0);
+
+                memset(readBuffer, 0, size);
+                assert(directoryLayer->Directory_Read(filename.c_str(), 0, size, readBuffer) == 0);
+                assert(memcmp(buffer, readBuffer, size) == 0);
+
+                // the neighbour's file is never seen half rewritten
+                std::string neighbour = std::string("/concurrent") + std::to_string((t + 1) % 4);
+                if (directoryLayer->Directory_Exists(neighbour.c_str()) == 0)
+                {
+                    struct stat stbuf;
+                    assert(directoryLayer->Directory_GetAttr(neighbour.c_str(), &stbuf) == 0);
+                    if (stbuf.st_size == size)
+                    {
+                        assert(directoryLayer->Directory_Read(neighbour.c_str(), 0, size, readBuffer) == 0);
+                        unsigned int * words = (unsigned int *)readBuffer;
+                        for (unsigned int i = 1; i < size / sizeof(unsigned int); ++i)
+                        {
+                            assert(words[i] == words[0] + i);
+                        }
+                    }
+                }
+            }
+
+            free(buffer);
+            free(readBuffer);
+        }));
+    }
+
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    // no directory update was lost
+    char ** files;
+    unsigned int numFiles = 0;
+    assert(directoryLayer->Directory_Readdir("/", &files, &numFiles) == 0);
+    unsigned int found = 0;
+    for (unsigned int i = 0; i < numFiles; ++i)
+    {
+        found += strncmp(files[i], "concurrent", strlen("concurrent")) == 0;
+        free(files[i]);
+    }
+
+    free(files);
+    assert(found == numThreads);
+
+    LfsStats stats;
+    directoryLayer->Directory_GetStats(&stats);
+    assert(stats.file.cleaningPasses > 0);
+}
+
 void RunTests()
 {
     Setup();
@@ -867,6 +1080,7 @@ void RunTests()
 	TestDirectoryWrite();
     TestDirectoryRead();
     TestDirectoryTruncate();
+    TestDirectorySeek();
     TestDirectoryChmod();
     TestDirectoryChown();
 	TestDirectoryMkdir();
@@ -882,12 +1096,19 @@ void RunTests()
     TestDirectoryRmdir();
     TestDirectoryRmdirNonEmptyDir();
     TestDirectoryRename();
+    TestLatencyHistograms();
+    TestStats();
+    TestTunables();
     Teardown();
 
     Setup();
     TestCleaner();
     Teardown();
 
+    Setup("-s 24 -w 100000");
+    TestConcurrentFiles();
+    Teardown();
+
 }
 
 int main(int argc, char **argv)
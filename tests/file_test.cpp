@@ -485,6 +485,889 @@ void TestCreateLotsOfFiles()
 	}
 }
 
+void TestDedupIdenticalFiles()
+{
+	std::cout << "\nTestDedupIdenticalFiles\n" << std::endl;
+	Mklfs(flashFile, "-d 1");
+	FileLayer * dedupLayer = new FileLayer(flashFile, segmentCacheSize, checkpointInterval, 1, 1);
+	dedupLayer->Init();
+
+	unsigned int first;
+	unsigned int second;
+	assert(dedupLayer->File_Create(FileType::File, 0744, &first) == 0);
+	assert(dedupLayer->File_Create(FileType::File, 0744, &second) == 0);
+
+	unsigned int length = 4 * BLOCK_SIZE;
+	char * writeBuffer  = (char *)malloc(length);
+	for (unsigned int i = 0; i < length; ++i)
+	{
+		writeBuffer[i] = 'a' + i / BLOCK_SIZE;
+	}
+
+	assert(dedupLayer->File_Write(first, 0, length, writeBuffer) == 0);
+	assert(dedupLayer->File_Write(second, 0, length, writeBuffer) == 0);
+
+	// freeing one copy leaves the blocks the other copy shares
+	assert(dedupLayer->File_Free(first) == 0);
+
+	char * readBuffer = (char *)malloc(length);
+	assert(dedupLayer->File_Read(second, 0, length, readBuffer) == 0);
+	assert(memcmp(writeBuffer, readBuffer, length) == 0);
+
+	// a sparse file far larger than its data shares the blocks too. the references are counted again
+	// on mount from the written runs, so freeing the other copy leaves the sparse file intact
+	unsigned int sparse;
+	unsigned int far = 1000000 * BLOCK_SIZE;
+	assert(dedupLayer->File_Create(FileType::File, 0744, &sparse) == 0);
+	assert(dedupLayer->File_Write(sparse, 0, length, writeBuffer) == 0);
+	assert(dedupLayer->File_Write(sparse, far, length, writeBuffer) == 0);
+
+	delete dedupLayer;
+	dedupLayer = new FileLayer(flashFile, segmentCacheSize, checkpointInterval, 1, 1);
+	assert(dedupLayer->Init() == 0);
+	assert(dedupLayer->File_Free(second) == 0);
+	assert(dedupLayer->File_Read(sparse, 0, length, readBuffer) == 0);
+	assert(memcmp(writeBuffer, readBuffer, length) == 0);
+	assert(dedupLayer->File_Read(sparse, far, length, readBuffer) == 0);
+	assert(memcmp(writeBuffer, readBuffer, length) == 0);
+
+	free(writeBuffer);
+	free(readBuffer);
+	delete dedupLayer;
+	DeleteTestFlash(flashFile);
+}
+
+void TestDedupOwnerSurvivesRemount()
+{
+	std::cout << "\nTestDedupOwnerSurvivesRemount\n" << std::endl;
+	Mklfs(flashFile, "-d 1");
+	FileLayer * dedupLayer = new FileLayer(flashFile, segmentCacheSize, checkpointInterval, 90, 95);
+	dedupLayer->Init();
+
+	unsigned int original;
+	unsigned int copy;
+	unsigned int filler;
+	assert(dedupLayer->File_Create(FileType::File, 0744, &original) == 0);
+	assert(dedupLayer->File_Create(FileType::File, 0744, &copy) == 0);
+	assert(dedupLayer->File_Create(FileType::File, 0744, &filler) == 0);
+
+	// the copy shares the original's block and the original then overwrites it, so the summary of the
+	// shared block names a file block that no longer refers to it
+	char * buffer = (char *)malloc(BLOCK_SIZE);
+	memset(buffer, 's', BLOCK_SIZE);
+	assert(dedupLayer->File_Write(original, 0, BLOCK_SIZE, buffer) == 0);
+	assert(dedupLayer->File_Write(copy, 0, BLOCK_SIZE, buffer) == 0);
+
+	// distinct filler blocks after it, freed later so its segment is worth cleaning
+	unsigned int blocks = 640;
+	for (unsigned int block = 0; block < blocks; ++block)
+	{
+		memset(buffer, 'f', BLOCK_SIZE);
+		memcpy(buffer, &block, sizeof(block));
+		assert(dedupLayer->File_Write(filler, block * BLOCK_SIZE, BLOCK_SIZE, buffer) == 0);
+	}
+
+	memset(buffer, 'o', BLOCK_SIZE);
+	assert(dedupLayer->File_Write(original, 0, BLOCK_SIZE, buffer) == 0);
+
+	// the cleaner only learns of the copy from the references rebuilt on mount
+	delete dedupLayer;
+	dedupLayer = new FileLayer(flashFile, segmentCacheSize, checkpointInterval, 90, 95);
+	assert(dedupLayer->Init() == 0);
+	assert(dedupLayer->File_Free(filler) == 0);
+	assert(dedupLayer->RunCleaner() == 0);
+
+	LfsStats stats;
+	dedupLayer->File_GetStats(&stats);
+	assert(stats.file.blocksMoved > 0);
+
+	// write over the segments the cleaner released
+	assert(dedupLayer->File_Create(FileType::File, 0744, &filler) == 0);
+	for (unsigned int block = 0; block < blocks; ++block)
+	{
+		memset(buffer, 'g', BLOCK_SIZE);
+		memcpy(buffer, &block, sizeof(block));
+		assert(dedupLayer->File_Write(filler, block * BLOCK_SIZE, BLOCK_SIZE, buffer) == 0);
+	}
+
+	for (int remount = 0; remount < 2; ++remount)
+	{
+		assert(dedupLayer->File_Read(copy, 0, BLOCK_SIZE, buffer) == 0);
+		for (unsigned int b = 0; b < BLOCK_SIZE; ++b)
+		{
+			assert(buffer[b] == 's');
+		}
+
+		assert(dedupLayer->File_Read(original, 0, BLOCK_SIZE, buffer) == 0);
+		assert(buffer[0] == 'o' && buffer[BLOCK_SIZE - 1] == 'o');
+
+		delete dedupLayer;
+		dedupLayer = new FileLayer(flashFile, segmentCacheSize, checkpointInterval, 90, 95);
+		assert(dedupLayer->Init() == 0);
+	}
+
+	free(buffer);
+	delete dedupLayer;
+	DeleteTestFlash(flashFile);
+}
+
+void TestWriteCauses()
+{
+	std::cout << "\nTestWriteCauses\n" << std::endl;
+	Mklfs(flashFile);
+	FileLayer * causeLayer = new FileLayer(flashFile, segmentCacheSize, checkpointInterval, 1, 1);
+	causeLayer->Init();
+
+	unsigned int inum;
+	assert(causeLayer->File_Create(FileType::File, 0744, &inum) == 0);
+
+	// whole blocks are user data and the indirect block is rewritten as the file grows
+	unsigned int blocks = 40;
+	char * buffer       = (char *)malloc(blocks * BLOCK_SIZE);
+	memset(buffer, 'w', blocks * BLOCK_SIZE);
+	assert(causeLayer->File_Write(inum, 0, blocks * BLOCK_SIZE, buffer) == 0);
+
+	// a few bytes in each existing block make each block a read-modify-write
+	for (unsigned int block = 0; block < blocks; ++block)
+	{
+		assert(causeLayer->File_Write(inum, block * BLOCK_SIZE + 10, 10, buffer) == 0);
+	}
+
+	LfsStats stats;
+	causeLayer->File_GetStats(&stats);
+	assert(stats.log.bytesWrittenByCause[WriteCause::UserData] >= 31 * BLOCK_SIZE);
+	// the hot stream fills the tail mklfs left, which already holds the ifile and root directory
+	assert(stats.log.bytesWrittenByCause[WriteCause::ReadModifyWrite] >= 28 * BLOCK_SIZE);
+	assert(stats.log.bytesWrittenByCause[WriteCause::CleanerRelocation] == 0);
+
+	unsigned long long total = 0;
+	for (int cause = 0; cause < NUM_WRITE_CAUSES; ++cause)
+	{
+		total += stats.log.bytesWrittenByCause[cause];
+	}
+
+	assert(total == stats.log.flashSectorsWritten * FLASH_SECTOR_SIZE);
+
+	free(buffer);
+	delete causeLayer;
+	DeleteTestFlash(flashFile);
+}
+
+void TestINodeWriteBack()
+{
+	std::cout << "\nTestINodeWriteBack\n" << std::endl;
+	Mklfs(flashFile);
+	FileLayer * cacheLayer = new FileLayer(flashFile, segmentCacheSize, checkpointInterval, 1, 1);
+	cacheLayer->Init();
+
+	// every operation changes an inode, but they reach the ifile only when they are written back
+	unsigned int files  = 20;
+	unsigned int writes = 100;
+	unsigned int inums[files];
+	for (unsigned int file = 0; file < files; ++file)
+	{
+		assert(cacheLayer->File_Create(FileType::File, 0644, &inums[file]) == 0);
+	}
+
+	// each write appends a block so the tails fill and segments are flushed
+	char buffer[BLOCK_SIZE];
+	for (unsigned int i = 0; i < writes; ++i)
+	{
+		memset(buffer, 'a' + i % 26, sizeof(buffer));
+		unsigned int file = i % files;
+		assert(cacheLayer->File_Write(inums[file], (i / files) * sizeof(buffer), sizeof(buffer), buffer) == 0);
+	}
+
+	for (unsigned int file = 0; file < files; ++file)
+	{
+		assert(cacheLayer->File_Chmod(inums[file], 0600) == 0);
+	}
+
+	LfsStats stats;
+	cacheLayer->File_GetStats(&stats);
+	unsigned int updates = files * 2 + writes;
+	assert(stats.file.inodeWriteBacks > 0);
+	assert(stats.file.inodeWriteBacks < updates / 10);
+	assert(stats.log.blocksWritten[WriteStream::Metadata] < updates / 2);
+	assert(stats.file.inodeCacheHits > stats.file.inodeCacheMisses);
+
+	// the dirty inodes are written back on unmount
+	delete cacheLayer;
+	cacheLayer = new FileLayer(flashFile, segmentCacheSize, checkpointInterval, 1, 1);
+	cacheLayer->Init();
+	char readBuffer[sizeof(buffer) * writes / files];
+	for (unsigned int file = 0; file < files; ++file)
+	{
+		struct stat stbuf;
+		assert(cacheLayer->File_GetAttr(inums[file], &stbuf) == 0);
+		assert(stbuf.st_mode == (GetFileTypeMode(FileType::File) | 0600));
+		assert(stbuf.st_size == writes / files * sizeof(buffer));
+
+		assert(cacheLayer->File_Read(inums[file], 0, sizeof(readBuffer), readBuffer) == 0);
+		for (unsigned int i = file; i < writes; i += files)
+		{
+			assert(readBuffer[(i / files) * sizeof(buffer)] == 'a' + i % 26);
+		}
+	}
+
+	delete cacheLayer;
+	DeleteTestFlash(flashFile);
+}
+
+void TestIndirectBlockWrittenOncePerWrite()
+{
+	std::cout << "\nTestIndirectBlockWrittenOncePerWrite\n" << std::endl;
+	Mklfs(flashFile);
+	FileLayer * mapLayer = new FileLayer(flashFile, segmentCacheSize, checkpointInterval, 1, 1);
+	mapLayer->Init();
+
+	unsigned int inum;
+	assert(mapLayer->File_Create(FileType::File, 0644, &inum) == 0);
+
+	LfsStats before;
+	mapLayer->File_GetStats(&before);
+
+	// the blocks past the first four are mapped by the indirect block, which is written once
+	unsigned int blocks = 100;
+	char * buffer       = (char *)malloc(blocks * BLOCK_SIZE);
+	for (unsigned int i = 0; i < blocks * BLOCK_SIZE; ++i)
+	{
+		buffer[i] = 'a' + i / BLOCK_SIZE % 26;
+	}
+
+	assert(mapLayer->File_Write(inum, 0, blocks * BLOCK_SIZE, buffer) == 0);
+
+	LfsStats after;
+	mapLayer->File_GetStats(&after);
+	unsigned long long metadataBlocks = after.log.blocksWritten[WriteStream::Metadata] - before.log.blocksWritten[WriteStream::Metadata];
+	unsigned long long iFileBlocks    = after.file.inodeWriteBacks - before.file.inodeWriteBacks;
+	assert(metadataBlocks <= 1 + iFileBlocks);
+
+	char * readBuffer = (char *)malloc(blocks * BLOCK_SIZE);
+	assert(mapLayer->File_Read(inum, 0, blocks * BLOCK_SIZE, readBuffer) == 0);
+	assert(memcmp(buffer, readBuffer, blocks * BLOCK_SIZE) == 0);
+
+	// the indirect block is read back from flash after a remount
+	delete mapLayer;
+	mapLayer = new FileLayer(flashFile, segmentCacheSize, checkpointInterval, 1, 1);
+	mapLayer->Init();
+	memset(readBuffer, 0, blocks * BLOCK_SIZE);
+	assert(mapLayer->File_Read(inum, 0, blocks * BLOCK_SIZE, readBuffer) == 0);
+	assert(memcmp(buffer, readBuffer, blocks * BLOCK_SIZE) == 0);
+
+	free(buffer);
+	free(readBuffer);
+	delete mapLayer;
+	DeleteTestFlash(flashFile);
+}
+
+// writes every other block after the direct blocks, so the file has more than a block of one block extents
+// and is moved to a block map
+void FragmentFile(FileLayer * layer, unsigned int inum)
+{
+	char block[BLOCK_SIZE];
+	memset(block, 0, sizeof(block));
+	for (unsigned int extent = 0; extent <= BLOCK_SIZE / sizeof(Extent); ++extent)
+	{
+		assert(layer->File_Write(inum, (NUM_DIRECT_BLOCKS + 2 * extent) * BLOCK_SIZE, BLOCK_SIZE, block) == 0);
+	}
+}
+
+// a file long enough to need the triple indirect block is written, read back and freed
+void TestTripleIndirectBlocks()
+{
+	std::cout << "\nTestTripleIndirectBlocks\n" << std::endl;
+	Mklfs(flashFile, "-s 800");
+	FileLayer * mapLayer = new FileLayer(flashFile, segmentCacheSize, checkpointInterval, 1, 1);
+	mapLayer->Init();
+
+	unsigned int inum;
+	assert(mapLayer->File_Create(FileType::File, 0644, &inum) == 0);
+
+	// 4 direct blocks, then N blocks under the indirect block and N * N under the double indirect block
+	unsigned int entries = BLOCK_SIZE / sizeof(LogAddress);
+	unsigned int blocks  = 4 + entries + entries * entries + 2 * entries;
+	unsigned int chunk   = 64 * BLOCK_SIZE;
+	unsigned int length  = blocks * BLOCK_SIZE;
+	char * buffer        = (char *)malloc(chunk);
+
+	FragmentFile(mapLayer, inum);
+
+	LfsStats converted;
+	mapLayer->File_GetStats(&converted);
+	assert(converted.file.extentFilesConverted == 1);
+
+	for (unsigned int offset = 0; offset < length; offset += chunk)
+	{
+		unsigned int writeLength = std::min(chunk, length - offset);
+		for (unsigned int i = 0; i < writeLength; i += sizeof(unsigned int))
+		{
+			*(unsigned int *)(buffer + i) = offset + i;
+		}
+
+		assert(mapLayer->File_Write(inum, offset, writeLength, buffer) == 0);
+	}
+
+	// writes past the largest file the block map can hold fail instead of being dropped
+	assert(mapLayer->File_Write(inum, length, UINT_MAX - length, buffer) != 0);
+
+	for (int remount = 0; remount < 2; ++remount)
+	{
+		for (unsigned int offset = 0; offset < length; offset += chunk)
+		{
+			unsigned int readLength = std::min(chunk, length - offset);
+			assert(mapLayer->File_Read(inum, offset, readLength, buffer) == 0);
+			for (unsigned int i = 0; i < readLength; i += sizeof(unsigned int))
+			{
+				assert(*(unsigned int *)(buffer + i) == offset + i);
+			}
+		}
+
+		delete mapLayer;
+		mapLayer = new FileLayer(flashFile, segmentCacheSize, checkpointInterval, 1, 1);
+		mapLayer->Init();
+	}
+
+	// freeing the file gives back the data blocks and every node of its block map
+	LfsStats before;
+	mapLayer->File_GetStats(&before);
+	assert(mapLayer->File_Free(inum) == 0);
+
+	LfsStats after;
+	mapLayer->File_GetStats(&after);
+	assert(after.log.freeSegments - before.log.freeSegments >= length / (32 * BLOCK_SIZE) - 2);
+
+	free(buffer);
+	delete mapLayer;
+	DeleteTestFlash(flashFile);
+}
+
+void TestExtentMappedFile()
+{
+	std::cout << "\nTestExtentMappedFile\n" << std::endl;
+	Mklfs(flashFile, "-s 400");
+	FileLayer * mapLayer = new FileLayer(flashFile, segmentCacheSize, checkpointInterval, 1, 1);
+	mapLayer->Init();
+
+	unsigned int blocks = 2000;
+	unsigned int chunk  = 50 * BLOCK_SIZE;
+	unsigned int length = blocks * BLOCK_SIZE;
+	char * buffer       = (char *)malloc(length);
+	for (unsigned int i = 0; i < length; i += sizeof(unsigned int))
+	{
+		*(unsigned int *)(buffer + i) = i;
+	}
+
+	// the second file is fragmented into a block map before it is written
+	unsigned int inums[2];
+	assert(mapLayer->File_Create(FileType::File, 0644, &inums[0]) == 0);
+	assert(mapLayer->File_Create(FileType::File, 0644, &inums[1]) == 0);
+	FragmentFile(mapLayer, inums[1]);
+
+	// written from start to end, the first file is mapped by about one extent per segment and each
+	// write only changes the last block of its extent list
+	unsigned long long metadataBlocks[2];
+	for (unsigned int file = 0; file < 2; ++file)
+	{
+		LfsStats before;
+		mapLayer->File_GetStats(&before);
+		for (unsigned int offset = 0; offset < length; offset += chunk)
+		{
+			assert(mapLayer->File_Write(inums[file], offset, chunk, buffer + offset) == 0);
+		}
+
+		LfsStats after;
+		mapLayer->File_GetStats(&after);
+		metadataBlocks[file] = after.log.blocksWritten[WriteStream::Metadata] - before.log.blocksWritten[WriteStream::Metadata];
+		assert(after.file.extentFilesConverted == 1);
+	}
+
+	assert(metadataBlocks[0] < metadataBlocks[1]);
+
+	char * readBuffer = (char *)malloc(length);
+	delete mapLayer;
+	mapLayer = new FileLayer(flashFile, segmentCacheSize, checkpointInterval, 1, 1);
+	mapLayer->Init();
+	assert(mapLayer->File_Read(inums[0], 0, length, readBuffer) == 0);
+	assert(memcmp(buffer, readBuffer, length) == 0);
+
+	// overwriting part of it splits the blocks out of their extent. the file keeps its extents and writes
+	// fewer map blocks than the nodes of a block map of it
+	LfsStats before;
+	mapLayer->File_GetStats(&before);
+	memset(buffer + 100 * BLOCK_SIZE, 'o', 3 * BLOCK_SIZE + 7);
+	assert(mapLayer->File_Write(inums[0], 100 * BLOCK_SIZE, 3 * BLOCK_SIZE + 7, buffer + 100 * BLOCK_SIZE) == 0);
+
+	LfsStats stats;
+	mapLayer->File_GetStats(&stats);
+	assert(stats.file.extentFilesConverted == 0);
+	assert(stats.log.blocksWritten[WriteStream::Metadata] - before.log.blocksWritten[WriteStream::Metadata] < blocks / (BLOCK_SIZE / sizeof(LogAddress)));
+
+	for (int remount = 0; remount < 2; ++remount)
+	{
+		memset(readBuffer, 0, length);
+		assert(mapLayer->File_Read(inums[0], 0, length, readBuffer) == 0);
+		assert(memcmp(buffer, readBuffer, length) == 0);
+
+		delete mapLayer;
+		mapLayer = new FileLayer(flashFile, segmentCacheSize, checkpointInterval, 1, 1);
+		mapLayer->Init();
+	}
+
+	free(buffer);
+	free(readBuffer);
+	delete mapLayer;
+	DeleteTestFlash(flashFile);
+}
+
+void TestWholeBlockOverwriteSkipsRead()
+{
+	std::cout << "\nTestWholeBlockOverwriteSkipsRead\n" << std::endl;
+	Mklfs(flashFile);
+	FileLayer * overwriteLayer = new FileLayer(flashFile, segmentCacheSize, checkpointInterval, 1, 1);
+	overwriteLayer->Init();
+
+	unsigned int inum;
+	unsigned int blocks = 200;
+	char * buffer       = (char *)malloc(blocks * BLOCK_SIZE);
+	memset(buffer, 'a', blocks * BLOCK_SIZE);
+	assert(overwriteLayer->File_Create(FileType::File, 0644, &inum) == 0);
+	assert(overwriteLayer->File_Write(inum, 0, blocks * BLOCK_SIZE, buffer) == 0);
+
+	// after a remount none of the file's segments are cached. reading its first byte loads its map
+	delete overwriteLayer;
+	overwriteLayer = new FileLayer(flashFile, segmentCacheSize, checkpointInterval, 1, 1);
+	overwriteLayer->Init();
+	assert(overwriteLayer->File_Read(inum, 0, 1, buffer) == 0);
+
+	LfsStats before;
+	overwriteLayer->File_GetStats(&before);
+	memset(buffer, 'b', 10 * BLOCK_SIZE);
+	assert(overwriteLayer->File_Write(inum, 150 * BLOCK_SIZE, 10 * BLOCK_SIZE, buffer) == 0);
+
+	LfsStats after;
+	overwriteLayer->File_GetStats(&after);
+	assert(after.log.cacheMisses == before.log.cacheMisses);
+
+	assert(overwriteLayer->File_Read(inum, 149 * BLOCK_SIZE, 12 * BLOCK_SIZE, buffer) == 0);
+	for (unsigned int i = 0; i < 12 * BLOCK_SIZE; ++i)
+	{
+		assert(buffer[i] == (i < BLOCK_SIZE || i >= 11 * BLOCK_SIZE ? 'a' : 'b'));
+	}
+
+	free(buffer);
+	delete overwriteLayer;
+	DeleteTestFlash(flashFile);
+}
+
+void TestPartialWritesMergedInTail()
+{
+	std::cout << "\nTestPartialWritesMergedInTail\n" << std::endl;
+	Mklfs(flashFile);
+	FileLayer * mergeLayer = new FileLayer(flashFile, segmentCacheSize, checkpointInterval, 1, 1);
+	mergeLayer->Init();
+
+	unsigned int inum;
+	assert(mergeLayer->File_Create(FileType::File, 0644, &inum) == 0);
+
+	// small appends to a block that has not left the tail change it in place
+	unsigned int writes = 8;
+	unsigned int length = BLOCK_SIZE / writes;
+	char buffer[BLOCK_SIZE];
+	LfsStats before;
+	mergeLayer->File_GetStats(&before);
+	for (unsigned int i = 0; i < writes; ++i)
+	{
+		memset(buffer + i * length, 'a' + i, length);
+		assert(mergeLayer->File_Write(inum, i * length, length, buffer + i * length) == 0);
+	}
+
+	LfsStats after;
+	mergeLayer->File_GetStats(&after);
+	assert(after.log.blocksRewritten - before.log.blocksRewritten == writes - 1);
+	assert(after.log.blocksWritten[WriteStream::HotData] + after.log.blocksWritten[WriteStream::ColdData] -
+	       before.log.blocksWritten[WriteStream::HotData] - before.log.blocksWritten[WriteStream::ColdData] == 1);
+
+	char readBuffer[BLOCK_SIZE];
+	for (int remount = 0; remount < 2; ++remount)
+	{
+		assert(mergeLayer->File_Read(inum, 0, BLOCK_SIZE, readBuffer) == 0);
+		assert(memcmp(buffer, readBuffer, BLOCK_SIZE) == 0);
+
+		delete mergeLayer;
+		mergeLayer = new FileLayer(flashFile, segmentCacheSize, checkpointInterval, 1, 1);
+		mergeLayer->Init();
+	}
+
+	delete mergeLayer;
+	DeleteTestFlash(flashFile);
+}
+
+void TestSparseFile()
+{
+	std::cout << "\nTestSparseFile\n" << std::endl;
+	Mklfs(flashFile, "-s 400");
+	FileLayer * sparseLayer = new FileLayer(flashFile, segmentCacheSize, checkpointInterval, 1, 1);
+	sparseLayer->Init();
+
+	unsigned int inum;
+	unsigned int length = 301 * BLOCK_SIZE;
+	char * expected     = (char *)malloc(length);
+	char * buffer       = (char *)malloc(length);
+	memset(expected, 0, length);
+	assert(sparseLayer->File_Create(FileType::File, 0644, &inum) == 0);
+
+	// writes past the end of the file leave holes that are not written
+	LfsStats before;
+	sparseLayer->File_GetStats(&before);
+	memset(expected, 'a', BLOCK_SIZE);
+	memset(expected + 6 * BLOCK_SIZE, 'b', 2 * BLOCK_SIZE);
+	memset(expected + 300 * BLOCK_SIZE + 10, 'c', 5);
+	assert(sparseLayer->File_Write(inum, 0, BLOCK_SIZE, expected) == 0);
+	assert(sparseLayer->File_Write(inum, 6 * BLOCK_SIZE, 2 * BLOCK_SIZE, expected + 6 * BLOCK_SIZE) == 0);
+	assert(sparseLayer->File_Write(inum, 300 * BLOCK_SIZE + 10, 5, expected + 300 * BLOCK_SIZE + 10) == 0);
+	unsigned int fileSize = 300 * BLOCK_SIZE + 15;
+
+	LfsStats after;
+	sparseLayer->File_GetStats(&after);
+	assert(after.log.blocksWritten[WriteStream::HotData] + after.log.blocksWritten[WriteStream::ColdData] -
+	       before.log.blocksWritten[WriteStream::HotData] - before.log.blocksWritten[WriteStream::ColdData] == 4);
+
+	struct stat stbuf;
+	assert(sparseLayer->File_GetAttr(inum, &stbuf) == 0);
+	assert(stbuf.st_size == fileSize);
+
+	// holes read back as zeros and reads stop at the end of the file
+	memset(buffer, 'x', length);
+	assert(sparseLayer->File_Read(inum, 0, length, buffer) == 0);
+	assert(memcmp(buffer, expected, fileSize) == 0);
+	assert(sparseLayer->File_Read(inum, fileSize + 1, 10, buffer) != 0);
+
+	unsigned int result;
+	assert(sparseLayer->File_Seek(inum, 0, SEEK_DATA, &result) == 0 && result == 0);
+	assert(sparseLayer->File_Seek(inum, 10, SEEK_HOLE, &result) == 0 && result == BLOCK_SIZE);
+	assert(sparseLayer->File_Seek(inum, BLOCK_SIZE, SEEK_DATA, &result) == 0 && result == 6 * BLOCK_SIZE);
+	assert(sparseLayer->File_Seek(inum, 6 * BLOCK_SIZE + 5, SEEK_DATA, &result) == 0 && result == 6 * BLOCK_SIZE + 5);
+	assert(sparseLayer->File_Seek(inum, 6 * BLOCK_SIZE + 5, SEEK_HOLE, &result) == 0 && result == 8 * BLOCK_SIZE);
+	assert(sparseLayer->File_Seek(inum, 8 * BLOCK_SIZE, SEEK_DATA, &result) == 0 && result == 300 * BLOCK_SIZE);
+	assert(sparseLayer->File_Seek(inum, 300 * BLOCK_SIZE, SEEK_HOLE, &result) == 0 && result == fileSize);
+	assert(sparseLayer->File_Seek(inum, fileSize, SEEK_DATA, &result) == -ENXIO);
+	assert(sparseLayer->File_Seek(inum, 0, SEEK_SET, &result) == -EINVAL);
+
+	// filling holes in the direct blocks and between extents keeps the file extent mapped
+	memset(expected + 3 * BLOCK_SIZE, 'd', BLOCK_SIZE);
+	memset(expected + 100 * BLOCK_SIZE, 'e', BLOCK_SIZE);
+	assert(sparseLayer->File_Write(inum, 3 * BLOCK_SIZE, BLOCK_SIZE, expected + 3 * BLOCK_SIZE) == 0);
+	assert(sparseLayer->File_Write(inum, 100 * BLOCK_SIZE, BLOCK_SIZE, expected + 100 * BLOCK_SIZE) == 0);
+	sparseLayer->File_GetStats(&after);
+	assert(after.file.extentFilesConverted == before.file.extentFilesConverted);
+	assert(sparseLayer->File_Seek(inum, BLOCK_SIZE, SEEK_DATA, &result) == 0 && result == 3 * BLOCK_SIZE);
+	assert(sparseLayer->File_Seek(inum, 8 * BLOCK_SIZE, SEEK_DATA, &result) == 0 && result == 100 * BLOCK_SIZE);
+
+	// a block mapped file skips the nodes that were never written
+	unsigned int mapped;
+	unsigned int chunk = 256 * BLOCK_SIZE;
+	memset(buffer, 'f', chunk);
+	assert(sparseLayer->File_Create(FileType::File, 0644, &mapped) == 0);
+	FragmentFile(sparseLayer, mapped);
+	assert(sparseLayer->File_Write(mapped, 0, chunk, buffer) == 0);
+	assert(sparseLayer->File_Write(mapped, 5000 * BLOCK_SIZE, BLOCK_SIZE, buffer) == 0);
+	sparseLayer->File_GetStats(&after);
+	assert(after.file.extentFilesConverted == before.file.extentFilesConverted + 1);
+
+	for (int remount = 0; remount < 2; ++remount)
+	{
+		memset(buffer, 'x', length);
+		assert(sparseLayer->File_Read(inum, 0, length, buffer) == 0);
+		assert(memcmp(buffer, expected, fileSize) == 0);
+		assert(sparseLayer->File_Seek(inum, 101 * BLOCK_SIZE, SEEK_DATA, &result) == 0 && result == 300 * BLOCK_SIZE);
+
+		assert(sparseLayer->File_Seek(mapped, 0, SEEK_HOLE, &result) == 0 && result == chunk);
+		assert(sparseLayer->File_Seek(mapped, chunk, SEEK_DATA, &result) == 0 && result == 5000 * BLOCK_SIZE);
+		assert(sparseLayer->File_Read(mapped, 3000 * BLOCK_SIZE, BLOCK_SIZE, buffer) == 0);
+		for (unsigned int i = 0; i < BLOCK_SIZE; ++i)
+		{
+			assert(buffer[i] == 0);
+		}
+
+		delete sparseLayer;
+		sparseLayer = new FileLayer(flashFile, segmentCacheSize, checkpointInterval, 1, 1);
+		sparseLayer->Init();
+	}
+
+	free(expected);
+	free(buffer);
+	delete sparseLayer;
+	DeleteTestFlash(flashFile);
+}
+
+void TestTruncateInPlace()
+{
+	std::cout << "\nTestTruncateInPlace\n" << std::endl;
+	Mklfs(flashFile, "-s 400");
+	FileLayer * truncateLayer = new FileLayer(flashFile, segmentCacheSize, checkpointInterval, 1, 1);
+	truncateLayer->Init();
+
+	unsigned int blocks = 1000;
+	unsigned int length = blocks * BLOCK_SIZE;
+	unsigned int chunk  = 64 * BLOCK_SIZE;
+	char * buffer       = (char *)malloc(length);
+	char * readBuffer   = (char *)malloc(length);
+	for (unsigned int i = 0; i < length; i += sizeof(unsigned int))
+	{
+		*(unsigned int *)(buffer + i) = i;
+	}
+
+	// the second file is moved to a block map, so it has nodes under the indirect and double indirect blocks
+	unsigned int inums[2];
+	for (unsigned int file = 0; file < 2; ++file)
+	{
+		assert(truncateLayer->File_Create(FileType::File, 0644, &inums[file]) == 0);
+		if (file == 1)
+		{
+			FragmentFile(truncateLayer, inums[file]);
+		}
+
+		assert(truncateLayer->File_Write(inums[file], 0, length, buffer) == 0);
+	}
+
+	delete truncateLayer;
+	truncateLayer = new FileLayer(flashFile, segmentCacheSize, checkpointInterval, 1, 1);
+	truncateLayer->Init();
+
+	// only the cut block is rewritten and the blocks past it are freed
+	unsigned int sizes[2] = { 600 * BLOCK_SIZE + 100, 100 * BLOCK_SIZE + 100 };
+	for (unsigned int file = 0; file < 2; ++file)
+	{
+		LfsStats before;
+		truncateLayer->File_GetStats(&before);
+		assert(truncateLayer->File_Truncate(inums[file], sizes[file]) == 0);
+
+		LfsStats after;
+		truncateLayer->File_GetStats(&after);
+		assert(after.log.blocksWritten[WriteStream::HotData] + after.log.blocksWritten[WriteStream::ColdData] -
+		       before.log.blocksWritten[WriteStream::HotData] - before.log.blocksWritten[WriteStream::ColdData] == 1);
+		assert(after.log.blocksWritten[WriteStream::Metadata] - before.log.blocksWritten[WriteStream::Metadata] < 4);
+		assert(after.log.freeSegments - before.log.freeSegments >= (length - sizes[file]) / (32 * BLOCK_SIZE) - 2);
+		assert(after.file.extentFilesConverted == before.file.extentFilesConverted);
+	}
+
+	// growing the file again leaves a hole, and the end of the cut block reads as zeros
+	unsigned int grown = 800 * BLOCK_SIZE;
+	for (unsigned int file = 0; file < 2; ++file)
+	{
+		assert(truncateLayer->File_Truncate(inums[file], grown) == 0);
+	}
+
+	for (int remount = 0; remount < 2; ++remount)
+	{
+		for (unsigned int file = 0; file < 2; ++file)
+		{
+			struct stat stbuf;
+			assert(truncateLayer->File_GetAttr(inums[file], &stbuf) == 0);
+			assert(stbuf.st_size == grown);
+
+			memset(readBuffer, 'x', length);
+			assert(truncateLayer->File_Read(inums[file], 0, grown, readBuffer) == 0);
+			assert(memcmp(readBuffer, buffer, sizes[file]) == 0);
+			for (unsigned int i = sizes[file]; i < grown; ++i)
+			{
+				assert(readBuffer[i] == 0);
+			}
+
+			unsigned int result;
+			assert(truncateLayer->File_Seek(inums[file], sizes[file], SEEK_HOLE, &result) == 0 && result == sizes[file] - 100 + BLOCK_SIZE);
+			assert(truncateLayer->File_Seek(inums[file], result, SEEK_DATA, &result) == -ENXIO);
+		}
+
+		delete truncateLayer;
+		truncateLayer = new FileLayer(flashFile, segmentCacheSize, checkpointInterval, 1, 1);
+		truncateLayer->Init();
+	}
+
+	// truncating to zero frees the rest, and the file can be written again
+	for (unsigned int file = 0; file < 2; ++file)
+	{
+		assert(truncateLayer->File_Truncate(inums[file], 0) == 0);
+		assert(truncateLayer->File_Read(inums[file], 0, 1, readBuffer) != 0);
+		assert(truncateLayer->File_Write(inums[file], 0, chunk, buffer) == 0);
+		assert(truncateLayer->File_Read(inums[file], 0, chunk, readBuffer) == 0);
+		assert(memcmp(readBuffer, buffer, chunk) == 0);
+	}
+
+	free(buffer);
+	free(readBuffer);
+	delete truncateLayer;
+	DeleteTestFlash(flashFile);
+}
+
+void TestFreeINodes()
+{
+	std::cout << "\nTestFreeINodes\n" << std::endl;
+	Mklfs(flashFile);
+	FileLayer * inodeLayer = new FileLayer(flashFile, segmentCacheSize, checkpointInterval, 1, 1);
+	inodeLayer->Init();
+
+	unsigned int files = 200;
+	unsigned int inums[files];
+	for (unsigned int file = 0; file < files; ++file)
+	{
+		assert(inodeLayer->File_Create(FileType::File, 0644, &inums[file]) == 0);
+	}
+
+	// each create and free changes the free inode count by one
+	struct statvfs before;
+	struct statvfs after;
+	assert(inodeLayer->File_Statfs(&before) == 0);
+	assert(inodeLayer->File_Free(inums[150]) == 0);
+	assert(inodeLayer->File_Free(inums[50]) == 0);
+	assert(inodeLayer->File_Statfs(&after) == 0);
+	assert(after.f_ffree - before.f_ffree == 2 + (after.f_bfree - before.f_bfree) * (BLOCK_SIZE / sizeof(INode)));
+	assert(after.f_files - after.f_ffree == before.f_files - before.f_ffree - 2);
+
+	// after a remount the free inums are known without reading any inode, and the lowest is reused first
+	delete inodeLayer;
+	inodeLayer = new FileLayer(flashFile, segmentCacheSize, checkpointInterval, 1, 1);
+	assert(inodeLayer->Init() == 0);
+
+	LfsStats stats;
+	inodeLayer->File_GetStats(&stats);
+	unsigned int inum;
+	assert(inodeLayer->File_Create(FileType::File, 0644, &inum) == 0 && inum == inums[50]);
+	assert(inodeLayer->File_Create(FileType::File, 0644, &inum) == 0 && inum == inums[150]);
+	assert(inodeLayer->File_Create(FileType::File, 0644, &inum) == 0 && inum == inums[files - 1] + 1);
+
+	LfsStats created;
+	inodeLayer->File_GetStats(&created);
+	assert(created.file.inodeCacheMisses == stats.file.inodeCacheMisses);
+
+	delete inodeLayer;
+	DeleteTestFlash(flashFile);
+}
+
+void TestINodeMap()
+{
+	std::cout << "\nTestINodeMap\n" << std::endl;
+	Mklfs(flashFile);
+	FileLayer * mapLayer = new FileLayer(flashFile, segmentCacheSize, checkpointInterval, 1, 1);
+	assert(mapLayer->Init() == 0);
+
+	// enough inodes that the ifile needs its double indirect tree
+	BlockMapGeometry geometry(BLOCK_SIZE);
+	unsigned int iNodesInBlock = BLOCK_SIZE / sizeof(INode);
+	unsigned int files         = geometry.RootFirstBlock(2) * iNodesInBlock + 2 * iNodesInBlock;
+	unsigned int inums[files];
+	LfsStats before;
+	mapLayer->File_GetStats(&before);
+	for (unsigned int file = 0; file < files; ++file)
+	{
+		assert(mapLayer->File_Create(FileType::File, 0644, &inums[file]) == 0);
+		assert(mapLayer->File_Chmod(inums[file], 0600 | (file % 2)) == 0);
+	}
+
+	// a write back writes each changed node of the inode map once, however many ifile blocks it writes
+	LfsStats created;
+	mapLayer->File_GetStats(&created);
+	unsigned long long writeBacks = created.file.inodeWriteBacks - before.file.inodeWriteBacks;
+	unsigned long long written    = created.file.inodesWrittenBack - before.file.inodesWrittenBack;
+	unsigned long long metadata   = created.log.blocksWritten[WriteStream::Metadata] - before.log.blocksWritten[WriteStream::Metadata];
+	assert(writeBacks > 0);
+	assert(metadata <= written / iNodesInBlock + writeBacks * (1 + MAX_BLOCK_MAP_HEIGHT));
+
+	// after a remount every inode is found through the map, and freed inums past the indirect tree are reused
+	delete mapLayer;
+	mapLayer = new FileLayer(flashFile, segmentCacheSize, checkpointInterval, 1, 1);
+	assert(mapLayer->Init() == 0);
+	for (unsigned int file = 0; file < files; ++file)
+	{
+		struct stat stbuf;
+		assert(mapLayer->File_GetAttr(inums[file], &stbuf) == 0);
+		assert(stbuf.st_mode == (GetFileTypeMode(FileType::File) | 0600 | (file % 2)));
+	}
+
+	unsigned int inum;
+	assert(mapLayer->File_Free(inums[files - 3]) == 0);
+	assert(mapLayer->File_Create(FileType::File, 0644, &inum) == 0 && inum == inums[files - 3]);
+	assert(mapLayer->File_Create(FileType::File, 0644, &inum) == 0 && inum == inums[files - 1] + 1);
+
+	delete mapLayer;
+	DeleteTestFlash(flashFile);
+}
+
+void TestInlineData()
+{
+	std::cout << "\nTestInlineData\n" << std::endl;
+	Mklfs(flashFile);
+	FileLayer * inlineLayer = new FileLayer(flashFile, segmentCacheSize, checkpointInterval, 1, 1);
+	assert(inlineLayer->Init() == 0);
+
+	// small files and symlinks are written into their inodes and take no blocks
+	unsigned int file;
+	unsigned int symlink;
+	const char * target = "/some/where/else";
+	char expected[BLOCK_SIZE];
+	char buffer[BLOCK_SIZE];
+	memset(expected, 0, sizeof(expected));
+	memset(expected, 'a', 50);
+	LfsStats before;
+	inlineLayer->File_GetStats(&before);
+	assert(inlineLayer->File_Create(FileType::File, 0644, &file) == 0);
+	assert(inlineLayer->File_Create(FileType::Symlink, 0777, &symlink) == 0);
+	assert(inlineLayer->File_Write(file, 0, 50, expected) == 0);
+	assert(inlineLayer->File_Write(symlink, 0, strlen(target), target) == 0);
+
+	LfsStats after;
+	inlineLayer->File_GetStats(&after);
+	for (int stream = 0; stream < NUM_WRITE_STREAMS; ++stream)
+	{
+		assert(after.log.blocksWritten[stream] == before.log.blocksWritten[stream]);
+	}
+
+	struct stat stbuf;
+	assert(inlineLayer->File_GetAttr(file, &stbuf) == 0);
+	assert(stbuf.st_size == 50 && stbuf.st_blocks == 0);
+	assert(inlineLayer->File_Read(symlink, 0, strlen(target), buffer) == 0);
+	assert(memcmp(buffer, target, strlen(target)) == 0);
+
+	// a shrink zeros the cut off data, so growing again reads zeros. there are no holes
+	memset(expected + 20, 'b', 10);
+	assert(inlineLayer->File_Write(file, 20, 10, expected + 20) == 0);
+	assert(inlineLayer->File_Truncate(file, 40) == 0);
+	assert(inlineLayer->File_Truncate(file, 60) == 0);
+	memset(expected + 40, 0, 20);
+	assert(inlineLayer->File_Read(file, 0, 60, buffer) == 0);
+	assert(memcmp(buffer, expected, 60) == 0);
+
+	unsigned int result;
+	assert(inlineLayer->File_Seek(file, 45, SEEK_DATA, &result) == 0 && result == 45);
+	assert(inlineLayer->File_Seek(file, 0, SEEK_HOLE, &result) == 0 && result == 60);
+
+	// the data moves to a block once the file outgrows its inode, and back after a truncate to 0
+	memset(expected + 60, 'c', 500);
+	assert(inlineLayer->File_Write(file, 60, 500, expected + 60) == 0);
+	assert(inlineLayer->File_GetAttr(file, &stbuf) == 0);
+	assert(stbuf.st_size == 560 && stbuf.st_blocks == 1);
+	assert(inlineLayer->File_Read(file, 0, 560, buffer) == 0);
+	assert(memcmp(buffer, expected, 560) == 0);
+
+	assert(inlineLayer->File_Truncate(file, 0) == 0);
+	assert(inlineLayer->File_Write(file, 0, 30, expected) == 0);
+	assert(inlineLayer->File_GetAttr(file, &stbuf) == 0);
+	assert(stbuf.st_size == 30 && stbuf.st_blocks == 0);
+
+	// inline data is kept with the inode across a remount
+	delete inlineLayer;
+	inlineLayer = new FileLayer(flashFile, segmentCacheSize, checkpointInterval, 1, 1);
+	assert(inlineLayer->Init() == 0);
+	assert(inlineLayer->File_Read(file, 0, 30, buffer) == 0);
+	assert(memcmp(buffer, expected, 30) == 0);
+	assert(inlineLayer->File_Read(symlink, 0, strlen(target), buffer) == 0);
+	assert(memcmp(buffer, target, strlen(target)) == 0);
+
+	delete inlineLayer;
+	DeleteTestFlash(flashFile);
+}
+
 void RunTests()
 {
 	Setup();
@@ -509,6 +1392,21 @@ void RunTests()
 	TestIndirectBlocksOneLevel();
 	TestCreateLotsOfFiles();
 	Teardown();
+
+	TestDedupIdenticalFiles();
+	TestDedupOwnerSurvivesRemount();
+	TestWriteCauses();
+	TestINodeWriteBack();
+	TestIndirectBlockWrittenOncePerWrite();
+	TestTripleIndirectBlocks();
+	TestExtentMappedFile();
+	TestWholeBlockOverwriteSkipsRead();
+	TestPartialWritesMergedInTail();
+	TestSparseFile();
+	TestTruncateInPlace();
+	TestFreeINodes();
+	TestINodeMap();
+	TestInlineData();
 }
 
 int main(int argc, char **argv)
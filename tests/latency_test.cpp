@@ -0,0 +1,125 @@
+#include <assert.h>
+#include <string>
+#include <iostream>
+#include <sstream>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "../latency.hpp"
+
+void TestBucketLimits()
+{
+	std::cout << "\nTestBucketLimits\n" << std::endl;
+	for (uint64_t value = 0; value < LATENCY_SUB_BUCKETS; ++value)
+	{
+		assert(value == GetLatencyBucket(value));
+		assert(value == GetLatencyBucketLimit(value));
+	}
+
+	// every value falls in a bucket whose limit is at most 1/16 above it
+	for (uint64_t value = LATENCY_SUB_BUCKETS; value < ((uint64_t)1 << 62); value = value * 3 / 2 + 1)
+	{
+		unsigned int bucket = GetLatencyBucket(value);
+		uint64_t limit      = GetLatencyBucketLimit(bucket);
+		assert(bucket < LATENCY_BUCKETS);
+		assert(limit >= value);
+		assert(limit - value <= value / LATENCY_SUB_BUCKETS);
+		assert(bucket == GetLatencyBucket(limit));
+		assert(bucket + 1 == GetLatencyBucket(limit + 1));
+	}
+
+	assert(LATENCY_BUCKETS - 1 == GetLatencyBucket(UINT64_MAX));
+}
+
+void TestPercentiles()
+{
+	std::cout << "\nTestPercentiles\n" << std::endl;
+	ResetLatencyHistograms();
+
+	// 1us to 1000us
+	for (uint64_t i = 1; i <= 1000; ++i)
+	{
+		RecordLatency(LatencyOp::FileRead, i * 1000);
+	}
+
+	assert(1000 == GetLatencyCount(LatencyOp::FileRead));
+	assert(500500 == GetLatencyMean(LatencyOp::FileRead));
+	assert(1000000 == GetLatencyMax(LatencyOp::FileRead));
+
+	uint64_t p50 = GetLatencyPercentile(LatencyOp::FileRead, 50);
+	uint64_t p99 = GetLatencyPercentile(LatencyOp::FileRead, 99);
+	assert(p50 >= 500000 && p50 <= 500000 + 500000 / LATENCY_SUB_BUCKETS);
+	assert(p99 >= 990000 && p99 <= 1000000);
+	assert(1000000 == GetLatencyPercentile(LatencyOp::FileRead, 100));
+	assert(0 == GetLatencyPercentile(LatencyOp::FileWrite, 50));
+}
+
+void TestTimer()
+{
+	std::cout << "\nTestTimer\n" << std::endl;
+	ResetLatencyHistograms();
+	{
+		LatencyTimer timer(LatencyOp::LogCheckpoint);
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
+	}
+
+	assert(1 == GetLatencyCount(LatencyOp::LogCheckpoint));
+	assert(GetLatencyMax(LatencyOp::LogCheckpoint) >= 2000000);
+}
+
+void TestConcurrentRecording()
+{
+	std::cout << "\nTestConcurrentRecording\n" << std::endl;
+	ResetLatencyHistograms();
+
+	unsigned int numThreads = 8;
+	unsigned int records    = 10000;
+	std::vector<std::thread> threads;
+	for (unsigned int t = 0; t < numThreads; ++t)
+	{
+		threads.push_back(std::thread([t, records]()
+		{
+			for (unsigned int i = 0; i < records; ++i)
+			{
+				RecordLatency(LatencyOp::LogWrite, (t + 1) * 100);
+			}
+		}));
+	}
+
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+
+	assert(numThreads * records == GetLatencyCount(LatencyOp::LogWrite));
+	assert(numThreads * 100 == GetLatencyMax(LatencyOp::LogWrite));
+}
+
+void TestReport()
+{
+	std::cout << "\nTestReport\n" << std::endl;
+	ResetLatencyHistograms();
+	RecordLatency(LatencyOp::FuseGetattr, 1500);
+
+	// only operations that have run are reported
+	std::ostringstream report;
+	PrintLatencyReport(report);
+	std::cout << report.str();
+	assert(report.str().find("lfs_getattr") != std::string::npos);
+	assert(report.str().find("lfs_read ") == std::string::npos);
+}
+
+void RunTests()
+{
+	TestBucketLimits();
+	TestPercentiles();
+	TestTimer();
+	TestConcurrentRecording();
+	TestReport();
+}
+
+int main(int argc, char **argv)
+{
+	RunTests();
+	return 0;
+}
@@ -2,6 +2,7 @@
 #include <string>
 #include <iostream>
 #include <cstring>
+#include <set>
 #include "test_utils.hpp"
 #include "../layers/log.hpp"
 
@@ -37,9 +38,9 @@ void TestShortWrite()
 	memcpy(buffer, s, sizeof(s)); 
 	assert(0 == log->Log_Write(inum, block, buffer, &addr));
 	log->PrintTail();
-	assert(3 == addr.logSegment);
-	assert(4 == addr.blockNumber);
-	assert(3 == log->getTailSegmentNumber());
+	assert(4 == addr.logSegment);
+	assert(1 == addr.blockNumber);
+	assert(4 == log->getTailSegmentNumber());
 	free(buffer);
 }
 
@@ -54,20 +55,20 @@ void TestMultiBlockWrite()
 	memset(buffer, 0, 512 * 2);
 	memcpy(buffer, s, sizeof(s)); 
 	assert(0 == log->Log_Write(inum, block, buffer, &addr));
-	assert(3 == addr.logSegment);
-	assert(5 == addr.blockNumber);
+	assert(4 == addr.logSegment);
+	assert(2 == addr.blockNumber);
 	assert(0 == log->Log_Write(inum, block+1, buffer, &addr));
-	assert(3 == addr.logSegment);
-	assert(6 == addr.blockNumber);
+	assert(4 == addr.logSegment);
+	assert(3 == addr.blockNumber);
 	log->PrintTail();
-	assert(3 == log->getTailSegmentNumber());
+	assert(4 == log->getTailSegmentNumber());
 	free(buffer);
 }
 
 void TestSegmentFill()
 {
     std::cout << "\nTestSegmentFill\n" << std::endl;
-	unsigned int blocksToFill = 32 - 7;
+	unsigned int blocksToFill = 32 - 4;
 	unsigned int inum = 2;
 	void * buffer = malloc(512 * 2);
 	for (int block = 0; block < blocksToFill; ++block)
@@ -78,13 +79,13 @@ void TestSegmentFill()
 		memset(buffer, 0, 512 * 2);
 		memcpy(buffer, s, sizeof(s)); 
 		assert(0 == log->Log_Write(inum, block, buffer, &addr));
-		assert(3 == addr.logSegment);
-		assert(block + 7 == addr.blockNumber);
+		assert(4 == addr.logSegment);
+		assert(block + 4 == addr.blockNumber);
     	std::cout << "wrote block: " << block + 6 << std::endl;
 	}
 
 	log->PrintTail();
-	assert(4 == log->getTailSegmentNumber());
+	assert(5 == log->getTailSegmentNumber());
 	free(buffer);
 }
 
@@ -100,7 +101,7 @@ void TestMoreWritesAfterSegmentFill()
 	memcpy(buffer, s, sizeof(s)); 
 	assert(0 == log->Log_Write(inum, block, buffer, &addr));
 	log->PrintTail();
-	assert(4 == addr.logSegment);
+	assert(5 == addr.logSegment);
 	assert(1 == addr.blockNumber);
 	free(buffer);
 }
@@ -133,9 +134,9 @@ void TestShortReadFromTail()
 	memset(buffer, 0, 512 * 2);
 	memcpy(buffer, s, sizeof(s)); 
 	assert(0 == log->Log_Write(inum, block, buffer, &addr));
-	assert(3 == addr.logSegment);
-	assert(4 == addr.blockNumber);
-	assert(3 == log->getTailSegmentNumber());
+	assert(4 == addr.logSegment);
+	assert(1 == addr.blockNumber);
+	assert(4 == log->getTailSegmentNumber());
 
 	memset(buffer, 0, 512 * 2);
 	log->Log_Read(addr, buffer);
@@ -158,23 +159,23 @@ void TestMultiBlockReadFromTail()
 	memset(buffer, 0, 512 * 2);
 	memcpy(buffer, s1, sizeof(s1)); 
 	assert(0 == log->Log_Write(inum, block, buffer, &addr));
-	assert(3 == addr.logSegment);
-	assert(5 == addr.blockNumber);
+	assert(4 == addr.logSegment);
+	assert(2 == addr.blockNumber);
 	memset(buffer, 0, 512 * 2);
 	memcpy(buffer, s2, sizeof(s2));
 	assert(0 == log->Log_Write(inum, block+1, buffer, &addr));
-	assert(3 == addr.logSegment);
-	assert(6 == addr.blockNumber);
-	assert(3 == log->getTailSegmentNumber());
+	assert(4 == addr.logSegment);
+	assert(3 == addr.blockNumber);
+	assert(4 == log->getTailSegmentNumber());
 
-	addr.blockNumber = 5;
+	addr.blockNumber = 2;
 	memset(buffer, 0, 512 * 2);
 	log->Log_Read(addr, buffer);
 	std::cout << "block 1 contents: \n\t" << (char *)buffer << std::endl;
 	assert(0 == strcmp(s1, (char *)buffer));
 
 
-	addr.blockNumber = 6;
+	addr.blockNumber = 3;
 	memset(buffer, 0, 512 * 2);
 	log->Log_Read(addr, buffer);
 	std::cout << "block 2 contents: \n\t" << (char *)buffer << std::endl;
@@ -187,7 +188,7 @@ void TestMultiBlockReadFromTail()
 void TestReadSegmentInCache()
 {
 	std::cout << "\nTestReadSegmentInCache\n" << std::endl;
-	unsigned int blocksToFill = 32 - 7;
+	unsigned int blocksToFill = 32 - 4;
 	unsigned int inum = 2;
 	void * buffer = malloc(512 * 2);
 
@@ -198,15 +199,15 @@ void TestReadSegmentInCache()
 		memset(buffer, 0, 512 * 2);
 		memcpy(buffer, s, sizeof(s)); 
 		assert(0 == log->Log_Write(inum, block, buffer, &addr));
-		assert(3 == addr.logSegment);
-		assert(block + 7 == addr.blockNumber);
+		assert(4 == addr.logSegment);
+		assert(block + 4 == addr.blockNumber);
 	}
 
-	assert(4 == log->getTailSegmentNumber());
+	assert(5 == log->getTailSegmentNumber());
 
 	LogAddress readAddr = 
 	{
-		.logSegment = 3,
+		.logSegment = 4,
 		.blockNumber = 12
 	};
 	memset(buffer, 0, 512 * 2);
@@ -235,11 +236,11 @@ void TestReadSegmentNotInCache()
 		addr.Print();
 	}
 
-	assert(7 == log->getTailSegmentNumber());
+	assert(8 == log->getTailSegmentNumber());
 
 	LogAddress readAddr = 
 	{
-		.logSegment = 3,
+		.logSegment = 4,
 		.blockNumber = 12
 	};
 	memset(buffer, 0, 512 * 2);
@@ -250,7 +251,7 @@ void TestReadSegmentNotInCache()
 
 	LogAddress readAddrCache = 
 	{
-		.logSegment = 6,
+		.logSegment = 7,
 		.blockNumber = 12
 	};
 	memset(buffer, 0, 512 * 2);
@@ -266,10 +267,10 @@ void TestReadAfterFree()
 {
 	std::cout << "\nTestReadAfterFree\n" << std::endl;
 
-	// segment 6 in tail, blocks 1-3 full
+	// segment 8 in tail, blocks 1-3 full
 	LogAddress addrToFree = 
 	{
-		.logSegment = 7,
+		.logSegment = 8,
 		.blockNumber = 2
 	};
 
@@ -285,7 +286,7 @@ void TestReadAfterFree()
 	LogAddress newAddr; memset(&newAddr, 0, sizeof(LogAddress)); 
 
 	assert(log->Log_Write(inum, addrToFree.blockNumber, buffer, &newAddr) == 0);
-	assert(newAddr.logSegment = 7);
+	assert(newAddr.logSegment = 8);
 	assert(newAddr.blockNumber = 2);
 
 	memset(buffer, 0, 512 * 2);
@@ -307,21 +308,756 @@ void TestReadSegmentUsageTable()
 	assert(table[0].ageOfYoungestBlock == 0);
 	assert(table[1].ageOfYoungestBlock == 0);
 	assert(table[2].ageOfYoungestBlock == 0);
-	assert(table[3].liveBytesInSegment == 31744);
+	assert(table[3].liveBytesInSegment == 3072);
 	assert(table[4].liveBytesInSegment == 31744);
 	assert(table[5].liveBytesInSegment == 31744);
 	assert(table[6].liveBytesInSegment == 31744);
+	assert(table[7].liveBytesInSegment == 31744);
 	assert(table[3].ageOfYoungestBlock > 0);
 	assert(table[4].ageOfYoungestBlock > 0);
 	assert(table[5].ageOfYoungestBlock > 0);
 	assert(table[6].ageOfYoungestBlock > 0);
-	for (int i = 7; i < 100; ++i)
+	assert(table[7].ageOfYoungestBlock > 0);
+	for (int i = 8; i < 100; ++i)
 	{
 		assert(table[i].liveBytesInSegment == 0);
 		assert(table[i].ageOfYoungestBlock == 0);
 	}
 }
 
+void TestWriteStreams()
+{
+	std::cout << "\nTestWriteStreams\n" << std::endl;
+	unsigned int inum = 2;
+	void * buffer = malloc(512 * 2);
+	LogAddress hotAddr, metadataAddr, coldAddr;
+
+	// the hot stream writes to the tail opened on mount, other streams open their own tail
+	char hot[] = "Test hot stream write\n";
+	memset(buffer, 0, 512 * 2);
+	memcpy(buffer, hot, sizeof(hot));
+	assert(0 == log->Log_Write(inum, 0, buffer, &hotAddr, WriteStream::HotData));
+	assert(4 == hotAddr.logSegment);
+	assert(1 == hotAddr.blockNumber);
+
+	char metadata[] = "Test metadata stream write\n";
+	memset(buffer, 0, 512 * 2);
+	memcpy(buffer, metadata, sizeof(metadata));
+	assert(0 == log->Log_Write(inum, 1, buffer, &metadataAddr, WriteStream::Metadata));
+	assert(5 == metadataAddr.logSegment);
+	assert(1 == metadataAddr.blockNumber);
+
+	char cold[] = "Test cold stream write\n";
+	memset(buffer, 0, 512 * 2);
+	memcpy(buffer, cold, sizeof(cold));
+	assert(0 == log->Log_Write(inum, 2, buffer, &coldAddr, WriteStream::ColdData));
+	assert(6 == coldAddr.logSegment);
+	assert(1 == coldAddr.blockNumber);
+
+	assert(4 == log->getTailSegmentNumber());
+	assert(5 == log->getTailSegmentNumber(WriteStream::Metadata));
+	assert(6 == log->getTailSegmentNumber(WriteStream::ColdData));
+	assert(log->IsTailSegment(4));
+	assert(log->IsTailSegment(5));
+	assert(log->IsTailSegment(6));
+	assert(!log->IsTailSegment(7));
+
+	memset(buffer, 0, 512 * 2);
+	assert(0 == log->Log_Read(hotAddr, buffer));
+	assert(0 == strcmp(hot, (char *)buffer));
+	memset(buffer, 0, 512 * 2);
+	assert(0 == log->Log_Read(metadataAddr, buffer));
+	assert(0 == strcmp(metadata, (char *)buffer));
+	memset(buffer, 0, 512 * 2);
+	assert(0 == log->Log_Read(coldAddr, buffer));
+	assert(0 == strcmp(cold, (char *)buffer));
+
+	free(buffer);
+}
+
+void TestWriteStreamFill()
+{
+	std::cout << "\nTestWriteStreamFill\n" << std::endl;
+	unsigned int inum = 2;
+	void * buffer = malloc(512 * 2);
+	memset(buffer, 0, 512 * 2);
+
+	// metadata tail has block 1 used, fill it and make sure the hot tail is untouched
+	LogAddress addr;
+	for (int block = 2; block < 32; ++block)
+	{
+		assert(0 == log->Log_Write(inum, block, buffer, &addr, WriteStream::Metadata));
+		assert(5 == addr.logSegment);
+		assert(block == addr.blockNumber);
+	}
+
+	assert(4 == log->getTailSegmentNumber());
+	assert(7 == log->getTailSegmentNumber(WriteStream::Metadata));
+	assert(!log->IsTailSegment(5));
+
+	assert(0 == log->Log_Write(inum, 0, buffer, &addr, WriteStream::Metadata));
+	assert(7 == addr.logSegment);
+	assert(1 == addr.blockNumber);
+	free(buffer);
+}
+
+void TestErasePoolReusesReleasedSegment()
+{
+	std::cout << "\nTestErasePoolReusesReleasedSegment\n" << std::endl;
+	Mklfs(flashFile);
+	Log * poolLog = new Log(flashFile, segmentCacheSize, checkpointInterval, 0);
+	poolLog->Init();
+
+	unsigned int inum = 2;
+	void * buffer = malloc(512 * 2);
+	memset(buffer, 0, 512 * 2);
+
+	// fill segments 4 and 5, then release segment 5 as the cleaner would
+	LogAddress addr;
+	for (int block = 1; block < 32; ++block)
+	{
+		assert(0 == poolLog->Log_Write(inum, block, buffer, &addr));
+		assert(4 == addr.logSegment);
+	}
+
+	for (int block = 1; block < 32; ++block)
+	{
+		assert(0 == poolLog->Log_Write(inum, block, buffer, &addr));
+		assert(5 == addr.logSegment);
+	}
+
+	assert(6 == poolLog->getTailSegmentNumber());
+	assert(0 == poolLog->GetSegmentWear(5));
+	assert(0 == poolLog->ReleaseSegment(5));
+	assert(0 == poolLog->InvalidateSegment(5));
+
+	// segment 5 ties with the unused segments on wear so it is reused next, after it is erased
+	for (int block = 1; block < 32; ++block)
+	{
+		assert(0 == poolLog->Log_Write(inum, block, buffer, &addr));
+		assert(6 == addr.logSegment);
+	}
+
+	assert(5 == poolLog->getTailSegmentNumber());
+	assert(1 == poolLog->GetSegmentWear(5));
+
+	// writing segment 5 back to flash fails if it was not erased
+	char s[] = "Test write to erased segment\n";
+	memcpy(buffer, s, sizeof(s));
+	for (int block = 1; block < 32; ++block)
+	{
+		assert(0 == poolLog->Log_Write(inum, block, buffer, &addr));
+		assert(5 == addr.logSegment);
+		assert(block == addr.blockNumber);
+	}
+
+	memset(buffer, 0, 512 * 2);
+	assert(0 == poolLog->Log_Read(addr, buffer));
+	assert(0 == strcmp(s, (char *)buffer));
+
+	free(buffer);
+	delete poolLog;
+	DeleteTestFlash(flashFile);
+}
+
+void TestWearAwareAllocation()
+{
+	std::cout << "\nTestWearAwareAllocation\n" << std::endl;
+	Mklfs(flashFile);
+	Log * wearLog = new Log(flashFile, segmentCacheSize, checkpointInterval, 0);
+	wearLog->Init();
+
+	unsigned int inum = 2;
+	void * buffer = malloc(512 * 2);
+	memset(buffer, 0, 512 * 2);
+
+	// release segment 4 once it is written. it is erased when it is reused after segment 5 fills
+	LogAddress addr;
+	for (int segment = 4; segment <= 5; ++segment)
+	{
+		for (int block = 1; block < 32; ++block)
+		{
+			assert(0 == wearLog->Log_Write(inum, block, buffer, &addr));
+			assert(segment == addr.logSegment);
+		}
+
+		if (segment == 4)
+		{
+			assert(0 == wearLog->ReleaseSegment(4));
+			assert(0 == wearLog->InvalidateSegment(4));
+		}
+	}
+
+	assert(4 == wearLog->getTailSegmentNumber());
+	assert(1 == wearLog->GetSegmentWear(4));
+	for (int block = 1; block < 32; ++block)
+	{
+		assert(0 == wearLog->Log_Write(inum, block, buffer, &addr));
+		assert(4 == addr.logSegment);
+	}
+
+	assert(0 == wearLog->ReleaseSegment(4));
+	assert(0 == wearLog->InvalidateSegment(4));
+
+	// segment 4 is the lowest free segment but has more wear than segment 7
+	for (int block = 1; block < 32; ++block)
+	{
+		assert(0 == wearLog->Log_Write(inum, block, buffer, &addr));
+		assert(6 == addr.logSegment);
+	}
+
+	assert(7 == wearLog->getTailSegmentNumber());
+	assert(0 == wearLog->GetSegmentWear(7));
+
+	free(buffer);
+	delete wearLog;
+	DeleteTestFlash(flashFile);
+}
+
+void FillCompressibleBlock(char * buffer, unsigned int blockSize, int block)
+{
+	for (unsigned int i = 0; i < blockSize; i += 16)
+	{
+		snprintf(buffer + i, 17, "block %4d %4u\n", block, i / 16);
+	}
+}
+
+void TestCompressedWrites()
+{
+	std::cout << "\nTestCompressedWrites\n" << std::endl;
+	Mklfs(flashFile, "-c 1");
+	Log * compressedLog = new Log(flashFile, segmentCacheSize, checkpointInterval);
+	compressedLog->Init();
+
+	unsigned int inum      = 2;
+	unsigned int blockSize = 512 * 2;
+	char * buffer          = (char *)malloc(blockSize);
+	char * readBuffer      = (char *)malloc(blockSize);
+
+	// 95 compressible blocks fit in segment 4 where 31 uncompressed ones would
+	LogAddress addr;
+	for (int block = 0; block < 95; ++block)
+	{
+		FillCompressibleBlock(buffer, blockSize, block);
+		assert(0 == compressedLog->Log_Write(inum, block, buffer, &addr));
+		assert(4 == addr.logSegment);
+		assert(block + 1 == addr.blockNumber);
+	}
+
+	// segment 4 ran out of slots and was written. read it back from flash
+	assert(4 != compressedLog->getTailSegmentNumber());
+	assert(0 == compressedLog->InvalidateSegment(4));
+	for (int block = 0; block < 95; ++block)
+	{
+		LogAddress readAddr = { .logSegment = 4, .blockNumber = (unsigned int)block + 1 };
+		FillCompressibleBlock(buffer, blockSize, block);
+		assert(0 == compressedLog->Log_Read(readAddr, readBuffer));
+		assert(0 == memcmp(buffer, readBuffer, blockSize));
+	}
+
+	// a block that does not compress is stored as is
+	srand(7);
+	for (unsigned int i = 0; i < blockSize; ++i)
+	{
+		buffer[i] = rand() & 0xFF;
+	}
+
+	assert(0 == compressedLog->Log_Write(inum, 95, buffer, &addr));
+	assert(0 == compressedLog->Log_Read(addr, readBuffer));
+	assert(0 == memcmp(buffer, readBuffer, blockSize));
+
+	free(buffer);
+	free(readBuffer);
+	delete compressedLog;
+	DeleteTestFlash(flashFile);
+}
+
+void TestDedupWrites()
+{
+	std::cout << "\nTestDedupWrites\n" << std::endl;
+	Mklfs(flashFile, "-d 1");
+	Log * dedupLog = new Log(flashFile, segmentCacheSize, checkpointInterval);
+	dedupLog->Init();
+	assert(dedupLog->IsDeduplicating());
+
+	unsigned int blockSize = 512 * 2;
+	void * buffer          = malloc(blockSize);
+	void * readBuffer      = malloc(blockSize);
+
+	// fill the cold data tail, segment 5, with distinct blocks so it is written to flash
+	LogAddress addr;
+	LogAddress firstAddr;
+	for (int block = 0; block < 31; ++block)
+	{
+		memset(buffer, 'a' + block, blockSize);
+		assert(0 == dedupLog->Log_Write(2, block, buffer, &addr, WriteStream::ColdData));
+		assert(5 == addr.logSegment);
+		if (block == 0)
+		{
+			firstAddr = addr;
+		}
+	}
+
+	// identical file data written by another file is stored once
+	memset(buffer, 'a', blockSize);
+	assert(0 == dedupLog->Log_Write(3, 0, buffer, &addr, WriteStream::HotData));
+	assert(firstAddr.logSegment == addr.logSegment && firstAddr.blockNumber == addr.blockNumber);
+	assert(1 == dedupLog->GetBlockOwners(addr).size());
+	assert(3 == dedupLog->GetBlockOwners(addr)[0].inum);
+
+	// metadata is not deduplicated
+	LogAddress metadataAddr;
+	assert(0 == dedupLog->Log_Write(4, 0, buffer, &metadataAddr, WriteStream::Metadata));
+	assert(5 != metadataAddr.logSegment);
+
+	// the shared block counts once per reference. write the metadata tail to store the table
+	for (int block = 1; block < 31; ++block)
+	{
+		memset(buffer, 'A' + block, blockSize);
+		assert(0 == dedupLog->Log_Write(4, block, buffer, &metadataAddr, WriteStream::Metadata));
+	}
+
+	SegmentUsageTableEntry * table = dedupLog->ReadSegmentUsageTable();
+	assert(table[5].liveBytesInSegment == 32 * blockSize);
+	free(table);
+
+	// the block stays live until both references are freed
+	assert(0 == dedupLog->Log_Free(firstAddr));
+	assert(0 == dedupLog->Log_Read(firstAddr, readBuffer));
+	memset(buffer, 'a', blockSize);
+	assert(0 == memcmp(buffer, readBuffer, blockSize));
+	assert(0 == dedupLog->Log_Free(firstAddr));
+
+	// a dead block is no longer a dedup target
+	assert(0 == dedupLog->Log_Write(5, 0, buffer, &addr, WriteStream::ColdData));
+	assert(firstAddr.logSegment != addr.logSegment || firstAddr.blockNumber != addr.blockNumber);
+
+	free(buffer);
+	free(readBuffer);
+	delete dedupLog;
+	DeleteTestFlash(flashFile);
+}
+
+void TestDedupMoveReferences()
+{
+	std::cout << "\nTestDedupMoveReferences\n" << std::endl;
+	Mklfs(flashFile, "-d 1");
+	Log * dedupLog = new Log(flashFile, segmentCacheSize, checkpointInterval);
+	dedupLog->Init();
+
+	unsigned int blockSize = 512 * 2;
+	void * buffer          = malloc(blockSize);
+	memset(buffer, 'm', blockSize);
+
+	LogAddress from;
+	LogAddress shared;
+	assert(0 == dedupLog->Log_Write(2, 0, buffer, &from, WriteStream::ColdData));
+	assert(0 == dedupLog->Log_Write(3, 1, buffer, &shared, WriteStream::ColdData));
+	assert(from.logSegment == shared.logSegment && from.blockNumber == shared.blockNumber);
+
+	// the cleaner copies the block once and moves both references to the copy
+	LogAddress to;
+	assert(0 == dedupLog->Log_Write(2, 0, buffer, &to, WriteStream::CleanerOutput));
+	assert(to.logSegment != from.logSegment);
+
+	std::vector<BlockOwner> owners = { { .inum = 2, .fileBlock = 0 }, { .inum = 3, .fileBlock = 1 } };
+	assert(0 == dedupLog->MoveBlockReferences(from, to, owners));
+	assert(0 == dedupLog->GetBlockOwners(from).size());
+	assert(2 == dedupLog->GetBlockOwners(to).size());
+
+	// new copies of the data now share the moved block
+	LogAddress addr;
+	assert(0 == dedupLog->Log_Write(4, 0, buffer, &addr, WriteStream::HotData));
+	assert(to.logSegment == addr.logSegment && to.blockNumber == addr.blockNumber);
+
+	free(buffer);
+	delete dedupLog;
+	DeleteTestFlash(flashFile);
+}
+
+void TestPartialTailsSurviveRemount()
+{
+	std::cout << "\nTestPartialTailsSurviveRemount\n" << std::endl;
+	Mklfs(flashFile);
+	Log * firstLog = new Log(flashFile, segmentCacheSize, checkpointInterval);
+	firstLog->Init();
+
+	unsigned int blockSize = 512 * 2;
+	void * buffer          = malloc(blockSize);
+	LogAddress hotAddr, metadataAddr;
+
+	char hot[] = "Test hot tail survives remount\n";
+	memset(buffer, 0, blockSize);
+	memcpy(buffer, hot, sizeof(hot));
+	assert(0 == firstLog->Log_Write(2, 0, buffer, &hotAddr, WriteStream::HotData));
+
+	char metadata[] = "Test metadata tail survives remount\n";
+	memset(buffer, 0, blockSize);
+	memcpy(buffer, metadata, sizeof(metadata));
+	assert(0 == firstLog->Log_Write(2, 1, buffer, &metadataAddr, WriteStream::Metadata));
+	assert(2 * blockSize == firstLog->GetDataAtRisk());
+
+	// the checkpoint on shutdown writes both partly filled tails
+	delete firstLog;
+
+	// the checkpoint refers to the partly filled tails, so they are not reopened
+	Log * secondLog = new Log(flashFile, segmentCacheSize, checkpointInterval);
+	secondLog->Init();
+	assert(0 == secondLog->GetDataAtRisk());
+	assert(hotAddr.logSegment != secondLog->getTailSegmentNumber());
+	assert(!secondLog->IsTailSegment(hotAddr.logSegment));
+
+	memset(buffer, 0, blockSize);
+	assert(0 == secondLog->Log_Read(hotAddr, buffer));
+	assert(0 == strcmp(hot, (char *)buffer));
+	memset(buffer, 0, blockSize);
+	assert(0 == secondLog->Log_Read(metadataAddr, buffer));
+	assert(0 == strcmp(metadata, (char *)buffer));
+
+	LogAddress addr;
+	unsigned int hotWear = secondLog->GetSegmentWear(hotAddr.logSegment);
+	for (unsigned int block = 1; block < 32; ++block)
+	{
+		assert(0 == secondLog->Log_Write(3, block, buffer, &addr, WriteStream::HotData));
+		assert(hotAddr.logSegment != addr.logSegment);
+	}
+
+	assert(hotWear == secondLog->GetSegmentWear(hotAddr.logSegment));
+	memset(buffer, 0, blockSize);
+	assert(0 == secondLog->Log_Read(hotAddr, buffer));
+	assert(0 == strcmp(hot, (char *)buffer));
+
+	free(buffer);
+	delete secondLog;
+	DeleteTestFlash(flashFile);
+}
+
+void TestCrashAfterSecondPartialTail()
+{
+	std::cout << "\nTestCrashAfterSecondPartialTail\n" << std::endl;
+	Mklfs(flashFile);
+	ILog * firstLog = new Log(flashFile, segmentCacheSize, checkpointInterval);
+	firstLog->Init();
+
+	unsigned int blockSize = 512 * 2;
+	void * buffer          = malloc(blockSize);
+	LogAddress firstAddr, secondAddr, lostAddr;
+
+	char first[] = "Test block written before the first checkpoint\n";
+	memset(buffer, 0, blockSize);
+	memcpy(buffer, first, sizeof(first));
+	assert(0 == firstLog->Log_Write(2, 0, buffer, &firstAddr));
+	assert(0 == firstLog->CheckpointNow());
+	unsigned int firstWear = firstLog->GetSegmentWear(firstAddr.logSegment);
+
+	// the second checkpoint adds to the same partly written tail without erasing it
+	char second[] = "Test block written before the second checkpoint\n";
+	memset(buffer, 0, blockSize);
+	memcpy(buffer, second, sizeof(second));
+	assert(0 == firstLog->Log_Write(2, 1, buffer, &secondAddr));
+	assert(secondAddr.logSegment == firstAddr.logSegment);
+	assert(0 == firstLog->CheckpointNow());
+	assert(firstWear == firstLog->GetSegmentWear(firstAddr.logSegment));
+	assert(firstLog->IsTailSegment(firstAddr.logSegment));
+
+	char lost[] = "Test block written after the last checkpoint\n";
+	memset(buffer, 0, blockSize);
+	memcpy(buffer, lost, sizeof(lost));
+	assert(0 == firstLog->Log_Write(2, 2, buffer, &lostAddr));
+
+	// copy the flash as a crash would leave it, before the log checkpoints on shutdown
+	char crashFile[] = "crash_flash_file";
+	CopyTestFlash(flashFile, crashFile);
+	delete firstLog;
+
+	ILog * crashLog = new Log(crashFile, segmentCacheSize, checkpointInterval);
+	assert(0 == crashLog->Init());
+	memset(buffer, 0, blockSize);
+	assert(0 == crashLog->Log_Read(firstAddr, buffer));
+	assert(0 == strcmp(first, (char *)buffer));
+	memset(buffer, 0, blockSize);
+	assert(0 == crashLog->Log_Read(secondAddr, buffer));
+	assert(0 == strcmp(second, (char *)buffer));
+	assert(!crashLog->IsTailSegment(secondAddr.logSegment));
+	assert(firstWear == crashLog->GetSegmentWear(firstAddr.logSegment));
+
+	free(buffer);
+	delete crashLog;
+
+	// recovery wrote the tail's summary block, so the next mount reads it as it is
+	crashLog = new Log(crashFile, segmentCacheSize, checkpointInterval);
+	assert(0 == crashLog->Init());
+	buffer = malloc(blockSize);
+	memset(buffer, 0, blockSize);
+	assert(0 == crashLog->Log_Read(secondAddr, buffer));
+	assert(0 == strcmp(second, (char *)buffer));
+
+	free(buffer);
+	delete crashLog;
+	DeleteTestFlash(crashFile);
+	DeleteTestFlash(flashFile);
+}
+
+void TestIdleCheckpointsShareTail()
+{
+	std::cout << "\nTestIdleCheckpointsShareTail\n" << std::endl;
+	Mklfs(flashFile);
+	ILog * idleLog = new Log(flashFile, segmentCacheSize, checkpointInterval);
+	idleLog->Init();
+
+	unsigned int blockSize = 512 * 2;
+	void * buffer          = malloc(blockSize);
+	LogAddress addrs[40];
+
+	// each checkpoint writes one block and a copy of the summary, so a segment holds 15 of them
+	// before its tail is closed. no segment is erased on the way
+	std::set<unsigned int> segments;
+	for (unsigned int block = 0; block < 40; ++block)
+	{
+		memset(buffer, block + 1, blockSize);
+		assert(0 == idleLog->Log_Write(2, block, buffer, &addrs[block]));
+		assert(0 == idleLog->CheckpointNow());
+		segments.insert(addrs[block].logSegment);
+	}
+
+	assert(3 == segments.size());
+	assert(addrs[14].logSegment == addrs[0].logSegment);
+	for (unsigned int segment : segments)
+	{
+		assert(0 == idleLog->GetSegmentWear(segment));
+	}
+
+	delete idleLog;
+
+	idleLog = new Log(flashFile, segmentCacheSize, checkpointInterval);
+	assert(0 == idleLog->Init());
+	for (unsigned int block = 0; block < 40; ++block)
+	{
+		memset(buffer, 0, blockSize);
+		assert(0 == idleLog->Log_Read(addrs[block], buffer));
+		assert(block + 1 == ((unsigned char *)buffer)[0] && block + 1 == ((unsigned char *)buffer)[blockSize - 1]);
+	}
+
+	free(buffer);
+	delete idleLog;
+	DeleteTestFlash(flashFile);
+}
+
+void TestTimedCheckpoint()
+{
+	std::cout << "\nTestTimedCheckpoint\n" << std::endl;
+	Mklfs(flashFile);
+	unsigned int checkpointAge = 1;
+	Log * timedLog = new Log(flashFile, segmentCacheSize, checkpointInterval, 4, checkpointAge);
+	timedLog->Init();
+	unsigned long long sequenceNumber = timedLog->getCheckpointSequenceNumber();
+
+	unsigned int blockSize = 512 * 2;
+	void * buffer          = malloc(blockSize);
+	memset(buffer, 't', blockSize);
+	LogAddress addr;
+	assert(0 == timedLog->Log_Write(2, 0, buffer, &addr));
+	assert(blockSize == timedLog->GetDataAtRisk());
+
+	// the timer checkpoints once the log has been idle, without another write
+	std::this_thread::sleep_for(std::chrono::seconds(3));
+	assert(0 == timedLog->GetDataAtRisk());
+	assert(sequenceNumber < timedLog->getCheckpointSequenceNumber());
+
+	free(buffer);
+	delete timedLog;
+	DeleteTestFlash(flashFile);
+}
+
+void TestValidityBitmaps()
+{
+	std::cout << "\nTestValidityBitmaps\n" << std::endl;
+	Mklfs(flashFile);
+	Log * bitmapLog = new Log(flashFile, segmentCacheSize, checkpointInterval);
+	bitmapLog->Init();
+
+	// mklfs marks the ifile and root directory blocks live
+	assert(3 == bitmapLog->CountLiveBlocks(3));
+	assert(0 == bitmapLog->CountLiveBlocks(4));
+
+	unsigned int blockSize = 512 * 2;
+	void * buffer          = malloc(blockSize);
+	memset(buffer, 0, blockSize);
+
+	// fill segment 4 so it and its bitmap are written to flash
+	LogAddress addrs[32];
+	for (int block = 1; block < 32; ++block)
+	{
+		assert(0 == bitmapLog->Log_Write(2, block, buffer, &addrs[block]));
+		assert(4 == addrs[block].logSegment);
+		assert(bitmapLog->IsBlockLive(addrs[block]));
+	}
+
+	assert(31 == bitmapLog->CountLiveBlocks(4));
+	for (int block = 2; block < 32; block += 2)
+	{
+		assert(0 == bitmapLog->Log_Free(addrs[block]));
+		assert(!bitmapLog->IsBlockLive(addrs[block]));
+		assert(bitmapLog->IsBlockLive(addrs[block + 1]));
+	}
+
+	assert(16 == bitmapLog->CountLiveBlocks(4));
+
+	// the bitmaps are stored with the segment usage table, which is written with the next segment
+	for (int block = 1; block < 32; ++block)
+	{
+		LogAddress addr;
+		assert(0 == bitmapLog->Log_Write(3, block, buffer, &addr));
+	}
+
+	delete bitmapLog;
+
+	bitmapLog = new Log(flashFile, segmentCacheSize, checkpointInterval);
+	bitmapLog->Init();
+	assert(16 == bitmapLog->CountLiveBlocks(4));
+	assert(31 == bitmapLog->CountLiveBlocks(5));
+	assert(!bitmapLog->IsBlockLive(addrs[2]));
+	assert(bitmapLog->IsBlockLive(addrs[3]));
+
+	// a released segment has no live blocks
+	assert(0 == bitmapLog->ReleaseSegment(4));
+	assert(0 == bitmapLog->CountLiveBlocks(4));
+
+	free(buffer);
+	delete bitmapLog;
+	DeleteTestFlash(flashFile);
+}
+
+void FillLiveBlock(void * buffer, unsigned int blockSize, unsigned int block)
+{
+	unsigned char * bytes = (unsigned char *)buffer;
+	unsigned int seed     = block;
+	memset(buffer, 0, blockSize);
+	for (unsigned int i = 0; i < blockSize / 2; ++i)
+	{
+		seed     = seed * 1103515245 + 12345;
+		bytes[i] = (unsigned char)(seed >> 16);
+	}
+}
+
+void TestReadLiveBlocks(const char * options)
+{
+	std::cout << "\nTestReadLiveBlocks " << options << "\n" << std::endl;
+	Mklfs(flashFile, options);
+	Log * liveLog = new Log(flashFile, segmentCacheSize, checkpointInterval);
+	liveLog->Init();
+
+	unsigned int blockSize = 512 * 2;
+	void * buffer          = malloc(blockSize);
+	void * expected        = malloc(blockSize);
+
+	// fill segment 4. half of each block is noise so compressed blocks still span sectors
+	std::vector<LogAddress> addrs;
+	LogAddress addr        = { .logSegment = 4, .blockNumber = 0 };
+	for (unsigned int block = 1; addr.logSegment == 4; ++block)
+	{
+		FillLiveBlock(buffer, blockSize, block);
+		assert(0 == liveLog->Log_Write(2, block, buffer, &addr));
+		if (addr.logSegment == 4)
+		{
+			addrs.push_back(addr);
+		}
+	}
+
+	// keep every fifth block
+	for (unsigned int i = 0; i < addrs.size(); ++i)
+	{
+		if (i % 5 != 0)
+		{
+			assert(0 == liveLog->Log_Free(addrs[i]));
+		}
+	}
+
+	InMemorySegment * segment = liveLog->ReadLiveBlocks(4);
+	assert(segment != NULL);
+	for (unsigned int i = 0; i < addrs.size(); ++i)
+	{
+		if (i % 5 == 0)
+		{
+			FillLiveBlock(expected, blockSize, i + 1);
+			memset(buffer, 0, blockSize);
+			assert(0 == liveLog->ReadSegmentBlock(segment, addrs[i].blockNumber, buffer));
+			assert(0 == memcmp(expected, buffer, blockSize));
+		}
+	}
+
+	// blocks in dead sectors stay zeroed and fail their checksums
+	memset(buffer, 0, blockSize);
+	assert(0 != liveLog->ReadSegmentBlock(segment, addrs[2].blockNumber, buffer));
+
+	liveLog->FreeSegment(segment);
+	free(expected);
+	free(buffer);
+	delete liveLog;
+	DeleteTestFlash(flashFile);
+}
+
+unsigned long long SumWriteCauses(LogStats& stats)
+{
+	unsigned long long total = 0;
+	for (int cause = 0; cause < NUM_WRITE_CAUSES; ++cause)
+	{
+		total += stats.bytesWrittenByCause[cause];
+	}
+
+	return total;
+}
+
+void TestWriteCauses()
+{
+	std::cout << "\nTestWriteCauses\n" << std::endl;
+	Mklfs(flashFile);
+	Log * causeLog = new Log(flashFile, segmentCacheSize, checkpointInterval);
+	causeLog->Init();
+
+	unsigned int blockSize = 512 * 2;
+	void * buffer          = malloc(blockSize);
+	memset(buffer, 0, blockSize);
+
+	// fill segment 4 with file data and a metadata tail with indirect blocks
+	LogAddress addr;
+	for (int block = 1; block < 32; ++block)
+	{
+		assert(0 == causeLog->Log_Write(2, block, buffer, &addr));
+	}
+
+	for (int block = 1; block < 32; ++block)
+	{
+		assert(0 == causeLog->Log_Write(3, block, buffer, &addr, WriteStream::Metadata, WriteCause::IndirectBlock));
+	}
+
+	LogStats stats;
+	causeLog->GetStats(&stats);
+	assert(31 * blockSize == stats.bytesWrittenByCause[WriteCause::UserData]);
+	assert(31 * blockSize == stats.bytesWrittenByCause[WriteCause::IndirectBlock]);
+	assert(stats.bytesWrittenByCause[WriteCause::SegmentOverhead] >= 2 * blockSize);
+	assert(SumWriteCauses(stats) == stats.flashSectorsWritten * FLASH_SECTOR_SIZE);
+
+	// a checkpoint closes the partly filled tail early and charges its unused space to itself
+	assert(0 == causeLog->Log_Write(2, 40, buffer, &addr, WriteStream::HotData, WriteCause::ReadModifyWrite));
+	unsigned long long checkpoints     = stats.checkpoints;
+	unsigned long long checkpointBytes = stats.bytesWrittenByCause[WriteCause::Checkpointing];
+	for (int block = 0; stats.checkpoints == checkpoints; ++block)
+	{
+		assert(0 == causeLog->Log_Write(4, block, buffer, &addr, WriteStream::Metadata, WriteCause::DirectoryData));
+		causeLog->GetStats(&stats);
+	}
+
+	assert(blockSize == stats.bytesWrittenByCause[WriteCause::ReadModifyWrite]);
+	assert(stats.bytesWrittenByCause[WriteCause::Checkpointing] > checkpointBytes);
+	assert(stats.bytesWrittenByCause[WriteCause::SegmentUsageTable] > 0);
+	assert(SumWriteCauses(stats) == stats.flashSectorsWritten * FLASH_SECTOR_SIZE);
+
+	free(buffer);
+	delete causeLog;
+	DeleteTestFlash(flashFile);
+}
+
 void RunWriteTests()
 {
 	Setup();
@@ -345,10 +1081,32 @@ void RunReadTests()
 	Teardown();
 }
 
+void RunWriteStreamTests()
+{
+	Setup();
+	TestWriteStreams();
+	TestWriteStreamFill();
+	Teardown();
+}
+
 void RunTests()
 {
 	RunWriteTests();
 	RunReadTests();
+	RunWriteStreamTests();
+	TestErasePoolReusesReleasedSegment();
+	TestWearAwareAllocation();
+	TestCompressedWrites();
+	TestDedupWrites();
+	TestDedupMoveReferences();
+	TestPartialTailsSurviveRemount();
+	TestCrashAfterSecondPartialTail();
+	TestIdleCheckpointsShareTail();
+	TestTimedCheckpoint();
+	TestValidityBitmaps();
+	TestReadLiveBlocks("");
+	TestReadLiveBlocks("-c 1");
+	TestWriteCauses();
 }
 
 int main(int argc, char **argv)
@@ -0,0 +1,114 @@
+#include <assert.h>
+#include <string>
+#include <iostream>
+#include <cstring>
+#include <stdlib.h>
+#include "../lz.hpp"
+
+void AssertRoundTrip(const unsigned char * input, unsigned int inputSize)
+{
+	unsigned int capacity = inputSize + inputSize / 255 + 16;
+	unsigned char * compressed   = (unsigned char *)malloc(capacity);
+	unsigned char * decompressed = (unsigned char *)malloc(inputSize + 1);
+
+	unsigned int compressedSize = LzCompress(input, inputSize, compressed, capacity);
+	assert(compressedSize != 0);
+	assert(LzDecompress(compressed, compressedSize, decompressed, inputSize) == inputSize);
+	assert(memcmp(input, decompressed, inputSize) == 0);
+
+	free(compressed);
+	free(decompressed);
+}
+
+void TestRoundTripZeros()
+{
+	std::cout << "\nTestRoundTripZeros\n" << std::endl;
+	unsigned char block[1024];
+	memset(block, 0, sizeof(block));
+	AssertRoundTrip(block, sizeof(block));
+
+	// one long match needs extra length bytes
+	unsigned char compressed[64];
+	assert(LzCompress(block, sizeof(block), compressed, sizeof(compressed)) < 16);
+}
+
+void TestRoundTripText()
+{
+	std::cout << "\nTestRoundTripText\n" << std::endl;
+	char block[1024];
+	for (unsigned int i = 0; i < sizeof(block); i += 16)
+	{
+		snprintf(block + i, 17, "line %10u\n", i / 16);
+	}
+
+	AssertRoundTrip((unsigned char *)block, sizeof(block));
+
+	unsigned char compressed[1024];
+	unsigned int compressedSize = LzCompress(block, sizeof(block), compressed, sizeof(compressed));
+	assert(compressedSize != 0 && compressedSize < sizeof(block) / 2);
+}
+
+void TestRoundTripRandom()
+{
+	std::cout << "\nTestRoundTripRandom\n" << std::endl;
+	srand(7);
+	unsigned char block[1024];
+	for (unsigned int i = 0; i < sizeof(block); ++i)
+	{
+		block[i] = rand() & 0xFF;
+	}
+
+	// one long literal run needs extra length bytes
+	AssertRoundTrip(block, sizeof(block));
+
+	// random data does not fit in less than its own size
+	unsigned char compressed[1024];
+	assert(LzCompress(block, sizeof(block), compressed, sizeof(compressed) - 1) == 0);
+}
+
+void TestRoundTripShortInputs()
+{
+	std::cout << "\nTestRoundTripShortInputs\n" << std::endl;
+	const unsigned char input[] = "abcabcabcabc";
+	for (unsigned int size = 0; size < sizeof(input); ++size)
+	{
+		AssertRoundTrip(input, size);
+	}
+}
+
+void TestRejectsMalformedInput()
+{
+	std::cout << "\nTestRejectsMalformedInput\n" << std::endl;
+	unsigned char output[64];
+
+	// match offset before the start of the output
+	const unsigned char badOffset[] = { 0x10, 'a', 0x05, 0x00 };
+	assert(LzDecompress(badOffset, sizeof(badOffset), output, sizeof(output)) == 0);
+
+	// literal run longer than the input
+	const unsigned char truncated[] = { 0x50, 'a', 'b' };
+	assert(LzDecompress(truncated, sizeof(truncated), output, sizeof(output)) == 0);
+
+	// output larger than the buffer
+	unsigned char block[128];
+	memset(block, 'x', sizeof(block));
+	unsigned char compressed[64];
+	unsigned int compressedSize = LzCompress(block, sizeof(block), compressed, sizeof(compressed));
+	assert(compressedSize != 0);
+	assert(LzDecompress(compressed, compressedSize, output, sizeof(output)) == 0);
+}
+
+void RunTests()
+{
+	TestRoundTripZeros();
+	TestRoundTripText();
+	TestRoundTripRandom();
+	TestRoundTripShortInputs();
+	TestRejectsMalformedInput();
+}
+
+int main(int argc, char **argv)
+{
+	RunTests();
+	return 0;
+}
@@ -1,5 +1,7 @@
 #include <iostream>
 #include <assert.h>
+#include <thread>
+#include <vector>
 #include "../data_structures/flash_data.hpp"
 #include "../data_structures/segment.hpp"
 #include "../data_structures/segment_factory.hpp"
@@ -118,9 +120,93 @@ void TestSegmentCache()
 	assert(cache.containsEntry(7) == false);
 }
 
+void TestResize()
+{
+	SegmentCache resized(&segmentFactory, 3);
+	resized.putEntry(segmentFactory.Build(3));
+	resized.putEntry(segmentFactory.Build(4));
+	resized.putEntry(segmentFactory.Build(5));
+	resized.getEntry(3);
+
+	// shrinking keeps the most recently used segments
+	resized.resize(1);
+	assert(resized.containsEntry(3) == true);
+	assert(resized.containsEntry(4) == false);
+	assert(resized.containsEntry(5) == false);
+
+	resized.resize(2);
+	resized.putEntry(segmentFactory.Build(6));
+	assert(resized.containsEntry(3) == true);
+	assert(resized.containsEntry(6) == true);
+
+	resized.putEntry(segmentFactory.Build(7));
+	assert(resized.containsEntry(3) == false);
+	assert(resized.containsEntry(6) == true);
+	assert(resized.containsEntry(7) == true);
+}
+
+void TestPutEntryIfAbsent()
+{
+	SegmentCache absent(&segmentFactory, 2);
+	assert(absent.putEntryIfAbsent(segmentFactory.Build(3)) == true);
+
+	// the caller keeps a segment that was not added
+	InMemorySegment * duplicate = segmentFactory.Build(3);
+	assert(absent.putEntryIfAbsent(duplicate) == false);
+	segmentFactory.Destroy(duplicate);
+
+	assert(absent.readEntry(3, [](InMemorySegment * segment) { assert(segment->summary.segmentNumber == 3); }) == true);
+	assert(absent.readEntry(4, [](InMemorySegment * segment) { assert(false); }) == false);
+}
+
+// readers copy out of entries while a writer keeps adding segments that evict them
+void TestConcurrentReaders()
+{
+	SegmentCache shared(&segmentFactory, 2);
+	unsigned int segments = 2000;
+	std::thread writer([&shared, segments]()
+	{
+		for (unsigned int segment = 0; segment < segments; ++segment)
+		{
+			InMemorySegment * toAdd = segmentFactory.Build(segment % 50);
+			if (!shared.putEntryIfAbsent(toAdd))
+			{
+				segmentFactory.Destroy(toAdd);
+			}
+		}
+	});
+
+	std::vector<std::thread> readers;
+	for (unsigned int r = 0; r < 4; ++r)
+	{
+		readers.push_back(std::thread([&shared, segments]()
+		{
+			for (unsigned int i = 0; i < segments; ++i)
+			{
+				unsigned int segmentNumber = i % 50;
+				shared.readEntry(segmentNumber, [segmentNumber](InMemorySegment * segment)
+				{
+					assert(segment->summary.segmentNumber == segmentNumber);
+				});
+			}
+		}));
+	}
+
+	writer.join();
+	for (std::thread& reader : readers)
+	{
+		reader.join();
+	}
+
+	assert(shared.containsEntry((segments - 1) % 50) == true);
+}
+
 void RunTests()
 {
 	TestSegmentCache();
+	TestResize();
+	TestPutEntryIfAbsent();
+	TestConcurrentReaders();
 }
 
 int main(int argc, char **argv)
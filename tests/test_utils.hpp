@@ -8,10 +8,30 @@ void Mklfs(char flashFile[])
 	system(command);
 }
 
+void Mklfs(char flashFile[], const char * options)
+{
+	char command[80];
+	strcpy(command, "./mklfs ");
+	strcat(command, options);
+	strcat(command, " ");
+	strcat(command, flashFile);
+	system(command);
+}
+
 void DeleteTestFlash(char flashFile[])
 {
 	char command[80];
 	strcpy(command, "rm ");
 	strcat(command, flashFile);
 	system(command);
+}
+
+void CopyTestFlash(char flashFile[], char copyFile[])
+{
+	char command[80];
+	strcpy(command, "cp ");
+	strcat(command, flashFile);
+	strcat(command, " ");
+	strcat(command, copyFile);
+	system(command);
 }
\ No newline at end of file
@@ -0,0 +1,161 @@
+#include <assert.h>
+#include <string>
+#include <iostream>
+#include <cstring>
+#include <thread>
+#include "../trace.hpp"
+
+char traceFile[] = "trace_test.trace";
+
+// records of the thread that traced them. each test traces on new threads so the rings start empty
+std::vector<TraceRecord> GetThreadRecords(const std::vector<TraceRecord>& records, uint32_t thread)
+{
+	std::vector<TraceRecord> threadRecords;
+	for (const TraceRecord& record : records)
+	{
+		if (record.thread == thread)
+		{
+			threadRecords.push_back(record);
+		}
+	}
+
+	return threadRecords;
+}
+
+void TestRecordArgs()
+{
+	std::cout << "\nTestRecordArgs\n" << std::endl;
+	uint32_t thread = 0;
+	std::thread tracer([&thread]()
+	{
+		thread = GetTraceRing()->thread;
+		TRACE_INFO(LogWrite, 2, 7, 1, 12, 30);
+		TRACE_INFO(FileTruncate, 5, -1);
+	});
+	tracer.join();
+
+	std::vector<TraceRecord> records = GetThreadRecords(TraceSnapshot(), thread);
+	assert(2 == records.size());
+	assert((uint16_t)TraceEvent::LogWrite == records[0].event);
+	assert(TRACE_LEVEL_INFO == records[0].level);
+	assert(2 == records[0].args[0] && 7 == records[0].args[1] && 1 == records[0].args[2]);
+	assert(12 == records[0].args[3] && 30 == records[0].args[4]);
+	assert(-1 == records[1].args[1]);
+	assert(records[0].timestamp <= records[1].timestamp);
+
+	char args[256];
+	TraceFormatArgs(records[0], args, sizeof(args));
+	assert(0 == strcmp(args, "inum: 2 block: 7 stream: 1 -> segment: 12 block: 30"));
+	assert(0 == strcmp(GetTraceEventName(records[1].event), "FileTruncate"));
+}
+
+void TestDisabledLevel()
+{
+	std::cout << "\nTestDisabledLevel\n" << std::endl;
+	uint32_t thread = 0;
+	std::thread tracer([&thread]()
+	{
+		thread = GetTraceRing()->thread;
+		TRACE_DEBUG(LogRead, 3, 4);
+	});
+	tracer.join();
+
+	// DEBUG events are compiled out at the default level
+	std::vector<TraceRecord> records = GetThreadRecords(TraceSnapshot(), thread);
+	assert((LFS_TRACE_LEVEL >= TRACE_LEVEL_DEBUG ? 1 : 0) == records.size());
+}
+
+void TestRingWraps()
+{
+	std::cout << "\nTestRingWraps\n" << std::endl;
+	uint32_t thread = 0;
+	unsigned int events = TRACE_RING_SIZE * 2 + 5;
+	std::thread tracer([&thread, events]()
+	{
+		thread = GetTraceRing()->thread;
+		for (unsigned int i = 0; i < events; ++i)
+		{
+			TRACE_INFO(LogEraseSegment, i);
+		}
+	});
+	tracer.join();
+
+	// only the newest records are kept, oldest first. the slot the next record goes into is not read
+	std::vector<TraceRecord> records = GetThreadRecords(TraceSnapshot(), thread);
+	assert(TRACE_RING_SIZE - 1 == records.size());
+	for (unsigned int i = 0; i < records.size(); ++i)
+	{
+		assert(events - (TRACE_RING_SIZE - 1) + i == records[i].args[0]);
+	}
+}
+
+void TestDumpAndLoad()
+{
+	std::cout << "\nTestDumpAndLoad\n" << std::endl;
+	unsigned int numThreads = 4;
+	unsigned int events     = 1000;
+	std::vector<std::thread> tracers;
+	std::vector<uint32_t> threads(numThreads);
+	for (unsigned int t = 0; t < numThreads; ++t)
+	{
+		tracers.push_back(std::thread([&threads, t, events]()
+		{
+			threads[t] = GetTraceRing()->thread;
+			for (unsigned int i = 0; i < events; ++i)
+			{
+				TRACE_INFO(FileWrite, t, i, 1024);
+			}
+		}));
+	}
+
+	for (std::thread& tracer : tracers)
+	{
+		tracer.join();
+	}
+
+	assert(0 == TraceDump(traceFile));
+	std::vector<TraceRecord> records;
+	assert(0 == TraceLoad(traceFile, records));
+	assert(records.size() == TraceSnapshot().size());
+
+	for (unsigned int t = 0; t < numThreads; ++t)
+	{
+		std::vector<TraceRecord> threadRecords = GetThreadRecords(records, threads[t]);
+		assert(events == threadRecords.size());
+		for (unsigned int i = 0; i < events; ++i)
+		{
+			assert(t == threadRecords[i].args[0]);
+			assert(i == threadRecords[i].args[1]);
+		}
+	}
+
+	remove(traceFile);
+}
+
+void TestLoadRejectsBadFile()
+{
+	std::cout << "\nTestLoadRejectsBadFile\n" << std::endl;
+	FILE * file = fopen(traceFile, "wb");
+	fputs("not a trace", file);
+	fclose(file);
+
+	std::vector<TraceRecord> records;
+	assert(0 != TraceLoad(traceFile, records));
+	remove(traceFile);
+	assert(0 != TraceLoad(traceFile, records));
+}
+
+void RunTests()
+{
+	TestRecordArgs();
+	TestDisabledLevel();
+	TestRingWraps();
+	TestDumpAndLoad();
+	TestLoadRejectsBadFile();
+}
+
+int main(int argc, char **argv)
+{
+	RunTests();
+	return 0;
+}
@@ -0,0 +1,309 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+// Binary event tracing used in place of iostream logging on the hot paths.
+//
+// Each thread appends fixed size records to its own ring buffer, so tracing takes no locks and never
+// touches stdout. A record is a timestamp, the thread, the event and up to TRACE_MAX_ARGS integer
+// arguments. The newest TRACE_RING_SIZE records of every thread are kept and TraceDump writes them to
+// a file which lfstrace decodes. Events above LFS_TRACE_LEVEL compile to nothing.
+
+#define TRACE_LEVEL_NONE  0
+#define TRACE_LEVEL_INFO  1
+#define TRACE_LEVEL_DEBUG 2
+
+#ifndef LFS_TRACE_LEVEL
+#define LFS_TRACE_LEVEL TRACE_LEVEL_INFO
+#endif
+
+#define TRACE_RING_SIZE 8192 // records per thread. must be a power of two
+#define TRACE_MAX_ARGS  5
+#define TRACE_MAGIC     "LFSTRACE"
+#define TRACE_VERSION   1
+
+// name and argument format of every event. the formats are used by the decoder
+#define TRACE_EVENTS(EVENT) \
+	EVENT(LogRead,                "segment: %lld block: %lld") \
+	EVENT(LogWrite,               "inum: %lld block: %lld stream: %lld -> segment: %lld block: %lld") \
+	EVENT(LogDedup,               "inum: %lld block: %lld -> segment: %lld block: %lld") \
+	EVENT(LogRewrite,             "segment: %lld block: %lld") \
+	EVENT(LogOpenTail,            "segment: %lld stream: %lld") \
+	EVENT(LogCacheTail,           "segment: %lld") \
+	EVENT(LogWritePartialTail,    "stream: %lld") \
+	EVENT(LogCloseRecoveredTail,  "segment: %lld stream: %lld") \
+	EVENT(LogReadSegment,         "segment: %lld") \
+	EVENT(LogReadLiveBlocks,      "segment: %lld reads: %lld sectors: %lld") \
+	EVENT(LogWriteSegment,        "segment: %lld") \
+	EVENT(LogEraseSegment,        "segment: %lld") \
+	EVENT(LogWaitForCleanSegment, "") \
+	EVENT(LogWearLimit,           "segment: %lld") \
+	EVENT(LogCheckpoint,          "data at risk: %lld bytes") \
+	EVENT(LogWriteCheckpoint,     "sector: %lld sequence number: %lld") \
+	EVENT(LogEraseCheckpoints,    "erase block: %lld") \
+	EVENT(SegmentBuild,           "segment: %lld") \
+	EVENT(SegmentCacheGet,        "segment: %lld") \
+	EVENT(SegmentCachePut,        "segment: %lld") \
+	EVENT(SegmentCacheEvict,      "segment: %lld") \
+	EVENT(SegmentCacheInvalidate, "segment: %lld") \
+	EVENT(FileCreate,             "inum: %lld file type: %lld") \
+	EVENT(FileWrite,              "inum: %lld offset: %lld length: %lld") \
+	EVENT(FileWriteBlocks,        "inum: %lld blocks: %lld to %lld") \
+	EVENT(FileRead,               "inum: %lld offset: %lld length: %lld") \
+	EVENT(FileReadBlocks,         "inum: %lld blocks: %lld to %lld") \
+	EVENT(FileTruncate,           "inum: %lld size: %lld") \
+	EVENT(FileSeek,               "inum: %lld offset: %lld whence: %lld") \
+	EVENT(FileFree,               "inum: %lld") \
+	EVENT(FileWriteBackINodes,    "inodes: %lld") \
+	EVENT(FileToBlockMap,         "inum: %lld extents: %lld") \
+	EVENT(CleanerCheck,           "") \
+	EVENT(CleanerStart,           "clean segments: %lld start threshold: %lld") \
+	EVENT(CleanerCandidates,      "segments with live data to pick from: %lld") \
+	EVENT(CleanerDone,            "") \
+	EVENT(CleanerEmptySegment,    "segment: %lld") \
+	EVENT(CleanerSegment,         "segment: %lld") \
+	EVENT(CleanerLevelWear,       "segment: %lld wear: %lld max wear: %lld") \
+	EVENT(DirectoryMkdir,         "mode: %lld") \
+	EVENT(DirectoryReaddir,       "") \
+	EVENT(DirectoryCreate,        "mode: %lld") \
+	EVENT(DirectoryRead,          "offset: %lld size: %lld") \
+	EVENT(DirectoryWrite,         "offset: %lld size: %lld") \
+	EVENT(DirectoryGetAttr,       "") \
+	EVENT(DirectoryTruncate,      "size: %lld") \
+	EVENT(DirectorySeek,          "offset: %lld whence: %lld") \
+	EVENT(DirectoryChmod,         "mode: %lld") \
+	EVENT(DirectoryChown,         "uid: %lld gid: %lld") \
+	EVENT(DirectoryLink,          "") \
+	EVENT(DirectorySymlink,       "") \
+	EVENT(DirectoryReadLink,      "size: %lld") \
+	EVENT(DirectoryUnlink,        "") \
+	EVENT(DirectoryRemove,        "") \
+	EVENT(DirectoryCheckAccess,   "") \
+	EVENT(DirectoryFindINum,      "inum: %lld") \
+	EVENT(DirectoryReadList,      "inum: %lld") \
+	EVENT(DirectoryWriteList,     "inum: %lld") \
+	EVENT(DirectoryListAdd,       "inum: %lld") \
+	EVENT(DirectoryListRemove,    "")
+
+#define TRACE_EVENT_ENUM(name, format) name,
+#define TRACE_EVENT_NAME(name, format) #name,
+#define TRACE_EVENT_FORMAT(name, format) format,
+
+enum class TraceEvent : uint16_t
+{
+	TRACE_EVENTS(TRACE_EVENT_ENUM)
+	Count
+};
+
+const char * traceEventNames[]   = { TRACE_EVENTS(TRACE_EVENT_NAME) };
+const char * traceEventFormats[] = { TRACE_EVENTS(TRACE_EVENT_FORMAT) };
+
+struct TraceRecord
+{
+	uint64_t timestamp; // nanoseconds on the monotonic clock
+	uint32_t thread;
+	uint16_t event;
+	uint16_t level;
+	int64_t args[TRACE_MAX_ARGS];
+};
+
+struct TraceFileHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t recordSize;
+	uint64_t recordCount;
+};
+
+// written only by its thread. head is published with release so a dump sees whole records
+struct TraceRing
+{
+	uint32_t thread;
+	std::atomic<uint64_t> head;
+	TraceRecord records[TRACE_RING_SIZE];
+};
+
+// rings outlive their threads so a dump still has the history of threads that have exited
+struct TraceRegistry
+{
+	std::mutex mutex;
+	std::vector<TraceRing *> rings;
+};
+
+TraceRegistry& GetTraceRegistry()
+{
+	static TraceRegistry registry;
+	return registry;
+}
+
+const char * GetTraceEventName(uint16_t event)
+{
+	return event < (uint16_t)TraceEvent::Count ? traceEventNames[event] : "Unknown";
+}
+
+const char * GetTraceEventFormat(uint16_t event)
+{
+	return event < (uint16_t)TraceEvent::Count ? traceEventFormats[event] : "";
+}
+
+const char * GetTraceLevelString(uint16_t level)
+{
+	return level == TRACE_LEVEL_INFO ? "INFO" : "DEBUG";
+}
+
+uint64_t TraceTimestamp()
+{
+	struct timespec spec;
+	clock_gettime(CLOCK_MONOTONIC, &spec);
+	return (uint64_t)spec.tv_sec * 1000000000ULL + (uint64_t)spec.tv_nsec;
+}
+
+TraceRing * RegisterTraceRing()
+{
+	TraceRegistry& registry = GetTraceRegistry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	TraceRing * ring        = new TraceRing();
+	ring->thread            = registry.rings.size();
+	ring->head.store(0, std::memory_order_relaxed);
+	registry.rings.push_back(ring);
+	return ring;
+}
+
+TraceRing * GetTraceRing()
+{
+	thread_local TraceRing * ring = RegisterTraceRing();
+	return ring;
+}
+
+void TraceWrite(uint16_t level, TraceEvent event, int64_t a0 = 0, int64_t a1 = 0, int64_t a2 = 0, int64_t a3 = 0, int64_t a4 = 0)
+{
+	TraceRing * ring      = GetTraceRing();
+	uint64_t head         = ring->head.load(std::memory_order_relaxed);
+	TraceRecord& record   = ring->records[head & (TRACE_RING_SIZE - 1)];
+	record.timestamp      = TraceTimestamp();
+	record.thread         = ring->thread;
+	record.event          = (uint16_t)event;
+	record.level          = level;
+	record.args[0]        = a0;
+	record.args[1]        = a1;
+	record.args[2]        = a2;
+	record.args[3]        = a3;
+	record.args[4]        = a4;
+	ring->head.store(head + 1, std::memory_order_release);
+}
+
+#if LFS_TRACE_LEVEL >= TRACE_LEVEL_INFO
+#define TRACE_INFO(event, ...) TraceWrite(TRACE_LEVEL_INFO, TraceEvent::event, ##__VA_ARGS__)
+#else
+#define TRACE_INFO(event, ...) do { } while (0)
+#endif
+
+#if LFS_TRACE_LEVEL >= TRACE_LEVEL_DEBUG
+#define TRACE_DEBUG(event, ...) TraceWrite(TRACE_LEVEL_DEBUG, TraceEvent::event, ##__VA_ARGS__)
+#else
+#define TRACE_DEBUG(event, ...) do { } while (0)
+#endif
+
+// copies the records held in every ring. records a thread overwrote, or may have been overwriting, while they were
+// being copied are dropped
+std::vector<TraceRecord> TraceSnapshot()
+{
+	std::vector<TraceRecord> records;
+	TraceRegistry& registry = GetTraceRegistry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	for (TraceRing * ring : registry.rings)
+	{
+		uint64_t head  = ring->head.load(std::memory_order_acquire);
+		uint64_t first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+		std::vector<TraceRecord> copied;
+		for (uint64_t i = first; i < head; ++i)
+		{
+			copied.push_back(ring->records[i & (TRACE_RING_SIZE - 1)]);
+		}
+
+		// the slot of record newHead - TRACE_RING_SIZE may be half way through being overwritten by record newHead
+		uint64_t newHead = ring->head.load(std::memory_order_acquire);
+		uint64_t valid   = newHead + 1 > TRACE_RING_SIZE ? newHead + 1 - TRACE_RING_SIZE : 0;
+		for (uint64_t i = std::max(first, valid); i < head; ++i)
+		{
+			records.push_back(copied[i - first]);
+		}
+	}
+
+	return records;
+}
+
+int TraceDump(const char * path)
+{
+	std::vector<TraceRecord> records = TraceSnapshot();
+	FILE * file                      = fopen(path, "wb");
+	if (file == NULL)
+	{
+		return 1;
+	}
+
+	TraceFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	header.version     = TRACE_VERSION;
+	header.recordSize  = sizeof(TraceRecord);
+	header.recordCount = records.size();
+
+	int ret = 0;
+	if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+		(!records.empty() && fwrite(records.data(), sizeof(TraceRecord), records.size(), file) != records.size()))
+	{
+		ret = 1;
+	}
+
+	if (fclose(file) != 0)
+	{
+		ret = 1;
+	}
+
+	return ret;
+}
+
+int TraceLoad(const char * path, std::vector<TraceRecord>& records)
+{
+	FILE * file = fopen(path, "rb");
+	if (file == NULL)
+	{
+		return 1;
+	}
+
+	TraceFileHeader header;
+	if (fread(&header, sizeof(header), 1, file) != 1 ||
+		memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+		header.version != TRACE_VERSION ||
+		header.recordSize != sizeof(TraceRecord))
+	{
+		fclose(file);
+		return 1;
+	}
+
+	records.resize(header.recordCount);
+	if (header.recordCount != 0 && fread(records.data(), sizeof(TraceRecord), header.recordCount, file) != header.recordCount)
+	{
+		fclose(file);
+		return 1;
+	}
+
+	fclose(file);
+	return 0;
+}
+
+// formats the arguments of a record with its event's format
+void TraceFormatArgs(const TraceRecord& record, char * buffer, size_t size)
+{
+	snprintf(buffer, size, GetTraceEventFormat(record.event),
+	         (long long)record.args[0], (long long)record.args[1], (long long)record.args[2],
+	         (long long)record.args[3], (long long)record.args[4]);
+}
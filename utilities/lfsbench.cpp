@@ -0,0 +1,190 @@
+/*
+Runs a workload against an LFS made by mklfs and reports how many bytes were written to flash
+for every byte written by files, broken down by what caused them. The workload creates files and
+writes them in full, overwrites small ranges of them at random, then deletes and rewrites half of
+them several times so the cleaner has work to do. The flash file is modified.
+
+	USAGE: lfsbench [options] file
+
+	-f files        number of files. The default is 16
+	-s size         size of each file in KB. The default is 64
+	-o overwrites   number of small random overwrites. The default is 2000
+	-r rounds       times half of the files are deleted and rewritten. The default is 4
+	-x seed         seed of the random overwrites. The default is 1
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cstring>
+#include "../layers/directory.hpp"
+#include "../utils.hpp"
+
+int parseArgs(int argc, char **argv, unsigned int * files, unsigned int * fileSize, unsigned int * overwrites, unsigned int * rounds, unsigned int * seed);
+int writeFile(IDirectoryLayer * directoryLayer, unsigned int file, unsigned int fileSize, char * buffer, unsigned long long * userBytes);
+void printReport(LfsStats& stats, unsigned long long userBytes);
+
+int main(int argc, char **argv)
+{
+	unsigned int files      = 16;
+	unsigned int fileSize   = 64;
+	unsigned int overwrites = 2000;
+	unsigned int rounds     = 4;
+	unsigned int seed       = 1;
+
+	if (parseArgs(argc, argv, &files, &fileSize, &overwrites, &rounds, &seed) != 0)
+	{
+		return 1;
+	}
+
+	fileSize *= 1024;
+	srand(seed);
+
+	char * flashFile = argv[argc - 1];
+	IDirectoryLayer * directoryLayer = new DirectoryLayer(flashFile, 4, 4, 4, 8, 4, 0, 0);
+	if (directoryLayer->Init() != 0)
+	{
+		std::cerr << "ERROR: Unable to open flash file " << flashFile << std::endl;
+		delete directoryLayer;
+		return 1;
+	}
+
+	ResetLatencyHistograms();
+	char * buffer                = (char *)malloc(fileSize);
+	unsigned long long userBytes = 0;
+	int ret                      = 0;
+	for (unsigned int file = 0; file < files && ret == 0; ++file)
+	{
+		ret = writeFile(directoryLayer, file, fileSize, buffer, &userBytes);
+	}
+
+	for (unsigned int i = 0; i < overwrites && ret == 0; ++i)
+	{
+		unsigned int length = 1 + rand() % 512;
+		unsigned int offset = rand() % (fileSize - length);
+		std::string path    = "/bench" + std::to_string(rand() % files);
+		memset(buffer, 'o', length);
+		ret        = directoryLayer->Directory_Write(path.c_str(), offset, length, buffer);
+		userBytes += length;
+	}
+
+	for (unsigned int round = 0; round < rounds && ret == 0; ++round)
+	{
+		for (unsigned int file = round % 2; file < files && ret == 0; file += 2)
+		{
+			std::string path = "/bench" + std::to_string(file);
+			ret              = directoryLayer->Directory_Unlink(path.c_str());
+			ret             += writeFile(directoryLayer, file, fileSize, buffer, &userBytes);
+		}
+	}
+
+	free(buffer);
+	if (ret != 0)
+	{
+		std::cerr << "ERROR: The workload failed. The flash may be too small for it" << std::endl;
+		delete directoryLayer;
+		return 1;
+	}
+
+	LfsStats stats;
+	directoryLayer->Directory_GetStats(&stats);
+	printReport(stats, userBytes);
+	delete directoryLayer;
+	return 0;
+}
+
+int writeFile(IDirectoryLayer * directoryLayer, unsigned int file, unsigned int fileSize, char * buffer, unsigned long long * userBytes)
+{
+	std::string path = "/bench" + std::to_string(file);
+	memset(buffer, 'a' + file % 26, fileSize);
+	if (directoryLayer->Directory_Create(path.c_str(), 0644) != 0 ||
+		directoryLayer->Directory_Write(path.c_str(), 0, fileSize, buffer) != 0)
+	{
+		return 1;
+	}
+
+	*userBytes += fileSize;
+	return 0;
+}
+
+void printReport(LfsStats& stats, unsigned long long userBytes)
+{
+	unsigned long long flashBytes = stats.log.flashSectorsWritten * FLASH_SECTOR_SIZE;
+	std::cout << "user bytes written:  " << userBytes  << std::endl;
+	std::cout << "flash bytes written: " << flashBytes << std::endl;
+	std::cout << "write amplification: " << std::fixed << std::setprecision(2) << (double)flashBytes / userBytes << std::endl;
+	std::cout << std::endl;
+
+	std::cout << std::left << std::setw(20) << "cause" << std::right << std::setw(14) << "flash bytes"
+	          << std::setw(10) << "percent" << std::setw(16) << "per user byte" << std::endl;
+	for (int cause = 0; cause < NUM_WRITE_CAUSES; ++cause)
+	{
+		unsigned long long bytes = stats.log.bytesWrittenByCause[cause];
+		std::cout << std::left << std::setw(20) << GetWriteCauseString((WriteCause)cause) << std::right
+		          << std::setw(14) << bytes
+		          << std::setw(10) << (flashBytes == 0 ? 0.0 : 100.0 * bytes / flashBytes)
+		          << std::setw(16) << (double)bytes / userBytes << std::endl;
+	}
+
+	std::cout << std::endl << "segments cleaned: " << stats.file.segmentsCleaned << ", blocks moved: " << stats.file.blocksMoved << std::endl;
+	std::cout.unsetf(std::ios_base::floatfield);
+	std::cout << std::endl;
+	PrintLatencyReport(std::cout);
+}
+
+int parseArgs(int argc, char **argv, unsigned int * files, unsigned int * fileSize, unsigned int * overwrites, unsigned int * rounds, unsigned int * seed)
+{
+	if (argc < 2 || argc % 2 != 0)
+	{
+		std::cerr << "USAGE: " << argv[0] << " [-f files] [-s size] [-o overwrites] [-r rounds] [-x seed] file" << std::endl;
+		return 1;
+	}
+
+	for (int i = 1; i < argc - 1; i += 2)
+	{
+		std::string option = argv[i];
+		if (!isNumber(argv[i + 1]))
+		{
+			std::cerr << "Option " << option << " takes a number" << std::endl;
+			return 1;
+		}
+
+		unsigned int value = std::stoi(argv[i + 1]);
+		if (option.compare("-f") == 0)
+		{
+			*files = value;
+		}
+		else if (option.compare("-s") == 0)
+		{
+			*fileSize = value;
+		}
+		else if (option.compare("-o") == 0)
+		{
+			*overwrites = value;
+		}
+		else if (option.compare("-r") == 0)
+		{
+			*rounds = value;
+		}
+		else if (option.compare("-x") == 0)
+		{
+			*seed = value;
+		}
+		else
+		{
+			std::cerr << "Unknown option " << option << std::endl;
+			return 1;
+		}
+	}
+
+	if (*files == 0 || *fileSize == 0)
+	{
+		std::cerr << "Files and file size must be at least 1" << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -3,6 +3,7 @@ Scans for:
 	- in-use inodes that do not have directory entries
 	- directory entries that refer to unused inodes
 	- incorrect segment summary information
+	- segment summaries and blocks that fail their checksums
 
 	USAGE: lfsck file
 */
@@ -11,11 +12,17 @@ Scans for:
 #include <stdio.h>
 #include <iostream>
 #include <string>
+#include <map>
+#include <vector>
 #include "../layers/flash/flash.h"
 #include "../layers/directory.hpp"
 #include "../data_structures/flash_data.hpp"
 #include "../data_structures/segment.hpp"
+#include "../data_structures/segment_factory.hpp"
 #include "../data_structures/inode.hpp"
+#include "../data_structures/block_map.hpp"
+#include "../data_structures/extent.hpp"
+#include "../lz.hpp"
 
 int reportInUseINodesWithNoDirectoryEntries(int * errors);
 int reportDirectoryEntriesThatReferToUnusedINodes(int * errors);
@@ -23,17 +30,27 @@ int reportIncorrectSegmentSummaryInformation(int * errors);
 
 
 void printIncorrectSegmentSummaryInfo(unsigned int segment, unsigned int block, int blockINum, INode inode);
-int checkBlock(unsigned int segment, unsigned int block, int blockINum, INode& inode);
+int checkBlock(unsigned int segment, unsigned int block, int blockINum, int fileBlock, INode& inode);
+int getBlockAddress(INode& inode, int fileBlock, LogAddress * address);
+int getBlockMapAddress(INode& inode, unsigned long long block, unsigned int height, LogAddress * address);
+int getExtentListBlockAddress(INode& inode, unsigned int listBlock, LogAddress * address);
+int readExtents(INode& inode, std::vector<Extent> ** extents);
+int readFile(INode& inode, void * buffer);
 int readDirectory(INode& inode, DirectoryList * directoryList);
-int readSegmentSummaryBlock(unsigned int segment, SegmentSummary * summaryBlock);
+int checkBlockChecksum(unsigned int segment, unsigned int block, SegmentSummary * summaryBlock);
+bool readSegmentSummaryBlock(unsigned int segment, SegmentSummary * summaryBlock);
+void freeSegmentSummary(SegmentSummary * summaryBlock);
 int readBlock(unsigned int segment, unsigned int block, void * buffer);
 int readSegment(unsigned int segment, void * buffer);
 int readFlashData(char * flashFile);
 int readIFileINode();
 int readIFile();
 
-Flash     flash;
-FlashData flashData;
+Flash            flash;
+FlashData        flashData;
+SegmentFactory * segmentFactory;
+BlockMapGeometry blockMap;
+std::map<unsigned int, std::vector<Extent>> extentLists;
 INode     iFileINode;
 INode *   iFileArray;
 
@@ -87,6 +104,7 @@ int main(int argc, char **argv)
 
 	Flash_Close(flash);
     free(iFileArray);
+    delete segmentFactory;
 	return errors;
 }
 
@@ -172,13 +190,21 @@ int reportIncorrectSegmentSummaryInformation(int * errors)
     // go through each segment
     for (int segment = flashData.checkpointSegment + 1; segment < flashData.flashSize; ++segment)
     {
-        SegmentSummary * summaryBlock = new SegmentSummary(segment, segment * flashData.segmentSize * flashData.blockSize, flashData.segmentSize);
-        readSegmentSummaryBlock(segment, summaryBlock);
+        SegmentSummary * summaryBlock = new SegmentSummary(segment, segment * flashData.segmentSize * flashData.blockSize, segmentFactory->getSegmentSizeInSlots(), segmentFactory->getUnpackedBlockSize());
+        bool validChecksum = readSegmentSummaryBlock(segment, summaryBlock);
+
+        // segments that were never written read back as zeros
+        bool written = summaryBlock->segmentNumber != 0 || summaryBlock->startSector != 0 || summaryBlock->numberOfBlocks != 0;
+        if (written && !validChecksum)
+        {
+            std::cout << "Segment: " << segment << " summary fails its checksum" << std::endl;
+            (*errors)++;
+        }
 
         // check metadata
         if (summaryBlock->segmentNumber  != segment                                               ||
             summaryBlock->startSector    != segment * flashData.segmentSize * flashData.blockSize ||
-            summaryBlock->numberOfBlocks != flashData.segmentSize)
+            summaryBlock->numberOfBlocks != segmentFactory->getSegmentSizeInSlots())
         {
             if (summaryBlock->segmentNumber != 0 || summaryBlock->startSector != 0 || summaryBlock->numberOfBlocks || 0)
             {
@@ -188,10 +214,15 @@ int reportIncorrectSegmentSummaryInformation(int * errors)
         }
 
         // check inums
-        for (int block = 0; block < flashData.segmentSize; ++block)
+        for (int block = 0; block < segmentFactory->getSegmentSizeInSlots(); ++block)
         {
             int blockINum = summaryBlock->blockINums[block];
 
+            if (block != 0 && blockINum != NO_INUM && written && validChecksum)
+            {
+                (*errors) += checkBlockChecksum(segment, block, summaryBlock);
+            }
+
             if (block == 0)
             {
                 if (blockINum != SUMMARY_BLOCK && blockINum != 0)
@@ -206,34 +237,56 @@ int reportIncorrectSegmentSummaryInformation(int * errors)
             }
             else if (blockINum == IFILE_INUM && summaryBlock->iNodeBlockNumbers[block] != 0)
             {
-                (*errors) += checkBlock(segment, block, blockINum, iFileINode);
+                (*errors) += checkBlock(segment, block, blockINum, summaryBlock->iNodeBlockNumbers[block], iFileINode);
             }
             else if (blockINum > 0)
             {
-                (*errors) += checkBlock(segment, block, blockINum, iFileArray[blockINum - 1]);
+                (*errors) += checkBlock(segment, block, blockINum, summaryBlock->iNodeBlockNumbers[block], iFileArray[blockINum - 1]);
             }
         }
 
-        free(summaryBlock->blockINums);
+        freeSegmentSummary(summaryBlock);
         delete summaryBlock;
     }
 
 	return 0;
 }
 
-int checkBlock(unsigned int segment, unsigned int block, int blockINum, INode& inode)
+int checkBlockChecksum(unsigned int segment, unsigned int block, SegmentSummary * summaryBlock)
 {
-    bool blockFound = false;
-    for (int dBlock = 0; dBlock < 4; ++dBlock)
+    void * blockBuffer = malloc(flashData.blockSize * FLASH_SECTOR_SIZE);
+    if (readBlock(segment, block, blockBuffer) != 0)
     {
-        if (inode.directBlocks[dBlock].logSegment  == segment && 
-            inode.directBlocks[dBlock].blockNumber == block)
-        {
-            blockFound = true;
-        }
+        std::cout << "Block cannot be decompressed!" << std::endl;
+        std::cout << "\tSegment: "  << segment << std::endl;
+        std::cout << "\tBlock: "    << block << std::endl;
+        free(blockBuffer);
+        return 1;
     }
 
-    if (!blockFound)
+    uint32_t checksum = Crc32c(blockBuffer, flashData.blockSize * FLASH_SECTOR_SIZE);
+    free(blockBuffer);
+
+    if (checksum != summaryBlock->blockChecksums[block])
+    {
+        std::cout << "Block fails its checksum!" << std::endl;
+        std::cout << "\tSegment: "  << segment << std::endl;
+        std::cout << "\tBlock: "    << block << std::endl;
+        std::cout << "\tExpected: " << summaryBlock->blockChecksums[block] << std::endl;
+        std::cout << "\tFound: "    << checksum << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+// the file block or block map node the summary names must be the one the inode's block map points at
+int checkBlock(unsigned int segment, unsigned int block, int blockINum, int fileBlock, INode& inode)
+{
+    LogAddress address;
+    if (getBlockAddress(inode, fileBlock, &address) != 0 ||
+        address.logSegment  != segment                  ||
+        address.blockNumber != block)
     {
         printIncorrectSegmentSummaryInfo(segment, block, blockINum, inode);
         return 1;
@@ -242,6 +295,160 @@ int checkBlock(unsigned int segment, unsigned int block, int blockINum, INode& i
     return 0;
 } 
 
+// finds a file block, a block map node when fileBlock is a node id or an extent list block when it is a list block id
+int getBlockAddress(INode& inode, int fileBlock, LogAddress * address)
+{
+    unsigned long long block = fileBlock;
+    unsigned int height      = 0;
+    unsigned int listBlock;
+    if (fileBlock < 0)
+    {
+        if (blockMap.DecodeExtentListBlockId(fileBlock, &listBlock))
+        {
+            return inode.extentMapped ? getExtentListBlockAddress(inode, listBlock, address) : 1;
+        }
+
+        return blockMap.DecodeNodeId(fileBlock, &block, &height) ? getBlockMapAddress(inode, block, height, address) : 1;
+    }
+
+    if (!inode.extentMapped || block < NUM_DIRECT_BLOCKS)
+    {
+        return getBlockMapAddress(inode, block, 0, address);
+    }
+
+    std::vector<Extent> * extents;
+    if (readExtents(inode, &extents) != 0)
+    {
+        return 1;
+    }
+
+    address->logSegment  = EMPTY_DIRECT_BLOCK_ADDRESS;
+    address->blockNumber = EMPTY_DIRECT_BLOCK_ADDRESS;
+    for (Extent& extent : *extents)
+    {
+        if (block >= extent.fileBlock && block < extent.End())
+        {
+            *address = extent.GetAddress(block);
+            break;
+        }
+    }
+
+    return 0;
+}
+
+// walks the block map from the inode to the node of the given height on the way to block, or to the block itself for height 0
+int getBlockMapAddress(INode& inode, unsigned long long block, unsigned int height, LogAddress * address)
+{
+    unsigned int rootHeight = blockMap.GetHeight(block);
+    if (rootHeight > MAX_BLOCK_MAP_HEIGHT)
+    {
+        return 1;
+    }
+
+    if (rootHeight == 0)
+    {
+        *address = inode.directBlocks[block];
+        return 0;
+    }
+
+    int ret              = 0;
+    *address             = *GetBlockMapRoot(&inode, rootHeight);
+    LogAddress * entries = (LogAddress *)malloc(flashData.blockSize * FLASH_SECTOR_SIZE);
+    for (unsigned int h = rootHeight; h > height && address->logSegment != EMPTY_DIRECT_BLOCK_ADDRESS; --h)
+    {
+        if (readBlock(address->logSegment, address->blockNumber, entries) != 0)
+        {
+            ret = 1;
+            break;
+        }
+
+        *address = entries[blockMap.ChildIndex(block, h)];
+    }
+
+    free(entries);
+    return ret;
+}
+
+// the first block of an extent list is the indirect block and the rest are mapped by the trees after it
+int getExtentListBlockAddress(INode& inode, unsigned int listBlock, LogAddress * address)
+{
+    if (listBlock == 0)
+    {
+        *address = inode.indirectBlock;
+        return 0;
+    }
+
+    return getBlockMapAddress(inode, blockMap.ExtentListMapBlock(listBlock), 0, address);
+}
+
+// reads the extent list of an extent mapped file once and keeps it for the rest of the check
+int readExtents(INode& inode, std::vector<Extent> ** extents)
+{
+    auto cached = extentLists.find(inode.inum);
+    if (cached != extentLists.end())
+    {
+        *extents = &cached->second;
+        return 0;
+    }
+
+    unsigned int blockSizeInBytes = flashData.blockSize * FLASH_SECTOR_SIZE;
+    unsigned int extentsInBlock   = blockSizeInBytes / sizeof(Extent);
+    Extent * blockBuffer          = (Extent *)malloc(blockSizeInBytes);
+    int ret                       = 0;
+    std::vector<Extent> list;
+    for (unsigned int listBlock = 0; listBlock * extentsInBlock < inode.extentCount && ret == 0; ++listBlock)
+    {
+        LogAddress address;
+        if (getExtentListBlockAddress(inode, listBlock, &address) != 0 ||
+            address.logSegment == EMPTY_DIRECT_BLOCK_ADDRESS         ||
+            readBlock(address.logSegment, address.blockNumber, blockBuffer) != 0)
+        {
+            ret = 1;
+            break;
+        }
+
+        unsigned int count = std::min(extentsInBlock, inode.extentCount - listBlock * extentsInBlock);
+        list.insert(list.end(), blockBuffer, blockBuffer + count);
+    }
+
+    free(blockBuffer);
+    if (ret != 0)
+    {
+        std::cout << "Unable to read the extent list of inode " << inode.inum << std::endl;
+        return 1;
+    }
+
+    *extents = &(extentLists[inode.inum] = list);
+    return 0;
+}
+
+// reads every block of a file into a buffer of its size rounded up to whole blocks
+int readFile(INode& inode, void * buffer)
+{
+    unsigned int blockSizeInBytes = flashData.blockSize * FLASH_SECTOR_SIZE;
+    unsigned int fileSizeInBlocks = inode.fileSize / blockSizeInBytes + (inode.fileSize % blockSizeInBytes > 0);
+    for (unsigned int b = 0; b < fileSizeInBlocks; ++b)
+    {
+        LogAddress address;
+        char * blockBuffer = (char *)buffer + b * blockSizeInBytes;
+        if (getBlockAddress(inode, b, &address) != 0)
+        {
+            return 1;
+        }
+
+        if (address.logSegment == EMPTY_DIRECT_BLOCK_ADDRESS)
+        {
+            memset(blockBuffer, 0, blockSizeInBytes);
+        }
+        else if (readBlock(address.logSegment, address.blockNumber, blockBuffer) != 0)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
 void printIncorrectSegmentSummaryInfo(unsigned int segment, unsigned int block, int blockINum, INode inode)
 {
     std::cout << "Incorrect segment summary info found!" << std::endl;
@@ -254,23 +461,11 @@ void printIncorrectSegmentSummaryInfo(unsigned int segment, unsigned int block,
 
 int readDirectory(INode& inode, DirectoryList * directoryList)
 {
-    unsigned int dirSizeInBlocks = 0;
-    for (int b = 0; b < 4; ++b)
-    {
-        if (inode.directBlocks[b].logSegment != EMPTY_DIRECT_BLOCK_ADDRESS)
-        {
-            dirSizeInBlocks++;
-        }
-    }
-
-    void * dirBuffer = malloc(dirSizeInBlocks * flashData.blockSize * FLASH_SECTOR_SIZE);
-    for (int b = 0; b < dirSizeInBlocks; ++b)
-    {
-        unsigned int segment      = inode.directBlocks[b].logSegment;
-        unsigned int block        = inode.directBlocks[b].blockNumber;
-        unsigned int bufferOffset = b * flashData.blockSize * FLASH_SECTOR_SIZE;
-        readBlock(segment, block, (char *)dirBuffer + bufferOffset);
-    }
+    unsigned int blockSizeInBytes = flashData.blockSize * FLASH_SECTOR_SIZE;
+    unsigned int dirSizeInBlocks  = inode.fileSize / blockSizeInBytes + (inode.fileSize % blockSizeInBytes > 0);
+    void * dirBuffer              = malloc(std::max(dirSizeInBlocks * blockSizeInBytes, (unsigned int)sizeof(DirectoryList)));
+    memset(dirBuffer, 0, std::max(dirSizeInBlocks * blockSizeInBytes, (unsigned int)sizeof(DirectoryList)));
+    readFile(inode, dirBuffer);
 
     DirectoryEntry * directoryEntriesPtr = directoryList->directoryEntries;
     memcpy(directoryList, dirBuffer, sizeof(DirectoryList));
@@ -286,30 +481,60 @@ int readDirectory(INode& inode, DirectoryList * directoryList)
     return 0;
 }
 
-int readSegmentSummaryBlock(unsigned int segment, SegmentSummary * summaryBlock)
+bool readSegmentSummaryBlock(unsigned int segment, SegmentSummary * summaryBlock)
 {
-    void * blockBuffer = malloc(flashData.blockSize * FLASH_SECTOR_SIZE);
-    readBlock(segment, 0, blockBuffer);
+    unsigned int sectorToRead          = segment * (flashData.segmentSize * flashData.blockSize);
+    unsigned int numberOfSectorsToRead = segmentFactory->getSummarySizeInBlocks() * flashData.blockSize;
+    void * summaryBuffer               = malloc(numberOfSectorsToRead * FLASH_SECTOR_SIZE);
+    Flash_Read(flash, sectorToRead, numberOfSectorsToRead, summaryBuffer);
 
-    int * oldINumsPointer = summaryBlock->blockINums;
-    int * oldBlocksPointer = summaryBlock->iNodeBlockNumbers;
-    memcpy(summaryBlock, blockBuffer, sizeof(SegmentSummary));
-    summaryBlock->blockINums = oldINumsPointer;
-    summaryBlock->iNodeBlockNumbers = oldBlocksPointer;
+    bool validChecksum = summaryBlock->Deserialize((char *)summaryBuffer);
 
-    memcpy(summaryBlock->blockINums, (char *)blockBuffer + sizeof(SegmentSummary), flashData.segmentSize * sizeof(int));
-    memcpy(summaryBlock->iNodeBlockNumbers, (char *)blockBuffer + sizeof(SegmentSummary) + flashData.segmentSize * sizeof(int), flashData.segmentSize * sizeof(int));
+    free(summaryBuffer);
+    return validChecksum;
+}
 
-    free(blockBuffer);
-    return 0;
+void freeSegmentSummary(SegmentSummary * summaryBlock)
+{
+    free(summaryBlock->blockINums);
+    free(summaryBlock->iNodeBlockNumbers);
+    free(summaryBlock->blockChecksums);
+    free(summaryBlock->blockOffsets);
+    free(summaryBlock->blockLengths);
 }
 
+// finds the block's extent in the segment summary and decompresses it if needed. returns 1 if the extent is bad
 int readBlock(unsigned int segment, unsigned int block, void * buffer)
 {
-    unsigned int sectorToRead          = segment * (flashData.segmentSize * flashData.blockSize) + block * flashData.blockSize;
-    unsigned int numberOfSectorsToRead = flashData.blockSize;
-    Flash_Read(flash, sectorToRead, numberOfSectorsToRead, buffer);
-    return 0;
+    unsigned int blockSizeInBytes   = flashData.blockSize * FLASH_SECTOR_SIZE;
+    unsigned int summarySizeInBytes = segmentFactory->getSummarySizeInBlocks() * blockSizeInBytes;
+    SegmentSummary summaryBlock(segment, segment * flashData.segmentSize * flashData.blockSize, segmentFactory->getSegmentSizeInSlots(), segmentFactory->getUnpackedBlockSize());
+    readSegmentSummaryBlock(segment, &summaryBlock);
+
+    void * segmentBuffer = malloc(segmentFactory->getSegmentSizeInBytes());
+    readSegment(segment, segmentBuffer);
+
+    int ret             = 0;
+    unsigned int offset = summaryBlock.blockOffsets[block];
+    unsigned int length = summaryBlock.blockLengths[block];
+    char * extent       = (char *)segmentBuffer + summarySizeInBytes + offset;
+    memset(buffer, 0, blockSizeInBytes);
+    if (length > blockSizeInBytes || offset + length > segmentFactory->getDataSizeInBytes())
+    {
+        ret = 1;
+    }
+    else if (length == blockSizeInBytes)
+    {
+        memcpy(buffer, extent, blockSizeInBytes);
+    }
+    else if (LzDecompress(extent, length, buffer, blockSizeInBytes) != blockSizeInBytes)
+    {
+        ret = 1;
+    }
+
+    free(segmentBuffer);
+    freeSegmentSummary(&summaryBlock);
+    return ret;
 }
 
 int readSegment(unsigned int segment, void * buffer)
@@ -324,23 +549,15 @@ int readIFile()
 {
     std::cout << "[lfsck] reading ifile..." << std::endl;
 
-    unsigned int iFileSizeInBlocks = 0;
-    for (int b = 0; b < 4; ++b)
-    {
-        if (iFileINode.directBlocks[b].logSegment != EMPTY_DIRECT_BLOCK_ADDRESS)
-        {
-            iFileSizeInBlocks++;
-        }
-    }
-
+    unsigned int blockSizeInBytes  = flashData.blockSize * FLASH_SECTOR_SIZE;
     unsigned int iFileSizeInBytes  = iFileINode.fileSize;
-    void * iFileBuffer             = malloc(iFileSizeInBlocks * flashData.blockSize * FLASH_SECTOR_SIZE);
-    for (int b = 0; b < iFileSizeInBlocks; ++b)
+    unsigned int iFileSizeInBlocks = iFileSizeInBytes / blockSizeInBytes + (iFileSizeInBytes % blockSizeInBytes > 0);
+    void * iFileBuffer             = malloc(iFileSizeInBlocks * blockSizeInBytes);
+    if (readFile(iFileINode, iFileBuffer) != 0)
     {
-        unsigned int segment      = iFileINode.directBlocks[b].logSegment;
-        unsigned int block        = iFileINode.directBlocks[b].blockNumber;
-        unsigned int bufferOffset = b * flashData.blockSize * FLASH_SECTOR_SIZE;
-        readBlock(segment, block, (char *)iFileBuffer + bufferOffset);
+        std::cerr << "[lfsck] ERROR: unable to read the ifile" << std::endl;
+        free(iFileBuffer);
+        return 1;
     }
 
     iFileArray = (INode *)malloc(iFileSizeInBytes); memset(iFileArray, 0, iFileSizeInBytes);
@@ -353,31 +570,28 @@ int readIFileINode()
 {
     std::cout << "[lfsck] reading checkpoint to get ifile inode..." << std::endl;
 
-    unsigned int checkpointBufferSize = CHECKPOINT_SIZE_IN_SECTORS * FLASH_SECTOR_SIZE;
-    void * checkpointBuffer           = malloc(checkpointBufferSize);
+    unsigned int checkpointSegmentSizeInSectors = flashData.segmentSize * flashData.blockSize;
+    unsigned int checkpointSegmentStartSector   = flashData.checkpointSegment * checkpointSegmentSizeInSectors;
+    unsigned int checkpointBufferSize           = checkpointSegmentSizeInSectors * FLASH_SECTOR_SIZE;
+    char * checkpointBuffer                     = (char *)malloc(checkpointBufferSize);
+    memset(checkpointBuffer, 0, checkpointBufferSize);
 
+    if (Flash_Read(flash, checkpointSegmentStartSector, checkpointSegmentSizeInSectors, checkpointBuffer) != 0)
+    {
+        std::cerr << "[lfsck] Unable to read the checkpoint segment" << std::endl;
+        std::cerr << "[lfsck] errno: " << errno << std::endl;
+        free(checkpointBuffer);
+        return 1;
+    }
+
+    // lfsck checks every slot rather than relying on the slots being in order
     Checkpoint curr;
     Checkpoint checkpoint;
-    memset(&curr, 0, sizeof(Checkpoint));
     memset(&checkpoint, 0, sizeof(Checkpoint));
-
-    unsigned int checkpointSegmentStartSector = flashData.checkpointSegment * flashData.segmentSize * flashData.blockSize;
-    unsigned int checkpointSegmentEndSector = checkpointSegmentStartSector + (flashData.segmentSize * flashData.blockSize);
-
-    for (unsigned int currSector = checkpointSegmentStartSector; currSector < checkpointSegmentEndSector; currSector += CHECKPOINT_SIZE_IN_SECTORS)
+    for (unsigned int slot = 0; slot < checkpointSegmentSizeInSectors / CHECKPOINT_SIZE_IN_SECTORS; ++slot)
     {
-        memset(&curr, 0, sizeof(Checkpoint));
-        memset(checkpointBuffer, 0, checkpointBufferSize);
-
-        if (Flash_Read(flash, currSector, CHECKPOINT_SIZE_IN_SECTORS, checkpointBuffer) != 0)
-        {
-            std::cerr << "[LogLayer] Unable to recover checkpoint on initFlash" << std::endl;
-            std::cerr << "[LogLayer] errno: " << errno << std::endl;
-            return 1;
-        }
-
-        memcpy(&curr, checkpointBuffer, sizeof(Checkpoint));
-        if (curr.isValid && checkpoint.time < curr.time)
+        memcpy(&curr, checkpointBuffer + (slot * CHECKPOINT_SIZE_IN_SECTORS * FLASH_SECTOR_SIZE), sizeof(Checkpoint));
+        if (curr.isValid && checkpoint.sequenceNumber < curr.sequenceNumber)
         {
             checkpoint = curr;
         }
@@ -387,6 +601,7 @@ int readIFileINode()
 
     std::cout << "[lfsck] recovered checkpoint:" << std::endl;
     std::cout << "[lfsck] \t time: " << checkpoint.time << std::endl;
+    std::cout << "[lfsck] \t sequenceNumber: " << checkpoint.sequenceNumber << std::endl;
     std::cout << "[lfsck] \t lastSegmentWritten: " << checkpoint.lastSegmentWritten << std::endl;
     std::cout << "[lfsck] \t segmentUsageTableSegment: " << checkpoint.segmentUsageTableSegment << std::endl;
     std::cout << "[lfsck] \t IFile INode: " << std::endl;
@@ -428,6 +643,8 @@ int readFlashData(char * flashFile)
 
     flashData = *reinterpret_cast<FlashData *>(flashDataBuffer);
     free(flashDataBuffer);
+    segmentFactory = new SegmentFactory(flashData);
+    blockMap       = BlockMapGeometry(flashData.blockSize * FLASH_SECTOR_SIZE);
 
     std::cout << "\tflash file: "   << flashFile             << std::endl;
     std::cout << "\tblock size: "   << flashData.blockSize   << std::endl;
@@ -436,6 +653,7 @@ int readFlashData(char * flashFile)
     std::cout << "\twear limit: "   << flashData.wearLimit   << std::endl; 
     std::cout << "\tnum blocks: "   << flashData.numBlocks   << std::endl;
     std::cout << "\tcheckpointSegment: "   << flashData.checkpointSegment   << std::endl;
+    std::cout << "\tcompression: "   << flashData.compression   << std::endl;
 
     return 0;
 }
\ No newline at end of file
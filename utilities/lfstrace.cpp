@@ -0,0 +1,65 @@
+/*
+Decodes a trace written by lfs. Records from every thread are printed in time order with the
+time since the first record, the thread, the level, the event and its arguments.
+
+	USAGE: lfstrace [-l level] file
+
+	level is 1 to print INFO events only and 2 to print INFO and DEBUG events. The default is 2.
+*/
+
+
+#include <stdio.h>
+#include <iostream>
+#include <string>
+#include <algorithm>
+#include "../trace.hpp"
+#include "../utils.hpp"
+
+int main(int argc, char **argv)
+{
+	unsigned int level = TRACE_LEVEL_DEBUG;
+	if (argc == 4 && std::string(argv[1]).compare("-l") == 0 && isNumber(argv[2]))
+	{
+		level = std::stoi(argv[2]);
+	}
+	else if (argc != 2)
+	{
+        std::cerr << "USAGE: " << argv[0] << " [-l level] file" << std::endl;
+	    return 1;
+	}
+
+	char * traceFile = argv[argc - 1];
+	std::vector<TraceRecord> records;
+	if (TraceLoad(traceFile, records) != 0)
+	{
+        std::cerr << "ERROR: Unable to read trace file " << traceFile << std::endl;
+	    return 1;
+	}
+
+	std::stable_sort(records.begin(), records.end(), [](const TraceRecord& a, const TraceRecord& b)
+	{
+		return a.timestamp < b.timestamp;
+	});
+
+	char args[256];
+	unsigned int printed = 0;
+	for (const TraceRecord& record : records)
+	{
+		if (record.level > level)
+		{
+			continue;
+		}
+
+		TraceFormatArgs(record, args, sizeof(args));
+		printf("%12.3f us  thread %-3u %-5s %-22s %s\n",
+		       (record.timestamp - records.front().timestamp) / 1000.0,
+		       record.thread,
+		       GetTraceLevelString(record.level),
+		       GetTraceEventName(record.event),
+		       args);
+		printed++;
+	}
+
+	std::cout << printed << " of " << records.size() << " records" << std::endl;
+	return 0;
+}
@@ -19,11 +19,12 @@
 #include "../data_structures/log_address.hpp"
 #include "../data_structures/flash_data.hpp"
 #include "../data_structures/segment.hpp"
+#include "../data_structures/segment_factory.hpp"
 #include "../data_structures/inode.hpp"
 #include "../utils.hpp"
 
-int parseArgs(int argc, char **argv, unsigned int *blockSize, unsigned int *segmentSize, unsigned int *flashSize, unsigned int *wearLimit);
-int initFlash(char *file, unsigned int blockSize, unsigned int segmentSize, unsigned int flashSize, unsigned int wearLimit);
+int parseArgs(int argc, char **argv, unsigned int *blockSize, unsigned int *segmentSize, unsigned int *flashSize, unsigned int *wearLimit, unsigned int *compression, unsigned int *deduplication);
+int initFlash(char *file, unsigned int blockSize, unsigned int segmentSize, unsigned int flashSize, unsigned int wearLimit, unsigned int compression, unsigned int deduplication);
 int optionCheck(char * s);
 
 int main(int argc, char **argv)
@@ -32,8 +33,10 @@ int main(int argc, char **argv)
     unsigned int segmentSize  = 32;   // Segment size, in blocks. The segment size must be a multiple of the flash erase block size, report an error otherwise. The default is 32
     unsigned int flashSize    = 100;  // Size of the flash, in segments.  The default is 100
     unsigned int wearLimit    = 1000; // Wear limit for erase blocks. The default is 1000.
+    unsigned int compression  = COMPRESSION_NONE; // Block compression codec. The default is none
+    unsigned int dedup        = 0;    // Store identical file data blocks once. The default is 0 (off)
 
-    if (parseArgs(argc, argv, &blockSize, &segmentSize, &flashSize, &wearLimit) != 0)
+    if (parseArgs(argc, argv, &blockSize, &segmentSize, &flashSize, &wearLimit, &compression, &dedup) != 0)
     {
         return 1;
     }
@@ -42,6 +45,8 @@ int main(int argc, char **argv)
     std::cout << "\tsegment size in blocks: " << segmentSize       << std::endl;
     std::cout << "\tflash size in segments: " << flashSize         << std::endl;
     std::cout << "\twear limit: "             << wearLimit         << std::endl;
+    std::cout << "\tcompression: "            << compression       << std::endl;
+    std::cout << "\tdeduplication: "          << dedup             << std::endl;
     
 	if (segmentSize % FLASH_SECTORS_PER_BLOCK != 0)
     {
@@ -55,8 +60,20 @@ int main(int argc, char **argv)
         throw;
     }
 
+    if (compression > COMPRESSION_LZ)
+    {
+        std::cerr << "Unknown compression codec " << compression << ". Valid codecs: " << COMPRESSION_NONE << " (none), " << COMPRESSION_LZ << " (lz)" << std::endl;
+        return 1;
+    }
+
+    if (compression == COMPRESSION_NONE && SegmentSummary::SizeInBytes(segmentSize, false) > blockSize * FLASH_SECTOR_SIZE)
+    {
+        std::cerr << "Segment summary for " << segmentSize << " blocks does not fit in a block of " << blockSize << " sectors" << std::endl;
+        return 1;
+    }
+
     char *file = argv[argc - 1];
-    if (initFlash(file, blockSize, segmentSize, flashSize, wearLimit) != 0)
+    if (initFlash(file, blockSize, segmentSize, flashSize, wearLimit, compression, dedup) != 0)
     {
         return 1;
     }
@@ -64,7 +81,7 @@ int main(int argc, char **argv)
 	return 0;
 }
 
-int initFlash(char *file, unsigned int blockSize, unsigned int segmentSize, unsigned int flashSize, unsigned int wearLimit)
+int initFlash(char *file, unsigned int blockSize, unsigned int segmentSize, unsigned int flashSize, unsigned int wearLimit, unsigned int compression, unsigned int deduplication)
 {
     std::cout << "initializing flash..."                                 << std::endl;
     std::cout << "\tflash file: "             << file                    << std::endl;
@@ -102,8 +119,19 @@ int initFlash(char *file, unsigned int blockSize, unsigned int segmentSize, unsi
         .flashSize                = flashSize,
         .wearLimit                = wearLimit,
         .numBlocks                = segmentSize * flashSize,
+        .compression              = compression,
+        .deduplication            = deduplication,
     };
 
+    // compressed segments have a larger summary which can take more than one block
+    SegmentFactory segmentFactory(flashData);
+    unsigned int summarySizeInBlocks = segmentFactory.getSummarySizeInBlocks();
+    if (summarySizeInBlocks >= segmentSize)
+    {
+        std::cerr << "Segment summary takes " << summarySizeInBlocks << " blocks which leaves no room for data" << std::endl;
+        return 1;
+    }
+
     // compute size of flash data in sectors 
     unsigned int flashDataFieldsSizeInBytes   = sizeof(flashData);
     unsigned int flashDataSizeInSectors       = flashDataFieldsSizeInBytes / FLASH_SECTOR_SIZE;
@@ -112,10 +140,11 @@ int initFlash(char *file, unsigned int blockSize, unsigned int segmentSize, unsi
         flashDataSizeInSectors++;
     }
 
-    // compute size of seg usage table in sectors
+    // compute size of seg usage table in sectors. the validity bitmaps of the segments follow the table
     unsigned int segmentUsageTableSizeInBytes   = flashSize * sizeof(SegmentUsageTableEntry);
-    unsigned int segmentUsageTableSizeInSectors = segmentUsageTableSizeInBytes / FLASH_SECTOR_SIZE;
-    if (segmentUsageTableSizeInBytes % FLASH_SECTOR_SIZE != 0 || segmentUsageTableSizeInSectors == 0)
+    unsigned int validityBitmapsSizeInBytes     = flashSize * segmentFactory.getValidityBitmapSizeInBytes();
+    unsigned int segmentUsageTableSizeInSectors = (segmentUsageTableSizeInBytes + validityBitmapsSizeInBytes) / FLASH_SECTOR_SIZE;
+    if ((segmentUsageTableSizeInBytes + validityBitmapsSizeInBytes) % FLASH_SECTOR_SIZE != 0 || segmentUsageTableSizeInSectors == 0)
     {
         segmentUsageTableSizeInSectors++;
     }
@@ -135,6 +164,13 @@ int initFlash(char *file, unsigned int blockSize, unsigned int segmentSize, unsi
         segmentUsageTableSizeInSegments++;
     }
 
+    // the log reads and writes the table as a single segment
+    if (segmentUsageTableSizeInSegments > 1)
+    {
+        std::cerr << "The segment usage table takes " << segmentUsageTableSizeInSegments << " segments, use fewer or larger segments" << std::endl;
+        return 1;
+    }
+
     // checkpoint location
     unsigned int flashDataSegment = 0;
     unsigned int segmentUsageTableSegment = flashDataSegment + flashDataSizeInSegments;
@@ -168,6 +204,10 @@ int initFlash(char *file, unsigned int blockSize, unsigned int segmentSize, unsi
 
         iFile[i].indirectBlock.logSegment  = EMPTY_DIRECT_BLOCK_ADDRESS; 
         iFile[i].indirectBlock.blockNumber = EMPTY_DIRECT_BLOCK_ADDRESS;
+        iFile[i].doubleIndirectBlock.logSegment  = EMPTY_DIRECT_BLOCK_ADDRESS;
+        iFile[i].doubleIndirectBlock.blockNumber = EMPTY_DIRECT_BLOCK_ADDRESS;
+        iFile[i].tripleIndirectBlock.logSegment  = EMPTY_DIRECT_BLOCK_ADDRESS;
+        iFile[i].tripleIndirectBlock.blockNumber = EMPTY_DIRECT_BLOCK_ADDRESS;
     }
 
     // create iFile iNode, it will be in checkpoint region
@@ -218,11 +258,16 @@ int initFlash(char *file, unsigned int blockSize, unsigned int segmentSize, unsi
 
     iFileINode.indirectBlock.logSegment  = EMPTY_DIRECT_BLOCK_ADDRESS; 
     iFileINode.indirectBlock.blockNumber = EMPTY_DIRECT_BLOCK_ADDRESS;
+    iFileINode.doubleIndirectBlock.logSegment  = EMPTY_DIRECT_BLOCK_ADDRESS;
+    iFileINode.doubleIndirectBlock.blockNumber = EMPTY_DIRECT_BLOCK_ADDRESS;
+    iFileINode.tripleIndirectBlock.logSegment  = EMPTY_DIRECT_BLOCK_ADDRESS;
+    iFileINode.tripleIndirectBlock.blockNumber = EMPTY_DIRECT_BLOCK_ADDRESS;
     
     // now we can make checkpoint regions
     Checkpoint initialCheckpoint = {
         .isValid                  = true,
         .time                     = NanosSinceEpoch(),
+        .sequenceNumber           = 1,
         .segmentUsageTableSegment = segmentUsageTableSegment,
         .lastSegmentWritten       = iFileSegment,
         .iFileINode               = iFileINode,
@@ -270,6 +315,10 @@ int initFlash(char *file, unsigned int blockSize, unsigned int segmentSize, unsi
 
     iFile[ROOT_DIRECTORY_INUM - 1].indirectBlock.logSegment  = EMPTY_DIRECT_BLOCK_ADDRESS; 
     iFile[ROOT_DIRECTORY_INUM - 1].indirectBlock.blockNumber = EMPTY_DIRECT_BLOCK_ADDRESS;
+    iFile[ROOT_DIRECTORY_INUM - 1].doubleIndirectBlock.logSegment  = EMPTY_DIRECT_BLOCK_ADDRESS;
+    iFile[ROOT_DIRECTORY_INUM - 1].doubleIndirectBlock.blockNumber = EMPTY_DIRECT_BLOCK_ADDRESS;
+    iFile[ROOT_DIRECTORY_INUM - 1].tripleIndirectBlock.logSegment  = EMPTY_DIRECT_BLOCK_ADDRESS;
+    iFile[ROOT_DIRECTORY_INUM - 1].tripleIndirectBlock.blockNumber = EMPTY_DIRECT_BLOCK_ADDRESS;
 
     unsigned int rootDirSizeInBlocks = iFile[ROOT_DIRECTORY_INUM - 1].fileSize / (blockSize * FLASH_SECTOR_SIZE);
     if (rootDirSizeInBlocks % (blockSize * FLASH_SECTOR_SIZE) != 0 || rootDirSizeInBlocks == 0)
@@ -291,7 +340,7 @@ int initFlash(char *file, unsigned int blockSize, unsigned int segmentSize, unsi
 
     // make a segment summary
     unsigned int startSector = iFileSegment * flashData.segmentSize * flashData.blockSize;
-    SegmentSummary iFileSegmentSummary(iFileSegment, startSector, segmentSize);
+    SegmentSummary iFileSegmentSummary(iFileSegment, startSector, segmentFactory.getSegmentSizeInSlots(), segmentFactory.getUnpackedBlockSize());
     int b = 1;
     while (b <= initialIFileSizeInBlocks)
     {
@@ -307,18 +356,47 @@ int initFlash(char *file, unsigned int blockSize, unsigned int segmentSize, unsi
         b++;
     }
     
+    // build ifile and root dir blocks first so the summary can hold their checksums
+    unsigned int blockSizeInBytes = blockSize * FLASH_SECTOR_SIZE;
+    void * dataBuffer = malloc(initialIFileSizeInBlocks * blockSizeInBytes);
+    memset(dataBuffer, 0, initialIFileSizeInBlocks * blockSizeInBytes);
+    memcpy(dataBuffer, iFile, sizeof(iFile));
+
+    void * rootDirBuffer = malloc(rootDirSizeInBlocks * blockSizeInBytes);
+    memset(rootDirBuffer, 0, rootDirSizeInBlocks * blockSizeInBytes);
+    memcpy(rootDirBuffer, &root, sizeof(DirectoryList));
+    memcpy((char *)rootDirBuffer + sizeof(DirectoryList), root.directoryEntries, 3 * sizeof(DirectoryEntry));
+
+    for (b = 0; b < initialIFileSizeInBlocks; ++b)
+    {
+        iFileSegmentSummary.blockChecksums[b + 1] = Crc32c((char *)dataBuffer + b * blockSizeInBytes, blockSizeInBytes);
+    }
+
+    for (b = 0; b < rootDirSizeInBlocks; ++b)
+    {
+        iFileSegmentSummary.blockChecksums[initialIFileSizeInBlocks + b + 1] = Crc32c((char *)rootDirBuffer + b * blockSizeInBytes, blockSizeInBytes);
+    }
+
+    // the initial blocks are stored uncompressed, one after another
+    for (b = 1; b <= initialIFileSizeInBlocks + rootDirSizeInBlocks; ++b)
+    {
+        iFileSegmentSummary.blockOffsets[b] = (b - 1) * blockSizeInBytes;
+        iFileSegmentSummary.blockLengths[b] = blockSizeInBytes;
+    }
+
+    iFileSegmentSummary.nextSlot  = initialIFileSizeInBlocks + rootDirSizeInBlocks + 1;
+    iFileSegmentSummary.dataBytes = (initialIFileSizeInBlocks + rootDirSizeInBlocks) * blockSizeInBytes;
+
     // write summary
     std::cout << "Writing ifile log segment to flash. seg num : " << iFileSegment << std::endl;
     std::cout << "ifile block size: " << initialIFileSizeInBlocks << std::endl;
 
-    char * segmentSummaryBlock = (char *)malloc(blockSize * FLASH_SECTOR_SIZE);
-    memset(segmentSummaryBlock, 0, blockSize);
-    memcpy(segmentSummaryBlock, &iFileSegmentSummary, sizeof(SegmentSummary));
-    memcpy(segmentSummaryBlock + sizeof(SegmentSummary), iFileSegmentSummary.blockINums, flashData.segmentSize * sizeof(int));
-    memcpy(segmentSummaryBlock + sizeof(SegmentSummary) + flashData.segmentSize * sizeof(int), iFileSegmentSummary.iNodeBlockNumbers, flashData.segmentSize * sizeof(int));
+    char * segmentSummaryBlock = (char *)malloc(summarySizeInBlocks * blockSizeInBytes);
+    memset(segmentSummaryBlock, 0, summarySizeInBlocks * blockSizeInBytes);
+    iFileSegmentSummary.Serialize(segmentSummaryBlock);
     
     unsigned int summarySector = iFileSegmentSummary.startSector;
-    int ret                    = Flash_Write(flash, summarySector, blockSize, segmentSummaryBlock);
+    int ret                    = Flash_Write(flash, summarySector, summarySizeInBlocks * blockSize, segmentSummaryBlock);
     free(segmentSummaryBlock);
     if (ret == 1)
     {
@@ -328,11 +406,7 @@ int initFlash(char *file, unsigned int blockSize, unsigned int segmentSize, unsi
     }
     
     // write ifile
-    void * dataBuffer = malloc(initialIFileSizeInBlocks * blockSize * FLASH_SECTOR_SIZE);
-    memset(dataBuffer, 0, initialIFileSizeInBlocks * blockSize * FLASH_SECTOR_SIZE);
-    memcpy(dataBuffer, iFile, sizeof(iFile));
-
-    unsigned int iFileSector      = summarySector + blockSize;
+    unsigned int iFileSector      = summarySector + summarySizeInBlocks * blockSize;
     unsigned int iFileSectorCount = initialIFileSizeInBlocks * blockSize;
     if (Flash_Write(flash, iFileSector, iFileSectorCount, dataBuffer) == 1)
     {
@@ -349,11 +423,6 @@ int initFlash(char *file, unsigned int blockSize, unsigned int segmentSize, unsi
     std::cout << "iFileSectorCount " << iFileSectorCount << std::endl;
 
     // write root dir
-    void * rootDirBuffer = malloc(rootDirSizeInBlocks * blockSize * FLASH_SECTOR_SIZE);
-    memset(rootDirBuffer, 0, rootDirSizeInBlocks * blockSize * FLASH_SECTOR_SIZE);
-    memcpy(rootDirBuffer, &root, sizeof(DirectoryList));
-    memcpy((char *)rootDirBuffer + sizeof(DirectoryList), root.directoryEntries, 3 * sizeof(DirectoryEntry));
-
     unsigned int rootDirSector      = iFileSector + iFileSectorCount;
     unsigned int rootDirSectorCount = rootDirSizeInBlocks * blockSize;
     if (Flash_Write(flash, rootDirSector, rootDirSectorCount, rootDirBuffer) == 1)
@@ -375,15 +444,18 @@ int initFlash(char *file, unsigned int blockSize, unsigned int segmentSize, unsi
     segmentUsageTable[iFileSegment].ageOfYoungestBlock = now;
 
     unsigned int segmentUsageTableSector = initialCheckpoint.segmentUsageTableSegment * segmentSize * blockSize;
-    unsigned int segmentUsageTableSectorCount = segmentUsageTableSizeInBytes / FLASH_SECTOR_SIZE;
-    if (segmentUsageTableSizeInBytes % FLASH_SECTOR_SIZE != 0 || segmentUsageTableSectorCount == 0)
-    {
-        segmentUsageTableSectorCount++;
-    }
+    unsigned int segmentUsageTableSectorCount = segmentUsageTableSizeInSectors;
 
     void * segmentUsageTableBuffer = malloc(segmentUsageTableSectorCount * FLASH_SECTOR_SIZE);
     memset(segmentUsageTableBuffer, 0, segmentUsageTableSectorCount * FLASH_SECTOR_SIZE);
     memcpy(segmentUsageTableBuffer, segmentUsageTable, segmentUsageTableSizeInBytes);
+
+    // the ifile and root directory blocks are the only live blocks
+    unsigned char * iFileSegmentBitmap = (unsigned char *)segmentUsageTableBuffer + segmentUsageTableSizeInBytes + iFileSegment * segmentFactory.getValidityBitmapSizeInBytes();
+    for (unsigned int block = 1; block <= initialIFileSizeInBlocks + rootDirSizeInBlocks; ++block)
+    {
+        iFileSegmentBitmap[block / 8] |= (1 << (block % 8));
+    }
     if (Flash_Write(flash, segmentUsageTableSector, segmentUsageTableSectorCount, segmentUsageTableBuffer) != 0)
     {
         std::cerr << "Unable to write segment usage table on initFlash" << std::endl;
@@ -410,7 +482,7 @@ int initFlash(char *file, unsigned int blockSize, unsigned int segmentSize, unsi
     std::cout << "checkpoints size: "                 << sizeof(Checkpoint)                   << std::endl;
     std::cout << "checkpoints sector count: "         << CHECKPOINT_SIZE_IN_SECTORS           << std::endl;
 
-    std::cout << "\nsegment summary size: " << sizeof(SegmentSummary) + 2 * flashData.segmentSize * sizeof(int)<< std::endl;
+    std::cout << "\nsegment summary size: " << SegmentSummary::SizeInBytes(segmentFactory.getSegmentSizeInSlots(), segmentFactory.isCompressed()) << std::endl;
     std::cout << "\ninode size: " << sizeof(INode) << std::endl;
 
     unsigned int maxFileSize = (4 * blockSize * FLASH_SECTOR_SIZE) + 
@@ -419,7 +491,7 @@ int initFlash(char *file, unsigned int blockSize, unsigned int segmentSize, unsi
     return 0;
 }
 
-int parseArgs(int argc, char **argv, unsigned int *blockSize, unsigned int *segmentSize, unsigned int *flashSize, unsigned int *wearLimit)
+int parseArgs(int argc, char **argv, unsigned int *blockSize, unsigned int *segmentSize, unsigned int *flashSize, unsigned int *wearLimit, unsigned int *compression, unsigned int *deduplication)
 {
     if (argc < 2)
     {
@@ -433,7 +505,7 @@ int parseArgs(int argc, char **argv, unsigned int *blockSize, unsigned int *segm
         {
             if (optionCheck(argv[i]) != 0)
             {
-                std::cerr << "Invalid option: " << argv[i] << "\nValid options: -b, -l, -s, -w, --block=size, --segment=size, --segments=segments, --wearLimit=limit" << std::endl;
+                std::cerr << "Invalid option: " << argv[i] << "\nValid options: -b, -l, -s, -w, -c, -d, --block=size, --segment=size, --segments=segments, --wearLimit=limit, --compression=codec, --dedup=enabled" << std::endl;
                 return 1;
             }
 
@@ -472,6 +544,16 @@ int parseArgs(int argc, char **argv, unsigned int *blockSize, unsigned int *segm
                     *wearLimit = stoi(token);
                     continue;
                 }
+                else if (isPrefix("--compression=", option))
+                {
+                    *compression = stoi(token);
+                    continue;
+                }
+                else if (isPrefix("--dedup=", option))
+                {
+                    *deduplication = stoi(token);
+                    continue;
+                }
             }
         
             // Second case is option is formatted as -option argument [e.g: -b 20]
@@ -498,6 +580,14 @@ int parseArgs(int argc, char **argv, unsigned int *blockSize, unsigned int *segm
             {
                 *wearLimit = stoi(arg);
             }
+            else if(option.compare("-c") == 0)
+            {
+                *compression = stoi(arg);
+            }
+            else if(option.compare("-d") == 0)
+            {
+                *deduplication = stoi(arg);
+            }
             
             i++;
         }
@@ -513,15 +603,21 @@ int optionCheck(char * str)
     std::string l = "--segment=";
     std::string seg = "--segments=";
     std::string w = "--wearLimit=";
+    std::string c = "--compression=";
+    std::string d = "--dedup=";
 
     if (s.compare("-b") == 0 ||
         s.compare("-l") == 0 ||
         s.compare("-s") == 0 ||
         s.compare("-w") == 0 ||
+        s.compare("-c") == 0 ||
+        s.compare("-d") == 0 ||
         isPrefix(b, s)       ||
         isPrefix(l, s)       ||
         isPrefix(seg, s)     ||
-        isPrefix(w, s))
+        isPrefix(w, s)       ||
+        isPrefix(c, s)       ||
+        isPrefix(d, s))
     {
        return 0;
     } 